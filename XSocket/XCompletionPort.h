@@ -355,6 +355,13 @@ public:
 		return nSend;
 	}
 
+	//重叠发送只投递第一个分片，完成后由TcpSocket推进分片继续发送
+	int SendV(const SOCKBUF* lpBufs, int nBufCount, int nFlags = 0)
+	{
+		ASSERT(nBufCount > 0);
+		return Send(SOCKBUF_BUF(lpBufs[0]), (int)SOCKBUF_LEN(lpBufs[0]), nFlags);
+	}
+
 	int Receive(char* lpBuf, int nBufLen, int nFlags = 0)
 	{
 		PER_IO_OPERATION_DATA* pOverlapped = &receive_overlapped_;
@@ -520,12 +527,14 @@ protected:
 		ULONG_PTR Key = 0;
 		DWORD dwTransfer = 0;
 		WSAOVERLAPPED *lpOverlapped = NULL;
+		Base::BeginWait();
 		BOOL bStatus = GetQueuedCompletionStatus(
 			hIocp_,
 			&dwTransfer,
 			(PULONG_PTR)&Key,
 			(LPOVERLAPPED *)&lpOverlapped,
 			Base::GetWaitingTimeOut()/*INFINITE*/);
+		Base::EndWait();
 		if(!bStatus) {
 			DWORD dwErr = GetLastError();
 			if (WAIT_TIMEOUT == dwErr) {
@@ -578,62 +587,58 @@ public:
 
 	int AddSocket(std::shared_ptr<Socket> sock_ptr, int evt = 0)
 	{
-		std::unique_lock<std::mutex> lock(mutex_);
-		int i, j = sock_ptrs_.size();
-		for (i = 0; i < j; i++)
-		{
-			if(sock_ptrs_[i]==NULL) {
-				if (sock_ptr) {
-					sock_count_++;
-					sock_ptrs_[i] = sock_ptr;
-					sock_ptr->AttachService(this);
-					//SetHandleInformation((HANDLE) (SOCKET)*sock_ptr, HANDLE_FLAG_INHERIT, 0);
-					HANDLE hIocp = CreateIoCompletionPort((HANDLE)(SOCKET)*sock_ptr, hIocp_, (ULONG_PTR)(i + 1), 0);
-					ASSERT(hIocp);
-					if (hIocp != INVALID_HANDLE_VALUE) {
+		std::unique_lock<std::mutex> lock(Base::mutex_);
+		if (!sock_ptr) {
+			//测试可不可以增加Socket，返回>=0表示可以增加
+			return Base::sock_free_head_;
+		}
+		int i = Base::AllocSlot();
+		if (i < 0) {
+			return -1;
+		}
+		Base::sock_count_++;
+		Base::sock_ptrs_[i] = sock_ptr;
+		sock_ptr->SetHandle(Base::MakeHandle(i), this);
+		sock_ptr->AttachService(this);
+		//SetHandleInformation((HANDLE) (SOCKET)*sock_ptr, HANDLE_FLAG_INHERIT, 0);
+		HANDLE hIocp = CreateIoCompletionPort((HANDLE)(SOCKET)*sock_ptr, hIocp_, (ULONG_PTR)(i + 1), 0);
+		ASSERT(hIocp);
+		if (hIocp != INVALID_HANDLE_VALUE) {
 #ifdef _DEBUG
-						PRINTF("CreateIoCompletionPort: %ld by %ld", hIocp, hIocp_);
+			PRINTF("CreateIoCompletionPort: %ld by %ld", hIocp, hIocp_);
 #endif
-					} else {
-						PRINTF("CreateIoCompletionPort Error:%d", ::GetLastError());
-					}
-					// if (family == AF_INET6) {
-					// 	//uv_tcp_non_ifs_lsp_ipv6 = 1表示IPPROTO_IP协议使用真正地操作系统句柄，没有lsp封装
-					// 	non_ifs_lsp = uv_tcp_non_ifs_lsp_ipv6;
-					// } else {
-					// 	//同理
-					// 	non_ifs_lsp = uv_tcp_non_ifs_lsp_ipv4;
-					// }
-
-					// if (pSetFileCompletionNotificationModes &&
-					// 	!(handle->flags & UV_HANDLE_EMULATE_IOCP) && !non_ifs_lsp) {
-					// 	if (pSetFileCompletionNotificationModes((HANDLE) socket,
-					// 		FILE_SKIP_SET_EVENT_ON_HANDLE |
-					// 		FILE_SKIP_COMPLETION_PORT_ON_SUCCESS))//如果操作立刻完成，不再向iocp发送通知 
-					// 	{
-					// 	handle->flags |= UV_HANDLE_SYNC_BYPASS_IOCP;
-					// 	} else if (GetLastError() != ERROR_INVALID_FUNCTION) {
-					// 	return GetLastError();
-					// 	}
-					// }
-					if(evt & FD_READ) {
-						PostQueuedCompletionStatus(hIocp_, IOCP_OPERATION_TRYRECEIVE, (ULONG_PTR)(i + 1), NULL);
-					}
-					if(evt & FD_WRITE) {
-						PostQueuedCompletionStatus(hIocp_, IOCP_OPERATION_TRYSEND, (ULONG_PTR)(i + 1), NULL);
-					}
-					if(evt & FD_ACCEPT) {
-						PostQueuedCompletionStatus(hIocp_, IOCP_OPERATION_TRYACCEPT, (ULONG_PTR)(i + 1), NULL);
-					}
-					return i;
-				} else {
-					//测试可不可以增加Socket，返回true表示可以增加
-					return i;
-				}
-				break;
-			}
+		} else {
+			PRINTF("CreateIoCompletionPort Error:%d", ::GetLastError());
+		}
+		// if (family == AF_INET6) {
+		// 	//uv_tcp_non_ifs_lsp_ipv6 = 1表示IPPROTO_IP协议使用真正地操作系统句柄，没有lsp封装
+		// 	non_ifs_lsp = uv_tcp_non_ifs_lsp_ipv6;
+		// } else {
+		// 	//同理
+		// 	non_ifs_lsp = uv_tcp_non_ifs_lsp_ipv4;
+		// }
+
+		// if (pSetFileCompletionNotificationModes &&
+		// 	!(handle->flags & UV_HANDLE_EMULATE_IOCP) && !non_ifs_lsp) {
+		// 	if (pSetFileCompletionNotificationModes((HANDLE) socket,
+		// 		FILE_SKIP_SET_EVENT_ON_HANDLE |
+		// 		FILE_SKIP_COMPLETION_PORT_ON_SUCCESS))//如果操作立刻完成，不再向iocp发送通知 
+		// 	{
+		// 	handle->flags |= UV_HANDLE_SYNC_BYPASS_IOCP;
+		// 	} else if (GetLastError() != ERROR_INVALID_FUNCTION) {
+		// 	return GetLastError();
+		// 	}
+		// }
+		if(evt & FD_READ) {
+			PostQueuedCompletionStatus(hIocp_, IOCP_OPERATION_TRYRECEIVE, (ULONG_PTR)(i + 1), NULL);
+		}
+		if(evt & FD_WRITE) {
+			PostQueuedCompletionStatus(hIocp_, IOCP_OPERATION_TRYSEND, (ULONG_PTR)(i + 1), NULL);
+		}
+		if(evt & FD_ACCEPT) {
+			PostQueuedCompletionStatus(hIocp_, IOCP_OPERATION_TRYACCEPT, (ULONG_PTR)(i + 1), NULL);
 		}
-		return -1;
+		return i;
 	}
 	template<class Ty = Socket>
 	inline int AddConnect(std::shared_ptr<Ty> sock_ptr, u_short port)
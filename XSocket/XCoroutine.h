@@ -0,0 +1,511 @@
+/*
+ * Copyright: 7thTool Open Source <i7thTool@qq.com>
+ * All rights reserved.
+ *
+ * Author	: Scott
+ * Email	：i7thTool@qq.com
+ * Blog		: http://blog.csdn.net/zhangzq86
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _H_XCOROUTINE_H_
+#define _H_XCOROUTINE_H_
+
+#include "XSocketEx.h"
+
+//C++20协程，库本身按C++11编译，只有用C++20编译的代码包含这个头文件才可以使用
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define USE_COROUTINE 1
+#include <coroutine>
+#else
+#define USE_COROUTINE 0
+#endif//
+
+#if USE_COROUTINE
+
+namespace XSocket {
+
+/*!
+ *	@brief CoFrame 定义.
+ *
+ *	协程帧分配，按2的幂分级从TaskCache分配，超过最大级别的直接堆分配
+ */
+template<size_t N>
+struct CoFrameBlock
+{
+	typename std::aligned_storage<N, alignof(std::max_align_t)>::type buf;
+};
+
+class CoFrame
+{
+	template<size_t N>
+	static inline bool Alloc(size_t size, void*& ptr)
+	{
+		if (size > N) {
+			return false;
+		}
+		ptr = TaskCache<CoFrameBlock<N>>::Alloc(sizeof(CoFrameBlock<N>));
+		return true;
+	}
+	template<size_t N>
+	static inline bool Free(void* ptr, size_t size)
+	{
+		if (size > N) {
+			return false;
+		}
+		TaskCache<CoFrameBlock<N>>::Free(ptr, sizeof(CoFrameBlock<N>));
+		return true;
+	}
+public:
+	static inline void* Alloc(size_t size)
+	{
+		void* ptr = nullptr;
+		if (Alloc<256>(size, ptr) || Alloc<512>(size, ptr) || Alloc<1024>(size, ptr)
+			|| Alloc<2048>(size, ptr) || Alloc<4096>(size, ptr) || Alloc<8192>(size, ptr)) {
+			return ptr;
+		}
+		return ::operator new(size);
+	}
+	static inline void Free(void* ptr, size_t size)
+	{
+		if (Free<256>(ptr, size) || Free<512>(ptr, size) || Free<1024>(ptr, size)
+			|| Free<2048>(ptr, size) || Free<4096>(ptr, size) || Free<8192>(ptr, size)) {
+			return;
+		}
+		::operator delete(ptr);
+	}
+};
+
+/*!
+ *	@brief CoPromiseBase 定义.
+ *
+ *	CoTask的promise公共部分，创建后先挂起，等被co_await或者Detach才开始执行，
+ *	结束时恢复等待它的协程，Detach的协程结束时自己销毁
+ */
+class CoPromiseBase
+{
+public:
+	std::coroutine_handle<> continuation_; //等待本协程结束的协程
+	bool detached_ = false;
+	std::exception_ptr error_;
+
+	static void* operator new(size_t size) { return CoFrame::Alloc(size); }
+	static void operator delete(void* ptr, size_t size) { CoFrame::Free(ptr, size); }
+
+	struct FinalAwaiter
+	{
+		inline bool await_ready() noexcept { return false; }
+		template<class P>
+		inline std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+		{
+			CoPromiseBase& promise = h.promise();
+			if (promise.continuation_) {
+				return promise.continuation_;
+			}
+			if (promise.detached_) {
+				if (promise.error_) {
+					PRINTF("CoTask unhandled exception");
+				}
+				h.destroy();
+			}
+			return std::noop_coroutine();
+		}
+		inline void await_resume() noexcept {}
+	};
+
+	inline std::suspend_always initial_suspend() noexcept { return {}; }
+	inline FinalAwaiter final_suspend() noexcept { return {}; }
+	inline void unhandled_exception() { error_ = std::current_exception(); }
+};
+
+template<class T>
+class CoPromise : public CoPromiseBase
+{
+public:
+	TaskValue<T> value_;
+
+	template<class V>
+	inline void return_value(V&& v) { value_.Set(std::forward<V>(v)); }
+	inline T Get()
+	{
+		if (error_) {
+			std::rethrow_exception(error_);
+		}
+		return value_.Get();
+	}
+};
+
+template<>
+class CoPromise<void> : public CoPromiseBase
+{
+public:
+	inline void return_void() { }
+	inline void Get()
+	{
+		if (error_) {
+			std::rethrow_exception(error_);
+		}
+	}
+};
+
+/*!
+ *	@brief CoTask 模板定义.
+ *
+ *	协程任务，co_await CoTask等待结束并取得结果（异常会重新抛出），
+ *	不需要等待的用Detach在当前线程开始执行，结束后自动销毁
+ */
+template<class T = void>
+class CoTask
+{
+public:
+	struct promise_type : public CoPromise<T>
+	{
+		inline CoTask get_return_object() { return CoTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+	};
+	typedef std::coroutine_handle<promise_type> handle_type;
+
+	struct Awaiter
+	{
+		handle_type handle;
+		inline bool await_ready() { return !handle || handle.done(); }
+		inline std::coroutine_handle<> await_suspend(std::coroutine_handle<> h)
+		{
+			handle.promise().continuation_ = h;
+			return handle;
+		}
+		inline T await_resume() { return handle.promise().Get(); }
+	};
+protected:
+	handle_type handle_;
+	explicit CoTask(handle_type h):handle_(h) {}
+public:
+	CoTask() {}
+	CoTask(CoTask&& o) noexcept:handle_(o.handle_) { o.handle_ = nullptr; }
+	CoTask(const CoTask&) = delete;
+	~CoTask() { if (handle_) { handle_.destroy(); } }
+
+	CoTask& operator=(CoTask&& o) noexcept
+	{
+		if (this != &o) {
+			if (handle_) {
+				handle_.destroy();
+			}
+			handle_ = o.handle_;
+			o.handle_ = nullptr;
+		}
+		return *this;
+	}
+	CoTask& operator=(const CoTask&) = delete;
+
+	inline bool IsValid() { return (bool)handle_; }
+	inline bool IsDone() { return !handle_ || handle_.done(); }
+
+	inline Awaiter operator co_await() && { return Awaiter{ handle_ }; }
+	inline Awaiter operator co_await() & { return Awaiter{ handle_ }; }
+
+	//开始执行并放弃等待，协程结束后自己销毁
+	inline void Detach()
+	{
+		handle_type h = handle_;
+		handle_ = nullptr;
+		if (h) {
+			h.promise().detached_ = true;
+			h.resume();
+		}
+	}
+};
+
+/*!
+ *	@brief SleepAwaiter 定义.
+ *
+ *	co_await AsyncSleep(millis)，用服务的定时器（SocketSet::AddTimer）在服务线程恢复协程，
+ *	服务不支持定时器时不挂起
+ */
+struct SleepAwaiter
+{
+	size_t millis;
+	Service* svr;
+	inline bool await_ready() { return millis == 0; }
+	inline bool await_suspend(std::coroutine_handle<> h)
+	{
+		Service* s = svr ? svr : Service::service();
+		if (!s) {
+			return false;
+		}
+		//挂起后本对象可能已经随协程恢复销毁，之后不能再访问成员
+		return s->AddTimer(millis, [h]() { h.resume(); }) != 0;
+	}
+	inline void await_resume() { }
+};
+
+//svr为空使用当前线程服务
+inline SleepAwaiter AsyncSleep(size_t millis, Service* svr = nullptr)
+{
+	return SleepAwaiter{ millis, svr };
+}
+
+/*!
+ *	@brief CoSocketImpl 模板定义.
+ *
+ *	协程Socket，在事件循环上提供co_await的连接、读、写操作，不额外创建线程，
+ *	OnConnect/OnReceive/OnSend在所属SocketSet服务线程（EPollSocketSetT::OnEPollEvent）里直接恢复协程。
+ *	读写只在有协程等待时才Select，连接完成后读写要在所属服务线程里发起；
+ *	TBase一般为ConnectSocketExT<EPollSocketT<SocketSet,SocketEx>>，
+ *	读写返回值>0为字节数，0为对端关闭，<0为负的错误码
+ */
+template<class T, class TBase>
+class CoSocketImpl : public SocketExImpl<T,TBase>, public std::enable_shared_from_this<T>
+{
+	typedef SocketExImpl<T,TBase> Base;
+protected:
+	std::coroutine_handle<> connect_waiter_;
+	std::coroutine_handle<> read_waiter_;
+	std::coroutine_handle<> write_waiter_;
+	std::coroutine_handle<>* suspending_ = nullptr; //正在Select的等待者，Select里同步触发的完成不恢复，直接不挂起
+	int connect_result_ = 0;
+	char* read_buf_ = nullptr;
+	int read_len_ = 0;
+	int read_result_ = 0;
+	const char* write_buf_ = nullptr;
+	int write_len_ = 0;
+	int write_sent_ = 0;
+	int write_result_ = 0;
+public:
+	template<class TSocketSet>
+	struct ConnectAwaiter
+	{
+		CoSocketImpl* sock;
+		TSocketSet* set;
+		u_short port;
+		inline bool await_ready() { return false; }
+		inline bool await_suspend(std::coroutine_handle<> h)
+		{
+			sock->connect_waiter_ = h;
+			sock->connect_result_ = 0;
+			std::shared_ptr<T> sock_ptr = sock->shared_from_this();
+			TSocketSet* s = set;
+			u_short p = port;
+			if (s->AddConnect(sock_ptr, p) < 0) {
+				//没有加入任何SocketSet，不会有事件，直接返回
+				sock->connect_waiter_ = nullptr;
+				sock->connect_result_ = -ENOBUFS;
+				return false;
+			}
+			//加入后服务线程可能已经恢复协程，之后不能再访问成员
+			return true;
+		}
+		inline int await_resume() { return sock->connect_result_; }
+	};
+
+	struct ReadAwaiter
+	{
+		CoSocketImpl* sock;
+		char* buf;
+		int len;
+		inline bool await_ready()
+		{
+			sock->read_buf_ = buf;
+			sock->read_len_ = len;
+			return sock->TryRead();
+		}
+		inline bool await_suspend(std::coroutine_handle<> h) { return sock->Suspend(sock->read_waiter_, h, FD_READ); }
+		inline int await_resume() { return sock->read_result_; }
+	};
+
+	struct WriteAwaiter
+	{
+		CoSocketImpl* sock;
+		const char* buf;
+		int len;
+		inline bool await_ready()
+		{
+			sock->write_buf_ = buf;
+			sock->write_len_ = len;
+			sock->write_sent_ = 0;
+			return sock->TryWrite();
+		}
+		inline bool await_suspend(std::coroutine_handle<> h) { return sock->Suspend(sock->write_waiter_, h, FD_WRITE); }
+		inline int await_resume() { return sock->write_result_; }
+	};
+
+public:
+	CoSocketImpl()
+	{
+	}
+
+	//co_await连接，set为SocketSet或SocketManager，通过AddConnect加入，返回0成功，<0为负的错误码
+	//需要先Open，连接完成后协程在所属SocketSet服务线程恢复
+	template<class TSocketSet>
+	inline ConnectAwaiter<TSocketSet> AsyncConnect(TSocketSet& set, u_short port)
+	{
+		return ConnectAwaiter<TSocketSet>{ this, &set, port };
+	}
+
+	//co_await读取最多len字节，有数据就返回
+	inline ReadAwaiter AsyncRead(char* buf, int len)
+	{
+		return ReadAwaiter{ this, buf, len };
+	}
+
+	//co_await写完len字节，返回len或者<0错误码
+	inline WriteAwaiter AsyncWrite(const char* buf, int len)
+	{
+		return WriteAwaiter{ this, buf, len };
+	}
+
+protected:
+	static inline bool IsWouldBlock(int nErrorCode)
+	{
+#ifdef WIN32
+		return nErrorCode == WSAEWOULDBLOCK || nErrorCode == WSA_IO_PENDING;
+#else
+		return nErrorCode == EWOULDBLOCK || nErrorCode == EAGAIN || nErrorCode == EINTR;
+#endif//
+	}
+
+	//读到数据、对端关闭或者出错返回true
+	inline bool TryRead()
+	{
+		if (!Base::IsSocket()) {
+			read_result_ = -ENOTCONN;
+			return true;
+		}
+		int nLen = Base::Receive(read_buf_, read_len_);
+		if (nLen >= 0) {
+			read_result_ = nLen;
+			return true;
+		}
+		int nErrorCode = XSocket::Socket::GetLastError();
+		if (IsWouldBlock(nErrorCode)) {
+			return false;
+		}
+		read_result_ = -nErrorCode;
+		return true;
+	}
+
+	//全部写完或者出错返回true
+	inline bool TryWrite()
+	{
+		if (!Base::IsSocket()) {
+			write_result_ = -ENOTCONN;
+			return true;
+		}
+		while (write_sent_ < write_len_)
+		{
+			int nLen = Base::Send(write_buf_ + write_sent_, write_len_ - write_sent_);
+			if (nLen > 0) {
+				write_sent_ += nLen;
+				continue;
+			}
+			int nErrorCode = XSocket::Socket::GetLastError();
+			if (nLen < 0 && IsWouldBlock(nErrorCode)) {
+				return false;
+			}
+			write_result_ = nLen < 0 ? -nErrorCode : -ECONNRESET;
+			return true;
+		}
+		write_result_ = write_sent_;
+		return true;
+	}
+
+	//记住等待者再Select，EPollSocketT::Select新选择事件时会同步触发一次，这时已经完成就不挂起
+	inline bool Suspend(std::coroutine_handle<>& waiter, std::coroutine_handle<> h, int lEvent)
+	{
+		waiter = h;
+		suspending_ = &waiter;
+		Base::Select(lEvent);
+		suspending_ = nullptr;
+		return (bool)waiter;
+	}
+
+	inline void Resume(std::coroutine_handle<>& waiter)
+	{
+		std::coroutine_handle<> h = waiter;
+		waiter = nullptr;
+		if (suspending_ != &waiter) {
+			h.resume();
+		}
+	}
+
+	//没有协程等待时不再选择事件，避免水平触发时空转，下次挂起再选择
+	inline void UnSelect(int lEvent)
+	{
+		if (Base::IsSelect(lEvent)) {
+			Base::RemoveSelect(lEvent);
+			Base::service()->SelectSocket(this, lEvent);
+		}
+	}
+
+	virtual void OnConnect(int nErrorCode)
+	{
+		//连接失败时Base::OnConnect会触发OnClose，在那里恢复等待者
+		Base::OnConnect(nErrorCode);
+
+		if (connect_waiter_) {
+			connect_result_ = -nErrorCode;
+			Resume(connect_waiter_);
+		}
+	}
+
+	virtual void OnReceive(int nErrorCode)
+	{
+		if (!read_waiter_) {
+			UnSelect(FD_READ);
+			return;
+		}
+		if (nErrorCode) {
+			read_result_ = -nErrorCode;
+		} else if (!TryRead()) {
+			return;
+		}
+		Resume(read_waiter_);
+	}
+
+	virtual void OnSend(int nErrorCode)
+	{
+		if (!write_waiter_) {
+			UnSelect(FD_WRITE);
+			return;
+		}
+		if (nErrorCode) {
+			write_result_ = -nErrorCode;
+		} else if (!TryWrite()) {
+			return;
+		}
+		Resume(write_waiter_);
+	}
+
+	virtual void OnClose(int nErrorCode)
+	{
+		int nResult = nErrorCode ? -nErrorCode : -ECONNABORTED;
+		if (connect_waiter_) {
+			connect_result_ = nResult;
+			Resume(connect_waiter_);
+		}
+		if (read_waiter_) {
+			read_result_ = nResult;
+			Resume(read_waiter_);
+		}
+		if (write_waiter_) {
+			write_result_ = nResult;
+			Resume(write_waiter_);
+		}
+		Base::OnClose(nErrorCode);
+	}
+};
+
+}
+
+#endif//USE_COROUTINE
+
+#endif//_H_XCOROUTINE_H_
@@ -26,6 +26,16 @@
 #include <sys/eventfd.h>
 #include <sys/timerfd.h>
 
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1u << 28)
+#endif//
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif//
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif//
+
 namespace XSocket {
 
 /*!
@@ -39,6 +49,8 @@ class EPollSocketT : public TBase
 	typedef TBase Base;
 public:
 	typedef TSocketSet SocketSet;
+protected:
+	bool nocork_ = false; //不参与SocketSet的合并发送，SendBuf马上发送
 public:
 	static SocketSet* service() { return dynamic_cast<SocketSet*>(SocketSet::service()); }
 
@@ -51,6 +63,29 @@ public:
 	{
 		
 	}
+
+	//延迟敏感的连接关闭合并发送
+	inline void SetNoCork(bool nocork) { nocork_ = nocork; }
+	inline bool IsNoCork() { return nocork_; }
+
+	//合并发送时本轮epoll_wait没有别的事件了，不会再有别的连接往这里SendBuf，推迟的数据马上发送
+	//单个连接一问一答时不用等读到EWOULDBLOCK，一次OnRecvBuf里多次SendBuf还是一次SendV
+	inline void FlushCork()
+	{
+		if (!Base::IsSocket() || !Base::IsPending(FD_WRITE) || nocork_) {
+			return;
+		}
+		SocketSet* svr = service();
+		if (!svr || !svr->IsCork() || svr->IsWaitLeft()) {
+			return;
+		}
+		if (Base::TakePending() & FD_READ) {
+			Base::Pending(FD_READ);
+		}
+		if (Base::IsSelect(FD_WRITE)) {
+			Base::Trigger(FD_WRITE, 0);
+		}
+	}
 	
 	inline void Select(int lEvent) {  
 		int lAsyncEvent = 0;
@@ -74,11 +109,20 @@ public:
 			Base::Trigger(FD_READ, 0);
 		}
 		if(lAsyncEvent & FD_WRITE) {
-			Base::Trigger(FD_WRITE, 0);
+			if(!nocork_ && service()->IsCork()) {
+				//合并发送：本轮事件处理完后在epoll_wait前统一发送，期间再SendBuf的数据一起SendV
+				Base::Pending(FD_WRITE);
+			} else {
+				Base::Trigger(FD_WRITE, 0);
+			}
 		}
 		if(lAsyncEvent & FD_ACCEPT) {
 			Base::Trigger(FD_ACCEPT, 0);
 		}
+		if(Base::IsPending(FD_READ|FD_WRITE)) {
+			//预算用完，下一轮继续
+			service()->ReadySocket(this);
+		}
 	}
 };
 
@@ -94,10 +138,17 @@ class EPollServiceT : public TService
 protected:
 	int epfd_ = 0;
 	int evfd_ = 0;
-	int evfd_pair_[2] = {0};
+	std::atomic<bool> evfd_signal_; //evfd_是否已经写入还没读取，合并多次唤醒
+	struct NotifyNode : public MPSCNode
+	{
+		void* data;
+		NotifyNode(void* _data):data(_data) {}
+	};
+	MPSCQueue<NotifyNode> notify_que_; //PostNotify(void*)投递的数据，服务线程在evfd_唤醒后批量取出
 	int timerfd_ = -1;
+	int wait_left_ = 0; //本轮epoll_wait还没处理的事件数
 public:
-	EPollServiceT()
+	EPollServiceT():evfd_signal_(false)
 	{
 		epfd_ = epoll_create(1024); //大于0即可，保险方式设置1024足够了
 		if(epfd_) {
@@ -106,29 +157,16 @@ public:
         		PRINTF("create event fd failed, errno(%d): %s\n", errno, strerror(errno));
 			} else {
 				struct epoll_event event = {0};
-				event.data.ptr = nullptr;
-				event.data.fd = evfd_;
+				event.data.u64 = evfd_; //高32位为0，不会和Socket槽位句柄冲突
 				event.events = EPOLLIN | EPOLLERR;
 				epoll_ctl(epfd_, EPOLL_CTL_ADD, evfd_, &event);
 			}
-			//if(socketpair(AF_UNIX, SOCK_STREAM, 0, evfd_pair_) == -1) { //OK
-			if(pipe(evfd_pair_) == -1) { //OK
-			//if(Socket::CreatePair(AF_UNIX, SOCK_STREAM, 0, evfd_pair_) == -1) { //OK
-        		PRINTF("create fd pair failed, errno(%d): %s\n", errno, strerror(errno));
-    		} else {
-				struct epoll_event event = {0};
-				event.data.ptr = nullptr;
-				event.data.fd = evfd_pair_[0];
-				event.events = EPOLLIN | EPOLLERR;
-				epoll_ctl(epfd_, EPOLL_CTL_ADD, evfd_pair_[0], &event);
-			}
 			timerfd_ = timerfd_create(CLOCK_REALTIME, O_NONBLOCK);
 			if(timerfd_ == -1) {
 				PRINTF("timerfd_create failed, errno(%d): %s\n", errno, strerror(errno));
 			} else {
 				struct epoll_event event = {0};
-				event.data.ptr = nullptr;
-				event.data.fd = timerfd_;
+				event.data.u64 = timerfd_; //高32位为0，不会和Socket槽位句柄冲突
 				event.events = EPOLLIN | EPOLLERR | EPOLLET;
 				epoll_ctl(epfd_, EPOLL_CTL_ADD, timerfd_, &event);
 			}
@@ -142,13 +180,6 @@ public:
 				close(timerfd_);
 				timerfd_ = 0;
 			}
-			if(evfd_pair_[0]) {
-				epoll_ctl(epfd_, EPOLL_CTL_DEL, evfd_pair_[0], nullptr);
-				close(evfd_pair_[0]);
-				close(evfd_pair_[1]);
-				evfd_pair_[0] = 0;
-				evfd_pair_[1] = 0;
-			}
 			if(evfd_) {
 				epoll_ctl(epfd_, EPOLL_CTL_DEL, evfd_, nullptr);
 				close(evfd_);
@@ -157,18 +188,25 @@ public:
 			close(epfd_);
 			epfd_ = 0;
 		}
+		while (NotifyNode* node = notify_que_.Pop())
+		{
+			delete node;
+		}
 	}
 	
+	inline bool IsServiceThread() { return XSocket::Service::service() == this; }
+
 	inline void PostNotify()
 	{
 		Base::PostNotify();
-		const size_t data = 1;
-		write(evfd_, &data, sizeof(data));
+		Signal();
 	}
 
 	inline void PostNotify(void* data)
 	{
-		write(evfd_pair_[1], &data, sizeof(data));
+		if(notify_que_.Push(new NotifyNode(data))) {
+			Signal();
+		}
 	}
 
 	inline void PostTimer(size_t millis)
@@ -200,6 +238,9 @@ public:
 		timerfd_settime(timerfd_, TFD_TIMER_ABSTIME, &new_value, NULL);
 	}
 
+	//正在处理的epoll_wait事件后面还有没处理的事件
+	inline bool IsWaitLeft() { return wait_left_ > 0; }
+
 protected:
 	//
 	virtual void OnNotify(void* data)
@@ -213,25 +254,54 @@ protected:
 	}
 	
 	virtual void OnWait()
+	{
+		EPollWait(Base::GetWaitingTimeOut());
+	}
+
+	//唤醒服务线程，多次唤醒只写一次evfd_
+	inline void Signal()
+	{
+		if(!evfd_signal_.exchange(true)) {
+			const size_t data = 1;
+			write(evfd_, &data, sizeof(data));
+		}
+	}
+
+	//批量处理PostNotify(void*)投递的数据
+	inline void DrainNotify()
+	{
+		notify_que_.Reset();
+		while (NotifyNode* node = notify_que_.Pop())
+		{
+			void* data = node->data;
+			delete node;
+			OnNotify(data);
+		}
+	}
+
+	inline void EPollWait(int timeout)
 	{
 		struct epoll_event events[1024] = {0};
 		//Specifying a timeout of -1 makes epoll_wait wait indefinitely, while specifying a timeout equal to zero makes epoll_wait to return immediately even if no events are available (return code equal to zero).
-		int nfds = epoll_wait(epfd_, events, 1024, Base::GetWaitingTimeOut());
+		Base::BeginWait();
+		int nfds = epoll_wait(epfd_, events, 1024, timeout);
+		Base::EndWait();
 		if (nfds > 0) {
+			Base::MarkBusy();
 			for (int i = 0; i < nfds; ++i)
 			{
+				wait_left_ = nfds - i - 1;
 				const struct epoll_event& event = events[i];
-				if(evfd_ == event.data.fd) {
+				if(event.data.u64 == (uint64_t)evfd_) {
+					//先读取再清除唤醒标志，清除后投递的通知会重新写evfd_，不会被这次read吞掉
 					size_t data = 0;
 					if(sizeof(size_t) == read(event.data.fd, &data, sizeof(data))) {
 						//PRINTF("OnNotify %u", data);
 					}
-				} else if(evfd_pair_[0] == event.data.fd) {
-					void* data = 0;
-					if(sizeof(void*) == read(event.data.fd, &data, sizeof(data))) {
-						OnNotify(data);
-					}
-				} else if(timerfd_ == event.data.fd) {
+					evfd_signal_.store(false, std::memory_order_release);
+					//清除标志后再取队列，清除前入队的数据在这里处理，清除后入队的会再次唤醒
+					DrainNotify();
+				} else if(event.data.u64 == (uint64_t)timerfd_) {
 					uint64_t data = 0;
 					if(sizeof(uint64_t) == read(event.data.fd, &data, sizeof(data))) {
 						//PRINTF("OnTimer %u", data);
@@ -241,6 +311,7 @@ protected:
 					OnEPollEvent(event);
 				}
 			}
+			wait_left_ = 0;
 		} else {
 			//
 		}
@@ -261,27 +332,148 @@ class EPollSocketSetT : public SocketSetT<TService,TSocket>
 public:
 	typedef TService Service;
 	typedef TSocket Socket;
+protected:
+	std::vector<uint32_t> sock_events_; //每个槽位内核已注册的epoll事件
+	std::vector<uint8_t> sock_dirtys_; //槽位是否在sock_dirty_list_里
+	std::vector<int> sock_dirty_list_; //需要在epoll_wait前修改事件的槽位
+	std::vector<uint64_t> ready_list_; //预算用完还没读写完的Socket句柄，在下次epoll_wait前继续处理
+	std::vector<uint64_t> ready_run_list_;
+	struct PostNode : public MPSCNode
+	{
+		uint64_t handle;
+		PostNode(uint64_t _handle):handle(_handle) {}
+	};
+	MPSCQueue<PostNode> post_que_; //其他线程投递了发送数据的Socket句柄，一批只唤醒一次服务线程
+	bool et_; //是否边缘触发
+	int recv_budget_ = 0; //加入的Socket默认接收预算，0表示不限制
+	int send_budget_ = 0; //加入的Socket默认发送预算，0表示不限制
+	int sock_busy_poll_ = 0; //加入的Socket的SO_BUSY_POLL（微秒），0表示不设置
+	bool sock_prefer_busy_poll_ = false; //加入的Socket是否设置SO_PREFER_BUSY_POLL
+	bool cork_ = false; //是否合并发送
 public:
-	EPollSocketSetT(int nMaxSocketCount):Base(nMaxSocketCount)
+	EPollSocketSetT(int nMaxSocketCount):Base(nMaxSocketCount),sock_events_(nMaxSocketCount),sock_dirtys_(nMaxSocketCount)
+#if USE_EPOLLET
+	,et_(true)
+#else
+	,et_(false)
+#endif//
 	{
 	}
 	~EPollSocketSetT() 
 	{
+		while (PostNode* node = post_que_.Pop())
+		{
+			delete node;
+		}
+	}
+
+	//设置边缘触发/水平触发，需要在加入Socket前设置
+	inline void SetEdgeTrigger(bool et) { et_ = et; }
+	inline bool IsEdgeTrigger() { return et_; }
+
+	//设置加入Socket的默认每次唤醒读写预算（字节），Socket自己设置过预算的不覆盖
+	//预算用完还没读写到EWOULDBLOCK的Socket放入就绪列表，下次epoll_wait前继续，避免大流量连接饿死其他连接
+	inline void SetBudget(int nRecvBudget, int nSendBudget) { recv_budget_ = nRecvBudget; send_budget_ = nSendBudget; }
+
+	//设置加入的Socket的内核忙轮询参数（SO_BUSY_POLL/SO_PREFER_BUSY_POLL），需要在加入Socket前设置，一般配合SetBusyPoll使用
+	inline void SetSocketBusyPoll(int usecs, bool prefer = false) { sock_busy_poll_ = usecs; sock_prefer_busy_poll_ = prefer; }
+
+	//合并发送：处理事件时SendBuf不马上发送，放进就绪列表，本轮epoll_wait的事件都处理完后每个Socket一次SendV发送
+	//一个响应多次SendBuf（比如HTTP头、内容、chunk）只用一次系统调用、尽量少的TCP分段，Socket可以SetNoCork单独关闭
+	//注意开启后SendBuf之后马上Close的数据不会发送，要等OnSendBuf发完再关闭
+	inline void SetCork(bool cork) { cork_ = cork; }
+	inline bool IsCork() { return cork_; }
+
+	//Socket还有预算外事件没处理完
+	void ReadySocket(SocketEx* sock_ptr)
+	{
+		std::unique_lock<std::mutex> lock(Base::mutex_);
+		ready_list_.push_back(sock_ptr->Handle());
+		if (!Base::IsServiceThread()) {
+			lock.unlock();
+			Base::PostNotify();
+		}
+	}
+
+	//其他线程给Socket投递了发送数据（比如SimpleSocketT::PostSendBuf），服务线程在epoll_wait前统一Select(FD_WRITE)
+	//多个线程、多个Socket的投递合并成一次evfd_唤醒
+	void PostSocket(SocketEx* sock_ptr)
+	{
+		if (post_que_.Push(new PostNode(sock_ptr->Handle()))) {
+			Base::PostNotify();
+		}
 	}
 
 	void SelectSocket(SocketEx* sock_ptr, int evt) {
 		//Base::SelectSocket(sock_ptr, evt);
+		std::unique_lock<std::mutex> lock(Base::mutex_);
+		size_t i = (uint32_t)sock_ptr->Handle();
+		if (i >= sock_events_.size() || Base::sock_ptrs_[i].get() != sock_ptr) {
+			return;
+		}
+		if (!IsEventsChanged(sock_ptr, sock_events_[i])) {
+			//内核已经注册了这些事件，不需要epoll_ctl
+			return;
+		}
+		if (Base::IsServiceThread()) {
+			//服务线程延迟到epoll_wait前统一修改，多次Select只修改一次
+			if (!sock_dirtys_[i]) {
+				sock_dirtys_[i] = 1;
+				sock_dirty_list_.push_back(i);
+			}
+		} else {
+			//其他线程直接修改，避免服务线程在epoll_wait里等不到新事件
+			ModifySocket(i);
+		}
+	}
+	
+	int AddSocket(std::shared_ptr<Socket> sock_ptr, int evt = 0, uint32_t ext_events = 0)
+	{
+		std::unique_lock<std::mutex> lock(Base::mutex_);
+		if (!sock_ptr) {
+			//测试可不可以增加Socket，返回>=0表示可以增加
+			return Base::sock_free_head_;
+		}
+		int i = Base::AllocSlot();
+		if (i < 0) {
+			return -1;
+		}
+		Base::sock_count_++;
+		Base::sock_ptrs_[i] = sock_ptr;
+		sock_ptr->SetHandle(Base::MakeHandle(i), this);
+		if (!sock_ptr->RecvBudget() && !sock_ptr->SendBudget()) {
+			sock_ptr->SetBudget(recv_budget_, send_budget_);
+		}
+		sock_ptr->AttachService(this);
+		sock_ptr->SocketEx::Select(evt);
 		int fd = *sock_ptr;
-		struct epoll_event event = {0};
-		event.data.ptr = (void*)sock_ptr;
+		if (sock_busy_poll_ > 0) {
+			//内核版本不支持或者权限不够会失败，不影响正常使用
+			setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &sock_busy_poll_, sizeof(sock_busy_poll_));
+			if (sock_prefer_busy_poll_) {
+				int prefer = 1;
+				setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer));
+			}
+		}
+		struct epoll_event event = {};
+		//槽位句柄，事件到来时直接定位槽位，代数不一致说明是已回收槽位的过期事件
+		event.data.u64 = sock_ptr->Handle();
+		//LT(默认)，LT+EPOLLONESHOT最可靠
+		//ET，EPOLLET最高效,ET+EPOLLONESHOT高效可靠
 		event.events = 0 
-		| EPOLLRDHUP
-						
-#if USE_EPOLLET
-		| EPOLLET
-#endif//
-		//| EPOLLONESHOT
+		//| EPOLLIN //表示对应的文件描述符可以读（包括对端SOCKET正常关闭）；
+		//| EPOLLPRI //表示对应的文件描述符有紧急的数据可读（这里应该表示有带外数据到来）；
+		//| EPOLLOUT //表示对应的文件描述符可以写；
+		| EPOLLRDHUP //Stream socket peer closed connection, or shut down writing  half of connection.
+		//| EPOLLERR //表示对应的文件描述符发生错误；不用注册，会自动触发
+		//| EPOLLHUP //表示对应的文件描述符被挂断；不用注册，会自动触发
+		//| EPOLLET //将EPOLL设为边缘触发(Edge Triggered)模式，这是相对于水平触发(LevelTriggered)来说的；由et_决定
+		//| EPOLLONESHOT //只监听一次事件，当监听完这次事件之后，如果还需要继续监听这个socket的话，需要再次把这个socket加入到EPOLL队列里
 		;
+		event.events |= ext_events;
+		if (IsEdgeTrigger(sock_ptr.get())) {
+			event.events |= EPOLLET;
+		}
 		if (sock_ptr->IsSelect(FD_READ|FD_ACCEPT)) {
 			event.events |= EPOLLIN;
 		}
@@ -291,61 +483,22 @@ public:
 		if (sock_ptr->IsSelect(FD_WRITE|FD_CONNECT)) {
 			event.events |= EPOLLOUT;
 		}
-		epoll_ctl(Base::epfd_,EPOLL_CTL_MOD,fd,&event);
-	}
-	
-	int AddSocket(std::shared_ptr<Socket> sock_ptr, int evt = 0)
-	{
-		std::unique_lock<std::mutex> lock(Base::mutex_);
-		int i, j = sock_ptrs_.size();
-		for (i = 0; i < j; i++)
-		{
-			if(Base::sock_ptrs_[i]==NULL) {
-				if (sock_ptr) {
-					Base::sock_count_++;
-					Base::sock_ptrs_[i] = sock_ptr;
-					sock_ptr->AttachService(this);
-					sock_ptr->SocketEx::Select(evt);
-					int fd = *sock_ptr;
-					struct epoll_event event = {0};
-					event.data.ptr = (void *)sock_ptr.get();
-					//LT(默认)，LT+EPOLLONESHOT最可靠
-					//ET，EPOLLET最高效,ET+EPOLLONESHOT高效可靠
-					event.events = 0 
-					//| EPOLLIN //表示对应的文件描述符可以读（包括对端SOCKET正常关闭）；
-					//| EPOLLPRI //表示对应的文件描述符有紧急的数据可读（这里应该表示有带外数据到来）；
-					//| EPOLLOUT //表示对应的文件描述符可以写；
-					| EPOLLRDHUP //Stream socket peer closed connection, or shut down writing  half of connection.
-					//| EPOLLERR //表示对应的文件描述符发生错误；不用注册，会自动触发
-					//| EPOLLHUP //表示对应的文件描述符被挂断；不用注册，会自动触发
-	#if USE_EPOLLET
-					| EPOLLET //将EPOLL设为边缘触发(Edge Triggered)模式，这是相对于水平触发(LevelTriggered)来说的；
-	#endif
-					//| EPOLLONESHOT //只监听一次事件，当监听完这次事件之后，如果还需要继续监听这个socket的话，需要再次把这个socket加入到EPOLL队列里
-					;
-					if (sock_ptr->IsSelect(FD_READ|FD_ACCEPT)) {
-						event.events |= EPOLLIN;
-					}
-					if (sock_ptr->IsSelect(FD_OOB)) {
-						event.events |= EPOLLPRI;
-					}
-					if (sock_ptr->IsSelect(FD_WRITE|FD_CONNECT)) {
-						event.events |= EPOLLOUT;
-					}
-					if (SOCKET_ERROR != epoll_ctl(Base::epfd_, EPOLL_CTL_ADD, fd, &event)) {
-						//return i;
-					} else {
-						PRINTF("epoll_ctl err:%d", XSocket::Socket::GetLastError());
-					}
-					return i;
-				} else {
-					//测试可不可以增加Socket，返回true表示可以增加
-					return i;
-				}
-				break;
-			}
+		if (event.events & EPOLLEXCLUSIVE) {
+			//EPOLLEXCLUSIVE只能和EPOLLIN/EPOLLOUT/EPOLLWAKEUP/EPOLLET一起使用
+			event.events &= (EPOLLEXCLUSIVE | EPOLLIN | EPOLLOUT | EPOLLET);
 		}
-		return -1;
+		if (i >= (int)sock_events_.size()) {
+			sock_events_.resize(Base::sock_ptrs_.size());
+			sock_dirtys_.resize(Base::sock_ptrs_.size());
+		}
+		if (SOCKET_ERROR != epoll_ctl(Base::epfd_, EPOLL_CTL_ADD, fd, &event)) {
+			//return i;
+			sock_events_[i] = event.events;
+		} else {
+			sock_events_[i] = 0;
+			PRINTF("epoll_ctl err:%d", XSocket::Socket::GetLastError());
+		}
+		return i;
 	}
 	template<class Ty = Socket>
 	inline int AddConnect(std::shared_ptr<Ty> sock_ptr, u_short port)
@@ -359,32 +512,165 @@ public:
 	{
 		return AddSocket(sock_ptr,FD_ACCEPT);
 	}
+	//多个SocketSet监听同一个监听Socket（dup的句柄）时使用，内核每个连接只唤醒其中一个epoll，避免惊群
+	inline int AddExclusiveAccept(std::shared_ptr<Socket> sock_ptr)
+	{
+		return AddSocket(sock_ptr,FD_ACCEPT,EPOLLEXCLUSIVE);
+	}
 
 	int RemoveSocket(std::shared_ptr<Socket> sock_ptr)
 	{
 		//std::unique_lock<std::mutex> lock(Base::mutex_);
-		int i, j = sock_ptrs_.size();
-		for (i = 0; i < j; i++)
-		{
-			if(Base::sock_ptrs_[i]==sock_ptr) {
-				if (sock_ptr->IsSocket()) {
-					int fd = *sock_ptr;
-					struct epoll_event event = {0};
-					event.data.ptr = (void *)sock_ptr.get();
-					epoll_ctl(Base::epfd_, EPOLL_CTL_DEL, fd, &event);
-				}
-				return Base::RemoveSocketByPos(i);
+		int i = Base::FindSocketPos(sock_ptr);
+		if (i >= 0) {
+			if (sock_ptr->IsSocket()) {
+				int fd = *sock_ptr;
+				struct epoll_event event = {};
+				event.data.u64 = sock_ptr->Handle();
+				epoll_ctl(Base::epfd_, EPOLL_CTL_DEL, fd, &event);
 			}
+			return Base::RemoveSocketByPos(i);
 		}
 		return -1;
 	}
 
 protected:
 	//
+	//监听Socket每次触发只Accept一个连接，总是用LT，ET会丢失积压的连接
+	inline bool IsEdgeTrigger(SocketEx* sock_ptr)
+	{
+		return et_ && !sock_ptr->IsSelect(FD_ACCEPT);
+	}
+
+	inline uint32_t MakeEvents(SocketEx* sock_ptr)
+	{
+		uint32_t events = 0 
+		| EPOLLRDHUP
+		//| EPOLLONESHOT
+		;
+		if (IsEdgeTrigger(sock_ptr)) {
+			events |= EPOLLET;
+		}
+		if (sock_ptr->IsSelect(FD_READ|FD_ACCEPT)) {
+			events |= EPOLLIN;
+		}
+		if (sock_ptr->IsSelect(FD_OOB)) {
+			events |= EPOLLPRI;
+		}
+		if (sock_ptr->IsSelect(FD_WRITE|FD_CONNECT)) {
+			events |= EPOLLOUT;
+		}
+		return events;
+	}
+
+	//ET模式多注册的事件最多多一次边沿通知，只在有新事件时修改；LT模式事件要和选择的完全一致
+	inline bool IsEventsChanged(SocketEx* sock_ptr, uint32_t events)
+	{
+		uint32_t new_events = MakeEvents(sock_ptr);
+		events &= ~EPOLLEXCLUSIVE;
+		if (IsEdgeTrigger(sock_ptr)) {
+			return (events & new_events) != new_events;
+		}
+		return events != new_events;
+	}
+
+	//需要在mutex_保护下调用
+	inline void ModifySocket(int i)
+	{
+		SocketEx* sock_ptr = Base::sock_ptrs_[i].get();
+		if (!sock_ptr || !sock_ptr->IsSocket() || !IsEventsChanged(sock_ptr, sock_events_[i])) {
+			return;
+		}
+		if (sock_events_[i] & EPOLLEXCLUSIVE) {
+			//EPOLLEXCLUSIVE不支持EPOLL_CTL_MOD
+			return;
+		}
+		struct epoll_event event = {};
+		event.data.u64 = sock_ptr->Handle();
+		event.events = MakeEvents(sock_ptr);
+		if (IsEdgeTrigger(sock_ptr)) {
+			event.events |= sock_events_[i];
+		}
+		if (SOCKET_ERROR != epoll_ctl(Base::epfd_, EPOLL_CTL_MOD, (SOCKET)*sock_ptr, &event)) {
+			sock_events_[i] = event.events;
+		}
+	}
+
+	//处理上一轮预算用完的Socket，每个Socket本轮最多再用一次预算
+	inline void RunReadyList()
+	{
+		std::unique_lock<std::mutex> lock(Base::mutex_);
+		ready_run_list_.swap(ready_list_);
+		lock.unlock();
+		for (uint64_t handle : ready_run_list_)
+		{
+			lock.lock();
+			std::shared_ptr<Socket> sock_ptr = Base::FindSocket(handle);
+			lock.unlock();
+			if (!sock_ptr) {
+				continue;
+			}
+			//同一个Socket重复加入时，第一次已经取走了事件
+			int evt = sock_ptr->TakePending();
+			if (sock_ptr->IsSocket() && (evt & FD_READ) && sock_ptr->IsSelect(FD_READ)) {
+				sock_ptr->Trigger(FD_READ, 0);
+			}
+			if (sock_ptr->IsSocket() && (evt & FD_WRITE) && sock_ptr->IsSelect(FD_WRITE)) {
+				sock_ptr->Trigger(FD_WRITE, 0);
+			}
+			if (sock_ptr->IsSocket() && sock_ptr->IsPending(FD_READ|FD_WRITE)) {
+				lock.lock();
+				ready_list_.push_back(handle);
+				lock.unlock();
+			}
+		}
+		ready_run_list_.clear();
+	}
+
+	//处理其他线程投递了发送数据的Socket，已经在等EPOLLOUT的Socket发送时会取信箱
+	inline void RunPostList()
+	{
+		post_que_.Reset();
+		while (PostNode* node = post_que_.Pop())
+		{
+			uint64_t handle = node->handle;
+			delete node;
+			std::unique_lock<std::mutex> lock(Base::mutex_);
+			std::shared_ptr<Socket> sock_ptr = Base::FindSocket(handle);
+			lock.unlock();
+			if (sock_ptr && sock_ptr->IsSocket() && !sock_ptr->IsSelect(FD_WRITE)) {
+				sock_ptr->Select(FD_WRITE);
+			}
+		}
+	}
+
+	virtual void OnWait()
+	{
+		RunPostList();
+		if (!ready_list_.empty()) {
+			RunReadyList();
+		}
+		if (!sock_dirty_list_.empty()) {
+			std::unique_lock<std::mutex> lock(Base::mutex_);
+			for (int i : sock_dirty_list_)
+			{
+				sock_dirtys_[i] = 0;
+				ModifySocket(i);
+			}
+			sock_dirty_list_.clear();
+		}
+		//还有没处理完的Socket，epoll_wait不等待，只收集新事件
+		Base::EPollWait(ready_list_.empty() ? Base::GetWaitingTimeOut() : 0);
+		if (cork_ && !ready_list_.empty()) {
+			//本轮事件合并的发送马上发，不等OnRun空闲休眠后的下一轮
+			RunReadyList();
+		}
+	}
+
 	virtual void OnEPollEvent(const epoll_event& event)
 	{
 		std::unique_lock<std::mutex> lock(Base::mutex_);
-		std::shared_ptr<Socket> sock_ptr = Base::FindSocket((Socket *)event.data.ptr);
+		std::shared_ptr<Socket> sock_ptr = Base::FindSocket(event.data.u64);
 		lock.unlock();
 		if (!sock_ptr) {
 			return;
@@ -397,6 +683,18 @@ protected:
 			PRINTF("epoll_wait error: fd=%d event=%u", fd, evt);
 		}
 #endif
+		if ((evt & EPOLLERR) && sock_ptr->IsSelect(FD_ERRQUEUE)) {
+			//错误队列里是MSG_ZEROCOPY完成通知，取完后SO_ERROR为0说明连接没有出错
+			sock_ptr->Trigger(FD_ERRQUEUE, 0);
+			if (sock_ptr->IsSocket()) {
+				sock_ptr->GetSockOpt(SOL_SOCKET, SO_ERROR, (void *)&nErrorCode, sizeof(nErrorCode));
+				if (nErrorCode) {
+					sock_ptr->Trigger(FD_CLOSE, nErrorCode);
+					return;
+				}
+				evt &= ~EPOLLERR;
+			}
+		}
 		if ((evt & (EPOLLRDHUP | EPOLLERR | EPOLLHUP)) && (evt & (EPOLLIN | EPOLLOUT)) == 0) {
 			/*
 			 * if the error events were returned without EPOLLIN or EPOLLOUT,
@@ -421,7 +719,8 @@ protected:
 			if (sock_ptr->IsSelect(FD_ACCEPT)) {
 				sock_ptr->Trigger(FD_ACCEPT, 0);
 			} else {
-				if (sock_ptr->IsSelect(FD_READ)) {
+				//已经在就绪列表里的等下一轮，保证公平
+				if (sock_ptr->IsSelect(FD_READ) && !sock_ptr->IsPending(FD_READ)) {
 					sock_ptr->Trigger(FD_READ, 0);
 				}
 			}
@@ -434,10 +733,15 @@ protected:
 					sock_ptr->GetSockOpt(SOL_SOCKET, SO_ERROR, (void *)&nErrorCode, sizeof(nErrorCode));
 				}
 				sock_ptr->Trigger(FD_CONNECT, nErrorCode);
-			} else if (sock_ptr->IsSelect(FD_WRITE)) {
+			} else if (sock_ptr->IsSelect(FD_WRITE) && !sock_ptr->IsPending(FD_WRITE)) {
 				sock_ptr->Trigger(FD_WRITE, 0);
 			}
 		}
+		if (sock_ptr->IsSocket() && sock_ptr->IsPending(FD_READ|FD_WRITE)) {
+			lock.lock();
+			ready_list_.push_back(event.data.u64);
+			lock.unlock();
+		}
 // #if USE_EPOLLET
 // #else
 // 		if (sock_ptr->IsSocket()) {
@@ -0,0 +1,319 @@
+/*
+ * Copyright: 7thTool Open Source <i7thTool@qq.com>
+ * All rights reserved.
+ * 
+ * Author	: Scott
+ * Email	：i7thTool@qq.com
+ * Blog		: http://blog.csdn.net/zhangzq86
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _H_XFRAMEIMPL_H_
+#define _H_XFRAMEIMPL_H_
+
+#include "XSimpleImpl.h"
+
+namespace XSocket {
+
+/*!
+ *	@brief FrameField 定义.
+ *
+ *	帧头里的定长整数字段，bBigEndian表示网络字节序，T为void表示没有这个字段
+ */
+template<class T, bool bBigEndian>
+struct FrameField
+{
+	typedef T Value;
+	enum { SIZE = sizeof(T) };
+
+	static inline T Get(const char* lpBuf)
+	{
+		T v = 0;
+		for (size_t i = 0; i < sizeof(T); i++)
+		{
+			v |= (T)(uint8_t)lpBuf[i] << (8 * (bBigEndian ? sizeof(T) - 1 - i : i));
+		}
+		return v;
+	}
+
+	static inline void Put(char* lpBuf, T v)
+	{
+		for (size_t i = 0; i < sizeof(T); i++)
+		{
+			lpBuf[i] = (char)(uint8_t)(v >> (8 * (bBigEndian ? sizeof(T) - 1 - i : i)));
+		}
+	}
+};
+
+template<bool bBigEndian>
+struct FrameField<void, bBigEndian>
+{
+	typedef int Value;
+	enum { SIZE = 0 };
+
+	static inline Value Get(const char* lpBuf) { return 0; }
+	static inline void Put(char* lpBuf, Value v) { }
+};
+
+/*!
+ *	@brief FixedFrameHeader 定义.
+ *
+ *	定长帧头：TLen长度字段 + 可选的TType类型字段，bLenIncludeHeader表示长度字段包含帧头长度
+ */
+template<class TLen = uint32_t, bool bBigEndian = true, class TType = void, bool bLenIncludeHeader = false>
+struct FixedFrameHeader
+{
+	typedef FrameField<TLen, bBigEndian> LenField;
+	typedef FrameField<TType, bBigEndian> TypeField;
+	typedef typename TypeField::Value Type;
+	enum { MAX_SIZE = LenField::SIZE + TypeField::SIZE };
+
+	//帧内容长度为nFrameLen时的帧头长度，帧太长长度字段放不下返回0
+	static inline int Size(size_t nFrameLen)
+	{
+		size_t len = bLenIncludeHeader ? nFrameLen + MAX_SIZE : nFrameLen;
+		return len <= (size_t)(TLen)-1 ? (int)MAX_SIZE : 0;
+	}
+
+	//解析帧头，返回帧头长度，0表示数据不够，-1表示帧头错误
+	static inline int Parse(const char* lpBuf, int nBufLen, size_t& nFrameLen, Type& type)
+	{
+		if (nBufLen < (int)MAX_SIZE) {
+			return 0;
+		}
+		nFrameLen = (size_t)LenField::Get(lpBuf);
+		if (bLenIncludeHeader) {
+			if (nFrameLen < (size_t)MAX_SIZE) {
+				return -1;
+			}
+			nFrameLen -= MAX_SIZE;
+		}
+		type = TypeField::Get(lpBuf + LenField::SIZE);
+		return MAX_SIZE;
+	}
+
+	//写入Size(nFrameLen)字节的帧头
+	static inline void Build(char* lpBuf, size_t nFrameLen, Type type)
+	{
+		LenField::Put(lpBuf, (TLen)(bLenIncludeHeader ? nFrameLen + MAX_SIZE : nFrameLen));
+		TypeField::Put(lpBuf + LenField::SIZE, type);
+	}
+};
+
+/*!
+ *	@brief VarintFrameHeader 定义.
+ *
+ *	变长帧头：varint（LEB128，每字节低7位，最高位表示后面还有）长度 + 可选的TType类型字段
+ */
+template<bool bBigEndian = true, class TType = void>
+struct VarintFrameHeader
+{
+	typedef FrameField<TType, bBigEndian> TypeField;
+	typedef typename TypeField::Value Type;
+	enum { LEN_MAX_SIZE = 10, MAX_SIZE = LEN_MAX_SIZE + TypeField::SIZE };
+
+	static inline int Size(size_t nFrameLen)
+	{
+		int size = 1;
+		while (nFrameLen >= 0x80)
+		{
+			nFrameLen >>= 7;
+			size++;
+		}
+		return size + TypeField::SIZE;
+	}
+
+	static inline int Parse(const char* lpBuf, int nBufLen, size_t& nFrameLen, Type& type)
+	{
+		uint64_t len = 0;
+		int i = 0;
+		for (; ; i++)
+		{
+			if (i >= nBufLen) {
+				return 0;
+			}
+			if (i >= LEN_MAX_SIZE) {
+				return -1;
+			}
+			uint8_t b = (uint8_t)lpBuf[i];
+			len |= (uint64_t)(b & 0x7f) << (7 * i);
+			if (!(b & 0x80)) {
+				break;
+			}
+		}
+		i++;
+		if (nBufLen < i + (int)TypeField::SIZE) {
+			return 0;
+		}
+		nFrameLen = (size_t)len;
+		type = TypeField::Get(lpBuf + i);
+		return i + TypeField::SIZE;
+	}
+
+	static inline void Build(char* lpBuf, size_t nFrameLen, Type type)
+	{
+		int i = 0;
+		while (nFrameLen >= 0x80)
+		{
+			lpBuf[i++] = (char)(uint8_t)(nFrameLen | 0x80);
+			nFrameLen >>= 7;
+		}
+		lpBuf[i++] = (char)(uint8_t)nFrameLen;
+		TypeField::Put(lpBuf + i, type);
+	}
+};
+
+/*!
+ *	@brief FramedSocketT 定义.
+ *
+ *	封装FramedSocketT，实现长度前缀的二进制帧协议，THeader定义帧头格式（FixedFrameHeader/VarintFrameHeader）
+ *	接收时OnFrame直接指向接收缓存里的帧内容，不拷贝；发送时帧头直接写进发送缓存，大帧内容作为分片不拷贝
+ *	TBase需要是SimpleSocketT
+ */
+template<class TBase, class THeader = FixedFrameHeader<>>
+class FramedSocketT : public TBase
+{
+	typedef TBase Base;
+public:
+	typedef THeader Header;
+	typedef typename Header::Type FrameType;
+	typedef typename Base::SendBuffer SendBuffer;
+protected:
+	size_t max_frame_size_ = DEFAULT_MAX_FRAME_SIZE;
+	int frame_head_ = 0; //ParseBuf解析出的帧头长度，紧接着的OnRecvBuf用
+	FrameType frame_type_ = FrameType();
+	size_t frame_pos_ = 0; //BeginFrame时帧头在发送缓存里的位置
+public:
+	//帧内容超过size按协议错误断开连接
+	inline void SetMaxFrameSize(size_t size) { max_frame_size_ = size; }
+	inline size_t GetMaxFrameSize() { return max_frame_size_; }
+
+	//拷贝lpBuf，帧头和内容一起放进发送缓存
+	inline bool SendFrame(const char* lpBuf, int nBufLen, FrameType type = FrameType())
+	{
+		if (!PutFrameHeader(nBufLen, type)) {
+			return false;
+		}
+		Base::send_buf_.append(lpBuf, lpBuf + nBufLen);
+		Base::SendBufDirect();
+		return true;
+	}
+
+	//owner持有lpBuf直到发送完，帧头写进发送缓存，大的内容作为分片不拷贝
+	inline bool SendFrame(std::shared_ptr<const void> owner, const char* lpBuf, int nBufLen, FrameType type = FrameType())
+	{
+		if (nBufLen < DEFAULT_SEND_COPY_SIZE) {
+			return SendFrame(lpBuf, nBufLen, type);
+		}
+		if (!PutFrameHeader(nBufLen, type)) {
+			return false;
+		}
+		Base::QueueSendBuf(std::move(owner), lpBuf, nBufLen);
+		Base::SendBufDirect();
+		return true;
+	}
+
+	//接管Buf的内存
+	inline bool SendFrame(SendBuffer&& Buf, FrameType type = FrameType())
+	{
+		if ((int)Buf.size() < DEFAULT_SEND_COPY_SIZE) {
+			return SendFrame(Buf.data(), (int)Buf.size(), type);
+		}
+		std::shared_ptr<SendBuffer> owner = std::make_shared<SendBuffer>(std::move(Buf));
+		const char* lpBuf = owner->data();
+		int nBufLen = (int)owner->size();
+		return SendFrame(std::move(owner), lpBuf, nBufLen, type);
+	}
+
+	//直接在发送缓存里组帧：BeginFrame返回发送缓存，追加帧内容后调用EndFrame写帧头，中间不能调用其他发送函数
+	inline SendBuffer& BeginFrame()
+	{
+		Base::ReserveSendBuf();
+		frame_pos_ = Base::send_buf_.size();
+		Base::send_buf_.resize(frame_pos_ + Header::MAX_SIZE);
+		return Base::send_buf_;
+	}
+
+	inline bool EndFrame(FrameType type = FrameType())
+	{
+		SendBuffer& send_buf = Base::send_buf_;
+		ASSERT(send_buf.size() >= frame_pos_ + Header::MAX_SIZE);
+		size_t len = send_buf.size() - frame_pos_ - Header::MAX_SIZE;
+		int head = Header::Size(len);
+		if (!head) {
+			send_buf.resize(frame_pos_);
+			return false;
+		}
+		//变长帧头比预留的短，内容往前移
+		if (head < (int)Header::MAX_SIZE) {
+			memmove(&send_buf[frame_pos_ + head], &send_buf[frame_pos_ + Header::MAX_SIZE], len);
+			send_buf.resize(frame_pos_ + head + len);
+		}
+		Header::Build(&send_buf[frame_pos_], len, type);
+		Base::SendBufDirect();
+		return true;
+	}
+
+protected:
+	//收到一个完整帧，lpBuf指向接收缓存，只在回调里有效
+	virtual void OnFrame(const char*, int, FrameType)
+	{
+
+	}
+
+	inline bool PutFrameHeader(int nBufLen, FrameType type)
+	{
+		int head = Header::Size(nBufLen);
+		if (!head) {
+			return false;
+		}
+		Base::ReserveSendBuf();
+		SendBuffer& send_buf = Base::send_buf_;
+		size_t pos = send_buf.size();
+		send_buf.resize(pos + head);
+		Header::Build(&send_buf[pos], nBufLen, type);
+		return true;
+	}
+
+	//TcpSocket 实现接口
+	virtual int ParseBuf(const char* lpBuf, int & nBufLen)
+	{
+		size_t len = 0;
+		FrameType type = FrameType();
+		int head = Header::Parse(lpBuf, nBufLen, len, type);
+		if (head == 0) {
+			return SOCKET_PACKET_FLAG_PENDING;
+		}
+		if (head < 0 || len > max_frame_size_) {
+			//帧头错误，断开连接
+			return 0;
+		}
+		if ((size_t)nBufLen - head < len) {
+			return SOCKET_PACKET_FLAG_PENDING;
+		}
+		nBufLen = head + (int)len;
+		frame_head_ = head;
+		frame_type_ = type;
+		return SOCKET_PACKET_FLAG_COMPLETE;
+	}
+
+	virtual void OnRecvBuf(const char* lpBuf, int nBufLen, int nFlags)
+	{
+		Base::OnRecvBuf(lpBuf, nBufLen, nFlags);
+		OnFrame(lpBuf + frame_head_, nBufLen - frame_head_, frame_type_);
+	}
+};
+
+}
+
+#endif//_H_XFRAMEIMPL_H_
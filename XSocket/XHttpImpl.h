@@ -1060,7 +1060,7 @@ namespace XSocket {
 			//base64_key[base64_len] = 0;
 			en64((const byte*)buf, (byte*)base64_key, buflen);
 #endif
-			SendBuffer& send_buf = Base::SendBuf();int send_len = send_buf.size();
+			typename Base::SendBuffer& send_buf = Base::SendBuf();int send_len = send_buf.size();
 			send_buf.resize(send_len + 1024);
 			std::ostrstream ss(&send_buf[send_len], 1024);
 			ss << "GET " << path << " HTTP/1.1\r\n"
@@ -1100,7 +1100,7 @@ namespace XSocket {
 			//buf[buflen] = 0;
 			en64((const byte*)hash_key.bytes, (byte*)buf, SHA1_HASH_SIZE);
 #endif
-			SendBuffer& send_buf = Base::SendBuf();int send_len = send_buf.size();
+			typename Base::SendBuffer& send_buf = Base::SendBuf();int send_len = send_buf.size();
 			send_buf.resize(send_len + 1024);
 			std::ostrstream ss(&send_buf[send_len], 1024);
 			ss << "HTTP/1.1 101 Switching Protocols\r\n"
@@ -1121,12 +1121,16 @@ namespace XSocket {
 		inline void StopCloseIfTimeOut() 
 		{
 			close_if_time_point_ = std::chrono::steady_clock::time_point();
+			Base::KillIdleTimer();
 		}
 
 		inline void SetCloseIfTimeOut(size_t millis)
 		{
 			close_if_time_point_ = (std::chrono::steady_clock::now() + std::chrono::milliseconds(millis));
-			Select(FD_IDLE);
+			//由SocketSet时间轮到期触发OnIdle，不支持定时器的服务退回空闲扫描
+			if(!Base::SetIdleTimer(millis)) {
+				Base::Select(FD_IDLE);
+			}
 		}
 
 		inline int IsCloseIfTimeOut() {
@@ -1250,8 +1254,12 @@ namespace XSocket {
 			if(isval) {
 				if(isval == 1) {
 					DoClose();
-				} else {
-					Select(FD_IDLE);
+				} else if(!Base::IsIdleTimer()) {
+					//还没到时间，继续等剩下的时间
+					size_t millis = std::chrono::duration_cast<std::chrono::milliseconds>(close_if_time_point_ - std::chrono::steady_clock::now()).count();
+					if(!Base::SetIdleTimer(millis + 1)) {
+						Base::Select(FD_IDLE);
+					}
 				}
 			}
 		}
@@ -217,22 +217,25 @@ const char * proxy_stringtable[] = {
 };
 
 /*!
- *	@brief ProxydSocketT 模板定义.
+ *	@brief HttpProxydSocketT 模板定义.
  *
- *	封装ProxydSocketT，实现代理服务端逻辑
+ *	封装HttpProxydSocketT，实现代理服务端逻辑
+ *	OnProxy里连目标并AddRelayPeer加到本连接所在的SocketSet，目标OnConnect后StartTunnel回复CONNECT成功、两边互相StartRelay开始转发
+ *	两边都是RelaySocketT<TBase>时用splice零拷贝
  */
 template<class TBase>
-class HttpProxydSocketT : public HttpSocket<TBase>
+class HttpProxydSocketT : public HttpSocket<RelaySocketT<TBase>>
 {
-	typedef ProxydSocketT<TBase> This;
-	typedef TBase Base;
+	typedef HttpProxydSocketT<TBase> This;
+	typedef RelaySocketT<TBase> Base;
 protected:
 	byte m_ProxyType:3; //代理类型
 	byte m_ProxyState:5;	//代理状态
+	bool m_ProxyHandshake = false; //刚解析的是握手包
 	SOCKADDR_IN ProxyAddr_ = {0}; //代理地址
 
 public:
-	ProxydSocketT():m_ProxyType(PROXYTYPE_NONE),m_ProxyState(PROXY_STATE_NONE)
+	HttpProxydSocketT():m_ProxyType(PROXYTYPE_NONE),m_ProxyState(PROXY_STATE_NONE)
 	{
 	}
 
@@ -258,6 +261,18 @@ public:
 		return ret;
 	}
 
+	//连上目标后在服务线程里调用（如目标连接的OnConnect）：回复握手成功，两边互相StartRelay开始转发
+	//目标连接要用AddRelayPeer加到本连接所在的SocketSet，返回false表示没有开始转发
+	template<class TPeer>
+	inline bool StartTunnel(const std::shared_ptr<TPeer>& peer, bool bSplice = true)
+	{
+		OnProxyDone(0);
+		if (!IsProxyOK()) {
+			return false;
+		}
+		return Base::StartRelayPair(peer, bSplice);
+	}
+
 protected:
 	//
 	
@@ -733,9 +748,11 @@ unsigned long getip46(int family, unsigned char *name,  struct sockaddr *sa){
 				{
 				case 0:
 					{
-						if(nBufLen < 3) {
+						if(nBufLen < 3 || nBufLen < 2 + (byte)lpBuf[1]) {
 							return SOCKET_PACKET_FLAG_PENDING;
 						}
+						//只吃掉握手包，后面跟着的数据留给下一个包
+						nBufLen = 2 + (byte)lpBuf[1];
 						if (IsProxyAuthRequired()) {
 							//需要使用用户名密码登录
 							m_ProxyState = 2;
@@ -774,6 +791,7 @@ unsigned long getip46(int family, unsigned char *name,  struct sockaddr *sa){
 							}
 							u_long ip = *(u_long*)&lpBuf[4];
 							u_short port = *(u_short*)&lpBuf[8];
+							nBufLen = 4 + 4 + 2;
 							OnProxy(ip,port);
 							return SOCKET_PACKET_FLAG_COMPLETE;
 						} else if(ATYP == 0X03) { //域名
@@ -782,8 +800,9 @@ unsigned long getip46(int family, unsigned char *name,  struct sockaddr *sa){
 								return SOCKET_PACKET_FLAG_PENDING;
 							}
 							char* addr = (char*)lpBuf + 4 + 1;
-							u_short port = *(u_short*)&lpBuf[4 + addr_len];
+							u_short port = *(u_short*)&lpBuf[4 + 1 + addr_len];
 							addr[addr_len] = 0;
+							nBufLen = 4 + 1 + addr_len + 2;
 							OnProxy(addr, port);
 							return SOCKET_PACKET_FLAG_COMPLETE;
 						} else if(ATYP == 0X03) { //IPV6
@@ -931,7 +950,11 @@ unsigned long getip46(int family, unsigned char *name,  struct sockaddr *sa){
 		case PROXYTYPE_HTTP10:
 		case PROXYTYPE_HTTP11:
 			{
-				if(nErrorCode != 555 && (nErrorCode < 90 || nErrorCode >=800 || nErrorCode == 100 ||(nErrorCode > 500 && nErrorCode< 800))) {
+				if(!nErrorCode) {
+					//CONNECT隧道建立，之后的数据都是隧道数据
+					m_ProxyState = PROXY_STATE_OK;
+					Base::SendBuf(proxy_stringtable[8], (int)strlen(proxy_stringtable[8]));
+				} else if(nErrorCode != 555 && (nErrorCode < 90 || nErrorCode >=800 || nErrorCode == 100 ||(nErrorCode > 500 && nErrorCode< 800))) {
 					//if((nErrorCode>=509 && nErrorCode < 517) || nErrorCode > 900) while( (i = sockgetlinebuf(param, CLIENT, buf, BUFSIZE - 1, '\n')) > 2);
 					if(nErrorCode == 10) {
 						Base::SendBuf(proxy_stringtable[2], (int)strlen(proxy_stringtable[2]));
@@ -984,10 +1007,24 @@ unsigned long getip46(int family, unsigned char *name,  struct sockaddr *sa){
 	virtual int ParseBuf(const char* lpBuf, int & nBufLen) 
 	{ 
 		if(!IsProxyOK()) {
-			return ReceiveProxy(lpBuf, nBufLen);
+			int ret = ReceiveProxy(lpBuf, nBufLen);
+			if(ret & SOCKET_PACKET_FLAG_COMPLETE) {
+				m_ProxyHandshake = true;
+			}
+			return ret;
 		}
 		return Base::ParseBuf(lpBuf, nBufLen);
 	}
+
+	//握手包ReceiveProxy已经处理了，不能当隧道数据转给对端
+	virtual void OnRecvBuf(const char* lpBuf, int nBufLen, int nFlags)
+	{
+		if(m_ProxyHandshake) {
+			m_ProxyHandshake = false;
+			return;
+		}
+		Base::OnRecvBuf(lpBuf, nBufLen, nFlags);
+	}
 };
 
 }
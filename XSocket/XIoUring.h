@@ -0,0 +1,973 @@
+/*
+ * Copyright: 7thTool Open Source <i7thTool@qq.com>
+ * All rights reserved.
+ *
+ * Author	: Scott
+ * Email	：i7thTool@qq.com
+ * Blog		: http://blog.csdn.net/zhangzq86
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _H_XIOURING_H_
+#define _H_XIOURING_H_
+
+#include "XSocketEx.h"
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <linux/io_uring.h>
+#include <deque>
+
+namespace XSocket {
+
+//不依赖liburing，直接使用io_uring系统调用，需要Linux 6.0以上内核（多次接收、接收缓存环、同步取消）
+
+#ifndef IOURING_SQ_ENTRIES
+#define IOURING_SQ_ENTRIES	1024 //提交队列长度，完成队列是它的4倍
+#endif//
+#ifndef IOURING_BUF_COUNT
+#define IOURING_BUF_COUNT	512 //每个Service共享的接收缓存块数，必须是2的幂
+#endif//
+#ifndef IOURING_BUF_SIZE
+#define IOURING_BUF_SIZE	4096 //接收缓存块大小
+#endif//
+#define IOURING_BUF_GROUP	0 //接收缓存环组ID
+
+/*!
+ *	@brief IoUring 操作类型定义.
+ *
+ *	user_data：高32位槽位代数，28~31位操作类型，低28位槽位；代数为0的是Service内部操作
+ */
+enum
+{
+	IOURING_OPERATION_NONE = 0, //已作废的请求，完成后忽略
+	IOURING_OPERATION_NOTIFY,
+	IOURING_OPERATION_NOTIFYDATA,
+	IOURING_OPERATION_ACCEPT,
+	IOURING_OPERATION_CONNECT,
+	IOURING_OPERATION_RECEIVE,
+	IOURING_OPERATION_SEND,
+};
+#define IOURING_OPERATION_SHIFT	28
+#define IOURING_OPERATION_MASK	((uint64_t)0xF << IOURING_OPERATION_SHIFT)
+
+/*!
+ *	@brief IoUringSocket 模板定义.
+ *
+ *	封装IoUringSocket，Receive从已完成的接收缓存读取，Send投递异步发送，和CompletionPortSocket一样通过完成事件驱动TcpSocket
+ */
+template<class TSocketSet, class TBase = SocketEx>
+class IoUringSocketT : public TBase
+{
+	typedef TBase Base;
+public:
+	typedef TSocketSet SocketSet;
+protected:
+	struct RecvChunk
+	{
+		unsigned short bid; //接收缓存块ID
+		int offset; //已读取长度
+		int len; //剩余长度
+	};
+	SocketSet* sockset_ = nullptr; //所属SocketSet，在AttachService时记录，避免其他线程调用时找不到
+	std::deque<RecvChunk> recv_que_; //已完成还没读取的接收缓存
+	int recv_err_ = 0; //接收错误
+	uint32_t recv_eof_:1; //对端已关闭
+	uint32_t recv_armed_:1; //已投递多次接收
+	uint32_t accept_armed_:1; //已投递多次Accept
+	uint32_t connect_armed_:1; //已投递连接检测
+	const char* send_buf_ = nullptr; //正在发送的数据
+	int send_len_ = 0; //正在发送的长度，非0表示有发送请求未完成
+public:
+	static SocketSet* service() { return dynamic_cast<SocketSet*>(SocketSet::service()); }
+
+	IoUringSocketT():Base(),recv_eof_(0),recv_armed_(0),accept_armed_(0),connect_armed_(0)
+	{
+
+	}
+
+	virtual ~IoUringSocketT()
+	{
+
+	}
+
+	//需要在服务线程调用，关闭前先取消该Socket上所有io_uring请求，否则内核持有的引用会让连接一直不关闭
+	inline int Close()
+	{
+		if(sockset_ && Base::IsSocket()) {
+			sockset_->CancelSocket((SOCKET)*this, Base::Handle());
+		}
+		ClearRecvBuf();
+		recv_err_ = 0;
+		recv_eof_ = 0;
+		recv_armed_ = 0;
+		accept_armed_ = 0;
+		connect_armed_ = 0;
+		send_buf_ = nullptr;
+		send_len_ = 0;
+		return Base::Close();
+	}
+
+	int Send(const char* lpBuf, int nBufLen, int nFlags = MSG_NOSIGNAL)
+	{
+		if(!sockset_) {
+			return Base::Send(lpBuf, nBufLen, nFlags);
+		}
+		if(!send_len_) {
+			//发送请求在本轮OnWait统一提交，完成后Trigger(FD_WRITE, lpBuf, n, 0)
+			if(!sockset_->PostSend(this, lpBuf, nBufLen, nFlags)) {
+				XSocket::Socket::SetLastError(ENOBUFS);
+				return SOCKET_ERROR;
+			}
+			send_buf_ = lpBuf;
+			send_len_ = nBufLen;
+		}
+		XSocket::Socket::SetLastError(EWOULDBLOCK);
+		return SOCKET_ERROR;
+	}
+
+	//io_uring只提交第一个分片，完成后由TcpSocket推进分片继续发送
+	int SendV(const SOCKBUF* lpBufs, int nBufCount, int nFlags = MSG_NOSIGNAL)
+	{
+		if(!sockset_) {
+			return Base::SendV(lpBufs, nBufCount, nFlags);
+		}
+		ASSERT(nBufCount > 0);
+		return Send(SOCKBUF_BUF(lpBufs[0]), (int)SOCKBUF_LEN(lpBufs[0]), nFlags);
+	}
+
+	int Receive(char* lpBuf, int nBufLen, int nFlags = MSG_NOSIGNAL)
+	{
+		if(!sockset_) {
+			return Base::Receive(lpBuf, nBufLen, nFlags);
+		}
+		int nRecvLen = 0;
+		while (nRecvLen < nBufLen && !recv_que_.empty()) {
+			RecvChunk& chunk = recv_que_.front();
+			int nLen = std::min<>(chunk.len, nBufLen - nRecvLen);
+			memcpy(lpBuf + nRecvLen, sockset_->GetBuf(chunk.bid) + chunk.offset, nLen);
+			nRecvLen += nLen;
+			chunk.offset += nLen;
+			chunk.len -= nLen;
+			if(!chunk.len) {
+				sockset_->RecycleBuf(chunk.bid);
+				recv_que_.pop_front();
+			}
+		}
+		if(nRecvLen > 0) {
+			return nRecvLen;
+		}
+		if(recv_err_) {
+			XSocket::Socket::SetLastError(recv_err_);
+			return SOCKET_ERROR;
+		}
+		if(recv_eof_) {
+			XSocket::Socket::SetLastError(0);
+			return 0;
+		}
+		XSocket::Socket::SetLastError(EWOULDBLOCK);
+		return SOCKET_ERROR;
+	}
+
+	inline void Select(int lEvent) {
+		int lAsyncEvent = 0;
+		if(!Base::IsSelect(FD_READ) && (lEvent & FD_READ)) {
+			lAsyncEvent |= FD_READ;
+		}
+		if(!Base::IsSelect(FD_WRITE) && (lEvent & FD_WRITE)) {
+			lAsyncEvent |= FD_WRITE;
+		}
+		if(!Base::IsSelect(FD_ACCEPT) && (lEvent & FD_ACCEPT)) {
+			lAsyncEvent |= FD_ACCEPT;
+		}
+		Base::Select(lEvent);
+		if(lAsyncEvent && sockset_) {
+			sockset_->SelectSocket(this, lAsyncEvent);
+		}
+	}
+
+public:
+	//以下由IoUringSocketSet在服务线程调用
+	inline bool IsRecvArmed() { return recv_armed_; }
+	inline void SetRecvArmed(bool armed) { recv_armed_ = armed; }
+	inline bool IsAcceptArmed() { return accept_armed_; }
+	inline void SetAcceptArmed(bool armed) { accept_armed_ = armed; }
+	inline bool IsConnectArmed() { return connect_armed_; }
+	inline void SetConnectArmed(bool armed) { connect_armed_ = armed; }
+
+	//有可读数据、错误或者对端关闭，需要Trigger(FD_READ)让上层读取
+	inline bool IsRecvReady() { return !recv_que_.empty() || recv_err_ || recv_eof_; }
+	//没有错误且对端没有关闭，可以继续投递接收
+	inline bool IsRecvOpen() { return !recv_err_ && !recv_eof_; }
+	inline void PushRecvBuf(unsigned short bid, int len) { recv_que_.push_back({bid, 0, len}); }
+	inline void SetRecvError(int err) { recv_err_ = err; }
+	inline void SetRecvEof() { recv_eof_ = 1; }
+
+	//发送完成，返回完成的发送数据
+	inline const char* SendComplete()
+	{
+		const char* lpBuf = send_buf_;
+		send_buf_ = nullptr;
+		send_len_ = 0;
+		return lpBuf;
+	}
+
+protected:
+	//
+	inline void ClearRecvBuf()
+	{
+		if(sockset_) {
+			for (auto& chunk : recv_que_)
+			{
+				sockset_->RecycleBuf(chunk.bid);
+			}
+		}
+		recv_que_.clear();
+	}
+
+	virtual void OnAttachService(Service* pSvr)
+	{
+		Base::OnAttachService(pSvr);
+		sockset_ = dynamic_cast<SocketSet*>(pSvr);
+	}
+
+	virtual void OnDetachService(Service* pSvr)
+	{
+		ClearRecvBuf();
+		Base::OnDetachService(pSvr);
+		sockset_ = nullptr;
+	}
+};
+
+/*!
+ *	@brief IoUringServiceT 模板定义.
+ *
+ *	封装IoUringServiceT，实现io_uring模型，提交请求在OnWait统一批量提交
+ */
+template<class TService = Service>
+class IoUringServiceT : public TService
+{
+	typedef TService Base;
+protected:
+	int ring_fd_ = -1;
+	//提交队列
+	void* sq_ring_ptr_ = MAP_FAILED;
+	size_t sq_ring_sz_ = 0;
+	unsigned* sq_head_ = nullptr;
+	unsigned* sq_tail_ = nullptr;
+	unsigned sq_mask_ = 0;
+	unsigned sq_entries_ = 0;
+	unsigned sq_local_tail_ = 0; //已准备还没提交的请求尾
+	struct io_uring_sqe* sqes_ = (struct io_uring_sqe*)MAP_FAILED;
+	size_t sqes_sz_ = 0;
+	//完成队列
+	void* cq_ring_ptr_ = MAP_FAILED;
+	size_t cq_ring_sz_ = 0;
+	unsigned* cq_head_ = nullptr;
+	unsigned* cq_tail_ = nullptr;
+	unsigned cq_mask_ = 0;
+	struct io_uring_cqe* cqes_ = nullptr;
+	//接收缓存环，多次接收完成时内核从这里取缓存
+	struct io_uring_buf_ring* buf_ring_ = (struct io_uring_buf_ring*)MAP_FAILED;
+	char* buf_base_ = (char*)MAP_FAILED;
+	unsigned short buf_tail_ = 0;
+	int buf_free_ = 0; //接收缓存环里可用的缓存块数
+	//通知
+	int evfd_ = -1;
+	int evfd_pair_[2] = {-1,-1};
+public:
+	IoUringServiceT()
+	{
+		struct io_uring_params params = {};
+		params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+		params.cq_entries = IOURING_SQ_ENTRIES * 4;
+		ring_fd_ = syscall(__NR_io_uring_setup, IOURING_SQ_ENTRIES, &params);
+		if(ring_fd_ < 0 && errno == EINVAL) {
+			//老内核不支持COOP_TASKRUN
+			memset(&params, 0, sizeof(params));
+			params.flags = IORING_SETUP_CQSIZE;
+			params.cq_entries = IOURING_SQ_ENTRIES * 4;
+			ring_fd_ = syscall(__NR_io_uring_setup, IOURING_SQ_ENTRIES, &params);
+		}
+		if(ring_fd_ < 0) {
+			PRINTF("io_uring_setup failed, errno(%d): %s\n", errno, strerror(errno));
+			return;
+		}
+		if(!MapRing(params)) {
+			PRINTF("io_uring mmap failed, errno(%d): %s\n", errno, strerror(errno));
+			UnmapRing();
+			close(ring_fd_);
+			ring_fd_ = -1;
+			return;
+		}
+		if(!RegisterBufRing()) {
+			PRINTF("io_uring register buf ring failed, errno(%d): %s\n", errno, strerror(errno));
+		}
+		evfd_ = eventfd(0, EFD_NONBLOCK);
+		if(evfd_ < 0) {
+			PRINTF("create event fd failed, errno(%d): %s\n", errno, strerror(errno));
+		} else {
+			PollNotify(evfd_, IOURING_OPERATION_NOTIFY);
+		}
+		if(pipe(evfd_pair_) == -1) {
+			PRINTF("create fd pair failed, errno(%d): %s\n", errno, strerror(errno));
+			evfd_pair_[0] = evfd_pair_[1] = -1;
+		} else {
+			//读端非阻塞，一次通知读完所有数据；写端阻塞和EPollService一样不丢通知
+			fcntl(evfd_pair_[0], F_SETFL, fcntl(evfd_pair_[0], F_GETFL) | O_NONBLOCK);
+			PollNotify(evfd_pair_[0], IOURING_OPERATION_NOTIFYDATA);
+		}
+	}
+	~IoUringServiceT()
+	{
+		if(evfd_pair_[0] >= 0) {
+			close(evfd_pair_[0]);
+			close(evfd_pair_[1]);
+			evfd_pair_[0] = -1;
+			evfd_pair_[1] = -1;
+		}
+		if(evfd_ >= 0) {
+			close(evfd_);
+			evfd_ = -1;
+		}
+		if(ring_fd_ >= 0) {
+			close(ring_fd_);
+			ring_fd_ = -1;
+		}
+		UnmapRing();
+		if(buf_ring_ != MAP_FAILED) {
+			munmap(buf_ring_, IOURING_BUF_COUNT * sizeof(struct io_uring_buf));
+			buf_ring_ = (struct io_uring_buf_ring*)MAP_FAILED;
+		}
+		if(buf_base_ != MAP_FAILED) {
+			munmap(buf_base_, (size_t)IOURING_BUF_COUNT * IOURING_BUF_SIZE);
+			buf_base_ = (char*)MAP_FAILED;
+		}
+	}
+
+	inline void PostNotify()
+	{
+		Base::PostNotify();
+		Wakeup();
+	}
+
+	inline void PostNotify(void* data)
+	{
+		write(evfd_pair_[1], &data, sizeof(data));
+	}
+
+	inline void PostTimer(size_t millis)
+	{
+		//定时器由OnWait等待超时实现，其他线程投递需要唤醒，让等待时间重新计算
+		Base::PostTimer(millis);
+		if(!IsServiceThread()) {
+			Wakeup();
+		}
+	}
+
+	inline bool IsServiceThread() { return XSocket::Service::service() == this; }
+
+	inline char* GetBuf(unsigned short bid) { return buf_base_ + (size_t)bid * IOURING_BUF_SIZE; }
+
+	//归还接收缓存块到接收缓存环，需要在服务线程调用
+	inline void RecycleBuf(unsigned short bid)
+	{
+		//C++下__DECLARE_FLEX_ARRAY展开的空结构体占1字节，bufs偏移不是0，直接按io_uring_buf数组访问
+		struct io_uring_buf* buf = (struct io_uring_buf*)buf_ring_ + (buf_tail_ & (IOURING_BUF_COUNT - 1));
+		buf->addr = (uint64_t)GetBuf(bid);
+		buf->len = IOURING_BUF_SIZE;
+		buf->bid = bid;
+		buf_tail_++;
+		__atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+		buf_free_++;
+	}
+
+	//取一个提交请求，提交队列满了先提交一次，需要在服务线程调用
+	inline struct io_uring_sqe* GetSqe()
+	{
+		if(ring_fd_ < 0) {
+			return nullptr;
+		}
+		if(sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+			Enter(0, 0);
+			if(sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+				PRINTF("io_uring submission queue is full");
+				return nullptr;
+			}
+		}
+		struct io_uring_sqe* sqe = &sqes_[sq_local_tail_ & sq_mask_];
+		memset(sqe, 0, sizeof(*sqe));
+		sq_local_tail_++;
+		return sqe;
+	}
+
+	//取消fd上所有请求，同步等待取消完成，之后内核不会再访问该Socket的发送缓存
+	inline void CancelSocket(int fd, uint64_t handle)
+	{
+		if(ring_fd_ < 0) {
+			return;
+		}
+		if(handle && IsServiceThread()) {
+			//还没提交的请求直接改成空操作，否则fd关闭后可能被新连接复用
+			unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+			for (; head != sq_local_tail_; ++head)
+			{
+				struct io_uring_sqe* sqe = &sqes_[head & sq_mask_];
+				if(sqe->user_data && (sqe->user_data & ~IOURING_OPERATION_MASK) == handle) {
+					memset(sqe, 0, sizeof(*sqe));
+					sqe->opcode = IORING_OP_NOP;
+					sqe->fd = -1;
+				}
+			}
+		}
+		struct io_uring_sync_cancel_reg reg = {};
+		reg.fd = fd;
+		reg.flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+		reg.timeout.tv_sec = -1;
+		reg.timeout.tv_nsec = -1;
+		syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_SYNC_CANCEL, &reg, 1);
+	}
+
+protected:
+	//
+	inline bool MapRing(const struct io_uring_params& params)
+	{
+		sq_ring_sz_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		cq_ring_sz_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		if(params.features & IORING_FEAT_SINGLE_MMAP) {
+			sq_ring_sz_ = cq_ring_sz_ = std::max<>(sq_ring_sz_, cq_ring_sz_);
+		}
+		sq_ring_ptr_ = mmap(0, sq_ring_sz_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+		if(sq_ring_ptr_ == MAP_FAILED) {
+			return false;
+		}
+		if(params.features & IORING_FEAT_SINGLE_MMAP) {
+			cq_ring_ptr_ = sq_ring_ptr_;
+		} else {
+			cq_ring_ptr_ = mmap(0, cq_ring_sz_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+			if(cq_ring_ptr_ == MAP_FAILED) {
+				return false;
+			}
+		}
+		sqes_sz_ = params.sq_entries * sizeof(struct io_uring_sqe);
+		sqes_ = (struct io_uring_sqe*)mmap(0, sqes_sz_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+		if(sqes_ == MAP_FAILED) {
+			return false;
+		}
+		char* sq_ptr = (char*)sq_ring_ptr_;
+		sq_head_ = (unsigned*)(sq_ptr + params.sq_off.head);
+		sq_tail_ = (unsigned*)(sq_ptr + params.sq_off.tail);
+		sq_mask_ = *(unsigned*)(sq_ptr + params.sq_off.ring_mask);
+		sq_entries_ = *(unsigned*)(sq_ptr + params.sq_off.ring_entries);
+		sq_local_tail_ = *sq_tail_;
+		//提交数组固定为一一对应，请求位置就是提交队列位置
+		unsigned* sq_array = (unsigned*)(sq_ptr + params.sq_off.array);
+		for (unsigned i = 0; i < sq_entries_; i++)
+		{
+			sq_array[i] = i;
+		}
+		char* cq_ptr = (char*)cq_ring_ptr_;
+		cq_head_ = (unsigned*)(cq_ptr + params.cq_off.head);
+		cq_tail_ = (unsigned*)(cq_ptr + params.cq_off.tail);
+		cq_mask_ = *(unsigned*)(cq_ptr + params.cq_off.ring_mask);
+		cqes_ = (struct io_uring_cqe*)(cq_ptr + params.cq_off.cqes);
+		return true;
+	}
+
+	inline void UnmapRing()
+	{
+		if(sqes_ != MAP_FAILED) {
+			munmap(sqes_, sqes_sz_);
+			sqes_ = (struct io_uring_sqe*)MAP_FAILED;
+		}
+		if(cq_ring_ptr_ != MAP_FAILED && cq_ring_ptr_ != sq_ring_ptr_) {
+			munmap(cq_ring_ptr_, cq_ring_sz_);
+		}
+		cq_ring_ptr_ = MAP_FAILED;
+		if(sq_ring_ptr_ != MAP_FAILED) {
+			munmap(sq_ring_ptr_, sq_ring_sz_);
+			sq_ring_ptr_ = MAP_FAILED;
+		}
+	}
+
+	inline bool RegisterBufRing()
+	{
+		buf_ring_ = (struct io_uring_buf_ring*)mmap(0, IOURING_BUF_COUNT * sizeof(struct io_uring_buf)
+			, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+		if(buf_ring_ == MAP_FAILED) {
+			return false;
+		}
+		buf_base_ = (char*)mmap(0, (size_t)IOURING_BUF_COUNT * IOURING_BUF_SIZE
+			, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+		if(buf_base_ == MAP_FAILED) {
+			return false;
+		}
+		struct io_uring_buf_reg reg = {};
+		reg.ring_addr = (uint64_t)buf_ring_;
+		reg.ring_entries = IOURING_BUF_COUNT;
+		reg.bgid = IOURING_BUF_GROUP;
+		if(syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+			return false;
+		}
+		buf_tail_ = 0;
+		for (int i = 0; i < IOURING_BUF_COUNT; i++)
+		{
+			RecycleBuf(i);
+		}
+		return true;
+	}
+
+	inline void Wakeup()
+	{
+		const uint64_t data = 1;
+		write(evfd_, &data, sizeof(data));
+	}
+
+	inline void PollNotify(int fd, int op)
+	{
+		struct io_uring_sqe* sqe = GetSqe();
+		if(sqe) {
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->fd = fd;
+			sqe->poll32_events = POLLIN;
+			sqe->len = IORING_POLL_ADD_MULTI;
+			sqe->user_data = (uint64_t)op << IOURING_OPERATION_SHIFT;
+		}
+	}
+
+	//提交所有准备好的请求，min_complete非0时等待完成事件，最多等待millis毫秒
+	inline int Enter(unsigned min_complete, size_t millis)
+	{
+		unsigned to_submit = sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+		__atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+		if(!to_submit && !min_complete) {
+			return 0;
+		}
+		unsigned flags = 0;
+		struct __kernel_timespec ts = {};
+		struct io_uring_getevents_arg arg = {};
+		if(min_complete) {
+			ts.tv_sec = millis / 1000;
+			ts.tv_nsec = millis % 1000 * 1000 * 1000;
+			arg.ts = (uint64_t)&ts;
+			flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+		}
+		int ret = syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete, flags, min_complete ? &arg : nullptr, sizeof(arg));
+		if(ret < 0) {
+			if(errno != ETIME && errno != EINTR && errno != EBUSY) {
+				PRINTF("io_uring_enter failed, errno(%d): %s\n", errno, strerror(errno));
+			}
+		}
+		return ret;
+	}
+
+	//
+	virtual void OnNotify(void*)
+	{
+		//PRINTF("OnNotify %p", data);
+	}
+
+	//提交前回调，在服务线程准备请求
+	virtual void OnSubmit()
+	{
+
+	}
+
+	virtual void OnCompletion(uint64_t, int, uint32_t)
+	{
+
+	}
+
+	virtual void OnWait()
+	{
+		if(ring_fd_ < 0) {
+			return;
+		}
+		OnSubmit();
+		unsigned head = *cq_head_;
+		if(head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+			Enter(0, 0); //已经有完成事件，只提交不等待
+		} else {
+			size_t millis = Base::GetWaitingTimeOut();
+			Base::BeginWait();
+			Enter(millis ? 1 : 0, millis);
+			Base::EndWait();
+		}
+		unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+		if(head != tail) {
+			Base::MarkBusy();
+		}
+		for (; head != tail; ++head)
+		{
+			const struct io_uring_cqe& cqe = cqes_[head & cq_mask_];
+			uint64_t user_data = cqe.user_data;
+			int res = cqe.res;
+			uint32_t flags = cqe.flags;
+			//先归还完成队列位置，回调里可能会提交新请求
+			__atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+			if(!(user_data >> 32)) {
+				switch ((user_data & IOURING_OPERATION_MASK) >> IOURING_OPERATION_SHIFT)
+				{
+				case IOURING_OPERATION_NOTIFY:
+				{
+					uint64_t data = 0;
+					while(sizeof(data) == read(evfd_, &data, sizeof(data))) {
+						//PRINTF("OnNotify %u", data);
+					}
+					if(!(flags & IORING_CQE_F_MORE)) {
+						PollNotify(evfd_, IOURING_OPERATION_NOTIFY);
+					}
+				}
+				break;
+				case IOURING_OPERATION_NOTIFYDATA:
+				{
+					void* data = 0;
+					while(sizeof(data) == read(evfd_pair_[0], &data, sizeof(data))) {
+						OnNotify(data);
+					}
+					if(!(flags & IORING_CQE_F_MORE)) {
+						PollNotify(evfd_pair_[0], IOURING_OPERATION_NOTIFYDATA);
+					}
+				}
+				break;
+				default:
+				break;
+				}
+			} else {
+				OnCompletion(user_data, res, flags);
+			}
+		}
+	}
+};
+
+typedef ThreadServiceT<IoUringServiceT<Service>> IoUringService;
+
+/*!
+ *	@brief IoUringSocketSet 模板定义.
+ *
+ *	封装IoUringSocketSet，实现io_uring模型，监听使用多次Accept，接收使用多次接收+接收缓存环，发送批量提交
+ */
+template<class TService = IoUringService, class TSocket = SocketEx>
+class IoUringSocketSetT : public SocketSetT<TService,TSocket>
+{
+	typedef SocketSetT<TService,TSocket> Base;
+public:
+	typedef TService Service;
+	typedef TSocket Socket;
+protected:
+	std::mutex select_mutex_;
+	std::vector<std::pair<uint64_t,int>> select_que_; //其他线程Select的事件，在服务线程投递请求
+	std::vector<uint64_t> recv_starved_; //接收缓存耗尽而停止接收的Socket
+public:
+	IoUringSocketSetT(int nMaxSocketCount):Base(nMaxSocketCount)
+	{
+	}
+	~IoUringSocketSetT()
+	{
+	}
+
+	//服务线程直接投递请求，其他线程排队并唤醒服务线程
+	template<class Ty>
+	void SelectSocket(Ty* sock_ptr, int evt) {
+		if(Base::IsServiceThread()) {
+			ArmSocket(sock_ptr, evt);
+		} else {
+			std::unique_lock<std::mutex> lock(select_mutex_);
+			select_que_.emplace_back(sock_ptr->Handle(), evt);
+			lock.unlock();
+			Base::Wakeup();
+		}
+	}
+
+	template<class Ty>
+	bool PostSend(Ty* sock_ptr, const char* lpBuf, int nBufLen, int nFlags) {
+		struct io_uring_sqe* sqe = Base::GetSqe();
+		if(!sqe) {
+			return false;
+		}
+		sqe->opcode = IORING_OP_SEND;
+		sqe->fd = (SOCKET)*sock_ptr;
+		sqe->addr = (uint64_t)lpBuf;
+		sqe->len = nBufLen;
+		sqe->msg_flags = nFlags | MSG_NOSIGNAL;
+		sqe->user_data = MakeUserData(sock_ptr->Handle(), IOURING_OPERATION_SEND);
+		return true;
+	}
+
+	int AddSocket(std::shared_ptr<Socket> sock_ptr, int evt = 0)
+	{
+		std::unique_lock<std::mutex> lock(Base::mutex_);
+		if (!sock_ptr) {
+			//测试可不可以增加Socket，返回>=0表示可以增加
+			return Base::sock_free_head_;
+		}
+		int i = Base::AllocSlot();
+		if (i < 0) {
+			return -1;
+		}
+		Base::sock_count_++;
+		Base::sock_ptrs_[i] = sock_ptr;
+		sock_ptr->SetHandle(Base::MakeHandle(i), this);
+		sock_ptr->AttachService(this);
+		sock_ptr->SocketEx::Select(evt);
+		lock.unlock();
+		SelectSocket(sock_ptr.get(), FD_READ|FD_WRITE|FD_ACCEPT|FD_CONNECT);
+		return i;
+	}
+	template<class Ty = Socket>
+	inline int AddConnect(std::shared_ptr<Ty> sock_ptr, u_short port)
+	{
+		if(sock_ptr) {
+			sock_ptr->Connect(port);
+		}
+		return AddSocket(std::static_pointer_cast<Socket>(sock_ptr));
+	}
+	inline int AddAccept(std::shared_ptr<Socket> sock_ptr)
+	{
+		return AddSocket(sock_ptr,FD_ACCEPT);
+	}
+
+	int RemoveSocket(std::shared_ptr<Socket> sock_ptr)
+	{
+		int i = Base::FindSocketPos(sock_ptr);
+		if (i >= 0) {
+			if (sock_ptr->IsSocket()) {
+				Base::CancelSocket((SOCKET)*sock_ptr, sock_ptr->Handle());
+			}
+			return Base::RemoveSocketByPos(i);
+		}
+		return -1;
+	}
+
+protected:
+	//
+	static inline uint64_t MakeUserData(uint64_t handle, int op)
+	{
+		return handle | ((uint64_t)op << IOURING_OPERATION_SHIFT);
+	}
+
+	template<class Ty>
+	void ArmReceive(Ty* sock_ptr)
+	{
+		struct io_uring_sqe* sqe = Base::GetSqe();
+		if(sqe) {
+			sqe->opcode = IORING_OP_RECV;
+			sqe->fd = (SOCKET)*sock_ptr;
+			sqe->ioprio = IORING_RECV_MULTISHOT;
+			sqe->flags = IOSQE_BUFFER_SELECT;
+			sqe->buf_group = IOURING_BUF_GROUP;
+			sqe->user_data = MakeUserData(sock_ptr->Handle(), IOURING_OPERATION_RECEIVE);
+			sock_ptr->SetRecvArmed(true);
+		}
+	}
+
+	template<class Ty>
+	void ArmAccept(Ty* sock_ptr)
+	{
+		struct io_uring_sqe* sqe = Base::GetSqe();
+		if(sqe) {
+			sqe->opcode = IORING_OP_ACCEPT;
+			sqe->fd = (SOCKET)*sock_ptr;
+			sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+			sqe->user_data = MakeUserData(sock_ptr->Handle(), IOURING_OPERATION_ACCEPT);
+			sock_ptr->SetAcceptArmed(true);
+		}
+	}
+
+	template<class Ty>
+	void ArmConnect(Ty* sock_ptr)
+	{
+		struct io_uring_sqe* sqe = Base::GetSqe();
+		if(sqe) {
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->fd = (SOCKET)*sock_ptr;
+			sqe->poll32_events = POLLOUT;
+			sqe->user_data = MakeUserData(sock_ptr->Handle(), IOURING_OPERATION_CONNECT);
+			sock_ptr->SetConnectArmed(true);
+		}
+	}
+
+	//在服务线程根据选择的事件投递请求
+	template<class Ty>
+	void ArmSocket(Ty* sock_ptr, int evt)
+	{
+		if(!sock_ptr->IsSocket()) {
+			return;
+		}
+		if((evt & FD_ACCEPT) && sock_ptr->IsSelect(FD_ACCEPT) && !sock_ptr->IsAcceptArmed()) {
+			ArmAccept(sock_ptr);
+		}
+		if((evt & FD_CONNECT) && sock_ptr->IsSelect(FD_CONNECT) && !sock_ptr->IsConnectArmed()) {
+			ArmConnect(sock_ptr);
+		}
+		if((evt & FD_READ) && sock_ptr->IsSelect(FD_READ)) {
+			if(!sock_ptr->IsRecvArmed() && sock_ptr->IsRecvOpen()) {
+				ArmReceive(sock_ptr);
+			}
+			if(sock_ptr->IsRecvReady()) {
+				//没有选择FD_READ期间到达的数据
+				sock_ptr->Trigger(FD_READ, 0);
+			}
+		}
+		if((evt & FD_WRITE) && sock_ptr->IsSocket() && sock_ptr->IsSelect(FD_WRITE)) {
+			sock_ptr->Trigger(FD_WRITE, 0);
+		}
+	}
+
+	virtual void OnSubmit()
+	{
+		Base::OnSubmit();
+		if(!select_que_.empty()) {
+			std::vector<std::pair<uint64_t,int>> select_que;
+			std::unique_lock<std::mutex> lock(select_mutex_);
+			select_que.swap(select_que_);
+			lock.unlock();
+			for (auto& it : select_que)
+			{
+				lock = std::unique_lock<std::mutex>(Base::mutex_);
+				std::shared_ptr<Socket> sock_ptr = Base::FindSocket(it.first);
+				lock.unlock();
+				if(sock_ptr) {
+					ArmSocket(sock_ptr.get(), it.second);
+				}
+			}
+		}
+		if(!recv_starved_.empty() && Base::buf_free_ > 0) {
+			//有缓存归还了，恢复接收
+			std::vector<uint64_t> recv_starved;
+			recv_starved.swap(recv_starved_);
+			for (auto handle : recv_starved)
+			{
+				std::unique_lock<std::mutex> lock(Base::mutex_);
+				std::shared_ptr<Socket> sock_ptr = Base::FindSocket(handle);
+				lock.unlock();
+				if(sock_ptr && sock_ptr->IsSocket() && !sock_ptr->IsRecvArmed() && sock_ptr->IsRecvOpen()) {
+					ArmReceive(sock_ptr.get());
+				}
+			}
+		}
+	}
+
+	virtual void OnCompletion(uint64_t user_data, int res, uint32_t flags)
+	{
+		int op = (user_data & IOURING_OPERATION_MASK) >> IOURING_OPERATION_SHIFT;
+		uint64_t handle = user_data & ~IOURING_OPERATION_MASK;
+		std::unique_lock<std::mutex> lock(Base::mutex_);
+		std::shared_ptr<Socket> sock_ptr = Base::FindSocket(handle);
+		lock.unlock();
+		if(flags & IORING_CQE_F_BUFFER) {
+			Base::buf_free_--;
+		}
+		if(!sock_ptr || !sock_ptr->IsSocket()) {
+			//过期的完成事件，归还接收缓存，关闭Accept到的Socket
+			if(flags & IORING_CQE_F_BUFFER) {
+				Base::RecycleBuf(flags >> IORING_CQE_BUFFER_SHIFT);
+			}
+			if(op == IOURING_OPERATION_ACCEPT && res >= 0) {
+				XSocket::Socket::Close((SOCKET)res);
+			}
+			return;
+		}
+		switch (op)
+		{
+		case IOURING_OPERATION_ACCEPT:
+		{
+			if(!(flags & IORING_CQE_F_MORE)) {
+				sock_ptr->SetAcceptArmed(false);
+			}
+			if(res >= 0) {
+				if(sock_ptr->IsSelect(FD_ACCEPT)) {
+					sock_ptr->Trigger(FD_ACCEPT, (SOCKET)res, nullptr, 0);
+				} else {
+					XSocket::Socket::Close((SOCKET)res);
+				}
+			} else if(res != -ECANCELED) {
+				sock_ptr->Trigger(FD_ACCEPT, -res);
+			}
+			if(!(flags & IORING_CQE_F_MORE) && res != -ECANCELED) {
+				ArmSocket(sock_ptr.get(), FD_ACCEPT);
+			}
+		}
+		break;
+		case IOURING_OPERATION_CONNECT:
+		{
+			sock_ptr->SetConnectArmed(false);
+			if(res != -ECANCELED && sock_ptr->IsSelect(FD_CONNECT)) {
+				sock_ptr->RemoveSelect(FD_CONNECT);
+				int nErrorCode = 0;
+				if(res < 0) {
+					nErrorCode = -res;
+				} else {
+					sock_ptr->GetSockOpt(SOL_SOCKET, SO_ERROR, (void *)&nErrorCode, sizeof(nErrorCode));
+				}
+				sock_ptr->Trigger(FD_CONNECT, nErrorCode);
+			}
+		}
+		break;
+		case IOURING_OPERATION_RECEIVE:
+		{
+			if(!(flags & IORING_CQE_F_MORE)) {
+				sock_ptr->SetRecvArmed(false);
+			}
+			if(res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+				sock_ptr->PushRecvBuf(flags >> IORING_CQE_BUFFER_SHIFT, res);
+			} else if(flags & IORING_CQE_F_BUFFER) {
+				Base::RecycleBuf(flags >> IORING_CQE_BUFFER_SHIFT);
+			}
+			if(res == 0) {
+				sock_ptr->SetRecvEof();
+			} else if(res == -ENOBUFS) {
+				//接收缓存耗尽，等有缓存归还再恢复接收
+				recv_starved_.push_back(handle);
+				break;
+			} else if(res == -ECANCELED) {
+				break;
+			} else if(res < 0) {
+				sock_ptr->SetRecvError(-res);
+			}
+			if(sock_ptr->IsSelect(FD_READ)) {
+				sock_ptr->Trigger(FD_READ, 0);
+			}
+			if(sock_ptr->IsSocket() && !sock_ptr->IsRecvArmed() && sock_ptr->IsRecvOpen()) {
+				ArmReceive(sock_ptr.get());
+			}
+		}
+		break;
+		case IOURING_OPERATION_SEND:
+		{
+			const char* lpBuf = sock_ptr->SendComplete();
+			if(res > 0) {
+				if (sock_ptr->IsSelect(FD_WRITE)) {
+					sock_ptr->Trigger(FD_WRITE, lpBuf, res, 0);
+				}
+				if (sock_ptr->IsSocket() && sock_ptr->IsSelect(FD_WRITE)) {
+					sock_ptr->Trigger(FD_WRITE, 0);
+				}
+			} else if(res == -EAGAIN || res == -EINTR) {
+				if (sock_ptr->IsSelect(FD_WRITE)) {
+					sock_ptr->Trigger(FD_WRITE, 0);
+				}
+			} else if(res != -ECANCELED) {
+				sock_ptr->Trigger(FD_CLOSE, res ? -res : EPIPE);
+			}
+		}
+		break;
+		default:
+		break;
+		}
+	}
+};
+
+}
+
+#endif//_H_XIOURING_H_
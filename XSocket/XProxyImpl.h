@@ -528,16 +528,358 @@ protected:
 	}
 };
 
+#ifndef WIN32
+/*!
+ *	@brief SplicePipe 定义.
+ *
+ *	splice转发用的非阻塞管道，关闭时空管道放回线程缓存，下个隧道直接复用
+ */
+class SplicePipe
+{
+	struct Pool
+	{
+		std::vector<std::pair<int,int>> pipes;
+		~Pool()
+		{
+			for (size_t i = 0; i < pipes.size(); i++)
+			{
+				::close(pipes[i].first);
+				::close(pipes[i].second);
+			}
+		}
+	};
+	static Pool& pool()
+	{
+		static thread_local Pool s_pool;
+		return s_pool;
+	}
+public:
+	int fd[2];
+	size_t len; //写进管道还没写出去的数据
+
+	SplicePipe():len(0)
+	{
+		fd[0] = fd[1] = -1;
+	}
+
+	~SplicePipe()
+	{
+		Close();
+	}
+
+	inline bool IsOpen() { return fd[0] >= 0; }
+
+	inline bool Open()
+	{
+		if (IsOpen()) {
+			return true;
+		}
+		Pool& p = pool();
+		if (!p.pipes.empty()) {
+			fd[0] = p.pipes.back().first;
+			fd[1] = p.pipes.back().second;
+			p.pipes.pop_back();
+		} else {
+			if (pipe2(fd, O_NONBLOCK | O_CLOEXEC) != 0) {
+				fd[0] = fd[1] = -1;
+				return false;
+			}
+			//失败就用系统默认大小
+			fcntl(fd[1], F_SETPIPE_SZ, DEFAULT_SPLICE_PIPE_SIZE);
+		}
+		len = 0;
+		return true;
+	}
+
+	inline void Close()
+	{
+		if (!IsOpen()) {
+			return;
+		}
+		Pool& p = pool();
+		if (!len && p.pipes.size() < DEFAULT_SPLICE_PIPE_POOL) {
+			p.pipes.push_back(std::make_pair(fd[0], fd[1]));
+		} else {
+			//管道里还有数据不能复用
+			::close(fd[0]);
+			::close(fd[1]);
+		}
+		fd[0] = fd[1] = -1;
+		len = 0;
+	}
+};
+#endif//
+
+/*!
+ *	@brief RelaySocketT 模板定义.
+ *
+ *	封装RelaySocketT，实现两个连接之间的隧道转发，两边都要StartRelay，而且要在同一个SocketSet（同一个服务线程）
+ *	转发时直接访问对端的发送缓存、管道和事件，对端用AddRelayPeer加到本连接所在的SocketSet，StartRelayPair在服务线程里两边一起开始
+ *	两边不在同一个SocketSet时StartRelay不开始转发，加入SocketSet前开始的转发在第一次转发数据时发现不在同一个SocketSet就关闭本连接
+ *	两边都是RelaySocketT<TBase>时用splice经过管道在内核里搬数据，不经过用户态接收/发送缓存
+ *	对端写不进去时暂停本连接接收，等对端可写（EPOLLOUT）再把管道里的数据写过去，管道大小就是这个方向的积压上限
+ *	TLS或者要检查数据时StartRelay(peer, false)走缓存拷贝，OnRecvBuf转给对端SendBuf，发送水位暂停/恢复对端接收
+ *	splice转发时不要再直接SendBuf给对端，自己的发送缓存有数据时管道里的数据会等它发完
+ */
+template<class TBase>
+class RelaySocketT : public TBase
+{
+	typedef RelaySocketT<TBase> This;
+	typedef TBase Base;
+	typedef typename Base::SocketSet SocketSet;
+protected:
+	std::function<void(const char*, int)> relay_send_; //缓存拷贝转发给对端
+	std::weak_ptr<This> relay_peer_; //对端也是RelaySocketT<TBase>时才有，splice转发用
+	std::weak_ptr<SocketEx> relay_sock_; //对端，转发前检查是不是还在本连接的SocketSet
+#ifndef WIN32
+	SplicePipe splice_pipe_; //本连接读到还没写给对端的数据
+	bool splice_wait_ = false; //对端管道里有数据等本连接可写
+#endif//
+public:
+	RelaySocketT()
+	{
+	}
+
+	inline int Close()
+	{
+		int ret = Base::Close();
+		relay_send_ = nullptr;
+		relay_peer_.reset();
+		relay_sock_.reset();
+#ifndef WIN32
+		splice_pipe_.Close();
+		splice_wait_ = false;
+#endif//
+		return ret;
+	}
+
+	//把对端加入本连接所在的SocketSet，转发的两边要在同一个服务线程，返回槽位，<0表示失败
+	//对端是要连接的目标时先Connect再AddRelayPeer，OnConnect里StartRelayPair
+	template<class TPeer>
+	inline int AddRelayPeer(const std::shared_ptr<TPeer>& peer, int evt = 0)
+	{
+		SocketSet* set = dynamic_cast<SocketSet*>(Base::Owner());
+		if (!set) {
+			return -1;
+		}
+		return set->AddSocket(peer, evt);
+	}
+
+	//开始转发本连接收到的数据给对端，bSplice为true时尝试splice，返回true表示用的splice，false表示缓存拷贝
+	//对端和本连接已经在不同的SocketSet时不开始转发，返回false，IsRelay()也是false
+	template<class TPeer>
+	inline bool StartRelay(const std::shared_ptr<TPeer>& peer, bool bSplice = true)
+	{
+		if (Base::Owner() && peer->Owner() && Base::Owner() != peer->Owner()) {
+			PRINTF("relay peer in other socket set");
+			return false;
+		}
+		std::weak_ptr<TPeer> weak_peer = peer;
+		relay_send_ = [weak_peer](const char* lpBuf, int nBufLen) {
+			std::shared_ptr<TPeer> peer = weak_peer.lock();
+			if (peer && peer->IsSocket()) {
+				peer->SendBuf(lpBuf, nBufLen);
+			}
+		};
+		relay_sock_ = peer;
+		if (!Base::m_nSendHighMark) {
+			Base::SetSendBufMark(DEFAULT_RELAY_SEND_MARK);
+		}
+		Base::SetRelayPeer(peer);
+		relay_peer_ = std::dynamic_pointer_cast<This>(peer);
+#ifndef WIN32
+		if (bSplice && !relay_peer_.expired() && splice_pipe_.Open()) {
+			return true;
+		}
+#endif//
+		return false;
+	}
+
+	//在服务线程里两边一起开始转发，对端要已经在本连接所在的SocketSet，如在对端的OnConnect里调用
+	template<class TPeer>
+	inline bool StartRelayPair(const std::shared_ptr<TPeer>& peer, bool bSplice = true)
+	{
+		SocketSet* set = dynamic_cast<SocketSet*>(Base::Owner());
+		if (!set || set != dynamic_cast<SocketSet*>(peer->Owner())) {
+			return false;
+		}
+		std::shared_ptr<typename SocketSet::Socket> self = set->FindSocket(Base::Handle());
+		if (!self) {
+			return false;
+		}
+		peer->StartRelay(self, bSplice);
+		StartRelay(peer, bSplice);
+		return IsRelay() && peer->IsRelay();
+	}
+
+	inline bool IsRelay() { return relay_send_ != nullptr; }
+
+	inline bool IsSplice()
+	{
+#ifndef WIN32
+		return splice_pipe_.IsOpen();
+#else
+		return false;
+#endif//
+	}
+
+protected:
+	//对端不在本连接的服务线程就不能访问它，只关闭本连接，对端由它自己的服务线程发现后关闭
+	inline bool IsRelayLocal()
+	{
+		std::shared_ptr<SocketEx> peer = relay_sock_.lock();
+		if (!peer || peer->Owner() == Base::Owner()) {
+			return true;
+		}
+		PRINTF("relay peer in other socket set");
+		Base::Trigger(FD_CLOSE, ECONNABORTED);
+		return false;
+	}
+
+	virtual void OnRecvBuf(const char* lpBuf, int nBufLen, int nFlags)
+	{
+		if (relay_send_) {
+			if (IsRelayLocal()) {
+				relay_send_(lpBuf, nBufLen);
+			}
+			return;
+		}
+		Base::OnRecvBuf(lpBuf, nBufLen, nFlags);
+	}
+
+#ifndef WIN32
+	//把管道里的数据写给对端，返回false表示对端写不进去，已经暂停接收等对端可写
+	bool SpliceFlush()
+	{
+		std::shared_ptr<This> peer = relay_peer_.lock();
+		if (!peer || !peer->IsSocket()) {
+			Base::Trigger(FD_CLOSE, 0);
+			return false;
+		}
+		if (!IsRelayLocal()) {
+			return false;
+		}
+		//对端自己的发送缓存先发完，保证顺序
+		while (splice_pipe_.len && !peer->NotSendBufSize())
+		{
+			ssize_t nLen = splice(splice_pipe_.fd[0], nullptr, (SOCKET)*peer, nullptr, splice_pipe_.len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (nLen > 0) {
+				splice_pipe_.len -= nLen;
+				continue;
+			}
+			int nErrorCode = XSocket::Socket::GetLastError();
+			if (nLen < 0 && nErrorCode == EINTR) {
+				continue;
+			}
+			if (nLen < 0 && (nErrorCode == EAGAIN || nErrorCode == EWOULDBLOCK)) {
+				break;
+			}
+			peer->Trigger(FD_CLOSE, nErrorCode);
+			return false;
+		}
+		if (!splice_pipe_.len) {
+			Base::ResumeRecv();
+			return true;
+		}
+		Base::PauseRecv();
+		peer->splice_wait_ = true;
+		if (!peer->IsSelect(FD_WRITE)) {
+			peer->Select(FD_WRITE);
+		}
+		return false;
+	}
+
+	//对端可写了，让它把管道里的数据写过来，返回false表示还是写不进来
+	inline bool OnSpliceWritable()
+	{
+		splice_wait_ = false;
+		std::shared_ptr<This> peer = relay_peer_.lock();
+		if (peer && peer->IsSocket() && peer->splice_pipe_.len) {
+			peer->SpliceFlush();
+		}
+		return !splice_wait_;
+	}
+
+	//socket -> 管道 -> 对端socket，管道空了才继续读，EAGAIN就只表示socket没数据
+	void OnSpliceReceive()
+	{
+		int nBudget = Base::RecvBudget();
+		while (Base::IsSocket() && !Base::IsRecvPaused())
+		{
+			if (splice_pipe_.len && !SpliceFlush()) {
+				return;
+			}
+			ssize_t nLen = splice((SOCKET)*this, nullptr, splice_pipe_.fd[1], nullptr, DEFAULT_SPLICE_PIPE_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (nLen < 0) {
+				if (XSocket::Socket::GetLastError() == EINTR) {
+					continue;
+				}
+				Base::OnReceive(XSocket::Socket::GetLastError());
+				return;
+			} else if (nLen == 0) {
+				Base::Trigger(FD_CLOSE, XSocket::Socket::GetLastError());
+				return;
+			}
+			splice_pipe_.len += nLen;
+			if (!SpliceFlush()) {
+				return;
+			}
+			if (nBudget) {
+				nBudget -= nLen;
+				if (nBudget <= 0) {
+					//接收预算用完，交给SocketSet下一轮继续
+					Base::Pending(FD_READ);
+					return;
+				}
+			}
+		}
+	}
+#endif//
+
+	virtual void OnReceive(int nErrorCode)
+	{
+#ifndef WIN32
+		//接收缓存里还有没处理完的数据时先走缓存，处理完再切到splice
+		if (!nErrorCode && splice_pipe_.IsOpen() && !Base::m_nRecvLen) {
+			OnSpliceReceive();
+			return;
+		}
+#endif//
+		Base::OnReceive(nErrorCode);
+	}
+
+	virtual void OnSend(int nErrorCode)
+	{
+#ifndef WIN32
+		if (!nErrorCode && splice_wait_ && !Base::NotSendBufSize()) {
+			//自己没有要发的数据，对端管道里的数据直接splice过来，还写不进来就保持FD_WRITE等下次可写
+			if (!OnSpliceWritable()) {
+				return;
+			}
+		}
+#endif//
+		Base::OnSend(nErrorCode);
+#ifndef WIN32
+		if (!nErrorCode && splice_wait_ && Base::IsSocket() && !Base::NotSendBufSize() && !Base::IsSelect(FD_WRITE)) {
+			//自己的数据刚发完，重新选择FD_WRITE轮到对端管道里的数据
+			Base::Select(FD_WRITE);
+		}
+#endif//
+	}
+};
+
 /*!
  *	@brief ProxydSocketT 模板定义.
  *
  *	封装ProxydSocketT，实现代理服务端逻辑
+ *	OnProxy里连目标并AddRelayPeer加到本连接所在的SocketSet，目标OnConnect后StartTunnel回复握手成功、两边互相StartRelay开始转发
+ *	两边都是RelaySocketT<TBase>时用splice零拷贝
  */
 template<class TBase>
-class ProxydSocketT : public TBase
+class ProxydSocketT : public RelaySocketT<TBase>
 {
 	typedef ProxydSocketT<TBase> This;
-	typedef TBase Base;
+	typedef RelaySocketT<TBase> Base;
 protected:
 	u_short m_ProxyType:3; //代理类型
 	u_short m_ProxyState:3; //代理状态
@@ -571,6 +913,18 @@ public:
 		return ret;
 	}
 
+	//连上目标后在服务线程里调用（如目标连接的OnConnect）：回复握手成功，两边互相StartRelay开始转发
+	//目标连接要用AddRelayPeer加到本连接所在的SocketSet，返回false表示没有开始转发
+	template<class TPeer>
+	inline bool StartTunnel(const std::shared_ptr<TPeer>& peer, bool bSplice = true)
+	{
+		OnProxyDone(0);
+		if (!IsProxyOK()) {
+			return false;
+		}
+		return Base::StartRelayPair(peer, bSplice);
+	}
+
 protected:
 	//
 	int ReceiveProxy(const char* lpBuf, int & nBufLen)
@@ -649,9 +1003,11 @@ protected:
 				{
 				case 0:
 					{
-						if(nBufLen < 3) {
+						if(nBufLen < 3 || nBufLen < 2 + (byte)lpBuf[1]) {
 							return SOCKET_PACKET_FLAG_PENDING;
 						}
+						//只吃掉握手包，后面跟着的数据留给下一个包
+						nBufLen = 2 + (byte)lpBuf[1];
 						if (IsProxyAuthRequired()) {
 							//需要使用用户名密码登录
 							m_ProxyState = 2;
@@ -690,6 +1046,7 @@ protected:
 							}
 							u_long ip = *(u_long*)&lpBuf[4];
 							u_short port = *(u_short*)&lpBuf[8];
+							nBufLen = 4 + 4 + 2;
 							OnProxy(ip,port);
 							return SOCKET_PACKET_FLAG_COMPLETE;
 						} else if(ATYP == 0X03) { //域名
@@ -698,8 +1055,9 @@ protected:
 								return SOCKET_PACKET_FLAG_PENDING;
 							}
 							char* addr = (char*)lpBuf + 4 + 1;
-							u_short port = *(u_short*)&lpBuf[4 + addr_len];
+							u_short port = *(u_short*)&lpBuf[4 + 1 + addr_len];
 							addr[addr_len] = 0;
+							nBufLen = 4 + 1 + addr_len + 2;
 							OnProxy(addr, port);
 							return SOCKET_PACKET_FLAG_COMPLETE;
 						} else if(ATYP == 0X03) { //IPV6
@@ -861,10 +1219,24 @@ protected:
 	virtual int ParseBuf(const char* lpBuf, int & nBufLen) 
 	{ 
 		if(!IsProxyOK()) {
-			return ReceiveProxy(lpBuf, nBufLen);
+			int ret = ReceiveProxy(lpBuf, nBufLen);
+			if(ret & SOCKET_PACKET_FLAG_COMPLETE) {
+				m_ProxyFlags |= (1<<2);
+			}
+			return ret;
 		}
 		return Base::ParseBuf(lpBuf, nBufLen);
 	}
+
+	//握手包ReceiveProxy已经处理了，不能当隧道数据转给对端
+	virtual void OnRecvBuf(const char* lpBuf, int nBufLen, int nFlags)
+	{
+		if(m_ProxyFlags & (1<<2)) {
+			m_ProxyFlags &= ~(1<<2);
+			return;
+		}
+		Base::OnRecvBuf(lpBuf, nBufLen, nFlags);
+	}
 };
 
 }
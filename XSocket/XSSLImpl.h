@@ -360,6 +360,13 @@ public:
         return ret;
 	}
 
+    //SSL_write重试必须用同一块缓存，这里只写第一个分片
+    int SendV(const SOCKBUF* lpBufs, int nBufCount, int nFlags = 0)
+    {
+        ASSERT(nBufCount > 0);
+        return Send(SOCKBUF_BUF(lpBufs[0]), (int)SOCKBUF_LEN(lpBufs[0]), nFlags);
+    }
+
 	int Receive(char* lpBuf, int nBufLen, int nFlags = 0)
     {
         int ret, ssl_err;
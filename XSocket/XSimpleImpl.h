@@ -111,6 +111,7 @@ public:
 	inline void SendBufDirect()
 	{
 		ASSERT(Base::IsSocket());
+		Base::CheckSendBufHigh();
 		if(!Base::IsSelect(FD_WRITE)) {
 			Base::Select(FD_WRITE);
 		}
@@ -156,27 +157,173 @@ protected:
 	}
 };
 
+/*!
+ *	@brief ZeroCopyLinger 定义.
+ *
+ *	连接关闭时内核可能还在发送MSG_ZEROCOPY分片（没确认的数据还要重传），关闭后收不到完成通知，
+ *	这些分片先停放DEFAULT_ZEROCOPY_LINGER毫秒再释放，不马上还给缓存池被复用改掉在途数据
+ *	到期的在下次停放时释放，还有停放的分片时在停放连接所属的服务上挂一个定时器回收，最后一次关闭停放的分片也会释放
+ */
+class ZeroCopyLinger
+{
+	struct Entry
+	{
+		std::chrono::steady_clock::time_point expire;
+		std::shared_ptr<const void> owner;
+	};
+	std::mutex mutex_;
+	std::deque<Entry> que_;
+	bool timer_ = false; //有回收定时器
+	std::chrono::steady_clock::time_point timer_expire_; //回收定时器应该到期的时间，过了很久还没到说明服务已经停了
+public:
+	static ZeroCopyLinger& Inst() {
+		//不析构，退出时停放的分片不再释放
+		static ZeroCopyLinger* _inst = new ZeroCopyLinger();
+		return *_inst;
+	}
+
+	//svr是停放连接所属的服务，用来挂回收定时器，可以为空
+	inline void Park(std::vector<std::shared_ptr<const void>>& owners, Service* svr = nullptr)
+	{
+		auto now = std::chrono::steady_clock::now();
+		std::vector<std::shared_ptr<const void>> expired; //在锁外释放
+		bool arm = false;
+		{
+		std::lock_guard<std::mutex> lock(mutex_);
+		Expire(now, expired);
+		for (auto& owner : owners)
+		{
+			que_.push_back({ now + std::chrono::milliseconds(DEFAULT_ZEROCOPY_LINGER), std::move(owner) });
+		}
+		arm = svr && !que_.empty() && (!timer_ || now > timer_expire_ + std::chrono::milliseconds(DEFAULT_ZEROCOPY_LINGER));
+		if (arm) {
+			timer_ = true;
+			timer_expire_ = que_.front().expire;
+		}
+		}
+		owners.clear();
+		if (arm) {
+			Arm(svr, now);
+		}
+	}
+
+	//回收到期的分片，还有停放的分片就再挂定时器
+	inline void Reclaim(Service* svr)
+	{
+		auto now = std::chrono::steady_clock::now();
+		std::vector<std::shared_ptr<const void>> expired;
+		bool arm = false;
+		{
+		std::lock_guard<std::mutex> lock(mutex_);
+		Expire(now, expired);
+		timer_ = !que_.empty();
+		if (timer_) {
+			timer_expire_ = que_.front().expire;
+			arm = true;
+		}
+		}
+		if (arm) {
+			Arm(svr, now);
+		}
+	}
+
+	inline size_t Count() { std::lock_guard<std::mutex> lock(mutex_); return que_.size(); }
+
+protected:
+	inline void Expire(std::chrono::steady_clock::time_point now, std::vector<std::shared_ptr<const void>>& expired)
+	{
+		while (!que_.empty() && que_.front().expire <= now)
+		{
+			expired.emplace_back(std::move(que_.front().owner));
+			que_.pop_front();
+		}
+	}
+
+	//在锁外挂定时器，定时器回调里会再加锁
+	inline void Arm(Service* svr, std::chrono::steady_clock::time_point now)
+	{
+		auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(timer_expire_ - now).count();
+		if (!svr->AddTimer(delay > 0 ? (size_t)delay + 1 : 1, [this, svr]() { Reclaim(svr); })) {
+			//服务不支持定时器，还是等下次停放
+			std::lock_guard<std::mutex> lock(mutex_);
+			timer_ = false;
+		}
+	}
+};
+
 /*!
  *	@brief SimpleSocketT 定义.
  *
  *	封装SimpleSocketT，实现简单的流式发送/接收（写入/读取）网络架构
+ *	接收缓存从SlabPool申请，大包扩容后处理完会退回预留大小；TSendBuffer用SlabString时发送缓存也走SlabPool
+ *	发送队列是引用计数的分片：小包拷贝进发送缓存，大包接管或共享不拷贝，一次SendV发送多个分片
+ *	EnableZeroCopy后大分片用MSG_ZEROCOPY发送，分片要等错误队列里的完成通知到了才释放
+ *	EnableRecvRing后用镜像环形缓存接收，解析后只移动读位置不memmove；扩容过的接收缓存空闲SetRecvShrinkIdle毫秒后缩回
+ *	SetSendBufMark设置发送水位，超过高水位OnSendBufHigh，降到低水位OnSendBufDrained；SetRelayPeer后自动暂停/恢复对端接收
+ *	其他线程用PostSendBuf发送，数据进无锁信箱，服务线程每轮取空信箱合并成一次SendV
  */
-template<class TBase>
+template<class TBase, class TSendBuffer = std::string>
 class SimpleSocketT : public TcpSocket<TBase>
 {
 	typedef TcpSocket<TBase> Base;
 public:
-	typedef std::string RecvBuffer;
-	typedef std::string SendBuffer;
+	typedef SlabBuffer RecvBuffer;
+	typedef TSendBuffer SendBuffer;
 protected:
 	RecvBuffer recv_buf_;
+	size_t recv_buf_size_ = 0; //预留的接收缓存大小
+	RingBuffer recv_ring_; //EnableRecvRing后代替recv_buf_
+	bool recv_ring_flag_ = false;
+	size_t recv_shrink_idle_ = 0; //扩容过的接收缓存空闲多少毫秒后缩回预留大小，0表示数据处理完马上缩
+	uint64_t recv_shrink_timer_ = 0;
+	Service* recv_shrink_svr_ = nullptr;
+	std::chrono::steady_clock::time_point recv_idle_time_; //接收缓存最后一次处理空的时间
 	SendBuffer send_buf_;
 	SendBuffer ppr_send_buf_;
+	size_t send_buf_size_ = 0; //预留的发送缓存大小
+	//发送分片，owner持有data指向的内存直到发送完，zc表示用MSG_ZEROCOPY发送过，要等序号zc_id完成才能释放
+	struct SendSlice
+	{
+		std::shared_ptr<const void> owner;
+		const char* data;
+		size_t size;
+		bool zc;
+		uint32_t zc_id;
+		SendSlice(std::shared_ptr<const void> _owner, const char* _data, size_t _size)
+			:owner(std::move(_owner)),data(_data),size(_size),zc(false),zc_id(0) {}
+	};
+	//待发送顺序：ppr_send_buf_、send_que_、send_buf_
+	std::vector<SendSlice> send_que_;
+	size_t send_que_size_ = 0; //send_que_字节数
+	size_t send_off_ = 0; //第一个待发送分片已发送的字节数
+	//其他线程PostSendBuf的数据，buf是拷贝或接管的数据，owner不为空时发送owner持有的data
+	struct SendInboxNode : public MPSCNode
+	{
+		SendBuffer buf;
+		std::shared_ptr<const void> owner;
+		const char* data = nullptr;
+		size_t size = 0;
+	};
+	MPSCQueue<SendInboxNode> send_inbox_;
+	std::atomic<XSocket::Service*> post_svr_; //所属SocketSet，其他线程投递时用，不能用线程相关的service()
+	//MSG_ZEROCOPY，序号和内核一样每次成功的发送加1
+	struct ZeroCopySlice
+	{
+		std::shared_ptr<const void> owner;
+		uint32_t id;
+	};
+	size_t zc_size_ = 0; //待发送分片不小于这个大小时用MSG_ZEROCOPY，0表示不启用
+	bool zc_sending_ = false; //本次SendV带了MSG_ZEROCOPY
+	uint32_t zc_next_ = 0; //下一个MSG_ZEROCOPY发送的序号
+	uint32_t zc_done_ = 0; //小于这个序号的发送都完成了
+	std::vector<std::pair<uint32_t,uint32_t>> zc_ranges_; //乱序到达的完成区间
+	std::vector<ZeroCopySlice> zc_que_; //已发送完但内核还在用的分片，按序号排列
+	size_t zc_copied_ = 0; //内核退化成拷贝的完成通知数
 	//std::mutex m_SendSection;
 	//std::mutex m_RecvSection;
 
 public:
-	SimpleSocketT()
+	SimpleSocketT():post_svr_(nullptr)
 	{
 		// recv_buf_.reserve(uMaxBufSize);
 		// recv_buf_.resize(uMaxBufSize);
@@ -186,37 +333,95 @@ public:
 
 	virtual ~SimpleSocketT()
 	{
-		
+		ParkZeroCopy();
+		KillShrinkTimer();
+		ClearSendInbox();
 	}
 
+	//第一次接收时才申请
 	inline void ReserveRecvBufSize(size_t size) {
-		recv_buf_.reserve(size);
-		recv_buf_.resize(size);
+		recv_buf_size_ = size;
+	}
+
+	//第一次接收前调用，用镜像环形缓存接收，系统不支持时还是用SlabBuffer
+	inline void EnableRecvRing(bool enable = true) {
+		recv_ring_flag_ = enable;
+	}
+
+	inline bool IsRecvRing() { return !recv_ring_.empty(); }
+
+	//扩容过的接收缓存空闲millis毫秒后缩回预留大小，0表示数据处理完马上缩
+	inline void SetRecvShrinkIdle(size_t millis) {
+		recv_shrink_idle_ = millis;
+	}
+
+	//用外部内存（比如SocketFactoryT给连接对象留的缓存）作为接收缓存，放得下时不向SlabPool申请
+	inline void EmbedRecvBuf(char* buf, size_t size) {
+		recv_buf_.Embed(buf, size);
 	}
 
+	//第一次发送时才申请
 	inline void ReserveSendBufSize(size_t size) {
-		send_buf_.reserve(size);
-		ppr_send_buf_.reserve(size);
+		send_buf_size_ = size;
 	}
 
 	inline int Close()
 	{
+		//先发掉推迟的发送，发出去的MSG_ZEROCOPY分片要一起停放
+		Base::FlushPendingSend();
+		ParkZeroCopy();
 		int ret = Base::Close();
 		//std::unique_lock<std::mutex> lock(m_SendSection);
 
 		ppr_send_buf_.clear();
 		send_buf_.clear();
+		send_que_.clear();
+		ClearSendInbox();
+		send_que_size_ = 0;
+		send_off_ = 0;
+		zc_que_.clear();
+		zc_ranges_.clear();
+		zc_size_ = 0;
+		zc_sending_ = false;
+		zc_next_ = 0;
+		zc_done_ = 0;
 		//lock.unlock();
+		//接收缓存还给SlabPool，下次接收时再申请
+		KillShrinkTimer();
+		recv_buf_.reset();
+		recv_ring_.Destroy();
 		return ret;
 	}
 
 	inline size_t NotSendBufSize() 
 	{
-		return send_buf_.size() + ppr_send_buf_.size();
+		return send_buf_.size() + ppr_send_buf_.size() + send_que_size_ - send_off_;
+	}
+
+	//大于等于size的分片用MSG_ZEROCOPY发送，需要EPoll且下层直接sendmsg（SSL/io_uring/IOCP不支持），Attach后调用
+	inline bool EnableZeroCopy(size_t size = DEFAULT_ZEROCOPY_SIZE)
+	{
+#ifdef WIN32
+		return false;
+#else
+		if (Base::SetSockOpt(SOL_SOCKET, SO_ZEROCOPY, 1) != 0) {
+			return false;
+		}
+		zc_size_ = std::max<size_t>(size, DEFAULT_SEND_COPY_SIZE);
+		Base::Select(FD_ERRQUEUE);
+		return true;
+#endif//
 	}
 
+	inline bool IsZeroCopy() { return zc_size_ != 0; }
+	//内核还没用完的MSG_ZEROCOPY分片数
+	inline size_t GetZeroCopyPending() { return zc_que_.size(); }
+	//内核退化成拷贝的完成通知数，比如回环或者网卡不支持SG，这时MSG_ZEROCOPY比直接拷贝还慢
+	inline size_t GetZeroCopyCopied() { return zc_copied_; }
+
 	inline SendBuffer& SendBuf() 
 	{
+		ReserveSendBuf();
 		return send_buf_;
 	}
 
@@ -224,6 +429,7 @@ public:
 	{
 		//std::lock_guard<std::mutex> lock(m_SendSection);
 		
+		ReserveSendBuf();
 		send_buf_ += Buf;
 
 		SendBufDirect();
@@ -233,14 +439,77 @@ public:
 	{
 		//std::lock_guard<std::mutex> lock(m_SendSection);
 
+		ReserveSendBuf();
 		send_buf_.append(lpBuf,lpBuf+nBufLen);
 
 		return SendBufDirect();
 	}
 
+	//接管Buf的内存，不拷贝
+	inline void SendBuf(SendBuffer&& Buf)
+	{
+		if ((int)Buf.size() < DEFAULT_SEND_COPY_SIZE) {
+			return SendBuf(Buf.data(), (int)Buf.size());
+		}
+		std::shared_ptr<SendBuffer> owner = std::make_shared<SendBuffer>(std::move(Buf));
+		const char* lpBuf = owner->data();
+		int nBufLen = (int)owner->size();
+		SendBuf(std::move(owner), lpBuf, nBufLen);
+	}
+
+	//共享Buf，发送完之前一直持有引用，同一个Buf可以发给多个连接
+	inline void SendBuf(const std::shared_ptr<const SendBuffer>& Buf)
+	{
+		ASSERT(Buf);
+		SendBuf(Buf, Buf->data(), (int)Buf->size());
+	}
+
+	//发送任意引用计数的内存，owner持有lpBuf直到发送完
+	inline void SendBuf(std::shared_ptr<const void> owner, const char* lpBuf, int nBufLen)
+	{
+		if (nBufLen < DEFAULT_SEND_COPY_SIZE) {
+			return SendBuf(lpBuf, nBufLen);
+		}
+		QueueSendBuf(std::move(owner), lpBuf, nBufLen);
+
+		return SendBufDirect();
+	}
+
+	//其他线程发送，先放进无锁发送信箱，服务线程在下次epoll_wait前统一取出一次SendV发送
+	//需要SocketSet支持PostSocket（目前是EPoll），调用者要持有Socket的shared_ptr直到返回
+	inline void PostSendBuf(const char* lpBuf, int nBufLen)
+	{
+		SendInboxNode* node = new SendInboxNode();
+		node->buf.append(lpBuf, lpBuf + nBufLen);
+		PostSendInbox(node);
+	}
+
+	inline void PostSendBuf(SendBuffer&& Buf)
+	{
+		SendInboxNode* node = new SendInboxNode();
+		node->buf = std::move(Buf);
+		PostSendInbox(node);
+	}
+
+	inline void PostSendBuf(std::shared_ptr<const void> owner, const char* lpBuf, int nBufLen)
+	{
+		SendInboxNode* node = new SendInboxNode();
+		node->owner = std::move(owner);
+		node->data = lpBuf;
+		node->size = nBufLen;
+		PostSendInbox(node);
+	}
+
+	inline void PostSendBuf(const std::shared_ptr<const SendBuffer>& Buf)
+	{
+		ASSERT(Buf);
+		PostSendBuf(Buf, Buf->data(), (int)Buf->size());
+	}
+
 	inline void SendBufDirect()
 	{
 		ASSERT(Base::IsSocket());
+		Base::CheckSendBufHigh();
 		if(!Base::IsSelect(FD_WRITE)) {
 			Base::Select(FD_WRITE);
 		}
@@ -308,12 +577,115 @@ public:
 // 	}
 
 protected:
+	inline void ReserveSendBuf()
+	{
+		if (send_buf_.capacity() < send_buf_size_) {
+			send_buf_.reserve(send_buf_size_);
+		}
+	}
+
+	//分片放进发送队列，send_buf_里已有的数据要排在前面
+	inline void QueueSendBuf(std::shared_ptr<const void> owner, const char* lpBuf, int nBufLen)
+	{
+		if (!send_buf_.empty()) {
+			if (ppr_send_buf_.empty() && send_que_.empty()) {
+				ppr_send_buf_.swap(send_buf_);
+				send_off_ = 0;
+			} else {
+				std::shared_ptr<SendBuffer> buf = std::make_shared<SendBuffer>(std::move(send_buf_));
+				send_que_.emplace_back(buf, buf->data(), buf->size());
+				send_que_size_ += buf->size();
+			}
+			send_buf_.clear();
+		}
+		send_que_.emplace_back(std::move(owner), lpBuf, (size_t)nBufLen);
+		send_que_size_ += nBufLen;
+	}
+
+	//信箱从空变成非空时才通知SocketSet，服务线程取空信箱前不会重复通知，SocketSet收到通知后Select(FD_WRITE)，在PrepareSendBufs里取信箱
+	inline void PostSendInbox(SendInboxNode* node)
+	{
+		if (send_inbox_.Push(node)) {
+			typedef typename Base::SocketSet SocketSet;
+			SocketSet* set = dynamic_cast<SocketSet*>(post_svr_.load());
+			if (set) {
+				set->PostSocket(this);
+			}
+		}
+	}
+
+	//服务线程取出信箱里所有数据放进发送队列，返回是否取到数据
+	inline bool DrainSendInbox()
+	{
+		send_inbox_.Reset();
+		bool ret = false;
+		while (SendInboxNode* node = send_inbox_.Pop())
+		{
+			if (node->owner) {
+				if (node->size < DEFAULT_SEND_COPY_SIZE) {
+					ReserveSendBuf();
+					send_buf_.append(node->data, node->data + node->size);
+				} else {
+					QueueSendBuf(std::move(node->owner), node->data, (int)node->size);
+				}
+			} else if (node->buf.size() < DEFAULT_SEND_COPY_SIZE) {
+				ReserveSendBuf();
+				send_buf_.append(node->buf.data(), node->buf.data() + node->buf.size());
+			} else {
+				std::shared_ptr<SendBuffer> buf = std::make_shared<SendBuffer>(std::move(node->buf));
+				QueueSendBuf(buf, buf->data(), (int)buf->size());
+			}
+			delete node;
+			ret = true;
+		}
+		if (ret) {
+			Base::CheckSendBufHigh();
+		}
+		return ret;
+	}
+
+	//关闭后对象可能被SocketFactoryT复用，要Reset让之后的投递重新通知
+	inline void ClearSendInbox()
+	{
+		send_inbox_.Reset();
+		while (SendInboxNode* node = send_inbox_.Pop())
+		{
+			delete node;
+		}
+	}
+
+	virtual void OnAttachService(XSocket::Service* pSvr)
+	{
+		Base::OnAttachService(pSvr);
+		post_svr_ = pSvr;
+	}
+
+	virtual void OnDetachService(XSocket::Service* pSvr)
+	{
+		post_svr_ = nullptr;
+		Base::OnDetachService(pSvr);
+	}
+
 	//TcpSocket 实现接口
 	virtual bool PrepareRecvBuf(char* & lpBuf, int & nBufLen)
 	{
 		//std::lock_guard<std::mutex> lock(m_RecvSection);
 
-		lpBuf = &recv_buf_[0];
+		size_t size = recv_buf_size_ ? recv_buf_size_ : DEFAULT_BUFSIZE;
+		if (recv_ring_flag_ && recv_ring_.empty() && !recv_ring_.Create(size)) {
+			//不支持镜像映射，退回SlabBuffer
+			recv_ring_flag_ = false;
+		}
+		if (!recv_ring_.empty()) {
+			lpBuf = recv_ring_.base();
+			nBufLen = (int)recv_ring_.capacity();
+			return true;
+		}
+		if (recv_buf_.size() < size) {
+			recv_buf_.resize(size);
+			recv_buf_.resize(recv_buf_.capacity());
+		}
+		lpBuf = recv_buf_.data();
 		nBufLen = recv_buf_.size();
 
 		return true;
@@ -322,12 +694,125 @@ protected:
 	{
 		//std::lock_guard<std::mutex> lock(m_RecvSection);
 
+		if (!recv_ring_.empty()) {
+			//环形缓存满了，换2倍大的，数据从读位置拷过去（镜像映射保证连续）
+			RingBuffer ring;
+			if (!ring.Create(recv_ring_.capacity() * 2)) {
+				return false;
+			}
+			memcpy(ring.base(), lpBuf, nBufLen);
+			recv_ring_.swap(ring);
+			lpBuf = recv_ring_.base();
+			nBufLen = (int)recv_ring_.capacity();
+			return true;
+		}
 		recv_buf_.resize(recv_buf_.size() * 2);
-		lpBuf = &recv_buf_[0];
+		lpBuf = recv_buf_.data();
 		nBufLen = recv_buf_.size();
 		return true;
 	}
 
+	virtual bool ConsumeRecvBuf(const char* lpBuf, int nBufLen)
+	{
+		if (recv_ring_.empty()) {
+			return Base::ConsumeRecvBuf(lpBuf, nBufLen);
+		}
+		//环形缓存只移动读位置，读位置超过一圈折回前半段
+		Base::m_pRecvBuf = nBufLen ? recv_ring_.wrap(lpBuf) : recv_ring_.base();
+		Base::m_nRecvLen = nBufLen;
+		return true;
+	}
+
+	using Base::OnReceive;
+	virtual void OnReceive(const char* lpBuf, int nBufLen, int nFlags) 
+	{
+		Base::OnReceive(lpBuf, nBufLen, nFlags);
+
+		//扩容过的接收缓存数据处理完了，退回预留大小
+		if (Base::m_pRecvBuf && !Base::m_nRecvLen && IsRecvBufExpanded()) {
+			if (!recv_shrink_idle_) {
+				ShrinkRecvBuf();
+			} else {
+				recv_idle_time_ = std::chrono::steady_clock::now();
+				if (!recv_shrink_timer_) {
+					SetShrinkTimer(recv_shrink_idle_);
+				}
+			}
+		}
+	}
+
+	inline bool IsRecvBufExpanded()
+	{
+		size_t size = recv_buf_size_ ? recv_buf_size_ : DEFAULT_BUFSIZE;
+		if (!recv_ring_.empty()) {
+			return recv_ring_.capacity() > std::max(size, RingBuffer::PageSize());
+		}
+		return recv_buf_.size() > std::max(size, SlabPool::Fit(size));
+	}
+
+	//接收缓存缩回预留大小，需要没有未处理的数据，大块还给SlabPool或者解除映射
+	inline void ShrinkRecvBuf()
+	{
+		ASSERT(!Base::m_nRecvLen);
+		size_t size = recv_buf_size_ ? recv_buf_size_ : DEFAULT_BUFSIZE;
+		if (!recv_ring_.empty()) {
+			RingBuffer ring;
+			if (!ring.Create(size)) {
+				return;
+			}
+			recv_ring_.swap(ring);
+			Base::m_pRecvBuf = recv_ring_.base();
+			Base::m_nRecvBufLen = (int)recv_ring_.capacity();
+			return;
+		}
+		recv_buf_.resize(0);
+		recv_buf_.shrink(size);
+		recv_buf_.resize(recv_buf_.capacity());
+		Base::m_pRecvBuf = recv_buf_.data();
+		Base::m_nRecvBufLen = recv_buf_.size();
+	}
+
+	//空闲缩容定时器，服务不支持定时器时马上缩
+	inline void SetShrinkTimer(size_t millis)
+	{
+		Service* svr = Service::service();
+		if (svr) {
+			recv_shrink_timer_ = svr->AddTimer(millis, [this]() {
+				recv_shrink_timer_ = 0;
+				recv_shrink_svr_ = nullptr;
+				OnShrinkTimer();
+			});
+		}
+		if (recv_shrink_timer_) {
+			recv_shrink_svr_ = svr;
+		} else {
+			ShrinkRecvBuf();
+		}
+	}
+
+	inline void KillShrinkTimer()
+	{
+		if (recv_shrink_timer_) {
+			recv_shrink_svr_->CancelTimer(recv_shrink_timer_);
+			recv_shrink_timer_ = 0;
+			recv_shrink_svr_ = nullptr;
+		}
+	}
+
+	inline void OnShrinkTimer()
+	{
+		if (!Base::IsSocket() || !Base::m_pRecvBuf || Base::m_nRecvLen || !IsRecvBufExpanded()) {
+			//又有数据在处理，等下次处理空了再计时
+			return;
+		}
+		size_t idle = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - recv_idle_time_).count();
+		if (idle >= recv_shrink_idle_) {
+			ShrinkRecvBuf();
+		} else {
+			SetShrinkTimer(recv_shrink_idle_ - idle);
+		}
+	}
+
 	// virtual void OnRecvBuf(const char* lpBuf, int nBufLen, int nFlags) 
 	// {
 	// 	Base::OnRecvBuf(lpBuf, nBufLen, nFlags);
@@ -337,26 +822,168 @@ protected:
 	// 	// recv_buf_.insert(recv_buf_.end(),lpBuf,lpBuf+nBufLen);
 	// }
 
-	virtual bool PrepareSendBuf(const char* & lpBuf, int & nBufLen)
+	virtual int PrepareSendBufs(SOCKBUF* lpBufs, int nBufCount, int & nFlags)
 	{
 		//std::unique_lock<std::mutex> lock(m_SendSection);
 
-		int nSendBufLen = send_buf_.size();
-		if (nSendBufLen>0) {
+		DrainSendInbox();
+		if (ppr_send_buf_.empty() && send_que_.empty()) {
+			if (send_buf_.empty()) {
+				return 0;
+			}
 			ppr_send_buf_.swap(send_buf_);
 			send_buf_.clear();
-			lpBuf = ppr_send_buf_.c_str();
-			nBufLen = ppr_send_buf_.size();
-			//lock.unlock();
-			return true;
+			send_off_ = 0;
 		}
+		int nCount = 0;
+		size_t off = send_off_;
+		if (!ppr_send_buf_.empty()) {
+			SOCKBUF_SET(lpBufs[nCount], ppr_send_buf_.data() + off, ppr_send_buf_.size() - off);
+			nCount++;
+			off = 0;
+		}
+		size_t size = 0;
+		for (size_t i = 0; i < send_que_.size() && nCount < nBufCount; i++) {
+			const SendSlice& slice = send_que_[i];
+			SOCKBUF_SET(lpBufs[nCount], slice.data + off, slice.size - off);
+			size += slice.size - off;
+			nCount++;
+			off = 0;
+		}
+		//ppr_send_buf_会被复用，只有全是分片时才能用MSG_ZEROCOPY
+		zc_sending_ = zc_size_ && ppr_send_buf_.empty() && size >= zc_size_;
+		if (zc_sending_) {
+			nFlags |= MSG_ZEROCOPY;
+		}
+		return nCount;
+	}
 
-		return false;
+	virtual void OnSendBufs(int nBufLen)
+	{
+		Base::OnSendBufs(nBufLen);
+
+		//OnSendBuf里可能关闭连接或者继续SendBuf，每次回调后都要重新检查
+		size_t len = nBufLen;
+		if (!ppr_send_buf_.empty()) {
+			size_t left = ppr_send_buf_.size() - send_off_;
+			if (len < left) {
+				send_off_ += len;
+				return;
+			}
+			len -= left;
+			send_off_ = 0;
+			this->OnSendBuf(ppr_send_buf_.data(), ppr_send_buf_.size());
+			ppr_send_buf_.clear();
+		}
+		bool zc = zc_sending_;
+		uint32_t zc_id = zc_next_;
+		if (zc) {
+			zc_sending_ = false;
+			zc_next_++;
+		}
+		size_t pos = 0;
+		for (; pos < send_que_.size(); pos++) {
+			SendSlice& head = send_que_[pos];
+			if (zc) {
+				head.zc = true;
+				head.zc_id = zc_id;
+			}
+			size_t left = head.size - send_off_;
+			if (len < left) {
+				send_off_ += len;
+				break;
+			}
+			len -= left;
+			send_off_ = 0;
+			SendSlice slice = std::move(head);
+			send_que_size_ -= slice.size;
+			//OnSendBuf里Close会停放zc_que_，MSG_ZEROCOPY分片要先放进去，不能跟着局部变量释放
+			if (slice.zc) {
+				zc_que_.push_back({ slice.owner, slice.zc_id });
+			}
+			this->OnSendBuf(slice.data, slice.size);
+			if (send_que_.empty()) {
+				return;
+			}
+		}
+		send_que_.erase(send_que_.begin(), send_que_.begin() + pos);
+	}
+
+	virtual void OnErrQueue(int nErrorCode)
+	{
+		Base::OnErrQueue(nErrorCode);
+		DrainZeroCopy();
 	}
 
 	virtual void OnSendBuf(const char* lpBuf, int nBufLen) 
 	{
 		Base::OnSendBuf(lpBuf, nBufLen);
+
+		//大包撑大的发送缓存发完就还回去，不让每个连接一直占着
+		size_t size = send_buf_size_ ? send_buf_size_ : DEFAULT_BUFSIZE;
+		if (ppr_send_buf_.capacity() > size * 2) {
+			SendBuffer().swap(ppr_send_buf_);
+		}
+	}
+
+protected:
+	//从错误队列取出所有已经到达的完成通知，释放内核用完的分片
+	inline void DrainZeroCopy()
+	{
+		uint32_t lo = 0, hi = 0;
+		bool copied = false;
+		while (Base::ZeroCopyDone(&lo, &hi, &copied) > 0)
+		{
+			if (copied) {
+				zc_copied_++;
+			}
+			if (lo == zc_done_) {
+				zc_done_ = hi + 1;
+			} else {
+				zc_ranges_.emplace_back(lo, hi);
+			}
+		}
+		//合并乱序到达的区间
+		for (size_t i = 0; i < zc_ranges_.size(); )
+		{
+			if (zc_ranges_[i].first == zc_done_) {
+				zc_done_ = zc_ranges_[i].second + 1;
+				zc_ranges_.erase(zc_ranges_.begin() + i);
+				i = 0;
+			} else {
+				i++;
+			}
+		}
+		size_t pos = 0;
+		while (pos < zc_que_.size() && (int32_t)(zc_que_[pos].id - zc_done_) < 0)
+		{
+			pos++;
+		}
+		zc_que_.erase(zc_que_.begin(), zc_que_.begin() + pos);
+	}
+
+	//关闭前先取完已经到达的完成通知，内核还没用完的分片（包括发了一部分的分片）停放到ZeroCopyLinger
+	inline void ParkZeroCopy()
+	{
+		if (!zc_size_ && zc_que_.empty()) {
+			return;
+		}
+		DrainZeroCopy();
+		std::vector<std::shared_ptr<const void>> owners;
+		for (auto& slice : zc_que_)
+		{
+			owners.emplace_back(std::move(slice.owner));
+		}
+		zc_que_.clear();
+		for (auto& slice : send_que_)
+		{
+			if (slice.zc && slice.owner) {
+				owners.emplace_back(std::move(slice.owner));
+			}
+		}
+		if (!owners.empty()) {
+			ZeroCopyLinger::Inst().Park(owners, Base::Owner());
+		}
 	}
 };
 
@@ -376,6 +1003,26 @@ public:
 		return Base::sock_->SendBuf();
 	}
 
+	inline void SetSendBufMark(size_t nHighMark, size_t nLowMark = (size_t)-1)
+	{
+		Base::sock_->SetSendBufMark(nHighMark, nLowMark);
+	}
+
+	inline bool IsSendBufHigh()
+	{
+		return Base::sock_->IsSendBufHigh();
+	}
+
+	inline void PauseRecv()
+	{
+		Base::sock_->PauseRecv();
+	}
+
+	inline void ResumeRecv()
+	{
+		Base::sock_->ResumeRecv();
+	}
+
 	inline int SendBuf(const std::string& Buf, int nFlags = 0)
 	{
 		return Base::sock_->SendBuf(Buf, nFlags);
@@ -539,7 +1186,7 @@ protected:
 	virtual bool PrepareSendBuf(Buffer& buf)
 	{
 		if (!sendbufs_.empty()) {
-			buf = sendbufs_.front();
+			buf = std::move(sendbufs_.front());
 			sendbufs_.pop();
 			return true;
 		}
@@ -24,6 +24,13 @@
 #include <ws2tcpip.h>
 #else
 #include <netdb.h>
+#include <linux/errqueue.h>
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif//
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif//
 #endif//
 #include <array>
 
@@ -405,6 +412,58 @@ int Socket::Send(SOCKET Sock, const char* lpBuf, int nBufLen, int nFlags)
 	return send(Sock, lpBuf, nBufLen, nFlags);
 }
 
+int Socket::SendV(SOCKET Sock, const SOCKBUF* lpBufs, int nBufCount, int nFlags)
+{
+#ifdef WIN32
+	DWORD dwSend = 0;
+	if (WSASend(Sock, (LPWSABUF)lpBufs, nBufCount, &dwSend, nFlags, NULL, NULL) == SOCKET_ERROR) {
+		return SOCKET_ERROR;
+	}
+	return (int)dwSend;
+#else
+	struct msghdr msg = {};
+	msg.msg_iov = (struct iovec*)lpBufs;
+	msg.msg_iovlen = nBufCount;
+	return sendmsg(Sock, &msg, nFlags);
+#endif//
+}
+
+int Socket::ZeroCopyDone(SOCKET Sock, uint32_t* lpLo, uint32_t* lpHi, bool* lpCopied)
+{
+#ifdef WIN32
+	return 0;
+#else
+	for (;;)
+	{
+		char control[128];
+		struct msghdr msg = {};
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(Sock, &msg, MSG_ERRQUEUE) < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			}
+			return SOCKET_ERROR;
+		}
+		for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+				|| (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))) {
+				continue;
+			}
+			struct sock_extended_err* serr = (struct sock_extended_err*)CMSG_DATA(cmsg);
+			if (serr->ee_errno == 0 && serr->ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+				*lpLo = serr->ee_info;
+				*lpHi = serr->ee_data;
+				*lpCopied = (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0;
+				return 1;
+			}
+		}
+		//不是MSG_ZEROCOPY的通知，跳过继续读
+	}
+#endif//
+}
+
 int Socket::Receive(SOCKET Sock, char* lpBuf, int nBufLen, int nFlags)
 {
 	return recv(Sock, lpBuf, nBufLen, nFlags);
@@ -96,6 +96,11 @@ public:
 	static int Listen(SOCKET Sock, int nConnectionBacklog);
 	static SOCKET Accept(SOCKET Sock, SOCKADDR* lpSockAddr, int* lpSockAddrLen);
 	static int Send(SOCKET Sock, const char* lpBuf, int nBufLen, int nFlags = MSG_NOSIGNAL);
+	//一次系统调用发送多个分片（sendmsg/WSASend），返回已发送字节数
+	static int SendV(SOCKET Sock, const SOCKBUF* lpBufs, int nBufCount, int nFlags = MSG_NOSIGNAL);
+	//从错误队列读取一个MSG_ZEROCOPY完成通知，序号[nLo,nHi]的发送内核已经用完，bCopied表示内核退化成了拷贝
+	//返回1读到通知，0没有通知，SOCKET_ERROR出错
+	static int ZeroCopyDone(SOCKET Sock, uint32_t* lpLo, uint32_t* lpHi, bool* lpCopied);
 	static int Receive(SOCKET Sock, char* lpBuf, int nBufLen, int nFlags = MSG_NOSIGNAL);
 	//int SyncSend(SOCKET Sock, const char* lpBuf, int nBufLen, int nFlags = MSG_NOSIGNAL);
 	//int SyncReceive(SOCKET Sock, char* lpBuf, int nBufLen, int nFlags = MSG_NOSIGNAL);
@@ -164,6 +169,8 @@ public:
 	inline int Listen(int nConnectionBacklog = 5) { return Listen(sock_, nConnectionBacklog); }
 	inline SOCKET Accept(SOCKADDR* lpSockAddr, int* lpSockAddrLen) { return Accept(sock_, lpSockAddr, lpSockAddrLen); }
 	inline int Send(const char* lpBuf, int nBufLen, int nFlags = MSG_NOSIGNAL) { return Send(sock_, lpBuf, nBufLen, nFlags); }
+	inline int SendV(const SOCKBUF* lpBufs, int nBufCount, int nFlags = MSG_NOSIGNAL) { return SendV(sock_, lpBufs, nBufCount, nFlags); }
+	inline int ZeroCopyDone(uint32_t* lpLo, uint32_t* lpHi, bool* lpCopied) { return ZeroCopyDone(sock_, lpLo, lpHi, lpCopied); }
 	inline int Receive(char* lpBuf, int nBufLen, int nFlags = MSG_NOSIGNAL) { return Receive(sock_, lpBuf, nBufLen, nFlags); }
 	//inline int SyncSend(const char* lpBuf, int nBufLen, int nFlags = MSG_NOSIGNAL) { return SyncSend(sock_, lpBuf, nBufLen, nFlags); }
 	//inline int SyncReceive(char* lpBuf, int nBufLen, int nFlags = MSG_NOSIGNAL) { return SyncReceive(sock_, lpBuf, nBufLen, nFlags); }
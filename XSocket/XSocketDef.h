@@ -52,8 +52,19 @@
 #define MSG_NOSIGNAL 0
 #endif//MSG_NOSIGNAL
 
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0
+#endif//MSG_ZEROCOPY
+
 typedef intptr_t ssize_t;
 
+typedef WSABUF SOCKBUF;
+typedef WSABUF *PSOCKBUF;
+typedef WSABUF FAR *LPSOCKBUF;
+#define SOCKBUF_SET(b,p,n) ((b).buf = (CHAR*)(p), (b).len = (ULONG)(n))
+#define SOCKBUF_BUF(b) ((const char*)(b).buf)
+#define SOCKBUF_LEN(b) ((size_t)(b).len)
+
 #else //LINUX
 
 #include <sys/types.h> 
@@ -69,6 +80,9 @@ typedef intptr_t ssize_t;
 
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <limits.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -76,6 +90,13 @@ typedef intptr_t ssize_t;
 #include <fcntl.h>
 #include <errno.h>
 
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif//SO_ZEROCOPY
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif//MSG_ZEROCOPY
+
 #ifndef stricmp
 #define stricmp strcasecmp 
 #endif//stricmp
@@ -144,6 +165,13 @@ typedef struct timeval TIMEVAL;
 typedef struct timeval *PTIMEVAL;
 typedef struct timeval FAR *LPTIMEVAL;
 
+typedef struct iovec SOCKBUF;
+typedef struct iovec *PSOCKBUF;
+typedef struct iovec FAR *LPSOCKBUF;
+#define SOCKBUF_SET(b,p,n) ((b).iov_base = (void*)(p), (b).iov_len = (size_t)(n))
+#define SOCKBUF_BUF(b) ((const char*)(b).iov_base)
+#define SOCKBUF_LEN(b) ((size_t)(b).iov_len)
+
 #ifndef SOCKET_ERROR
 #define SOCKET_ERROR  (-1)  
 #endif//SOCKET_ERROR
@@ -167,6 +195,9 @@ typedef struct timeval FAR *LPTIMEVAL;
 #endif//
 
 #define FD_IDLE			0x80
+#ifndef FD_ERRQUEUE
+#define FD_ERRQUEUE		0x40 //错误队列有数据，比如MSG_ZEROCOPY完成通知，目前只有EPoll支持
+#endif//
 
 #if __cpp_inline_variables >= 201606L
 #define INLINE_GLOBAL inline // C++17
@@ -454,6 +485,43 @@ typedef unsigned char byte;
 
 #define DEFAULT_BUFSIZE	8*1024
 
+//SendV单次最多提交的分片数，不超过IOV_MAX
+#ifndef DEFAULT_SEND_IOV_COUNT
+#if defined(IOV_MAX) && IOV_MAX < 64
+#define DEFAULT_SEND_IOV_COUNT IOV_MAX
+#else
+#define DEFAULT_SEND_IOV_COUNT 64
+#endif
+#endif//
+//EnableZeroCopy默认阈值，小于这个大小MSG_ZEROCOPY锁页和完成通知的开销比拷贝大
+#ifndef DEFAULT_ZEROCOPY_SIZE
+#define DEFAULT_ZEROCOPY_SIZE 64*1024
+#endif//
+//关闭时内核还没用完的MSG_ZEROCOPY分片保留多少毫秒再释放，关闭后收不到完成通知
+#ifndef DEFAULT_ZEROCOPY_LINGER
+#define DEFAULT_ZEROCOPY_LINGER 2000
+#endif//
+//小于这个大小的分片直接拷贝到发送缓存，比单独占一个分片划算
+#ifndef DEFAULT_SEND_COPY_SIZE
+#define DEFAULT_SEND_COPY_SIZE 1024
+#endif//
+//FramedSocketT默认最大帧长度，帧头里的长度超过这个值按协议错误断开连接
+#ifndef DEFAULT_MAX_FRAME_SIZE
+#define DEFAULT_MAX_FRAME_SIZE 64*1024*1024
+#endif//
+//RelaySocketT splice转发的管道大小，也是每个方向在内核里最多积压的数据
+#ifndef DEFAULT_SPLICE_PIPE_SIZE
+#define DEFAULT_SPLICE_PIPE_SIZE 256*1024
+#endif//
+//每个线程缓存的空闲管道数，短连接隧道不用每次pipe2/close
+#ifndef DEFAULT_SPLICE_PIPE_POOL
+#define DEFAULT_SPLICE_PIPE_POOL 64
+#endif//
+//RelaySocketT缓存拷贝转发时默认的发送高水位，超过后暂停对端接收
+#ifndef DEFAULT_RELAY_SEND_MARK
+#define DEFAULT_RELAY_SEND_MARK 1024*1024
+#endif//
+
 #define DEFAULT_MAX_SOCKET_COUNT 10*1024
 #define DEFAULT_MAX_SOCKSET_COUNT 10
 
@@ -76,6 +76,14 @@ SocketEx::SocketEx()
 ,flags_(SOCKET_FLAG_DEBUG)
 #endif
 ,event_(0)
+,pending_(0)
+,recv_budget_(0)
+,send_budget_(0)
+,handle_(0)
+,owner_(nullptr)
+,idle_timer_(0)
+,timer_svr_(nullptr)
+,idle_pending_(false)
 {
 #ifdef _DEBUG
 	PRINTF("new Socket %p", this);
@@ -85,6 +93,7 @@ SocketEx::SocketEx()
 SocketEx::~SocketEx()
 {
 	ASSERT(!IsSocket());
+	KillIdleTimer();
 #ifdef _DEBUG
 	PRINTF("delete Socket %p %u", this, sock_);
 	role_ = SOCKET_ROLE_NONE;
@@ -150,6 +159,7 @@ int SocketEx::Close()
 			PRINTF("Close Socket %p %u", this, (SOCKET)*this);
 		}
 		event_ = 0;
+		pending_ = 0;
 		return Base::Close(Detach());
 	}
 	return 0;
@@ -255,6 +265,41 @@ void SocketEx::OnDetachService(Service* pSvr)
 	if(IsDebug()) {
 		PRINTF("(%p %p %u)::OnDetachService", pSvr, this, (SOCKET)*this);
 	}
+	KillIdleTimer();
+}
+
+bool SocketEx::SetIdleTimer(size_t millis, Service* svr)
+{
+	KillIdleTimer();
+	if(!svr) {
+		svr = Service::service();
+	}
+	if(!svr) {
+		return false;
+	}
+	//回调只改idle_pending_，idle_timer_/timer_svr_只由设置/取消的线程改
+	//对象释放前KillIdleTimer会取消定时器或者等回调执行完，所以可以捕获this
+	idle_pending_ = true;
+	idle_timer_ = svr->AddTimer(millis, [this]() {
+		idle_pending_ = false;
+		Trigger(FD_IDLE, 0);
+	});
+	if(!idle_timer_) {
+		idle_pending_ = false;
+		return false;
+	}
+	timer_svr_ = svr;
+	return true;
+}
+
+void SocketEx::KillIdleTimer()
+{
+	if(timer_svr_) {
+		timer_svr_->CancelTimer(idle_timer_);
+		idle_timer_ = 0;
+		timer_svr_ = nullptr;
+	}
+	idle_pending_ = false;
 }
 
 inline bool IsNBErrorCode(int nErrorCode)
@@ -355,6 +400,13 @@ void SocketEx::OnOOB(const char* lpBuf, int nBufLen, int nFlags)
 	}
 }
 
+void SocketEx::OnErrQueue(int nErrorCode)
+{
+	if(IsDebug()) {
+		PRINTF("(%p %p %u)::OnErrQueue:%d", Service::service(), this, (SOCKET)*this, nErrorCode);
+	}
+}
+
 void SocketEx::OnAccept(int nErrorCode)
 {
 	if(!IsNBErrorCode(nErrorCode)) {
@@ -401,9 +453,60 @@ Service* Service::service()
 	return s_thread_service_;
 }
 
-Service::Service():stop_flag_(true),idle_flag_(true),notify_flag_(false),wait_timeout_(0)
+Service::Service():stop_flag_(true),notify_flag_(false),idle_flag_(true),wait_timeout_(0)
+,busy_poll_us_(0),stat_flag_(false),notify_time_(0)
+,wait_ns_(0),load_(0),busy_ns_(0),run_ns_(0)
 {
-	
+	ResetStat();
+}
+
+void Service::GetStat(ServiceStat& stat)
+{
+	stat.wakeups = stat_.wakeups.load(std::memory_order_relaxed);
+	stat.total_us = stat_.total_us.load(std::memory_order_relaxed);
+	stat.max_us = stat_.max_us.load(std::memory_order_relaxed);
+	for (int i = 0; i < ServiceStat::HIST_COUNT; i++)
+	{
+		stat.hist[i] = stat_.hist[i].load(std::memory_order_relaxed);
+	}
+	stat.spins = stat_.spins.load(std::memory_order_relaxed);
+	stat.blocks = stat_.blocks.load(std::memory_order_relaxed);
+	stat.busy_us = busy_ns_.load(std::memory_order_relaxed) / 1000;
+	stat.run_us = run_ns_.load(std::memory_order_relaxed) / 1000;
+	stat.load = load_.load(std::memory_order_relaxed);
+}
+
+void Service::ResetStat()
+{
+	stat_.wakeups = 0;
+	stat_.total_us = 0;
+	stat_.max_us = 0;
+	for (int i = 0; i < ServiceStat::HIST_COUNT; i++)
+	{
+		stat_.hist[i] = 0;
+	}
+	stat_.spins = 0;
+	stat_.blocks = 0;
+	busy_ns_ = 0;
+	run_ns_ = 0;
+}
+
+void Service::UpdateLoad(const std::chrono::steady_clock::time_point& now)
+{
+	if (!load_time_.time_since_epoch().count()) {
+		load_time_ = now;
+		wait_ns_ = 0;
+		return;
+	}
+	uint64_t span = std::chrono::duration_cast<std::chrono::nanoseconds>(now - load_time_).count();
+	uint64_t busy = span > wait_ns_ ? span - wait_ns_ : 0;
+	busy_ns_.fetch_add(busy, std::memory_order_relaxed);
+	run_ns_.fetch_add(span, std::memory_order_relaxed);
+	uint32_t load = span ? (uint32_t)(busy * 1000 / span) : 0;
+	//平滑一下，避免单个窗口的抖动影响负载均衡
+	load_.store((load_.load(std::memory_order_relaxed) + load) / 2, std::memory_order_relaxed);
+	load_time_ = now;
+	wait_ns_ = 0;
 }
 
 bool Service::OnInit()
@@ -28,10 +28,15 @@
 #include <condition_variable>
 #endif
 #include <thread>
+#include <deque>
 #include <future>
 #include <functional>
+#include <type_traits>
+#include <cstddef>
+#include <exception>
 #include <algorithm>
 #include <vector>
+#include <array>
 #include <queue>
 #include <map>
 #include <set>
@@ -40,9 +45,6 @@
 #include <chrono>
 #include <iomanip>
 #include <sstream>
-#if USE_BOOST
-#include <boost/lockfree/queue.hpp>
-#endif
 #include "XSocket.h"
 #include "XStr.h"
 
@@ -122,6 +124,29 @@ public:
 	inline int Flags() { return flags_; }
 	inline bool IsDebug() { return flags_ & SOCKET_FLAG_DEBUG; }
 
+	//所属SocketSet的槽位句柄（高32位代数|低32位槽位）和SocketSet本身，0表示不属于任何SocketSet
+	inline void SetHandle(uint64_t handle, Service* owner = nullptr) { handle_ = handle; owner_ = owner; }
+	inline uint64_t Handle() { return handle_; }
+	inline Service* Owner() { return owner_; }
+
+	//每次唤醒最多接收/发送的字节数，0表示不限制，预算用完还没读写完的Socket由SocketSet下一轮继续
+	inline void SetBudget(int nRecvBudget, int nSendBudget) { recv_budget_ = nRecvBudget; send_budget_ = nSendBudget; }
+	inline int RecvBudget() { return recv_budget_; }
+	inline int SendBudget() { return send_budget_; }
+	//标记预算用完还没处理完的事件，SocketSet取走后重新Trigger
+	inline void Pending(int lEvent) { pending_ |= lEvent; }
+	inline bool IsPending(int lEvent) { return pending_ & lEvent; }
+	inline int TakePending() { int lEvent = pending_; pending_ = 0; return lEvent; }
+	//合并发送推迟的数据在服务本轮没有别的事件要处理时提前发送，支持合并发送的Socket实现
+	inline void FlushCork() { }
+
+	//空闲定时器，millis毫秒后在服务线程触发FD_IDLE（OnIdle），重复设置会替换之前的定时器
+	//svr为空使用当前线程服务，服务不支持定时器返回false，这时只能Select(FD_IDLE)等待空闲扫描
+	//KillIdleTimer（析构时也会调用）在回调正在其他线程执行时会等它执行完
+	bool SetIdleTimer(size_t millis, Service* svr = nullptr);
+	void KillIdleTimer();
+	inline bool IsIdleTimer() { return idle_pending_; }
+
 	inline void AttachService(Service* svr) { OnAttachService(svr); }
 	inline void DetachService(Service* svr) { OnDetachService(svr); }
 	
@@ -154,6 +179,9 @@ public:
 		case FD_OOB:
 			OnOOB(nErrorCode);
 			break;
+		case FD_ERRQUEUE:
+			OnErrQueue(nErrorCode);
+			break;
 		case FD_ACCEPT:
 			OnAccept(nErrorCode);
 			break;
@@ -318,6 +346,14 @@ protected:
 	virtual void OnOOB(int nErrorCode);
 	virtual void OnOOB(const char* lpBuf, int nBufLen, int nFlags);
 
+	/*!
+	 *	@brief 通知套接字错误队列有数据，比如MSG_ZEROCOPY完成通知，需要Select(FD_ERRQUEUE).
+	 *
+	 *	
+	 *	Notifies a socket that there are messages to be read from its error queue (MSG_ERRQUEUE).
+	 */
+	virtual void OnErrQueue(int nErrorCode);
+
 	/*!
 	 *	@brief 通知正在监听的服务器套接字有一个连接需要调用Accept接收连接.
 	 *
@@ -374,6 +410,14 @@ protected:
 	uint8_t role_:3;
 	uint8_t flags_:5;
 	uint8_t event_;
+	uint8_t pending_;
+	int recv_budget_;
+	int send_budget_;
+	uint64_t handle_;
+	Service* owner_; //所属SocketSet
+	uint64_t idle_timer_; //空闲定时器ID，到期后也保留，KillIdleTimer用它等回调执行完
+	Service* timer_svr_; //空闲定时器所在服务
+	bool idle_pending_; //空闲定时器还没到期
 
 private:
 	SocketEx(const SocketEx& Sock) {};
@@ -425,19 +469,141 @@ protected:
 	}
 };
 
+#ifndef DEFAULT_POOL_MAGAZINE_SIZE
+#define DEFAULT_POOL_MAGAZINE_SIZE 32 //ObjectPoolT每个线程弹匣的对象数
+#endif//
+
+/*!
+ *	@brief PoolNode 模板定义.
+ *
+ *	对象池节点，引用计数和对象指针放在一起，PoolPtr直接持有节点
+ */
+template<class _Ty>
+struct PoolNode
+{
+	std::atomic<uint32_t> ref;
+	void* pool;
+	void (*recycle)(PoolNode*);
+	PoolNode* next;
+	_Ty* obj;
+	PoolNode():ref(0),pool(nullptr),recycle(nullptr),next(nullptr),obj(nullptr) {}
+};
+
+/*!
+ *	@brief PoolPtr 模板定义.
+ *
+ *	对象池对象的侵入式引用计数句柄，用法和shared_ptr一样，最后一个句柄释放时对象回到对象池
+ */
+template<class _Ty>
+class PoolPtr
+{
+	typedef PoolNode<_Ty> Node;
+	Node* node_ = nullptr;
+public:
+	PoolPtr() {}
+	PoolPtr(std::nullptr_t) {}
+	//接管节点上的一个引用
+	explicit PoolPtr(Node* node):node_(node) {}
+	PoolPtr(const PoolPtr& o):node_(o.node_)
+	{
+		if (node_) {
+			node_->ref.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	PoolPtr(PoolPtr&& o) noexcept:node_(o.node_) { o.node_ = nullptr; }
+	~PoolPtr() { reset(); }
+
+	PoolPtr& operator=(const PoolPtr& o)
+	{
+		if (node_ != o.node_) {
+			PoolPtr(o).swap(*this);
+		}
+		return *this;
+	}
+	PoolPtr& operator=(PoolPtr&& o) noexcept
+	{
+		if (this != &o) {
+			reset();
+			node_ = o.node_;
+			o.node_ = nullptr;
+		}
+		return *this;
+	}
+
+	inline void swap(PoolPtr& o) noexcept { std::swap(node_, o.node_); }
+	inline void reset()
+	{
+		if (node_) {
+			if (node_->ref.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				node_->recycle(node_);
+			}
+			node_ = nullptr;
+		}
+	}
+
+	inline _Ty* get() const { return node_ ? node_->obj : nullptr; }
+	inline _Ty& operator*() const { return *node_->obj; }
+	inline _Ty* operator->() const { return node_->obj; }
+	inline explicit operator bool() const { return node_ != nullptr; }
+	inline long use_count() const { return node_ ? node_->ref.load(std::memory_order_relaxed) : 0; }
+};
+
 /*!
  *	@brief ObjectPoolT 模板定义.
  *
  *	封装ObjectPoolT，对象池
+ *	每个线程有loaded/previous两个弹匣（每个DEFAULT_POOL_MAGAZINE_SIZE个对象），New/释放先在本线程弹匣里完成，不加锁；
+ *	弹匣空了/满了才加锁到全局仓库换一个满的/空的弹匣，一个线程分配、另一个线程释放也能整弹匣周转；
+ *	设置了max_count的池子需要在对象不够时等待，不使用弹匣，直接在仓库里分配释放
  */
 template<class T, class _Ty>
 class ObjectPoolT
 {
+public:
+	typedef PoolNode<_Ty> Node;
+	typedef PoolPtr<_Ty> Ptr;
+protected:
+	struct Magazine
+	{
+		size_t count = 0;
+		Node* nodes[DEFAULT_POOL_MAGAZINE_SIZE];
+		inline bool IsEmpty() { return count == 0; }
+		inline bool IsFull() { return count == DEFAULT_POOL_MAGAZINE_SIZE; }
+	};
+	//线程本地弹匣，绑定第一个使用它的池子，其他同类型池子在这个线程直接走仓库
+	struct Cache
+	{
+		ObjectPoolT* owner = nullptr;
+		Magazine* loaded = nullptr;
+		Magazine* previous = nullptr;
+		~Cache()
+		{
+			std::lock_guard<std::mutex> lock(Registry());
+			if (owner) {
+				owner->Unregister(this);
+			}
+		}
+	};
+	static inline std::mutex& Registry()
+	{
+		//不析构，线程退出时可能还要用
+		static std::mutex* s_mutex = new std::mutex();
+		return *s_mutex;
+	}
+	static inline Cache& Local()
+	{
+		static thread_local Cache s_cache;
+		return s_cache;
+	}
+	static void Recycle(Node* node)
+	{
+		((ObjectPoolT*)node->pool)->Delete(node);
+	}
 public:
 	ObjectPoolT():count_(0)
 	{
 	}
-	ObjectPoolT(size_t count, size_t max_count = 0)
+	ObjectPoolT(size_t count, size_t max_count = 0):count_(0)
 	{
 		Init(count, max_count);
 	}
@@ -448,114 +614,277 @@ public:
 
 	void Init(size_t count, size_t max_count = 0)
 	{
-		T* pT = static_cast<T*>(this);
-		count_ = count;
+		std::lock_guard<std::mutex> lock(mutex_);
 		max_count_ = max_count;
-		for(size_t i = 0; i < count_; i++)
+		for(size_t i = 0; i < count; i++)
 		{
-#if USE_BOOST
-			objptrs_.push(pT->Alloc());
-#else
-			objptrs_.emplace(pT->Alloc());
-#endif
+			Node* node = AllocNode();
+			node->next = free_;
+			free_ = node;
+			depot_count_++;
 		}
 	}
 
+	//等所有对象都还回来后释放，需要在其他线程不再使用时调用
 	void Release()
 	{
 		T* pT = static_cast<T*>(this);
-#if USE_BOOST
-		while(count_ != objptrs_.size())) {
-			std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
-		}
-		auto objptr = nullptr;
-		while(!objptrs_.pop(objptr)) {
-			pT->Free(objptr);
-		}
-#else
+		std::unique_lock<std::mutex> registry(Registry());
 		std::unique_lock<std::mutex> lock(mutex_);
-		while(count_ != objptrs_.size()) {
+		closing_ = true;
+		for (Cache* cache : caches_)
+		{
+			FlushCache(cache);
+			cache->owner = nullptr;
+		}
+		caches_.clear();
+		registry.unlock();
+		while (depot_count_ != count_)
+		{
+			waiters_++;
 			cv_.wait(lock);
+			waiters_--;
+		}
+		for (Magazine* mag : full_)
+		{
+			for (size_t i = 0; i < mag->count; i++)
+			{
+				FreeNode(pT, mag->nodes[i]);
+			}
+			delete mag;
+		}
+		full_.clear();
+		for (Magazine* mag : empty_)
+		{
+			delete mag;
 		}
-		while(!objptrs_.empty()) {
-			auto objptr = objptrs_.front();
-			pT->Free(objptr);
-			objptrs_.pop();
+		empty_.clear();
+		while (free_)
+		{
+			Node* node = free_;
+			free_ = node->next;
+			FreeNode(pT, node);
 		}
-#endif
+		depot_count_ = 0;
+		count_ = 0;
+		closing_ = false;
 	}
 
-	/*template<typename _Rep, typename _Period>
-	std::shared_ptr<_Ty> New(const std::chrono::duration<_Rep, _Period>& timeout)
+	Ptr New()
 	{
-		std::unique_lock<std::mutex> lock(mutex_);
-		if(!cv_.wait_for(lock,timeout,[this] { return !objptrs_.empty(); })) {
-			return nullptr;
+		Node* node = nullptr;
+		Cache* cache = Bind();
+		if (cache) {
+			Magazine*& loaded = cache->loaded;
+			if (loaded->IsEmpty()) {
+				if (!cache->previous->IsEmpty()) {
+					std::swap(loaded, cache->previous);
+				} else {
+					//两个弹匣都空了，用空弹匣到仓库换一个满的
+					std::lock_guard<std::mutex> lock(mutex_);
+					Magazine* full = TakeFull();
+					if (full) {
+						empty_.push_back(loaded);
+						loaded = full;
+					}
+				}
+			}
+			if (!loaded->IsEmpty()) {
+				node = loaded->nodes[--loaded->count];
+			}
+		}
+		if (!node) {
+			node = NewNode();
+		}
+		node->ref.store(1, std::memory_order_relaxed);
+		return Ptr(node);
+	}
+
+protected:
+	inline _Ty* Alloc() { return new _Ty(); }
+	inline void Free(_Ty* ptr) { return delete ptr; }
+	//对象回到池子前调用，可以在这里清理/收缩对象
+	inline void Reuse(_Ty*) { }
+
+	void Delete(Node* node)
+	{
+		static_cast<T*>(this)->Reuse(node->obj);
+		Cache* cache = Bind();
+		if (cache) {
+			Magazine*& loaded = cache->loaded;
+			if (loaded->IsFull()) {
+				if (cache->previous->IsEmpty()) {
+					std::swap(loaded, cache->previous);
+				} else {
+					//两个弹匣都满了，把满的交给仓库，换一个空的
+					std::lock_guard<std::mutex> lock(mutex_);
+					full_.push_back(cache->previous);
+					depot_count_ += cache->previous->count;
+					cache->previous = loaded;
+					loaded = TakeEmpty();
+				}
+			}
+			loaded->nodes[loaded->count++] = node;
+			return;
 		}
-		auto objptr = std::shared_ptr<_Ty>(objptrs_.front(),[this](_Ty* objptr){ 
-			std::lock_guard<std::mutex> lock(mutex_);
-			objptrs_.emplace(objptr);
+		std::lock_guard<std::mutex> lock(mutex_);
+		node->next = free_;
+		free_ = node;
+		depot_count_++;
+		if (waiters_) {
 			cv_.notify_one();
-		});
-		objptrs_.pop();
-		return objptr;
-	}*/
+		}
+	}
 
-	std::shared_ptr<_Ty> New()
+	//取本线程弹匣，限制了对象数或者正在释放时返回空
+	inline Cache* Bind()
 	{
-		T* pT = static_cast<T*>(this);
-		_Ty* objptr = nullptr;
-#if USE_BOOST
-		if(!objptrs_.pop(objptr)) {
-			if(max_count_ && count_ > max_count_) {
-				do {
-					std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
-				} while(!objptrs_.pop(objptr));
+		if (max_count_) {
+			return nullptr;
+		}
+		Cache& cache = Local();
+		if (cache.owner == this) {
+			return &cache;
+		}
+		if (cache.owner) {
+			return nullptr;
+		}
+		std::lock_guard<std::mutex> registry(Registry());
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (closing_) {
+			return nullptr;
+		}
+		cache.loaded = TakeEmpty();
+		cache.previous = TakeEmpty();
+		cache.owner = this;
+		caches_.push_back(&cache);
+		return &cache;
+	}
+
+	//线程退出，弹匣还给仓库，需要在Registry()保护下调用
+	void Unregister(Cache* cache)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		FlushCache(cache);
+		cache->owner = nullptr;
+		caches_.erase(std::find(caches_.begin(), caches_.end(), cache));
+	}
+
+	//需要在mutex_保护下调用
+	inline void FlushCache(Cache* cache)
+	{
+		Magazine* mags[2] = { cache->loaded, cache->previous };
+		for (Magazine* mag : mags)
+		{
+			if (!mag) {
+				continue;
+			}
+			if (mag->IsEmpty()) {
+				empty_.push_back(mag);
 			} else {
-				objptr = pT->Alloc();
-				count_++;
+				full_.push_back(mag);
+				depot_count_ += mag->count;
 			}
-		} 
-		auto sp_objptr = std::shared_ptr<_Ty>(objptr,[this](_Ty* objptr) { 
-			objptrs_.push(objptr);
-		});
-		return sp_objptr;
-#else
+		}
+		cache->loaded = cache->previous = nullptr;
+		if (waiters_) {
+			cv_.notify_all();
+		}
+	}
+
+	//仓库取一个有对象的弹匣，没有整弹匣时用散的对象装一个，需要在mutex_保护下调用
+	inline Magazine* TakeFull()
+	{
+		Magazine* mag = nullptr;
+		if (!full_.empty()) {
+			mag = full_.back();
+			full_.pop_back();
+		} else if (free_) {
+			mag = TakeEmpty();
+			while (free_ && !mag->IsFull())
+			{
+				mag->nodes[mag->count++] = free_;
+				free_ = free_->next;
+			}
+		}
+		if (mag) {
+			depot_count_ -= mag->count;
+		}
+		return mag;
+	}
+
+	//需要在mutex_保护下调用
+	inline Magazine* TakeEmpty()
+	{
+		if (empty_.empty()) {
+			return new Magazine();
+		}
+		Magazine* mag = empty_.back();
+		empty_.pop_back();
+		return mag;
+	}
+
+	//弹匣没有对象时从仓库取一个，仓库也没有就分配新的，限制了对象数时等待其他线程释放
+	Node* NewNode()
+	{
 		std::unique_lock<std::mutex> lock(mutex_);
-		if(objptrs_.empty()) {
-			if(max_count_ && count_ > max_count_) {
-				cv_.wait(lock);
-				objptr = objptrs_.front();
-				objptrs_.pop();
-			} else {
-				objptr = pT->Alloc();
-				count_++;
+		for (;;)
+		{
+			if (free_) {
+				Node* node = free_;
+				free_ = node->next;
+				depot_count_--;
+				return node;
 			}
-		} else {
-			objptr = objptrs_.front();
-			objptrs_.pop();
+			if (!full_.empty()) {
+				Magazine* mag = full_.back();
+				Node* node = mag->nodes[--mag->count];
+				if (mag->IsEmpty()) {
+					full_.pop_back();
+					empty_.push_back(mag);
+				}
+				depot_count_--;
+				return node;
+			}
+			if (!max_count_ || count_ < max_count_) {
+				return AllocNode();
+			}
+			waiters_++;
+			cv_.wait(lock);
+			waiters_--;
 		}
-		auto sp_objptr = std::shared_ptr<_Ty>(objptr,[this](_Ty* objptr) { 
-			std::lock_guard<std::mutex> lock(mutex_);
-			objptrs_.emplace(objptr);
-			cv_.notify_one();
-		});
-		return sp_objptr;
-#endif
 	}
-protected:
-	inline _Ty* Alloc() { return new _Ty(); }
-	inline void Free(_Ty* ptr) { return delete ptr; }
+
+	//需要在mutex_保护下调用
+	inline Node* AllocNode()
+	{
+		T* pT = static_cast<T*>(this);
+		Node* node = new Node();
+		node->obj = pT->Alloc();
+		node->pool = this;
+		node->recycle = &Recycle;
+		count_++;
+		return node;
+	}
+
+	static inline void FreeNode(T* pT, Node* node)
+	{
+		pT->Free(node->obj);
+		delete node;
+	}
+
 private:
 	size_t max_count_ = 0; //0表示不限制
-	std::atomic<size_t> count_;
-#if USE_BOOST
-	boost::lockfree::queue<_Ty > objptrs_;
-#else
-	std::queue<_Ty*> objptrs_;
+	size_t count_; //分配的对象总数
+	size_t depot_count_ = 0; //仓库里的对象数
+	Node* free_ = nullptr; //仓库里散的对象
+	std::vector<Magazine*> full_; //仓库里有对象的弹匣
+	std::vector<Magazine*> empty_; //仓库里的空弹匣
+	std::vector<Cache*> caches_; //绑定了本池子的线程弹匣
+	bool closing_ = false;
+	size_t waiters_ = 0;
 	std::mutex mutex_;
 	std::condition_variable cv_;
-#endif
 };
 class BufferPool : public ObjectPoolT<BufferPool,std::string>
 {
@@ -571,6 +900,14 @@ public:
 		ptr->reserve(DEFAULT_BUFSIZE);
 		return ptr;
 	}
+	//大包撑大的字符串不再留在池子里，还回来时收缩到DEFAULT_BUFSIZE
+	inline void Reuse(std::string* ptr) {
+		ptr->clear();
+		if (ptr->capacity() > DEFAULT_BUFSIZE) {
+			std::string().swap(*ptr);
+			ptr->reserve(DEFAULT_BUFSIZE);
+		}
+	}
 };
 typedef std::array<char,2048> UdpBuffer;
 class  UdpBufferPool : public ObjectPoolT<UdpBufferPool,UdpBuffer>
@@ -582,86 +919,889 @@ public:
 	}
 };
 
+#ifndef DEFAULT_SLAB_MIN_SHIFT
+#define DEFAULT_SLAB_MIN_SHIFT 8 //SlabPool最小规格2^8=256B
+#endif//
+#ifndef DEFAULT_SLAB_MAX_SHIFT
+#define DEFAULT_SLAB_MAX_SHIFT 20 //SlabPool最大规格2^20=1MB，更大的直接向系统申请
+#endif//
+#ifndef DEFAULT_SLAB_ARENA_SIZE
+#define DEFAULT_SLAB_ARENA_SIZE (1024*1024) //SlabPool每次向系统申请的arena大小
+#endif//
+#ifndef DEFAULT_SLAB_TRIM_WINDOW
+#define DEFAULT_SLAB_TRIM_WINDOW 10000 //SlabPool高水位统计窗口（毫秒）
+#endif//
+
+/*!
+ *	@brief SlabStat 定义.
+ *
+ *	SlabPool每个规格的统计
+ */
+struct SlabStat
+{
+	size_t size = 0; //块大小，0表示超过最大规格直接向系统申请的块
+	size_t allocs = 0; //累计分配次数
+	size_t frees = 0; //累计释放次数
+	size_t used = 0; //正在使用的块数
+	size_t high = 0; //当前统计窗口的高水位
+	size_t peak = 0; //历史最高使用块数
+	size_t blocks = 0; //arena里的总块数
+	size_t arenas = 0; //arena个数
+	size_t bytes = 0; //向系统申请的字节数
+	size_t trims = 0; //累计还给系统的arena个数
+};
+
 /*!
- *	@brief IDGenerator 定义.
+ *	@brief SlabPool 定义.
  *
- *	封装IDGenerator，实现基本服务框架
+ *	封装SlabPool，按2的幂分规格（256B...1MB）的缓存池
+ *	每个规格从大块arena里切块，块头记着所属arena，释放时还回arena；
+ *	arena整个空了并且总块数超过统计窗口内的高水位时还给系统，Trim可以在定时器里调用，把空闲arena收缩到上个窗口的高水位；
+ *	超过最大规格的直接向系统申请；块带引用计数，可以在多个句柄间共享
  */
-template<typename _Ty>
-class IDGenerator 
+class SlabPool
 {
 public:
-	static IDGenerator<_Ty>& Inst() {
-		static IDGenerator<_Ty> _inst;
-		return _inst;
+	enum
+	{
+		MIN_SHIFT = DEFAULT_SLAB_MIN_SHIFT,
+		MAX_SHIFT = DEFAULT_SLAB_MAX_SHIFT,
+		CLASS_COUNT = MAX_SHIFT - MIN_SHIFT + 1,
+		PAGE_SIZE = 4096,
+	};
+protected:
+	struct Class;
+	struct Block;
+	struct Arena
+	{
+		Class* owner = nullptr;
+		char* mem = nullptr;
+		size_t total = 0; //总块数
+		size_t carved = 0; //已经切出去过的块数
+		size_t used = 0; //正在使用的块数
+		Block* free = nullptr; //还回来的块
+		Arena* prev = nullptr; //所有arena链表
+		Arena* next = nullptr;
+		Arena* avail_prev = nullptr; //有空闲块的arena链表
+		Arena* avail_next = nullptr;
+		bool avail = false;
+	};
+	struct alignas(16) Block
+	{
+		void* owner; //pages为0时是所属Arena，否则是超大块的Class
+		std::atomic<uint32_t> ref;
+		uint32_t pages; //直接向系统申请的块的页数
+	};
+	struct Class
+	{
+		std::mutex mutex;
+		size_t stride = 0; //块头+块大小
+		Arena* arenas = nullptr;
+		Arena* avail = nullptr;
+		SlabStat stat;
+		std::chrono::steady_clock::time_point window; //当前统计窗口开始时间
+	};
+	//空闲块的next放在数据区
+	static inline Block*& NextOf(Block* block) { return *(Block**)(block + 1); }
+public:
+	static SlabPool& Inst() {
+		//不析构，静态对象析构时可能还持有缓存
+		static SlabPool* _inst = new SlabPool();
+		return *_inst;
 	}
-	IDGenerator():id_(0) {}
-	_Ty get() {
-		return ++id_;
+
+	SlabPool()
+	{
+		static_assert(sizeof(Block) % alignof(std::max_align_t) == 0, "Block header breaks alignment");
+		auto now = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < CLASS_COUNT; i++)
+		{
+			classes_[i].stat.size = (size_t)1 << (MIN_SHIFT + i);
+			classes_[i].stride = sizeof(Block) + classes_[i].stat.size;
+			classes_[i].window = now;
+		}
 	}
-private:
-	std::atomic<_Ty> id_;
-};
-// template<typename _Ty>
-// INLINE_GLOBAL IDGenerator<_Ty>::id_;
 
-// /*!
-//  *	@brief IDManager 定义.
-//  *
-//  *	封装IDManager，实现ID管理，判断ID是否存在
-//  */
-// template<typename _Kty, typename _Ty>
-// class IDManager
-// {
-// public:
-// 	static IDManager<_Kty, _Ty>& Inst() {
-// 		static IDManager<_Kty, _Ty> _inst;
-// 		return _inst;
-// 	}
+	//需要在所有块都还回来后调用
+	~SlabPool()
+	{
+		for (size_t i = 0; i < CLASS_COUNT; i++)
+		{
+			Class& c = classes_[i];
+			while (c.arenas)
+			{
+				Arena* arena = c.arenas;
+				c.arenas = arena->next;
+				::operator delete(arena->mem);
+				delete arena;
+			}
+		}
+	}
 
-// 	inline void Add(const _Kty& id, const _Ty& val) {
-// 		//std::lock_guard<std::mutex> lock(mutex_);
-// 		std::unique_lock<std::shared_mutex> lock(mutex_);
-// 		map_id2vs_.emplace(id,val);
-// 	}
-// 	inline bool AddBidi(const _Kty& id, const _Ty& val) {
-// 		//std::lock_guard<std::mutex> lock(mutex_);
-// 		std::unique_lock<std::shared_mutex> lock(mutex_);
-// 		map_id2vs_.emplace(id,val);
-// 		map_v2id_.emplace(val,id);
-// 		return true;
-// 	}
-// 	inline void Remove(const _Kty& id) {
-// 		//std::lock_guard<std::mutex> lock(mutex_);
-// 		std::unique_lock<std::shared_mutex> lock(mutex_);
-// 		map_id2vs_.erase(id);
-// 	}
-// 	inline void RemoveBidi(const _Kty& id) {
-// 		//std::lock_guard<std::mutex> lock(mutex_);
-// 		std::unique_lock<std::shared_mutex> lock(mutex_);
-// 		auto pr = map_id2vs_.equal_range(id);
-// 		if(pr.first != map_id2vs_.end()) {
-// 			for(auto it = pr.first; it != pr.second; ++it)
-// 			{
-// 				map_v2id_.erase(it->second);
-// 			}
-// 			map_id2vs_.erase(pr.first,pr.second);
-// 		}
-// 	}
-// 	inline void RemoveByVal(const _Ty& val) {
-// 		//std::lock_guard<std::mutex> lock(mutex_);
-// 		std::unique_lock<std::shared_mutex> lock(mutex_);
-// 		auto it = map_v2id_.find(val);
-// 		if(it != map_v2id_.end()) {
-// 			auto itt = map_id2vs_.find(it->second);
-// 			while(itt != map_id2vs_.end()) {
-// 				if(itt->second == val) {
-// 					map_id2vs_.erase(itt);
-// 					break;
-// 				}
-// 				++itt;
-// 			}
-// 			map_v2id_.erase(it);
+	//size所在规格，超过最大规格返回CLASS_COUNT
+	static inline size_t ClassOf(size_t size)
+	{
+		size_t cls = 0;
+		size_t cap = (size_t)1 << MIN_SHIFT;
+		while (cap < size && cls < CLASS_COUNT)
+		{
+			cap <<= 1;
+			cls++;
+		}
+		return cls;
+	}
+
+	//申请size大小时实际能得到的容量
+	static inline size_t Fit(size_t size)
+	{
+		size_t cls = ClassOf(size);
+		if (cls < CLASS_COUNT) {
+			return (size_t)1 << (MIN_SHIFT + cls);
+		}
+		return (size + sizeof(Block) + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE - sizeof(Block);
+	}
+
+	//块容量
+	static inline size_t Capacity(const char* ptr)
+	{
+		const Block* block = (const Block*)ptr - 1;
+		if (block->pages) {
+			return (size_t)block->pages * PAGE_SIZE - sizeof(Block);
+		}
+		return ((Arena*)block->owner)->owner->stat.size;
+	}
+
+	static inline void AddRef(char* ptr)
+	{
+		((Block*)ptr - 1)->ref.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	//释放一个引用，最后一个引用释放时块还回arena
+	static inline void Free(char* ptr)
+	{
+		Block* block = (Block*)ptr - 1;
+		if (block->ref.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+			return;
+		}
+		if (block->pages) {
+			FreeHuge(block);
+		} else {
+			FreeBlock(block);
+		}
+	}
+
+	//申请至少size大小的块，引用计数为1
+	char* Alloc(size_t size)
+	{
+		size_t cls = ClassOf(size);
+		Block* block = cls < CLASS_COUNT ? AllocBlock(classes_[cls]) : AllocHuge(size);
+		block->ref.store(1, std::memory_order_relaxed);
+		return (char*)(block + 1);
+	}
+
+	//把空闲arena收缩到当前窗口的高水位，并开始新的统计窗口
+	void Trim()
+	{
+		auto now = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < CLASS_COUNT; i++)
+		{
+			Class& c = classes_[i];
+			std::lock_guard<std::mutex> lock(c.mutex);
+			TrimClass(c);
+			c.stat.high = c.stat.used;
+			c.window = now;
+		}
+	}
+
+	inline void SetTrimWindow(size_t millis) { trim_window_ = millis; }
+	inline size_t GetTrimWindow() { return trim_window_; }
+
+	//cls为CLASS_COUNT时返回超大块的统计
+	SlabStat GetStat(size_t cls)
+	{
+		Class& c = cls < CLASS_COUNT ? classes_[cls] : huge_;
+		std::lock_guard<std::mutex> lock(c.mutex);
+		return c.stat;
+	}
+
+	void GetStats(std::vector<SlabStat>& stats)
+	{
+		stats.resize(CLASS_COUNT + 1);
+		for (size_t i = 0; i <= CLASS_COUNT; i++)
+		{
+			stats[i] = GetStat(i);
+		}
+	}
+
+protected:
+	static inline void Link(Arena*& head, Arena* arena)
+	{
+		arena->prev = nullptr;
+		arena->next = head;
+		if (head) {
+			head->prev = arena;
+		}
+		head = arena;
+	}
+	static inline void Unlink(Arena*& head, Arena* arena)
+	{
+		if (arena->prev) {
+			arena->prev->next = arena->next;
+		} else {
+			head = arena->next;
+		}
+		if (arena->next) {
+			arena->next->prev = arena->prev;
+		}
+	}
+	static inline void LinkAvail(Class& c, Arena* arena)
+	{
+		arena->avail = true;
+		arena->avail_prev = nullptr;
+		arena->avail_next = c.avail;
+		if (c.avail) {
+			c.avail->avail_prev = arena;
+		}
+		c.avail = arena;
+	}
+	static inline void UnlinkAvail(Class& c, Arena* arena)
+	{
+		arena->avail = false;
+		if (arena->avail_prev) {
+			arena->avail_prev->avail_next = arena->avail_next;
+		} else {
+			c.avail = arena->avail_next;
+		}
+		if (arena->avail_next) {
+			arena->avail_next->avail_prev = arena->avail_prev;
+		}
+	}
+
+	//需要在c.mutex保护下调用
+	static inline Arena* NewArena(Class& c)
+	{
+		Arena* arena = new Arena();
+		arena->owner = &c;
+		arena->total = std::max<size_t>(DEFAULT_SLAB_ARENA_SIZE / c.stride, 1);
+		arena->mem = (char*)::operator new(arena->total * c.stride);
+		Link(c.arenas, arena);
+		LinkAvail(c, arena);
+		c.stat.arenas++;
+		c.stat.blocks += arena->total;
+		c.stat.bytes += arena->total * c.stride;
+		return arena;
+	}
+
+	//需要在c.mutex保护下调用
+	static inline void ReleaseArena(Class& c, Arena* arena)
+	{
+		ASSERT(!arena->used);
+		if (arena->avail) {
+			UnlinkAvail(c, arena);
+		}
+		Unlink(c.arenas, arena);
+		c.stat.arenas--;
+		c.stat.blocks -= arena->total;
+		c.stat.bytes -= arena->total * c.stride;
+		c.stat.trims++;
+		::operator delete(arena->mem);
+		delete arena;
+	}
+
+	//空闲arena超过高水位的部分还给系统，需要在c.mutex保护下调用
+	static inline void TrimClass(Class& c)
+	{
+		Arena* arena = c.avail;
+		while (arena)
+		{
+			Arena* next = arena->avail_next;
+			if (!arena->used && c.stat.blocks - arena->total >= c.stat.high) {
+				ReleaseArena(c, arena);
+			}
+			arena = next;
+		}
+	}
+
+	static inline Block* AllocBlock(Class& c)
+	{
+		std::lock_guard<std::mutex> lock(c.mutex);
+		Arena* arena = c.avail;
+		if (!arena) {
+			arena = NewArena(c);
+		}
+		Block* block = arena->free;
+		if (block) {
+			arena->free = NextOf(block);
+		} else {
+			//新arena不一次切完，用到哪切到哪，没用到的页不会被访问
+			block = (Block*)(arena->mem + arena->carved++ * c.stride);
+			block->owner = arena;
+			block->pages = 0;
+		}
+		if (++arena->used == arena->total) {
+			UnlinkAvail(c, arena);
+		}
+		c.stat.allocs++;
+		if (++c.stat.used > c.stat.high) {
+			c.stat.high = c.stat.used;
+			if (c.stat.high > c.stat.peak) {
+				c.stat.peak = c.stat.high;
+			}
+		}
+		return block;
+	}
+
+	static inline void FreeBlock(Block* block)
+	{
+		Arena* arena = (Arena*)block->owner;
+		Class& c = *arena->owner;
+		std::lock_guard<std::mutex> lock(c.mutex);
+		NextOf(block) = arena->free;
+		arena->free = block;
+		if (!arena->avail) {
+			LinkAvail(c, arena);
+		}
+		c.stat.frees++;
+		c.stat.used--;
+		if (!--arena->used) {
+			//arena空了，统计窗口过了就用当前使用数开始新窗口，总块数超过高水位就还给系统
+			SlabPool& pool = Inst();
+			auto now = std::chrono::steady_clock::now();
+			if (now - c.window >= std::chrono::milliseconds(pool.trim_window_)) {
+				c.stat.high = c.stat.used;
+				c.window = now;
+			}
+			if (c.stat.blocks - arena->total >= c.stat.high) {
+				ReleaseArena(c, arena);
+			}
+		}
+	}
+
+	inline Block* AllocHuge(size_t size)
+	{
+		size_t pages = (size + sizeof(Block) + PAGE_SIZE - 1) / PAGE_SIZE;
+		Block* block = (Block*)::operator new(pages * PAGE_SIZE);
+		block->owner = &huge_;
+		block->pages = (uint32_t)pages;
+		std::lock_guard<std::mutex> lock(huge_.mutex);
+		huge_.stat.allocs++;
+		huge_.stat.bytes += pages * PAGE_SIZE;
+		if (++huge_.stat.used > huge_.stat.peak) {
+			huge_.stat.peak = huge_.stat.used;
+		}
+		huge_.stat.high = std::max(huge_.stat.high, huge_.stat.used);
+		return block;
+	}
+
+	static inline void FreeHuge(Block* block)
+	{
+		Class& c = *(Class*)block->owner;
+		{
+			std::lock_guard<std::mutex> lock(c.mutex);
+			c.stat.frees++;
+			c.stat.used--;
+			c.stat.bytes -= (size_t)block->pages * PAGE_SIZE;
+		}
+		::operator delete(block);
+	}
+
+protected:
+	Class classes_[CLASS_COUNT];
+	Class huge_;
+	size_t trim_window_ = DEFAULT_SLAB_TRIM_WINDOW;
+};
+
+/*!
+ *	@brief SlabBuffer 定义.
+ *
+ *	从SlabPool申请的独占缓存，扩容时换更大规格的块，shrink把多余的块还给SlabPool；
+ *	Embed可以挂一块外部内存（比如连接对象自带的缓存），放得下时优先用它，不向SlabPool申请
+ */
+class SlabBuffer
+{
+	char* ptr_ = nullptr;
+	size_t size_ = 0;
+	char* embed_ = nullptr;
+	size_t embed_cap_ = 0;
+public:
+	SlabBuffer() {}
+	explicit SlabBuffer(size_t size) { resize(size); }
+	SlabBuffer(const SlabBuffer&) = delete;
+	SlabBuffer& operator=(const SlabBuffer&) = delete;
+	SlabBuffer(SlabBuffer&& o) noexcept:ptr_(o.ptr_),size_(o.size_),embed_(o.embed_),embed_cap_(o.embed_cap_)
+	{ 
+		o.ptr_ = nullptr;
+		o.size_ = 0;
+		o.embed_ = nullptr;
+		o.embed_cap_ = 0;
+	}
+	SlabBuffer& operator=(SlabBuffer&& o) noexcept
+	{
+		if (this != &o) {
+			reset();
+			embed_ = nullptr;
+			embed_cap_ = 0;
+			swap(o);
+		}
+		return *this;
+	}
+	~SlabBuffer() { reset(); }
+
+	inline char* data() const { return ptr_; }
+	inline size_t size() const { return size_; }
+	inline size_t capacity() const 
+	{ 
+		if (!ptr_) {
+			return 0;
+		}
+		if (ptr_ == embed_) {
+			return embed_cap_;
+		}
+		return SlabPool::Capacity(ptr_);
+	}
+	inline bool empty() const { return size_ == 0; }
+	inline char& operator[](size_t pos) { return ptr_[pos]; }
+	inline const char& operator[](size_t pos) const { return ptr_[pos]; }
+
+	//挂一块外部内存，需要比SlabBuffer活得久
+	inline void Embed(char* buf, size_t cap)
+	{
+		reset();
+		embed_ = buf;
+		embed_cap_ = cap;
+	}
+
+	inline void clear() { size_ = 0; }
+	inline void reserve(size_t cap) 
+	{ 
+		if (cap > capacity()) {
+			Realloc(cap);
+		}
+	}
+	inline void resize(size_t size) 
+	{ 
+		reserve(size);
+		size_ = size;
+	}
+	inline void append(const char* buf, size_t len)
+	{
+		if (size_ + len > capacity()) {
+			Realloc(std::max(size_ + len, size_ * 2));
+		}
+		memcpy(ptr_ + size_, buf, len);
+		size_ += len;
+	}
+	//容量比cap所在规格大时换一个小块（放得下时回到外部内存），多出来的还给SlabPool
+	inline void shrink(size_t cap)
+	{
+		cap = std::max(cap, size_);
+		if (!cap) {
+			reset();
+		} else if (cap <= embed_cap_) {
+			if (ptr_ != embed_) {
+				Realloc(cap);
+			}
+		} else if (SlabPool::Fit(cap) < capacity()) {
+			Realloc(cap);
+		}
+	}
+	inline void reset() 
+	{ 
+		if (ptr_ && ptr_ != embed_) {
+			SlabPool::Free(ptr_);
+		}
+		ptr_ = nullptr;
+		size_ = 0;
+	}
+	inline void swap(SlabBuffer& o) noexcept
+	{
+		std::swap(ptr_, o.ptr_);
+		std::swap(size_, o.size_);
+		std::swap(embed_, o.embed_);
+		std::swap(embed_cap_, o.embed_cap_);
+	}
+
+protected:
+	inline void Realloc(size_t cap)
+	{
+		char* ptr = cap <= embed_cap_ ? embed_ : SlabPool::Inst().Alloc(cap);
+		if (ptr_) {
+			if (size_) {
+				memcpy(ptr, ptr_, std::min(size_, cap));
+			}
+			if (ptr_ != embed_) {
+				SlabPool::Free(ptr_);
+			}
+		}
+		ptr_ = ptr;
+		size_ = std::min(size_, cap);
+	}
+};
+
+/*!
+ *	@brief RingBuffer 定义.
+ *
+ *	镜像环形缓存：同一块内存（memfd）连续映射两次，读写位置绕回开头时看到的仍然是连续内存，
+ *	解析时不需要memmove整理；大小按页对齐，每个缓存占两个VMA，注意vm.max_map_count。Windows暂不支持，Create返回false
+ */
+class RingBuffer
+{
+	char* base_ = nullptr;
+	size_t cap_ = 0;
+public:
+	RingBuffer() {}
+	RingBuffer(const RingBuffer&) = delete;
+	RingBuffer& operator=(const RingBuffer&) = delete;
+	~RingBuffer() { Destroy(); }
+
+	static inline size_t PageSize()
+	{
+#ifdef WIN32
+		return 4096;
+#else
+		static const size_t page_size = sysconf(_SC_PAGESIZE);
+		return page_size;
+#endif//
+	}
+
+	//size向上按页对齐，失败返回false
+	bool Create(size_t size)
+	{
+		Destroy();
+#if defined(WIN32) || !defined(SYS_memfd_create)
+		return false;
+#else
+		size_t page_size = PageSize();
+		size = (std::max<size_t>(size, 1) + page_size - 1) / page_size * page_size;
+		int fd = (int)syscall(SYS_memfd_create, "xsocket_ring", 1/*MFD_CLOEXEC*/);
+		if (fd < 0) {
+			return false;
+		}
+		char* base = nullptr;
+		if (ftruncate(fd, size) == 0) {
+			//先占2倍地址空间，再把同一个文件映射到前后两半
+			base = (char*)mmap(nullptr, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (base == MAP_FAILED) {
+				base = nullptr;
+			} else if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+				|| mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+				munmap(base, size * 2);
+				base = nullptr;
+			}
+		}
+		close(fd);
+		if (!base) {
+			return false;
+		}
+		base_ = base;
+		cap_ = size;
+		return true;
+#endif//
+	}
+
+	void Destroy()
+	{
+#if !defined(WIN32)
+		if (base_) {
+			munmap(base_, cap_ * 2);
+		}
+#endif//
+		base_ = nullptr;
+		cap_ = 0;
+	}
+
+	//base()开始的2*capacity()字节都可以访问，[base()+i]和[base()+capacity()+i]是同一个字节
+	inline char* base() { return base_; }
+	inline size_t capacity() const { return cap_; }
+	inline bool empty() const { return !base_; }
+	//把ptr折回[base(),base()+capacity())
+	inline char* wrap(const char* ptr) { return (char*)(ptr >= base_ + cap_ ? ptr - cap_ : ptr); }
+
+	inline void swap(RingBuffer& o)
+	{
+		std::swap(base_, o.base_);
+		std::swap(cap_, o.cap_);
+	}
+};
+
+/*!
+ *	@brief SlabAllocator 模板定义.
+ *
+ *	从SlabPool申请内存的分配器，可以让std容器/字符串的缓存走SlabPool
+ */
+template<class _Ty>
+struct SlabAllocator
+{
+	typedef _Ty value_type;
+	typedef _Ty* pointer;
+	typedef const _Ty* const_pointer;
+	typedef _Ty& reference;
+	typedef const _Ty& const_reference;
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+	template<class _Other>
+	struct rebind { typedef SlabAllocator<_Other> other; };
+
+	SlabAllocator() noexcept {}
+	template<class _Other>
+	SlabAllocator(const SlabAllocator<_Other>&) noexcept {}
+
+	inline _Ty* allocate(size_t n, const void* = nullptr) { return (_Ty*)SlabPool::Inst().Alloc(n * sizeof(_Ty)); }
+	inline void deallocate(_Ty* ptr, size_t) noexcept { SlabPool::Free((char*)ptr); }
+	inline size_t max_size() const noexcept { return ((size_t)-1 - PAGE_SIZE) / sizeof(_Ty); }
+	template<class _Other, class... _Args>
+	inline void construct(_Other* ptr, _Args&&... args) { ::new((void*)ptr) _Other(std::forward<_Args>(args)...); }
+	template<class _Other>
+	inline void destroy(_Other* ptr) { ptr->~_Other(); }
+private:
+	enum { PAGE_SIZE = SlabPool::PAGE_SIZE };
+};
+template<class _Ty, class _Other>
+inline bool operator==(const SlabAllocator<_Ty>&, const SlabAllocator<_Other>&) { return true; }
+template<class _Ty, class _Other>
+inline bool operator!=(const SlabAllocator<_Ty>&, const SlabAllocator<_Other>&) { return false; }
+
+//缓存走SlabPool的字符串，可以作为SimpleSocketT的发送缓存
+typedef std::basic_string<char, std::char_traits<char>, SlabAllocator<char>> SlabString;
+
+#ifndef DEFAULT_CACHE_LINE_SIZE
+#define DEFAULT_CACHE_LINE_SIZE 64 //缓存行大小
+#endif//
+#ifndef DEFAULT_SOCKET_FACTORY_COUNT
+#define DEFAULT_SOCKET_FACTORY_COUNT 64 //SocketFactoryT每个arena的连接对象数
+#endif//
+
+/*!
+ *	@brief SocketFactoryT 模板定义.
+ *
+ *	连接对象工厂，用allocate_shared把对象和shared_ptr控制块放在一个按缓存行对齐的定长块里，
+ *	块从每次DEFAULT_SOCKET_FACTORY_COUNT个的arena里切；对象有EmbedRecvBuf（比如SimpleSocketT）时，
+ *	块尾部再留nBufSize字节作为它的第一块接收缓存，一个连接只需要一次分配；
+ *	连接DetachService后SocketSet释放最后一个引用，块回到空闲链表给下一个连接用，arena不还给系统；
+ *	省掉的是堆分配次数，连接数多到块超出缓存后耗时主要是访存，和make_shared加SlabPool接收缓存差不多
+ */
+template<class T, size_t nBufSize = DEFAULT_BUFSIZE>
+class SocketFactoryT
+{
+	typedef SocketFactoryT<T,nBufSize> This;
+	struct Block
+	{
+		Block* next;
+	};
+	template<class _Ty>
+	struct Allocator
+	{
+		typedef _Ty value_type;
+		template<class _Other>
+		struct rebind { typedef Allocator<_Other> other; };
+
+		This* factory;
+		char** block; //New拿到对象所在块，用来挂接收缓存
+		Allocator(This* f, char** b):factory(f),block(b) {}
+		template<class _Other>
+		Allocator(const Allocator<_Other>& o):factory(o.factory),block(o.block) {}
+
+		inline _Ty* allocate(size_t n)
+		{
+			if (n != 1) {
+				return (_Ty*)::operator new(n * sizeof(_Ty));
+			}
+			char* ptr = factory->Alloc(sizeof(_Ty));
+			*block = ptr;
+			return (_Ty*)ptr;
+		}
+		inline void deallocate(_Ty* ptr, size_t n)
+		{
+			if (n != 1) {
+				::operator delete(ptr);
+				return;
+			}
+			factory->Free((char*)ptr, sizeof(_Ty));
+		}
+		template<class _Other>
+		inline bool operator==(const Allocator<_Other>& o) const { return factory == o.factory; }
+		template<class _Other>
+		inline bool operator!=(const Allocator<_Other>& o) const { return factory != o.factory; }
+	};
+
+	template<class _Ty>
+	static auto HasEmbed(int) -> decltype(std::declval<_Ty*>()->EmbedRecvBuf((char*)nullptr, (size_t)0), std::true_type());
+	template<class _Ty>
+	static std::false_type HasEmbed(long);
+	template<class _Ty>
+	static inline void Embed(_Ty* ptr, char* buf, size_t len, std::true_type) { ptr->EmbedRecvBuf(buf, len); }
+	template<class _Ty>
+	static inline void Embed(_Ty* ptr, char* buf, size_t len, std::false_type) { }
+
+	static inline size_t Align(size_t size) { return (size + DEFAULT_CACHE_LINE_SIZE - 1) / DEFAULT_CACHE_LINE_SIZE * DEFAULT_CACHE_LINE_SIZE; }
+public:
+	typedef decltype(HasEmbed<T>(0)) Embeddable;
+	enum { BUF_SIZE = Embeddable::value ? (nBufSize + DEFAULT_CACHE_LINE_SIZE - 1) / DEFAULT_CACHE_LINE_SIZE * DEFAULT_CACHE_LINE_SIZE : 0 };
+
+	static This& Inst() {
+		//不析构，连接对象可能比静态对象活得久
+		static This* _inst = new This();
+		return *_inst;
+	}
+
+	//需要在所有对象都释放后调用
+	~SocketFactoryT()
+	{
+		for (char* arena : arenas_)
+		{
+			::operator delete(arena);
+		}
+	}
+
+	template<class... Args>
+	std::shared_ptr<T> New(Args&&... args)
+	{
+		char* block = nullptr;
+		std::shared_ptr<T> ptr = std::allocate_shared<T>(Allocator<T>(this, &block), std::forward<Args>(args)...);
+		if (BUF_SIZE != 0 && block != nullptr) {
+			Embed(ptr.get(), block + head_size_, BUF_SIZE, Embeddable());
+		}
+		return ptr;
+	}
+
+	inline size_t GetBlockSize() { return stride_; }
+	inline size_t GetCount() { std::lock_guard<std::mutex> lock(mutex_); return count_; }
+	inline size_t GetUsedCount() { std::lock_guard<std::mutex> lock(mutex_); return used_; }
+	inline size_t GetArenaCount() { std::lock_guard<std::mutex> lock(mutex_); return arenas_.size(); }
+
+protected:
+	//块大小在第一次分配时按控制块+对象的大小确定
+	char* Alloc(size_t size)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (!stride_) {
+			head_size_ = Align(size);
+			stride_ = head_size_ + BUF_SIZE;
+		}
+		if (Align(size) != head_size_) {
+			return (char*)::operator new(size);
+		}
+		if (!free_) {
+			char* arena = (char*)::operator new(DEFAULT_CACHE_LINE_SIZE + stride_ * DEFAULT_SOCKET_FACTORY_COUNT);
+			arenas_.push_back(arena);
+			char* base = (char*)Align((size_t)arena);
+			for (size_t i = DEFAULT_SOCKET_FACTORY_COUNT; i > 0; i--)
+			{
+				Block* block = (Block*)(base + (i - 1) * stride_);
+				block->next = free_;
+				free_ = block;
+			}
+			count_ += DEFAULT_SOCKET_FACTORY_COUNT;
+		}
+		Block* block = free_;
+		free_ = block->next;
+		used_++;
+		return (char*)block;
+	}
+
+	void Free(char* ptr, size_t size)
+	{
+		if (Align(size) != head_size_) {
+			::operator delete(ptr);
+			return;
+		}
+		std::lock_guard<std::mutex> lock(mutex_);
+		Block* block = (Block*)ptr;
+		block->next = free_;
+		free_ = block;
+		used_--;
+	}
+
+protected:
+	std::mutex mutex_;
+	size_t head_size_ = 0; //控制块+对象按缓存行对齐后的大小，接收缓存从这里开始
+	size_t stride_ = 0;
+	Block* free_ = nullptr;
+	size_t count_ = 0;
+	size_t used_ = 0;
+	std::vector<char*> arenas_;
+};
+
+/*!
+ *	@brief IDGenerator 定义.
+ *
+ *	封装IDGenerator，实现基本服务框架
+ */
+template<typename _Ty>
+class IDGenerator 
+{
+public:
+	static IDGenerator<_Ty>& Inst() {
+		static IDGenerator<_Ty> _inst;
+		return _inst;
+	}
+	IDGenerator():id_(0) {}
+	_Ty get() {
+		return ++id_;
+	}
+private:
+	std::atomic<_Ty> id_;
+};
+// template<typename _Ty>
+// INLINE_GLOBAL IDGenerator<_Ty>::id_;
+
+// /*!
+//  *	@brief IDManager 定义.
+//  *
+//  *	封装IDManager，实现ID管理，判断ID是否存在
+//  */
+// template<typename _Kty, typename _Ty>
+// class IDManager
+// {
+// public:
+// 	static IDManager<_Kty, _Ty>& Inst() {
+// 		static IDManager<_Kty, _Ty> _inst;
+// 		return _inst;
+// 	}
+
+// 	inline void Add(const _Kty& id, const _Ty& val) {
+// 		//std::lock_guard<std::mutex> lock(mutex_);
+// 		std::unique_lock<std::shared_mutex> lock(mutex_);
+// 		map_id2vs_.emplace(id,val);
+// 	}
+// 	inline bool AddBidi(const _Kty& id, const _Ty& val) {
+// 		//std::lock_guard<std::mutex> lock(mutex_);
+// 		std::unique_lock<std::shared_mutex> lock(mutex_);
+// 		map_id2vs_.emplace(id,val);
+// 		map_v2id_.emplace(val,id);
+// 		return true;
+// 	}
+// 	inline void Remove(const _Kty& id) {
+// 		//std::lock_guard<std::mutex> lock(mutex_);
+// 		std::unique_lock<std::shared_mutex> lock(mutex_);
+// 		map_id2vs_.erase(id);
+// 	}
+// 	inline void RemoveBidi(const _Kty& id) {
+// 		//std::lock_guard<std::mutex> lock(mutex_);
+// 		std::unique_lock<std::shared_mutex> lock(mutex_);
+// 		auto pr = map_id2vs_.equal_range(id);
+// 		if(pr.first != map_id2vs_.end()) {
+// 			for(auto it = pr.first; it != pr.second; ++it)
+// 			{
+// 				map_v2id_.erase(it->second);
+// 			}
+// 			map_id2vs_.erase(pr.first,pr.second);
+// 		}
+// 	}
+// 	inline void RemoveByVal(const _Ty& val) {
+// 		//std::lock_guard<std::mutex> lock(mutex_);
+// 		std::unique_lock<std::shared_mutex> lock(mutex_);
+// 		auto it = map_v2id_.find(val);
+// 		if(it != map_v2id_.end()) {
+// 			auto itt = map_id2vs_.find(it->second);
+// 			while(itt != map_id2vs_.end()) {
+// 				if(itt->second == val) {
+// 					map_id2vs_.erase(itt);
+// 					break;
+// 				}
+// 				++itt;
+// 			}
+// 			map_v2id_.erase(it);
 // 		}
 // 	}
 // 	inline bool Find(const _Kty& id) {
@@ -690,172 +1830,1617 @@ private:
 // };
 
 /*!
- *	@brief Service 定义.
+ *	@brief StealDeque 模板定义.
+ *
+ *	Chase-Lev无锁工作窃取双端队列，只有所有者线程可以Push/Take（后进先出），其他线程Steal（先进先出），
+ *	T必须是指针等可以原子读写的类型，空值表示没有数据，扩容后旧数组保留到析构时释放
+ */
+template<class T>
+class StealDeque
+{
+protected:
+	struct Array
+	{
+		int64_t size;
+		std::atomic<T>* buf;
+		Array(int64_t _size):size(_size),buf(new std::atomic<T>[_size]) {}
+		~Array() { delete[] buf; }
+		inline T Get(int64_t i) { return buf[i & (size - 1)].load(std::memory_order_relaxed); }
+		inline void Put(int64_t i, T x) { buf[i & (size - 1)].store(x, std::memory_order_relaxed); }
+	};
+	std::atomic<int64_t> top_;
+	std::atomic<int64_t> bottom_;
+	std::atomic<Array*> array_;
+	std::vector<Array*> garbage_; //扩容后的旧数组，可能还有窃取线程在读
+public:
+	StealDeque(int64_t size = 256):top_(0),bottom_(0),array_(new Array(size))
+	{
+		ASSERT(size > 0 && !(size & (size - 1)));
+	}
+	~StealDeque()
+	{
+		delete array_.load();
+		for (size_t i = 0; i < garbage_.size(); i++)
+		{
+			delete garbage_[i];
+		}
+	}
+
+	//估计的数据个数，其他线程调用时只是参考
+	inline int64_t Size()
+	{
+		int64_t b = bottom_.load(std::memory_order_relaxed);
+		int64_t t = top_.load(std::memory_order_relaxed);
+		return b > t ? b - t : 0;
+	}
+
+	//所有者线程调用
+	inline void Push(T x)
+	{
+		int64_t b = bottom_.load(std::memory_order_relaxed);
+		int64_t t = top_.load(std::memory_order_acquire);
+		Array* a = array_.load(std::memory_order_relaxed);
+		if (b - t > a->size - 1) {
+			a = Grow(a, b, t);
+		}
+		a->Put(b, x);
+		bottom_.store(b + 1, std::memory_order_release);
+	}
+
+	//所有者线程调用
+	inline T Take()
+	{
+		int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+		Array* a = array_.load(std::memory_order_relaxed);
+		bottom_.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = top_.load(std::memory_order_relaxed);
+		T x = T();
+		if (t <= b) {
+			x = a->Get(b);
+			if (t == b) {
+				//最后一个，和窃取线程竞争
+				if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+					x = T();
+				}
+				bottom_.store(b + 1, std::memory_order_relaxed);
+			}
+		} else {
+			bottom_.store(b + 1, std::memory_order_relaxed);
+		}
+		return x;
+	}
+
+	//任意线程调用，返回空值表示没有数据或者竞争失败
+	inline T Steal()
+	{
+		int64_t t = top_.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = bottom_.load(std::memory_order_acquire);
+		T x = T();
+		if (t < b) {
+			Array* a = array_.load(std::memory_order_acquire);
+			x = a->Get(t);
+			if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+				return T();
+			}
+		}
+		return x;
+	}
+
+protected:
+	Array* Grow(Array* a, int64_t b, int64_t t)
+	{
+		Array* na = new Array(a->size * 2);
+		for (int64_t i = t; i < b; i++)
+		{
+			na->Put(i, a->Get(i));
+		}
+		garbage_.push_back(a);
+		array_.store(na, std::memory_order_release);
+		return na;
+	}
+};
+
+#ifndef DEFAULT_SERVICE_LOAD_WINDOW
+#define DEFAULT_SERVICE_LOAD_WINDOW 100 //服务负载统计窗口（毫秒）
+#endif//
+
+#ifndef DEFAULT_TIMER_WHEEL_TICK
+#define DEFAULT_TIMER_WHEEL_TICK 1 //时间轮刻度（毫秒）
+#endif//
+
+/*!
+ *	@brief MPSCNode 定义.
+ *
+ *	MPSCQueue的侵入式节点，需要入队的对象继承MPSCNode
+ */
+struct MPSCNode
+{
+	std::atomic<MPSCNode*> next;
+	MPSCNode():next(nullptr) {}
+};
+
+/*!
+ *	@brief MPSCQueue 模板定义.
+ *
+ *	侵入式无锁多生产者单消费者队列，Push可以在任意线程调用，Pop只能在一个线程（或者加锁）调用，
+ *	Push返回true表示需要唤醒消费者，消费者在取数据前调用Reset，这样多个Push只唤醒一次
+ */
+template<class T>
+class MPSCQueue
+{
+protected:
+	std::atomic<MPSCNode*> head_; //生产者入队位置
+	MPSCNode* tail_; //消费者出队位置
+	MPSCNode stub_;
+	std::atomic<bool> signal_; //是否已经唤醒消费者
+public:
+	MPSCQueue():head_(&stub_),tail_(&stub_),signal_(false)
+	{
+	}
+
+	inline bool Push(T* node)
+	{
+		Link(node);
+		return !signal_.exchange(true);
+	}
+
+	//消费者取数据前调用，之后的Push会重新唤醒消费者
+	inline void Reset()
+	{
+		signal_.store(false);
+	}
+
+	//返回nullptr表示队列为空或者生产者正在入队（这时生产者会再次唤醒消费者）
+	inline T* Pop()
+	{
+		MPSCNode* tail = tail_;
+		MPSCNode* next = tail->next.load(std::memory_order_acquire);
+		if (tail == &stub_) {
+			if (!next) {
+				return nullptr;
+			}
+			tail_ = next;
+			tail = next;
+			next = next->next.load(std::memory_order_acquire);
+		}
+		if (next) {
+			tail_ = next;
+			return static_cast<T*>(tail);
+		}
+		if (tail != head_.load(std::memory_order_acquire)) {
+			return nullptr;
+		}
+		Link(&stub_);
+		next = tail->next.load(std::memory_order_acquire);
+		if (next) {
+			tail_ = next;
+			return static_cast<T*>(tail);
+		}
+		return nullptr;
+	}
+
+	inline bool IsEmpty()
+	{
+		return tail_ == head_.load(std::memory_order_acquire) && tail_ == &stub_;
+	}
+
+protected:
+	inline void Link(MPSCNode* node)
+	{
+		node->next.store(nullptr, std::memory_order_relaxed);
+		MPSCNode* prev = head_.exchange(node, std::memory_order_acq_rel);
+		prev->next.store(node, std::memory_order_release);
+	}
+};
+
+/*!
+ *	@brief TimerWheel 定义.
+ *
+ *	分层时间轮，4层每层64个槽，每层用64位位图记录非空槽，O(1)增加/取消定时器，
+ *	最多覆盖64^4个刻度，更远的定时器先放在最高层最后一个槽，到时再重新分层
+ *	定时器ID是高32位代数|低32位节点下标，0表示无效ID，非线程安全
+ *	Advance只取出到期的定时器，由调用者放开锁后再执行回调
+ */
+class TimerWheel
+{
+public:
+	typedef std::pair<uint64_t, std::function<void()>> Expired; //到期的定时器ID和回调
+	enum
+	{
+		LEVEL_BITS = 6,
+		LEVEL_SLOTS = 1 << LEVEL_BITS,
+		LEVEL_MASK = LEVEL_SLOTS - 1,
+		LEVEL_COUNT = 4,
+	};
+protected:
+	struct Node
+	{
+		std::function<void()> cb;
+		uint64_t expire = 0; //到期刻度
+		uint32_t gen = 1; //节点代数，节点每回收一次加1
+		int prev = -1;
+		int next = -1; //已链接时是槽链表的下一个节点，空闲时是空闲链表的下一个节点
+		int slot = -1; //所在槽（层*64+槽），-1表示没有链接
+	};
+	std::vector<Node> nodes_;
+	int free_head_ = -1;
+	int slots_[LEVEL_COUNT * LEVEL_SLOTS];
+	uint64_t bitmaps_[LEVEL_COUNT] = {0};
+	uint64_t current_ = 0; //当前刻度
+	size_t count_ = 0;
+	size_t tick_ = DEFAULT_TIMER_WHEEL_TICK;
+public:
+	TimerWheel(size_t tick = DEFAULT_TIMER_WHEEL_TICK):tick_(tick ? tick : 1)
+	{
+		for (int i = 0; i < LEVEL_COUNT * LEVEL_SLOTS; i++)
+		{
+			slots_[i] = -1;
+		}
+		current_ = Now();
+	}
+
+	inline size_t Count() { return count_; }
+	inline bool IsEmpty() { return !count_; }
+
+	//millis毫秒后执行cb，返回定时器ID
+	uint64_t Add(size_t millis, std::function<void()>&& cb)
+	{
+		if (IsEmpty()) {
+			//没有定时器时不推进刻度，增加前先对齐当前时间
+			current_ = Now();
+		}
+		int i = free_head_;
+		if (i >= 0) {
+			free_head_ = nodes_[i].next;
+		} else {
+			i = nodes_.size();
+			nodes_.emplace_back();
+		}
+		Node& node = nodes_[i];
+		node.cb = std::move(cb);
+		//按当前时间计算到期刻度，至少下一个刻度到期
+		uint64_t ticks = (millis + tick_ - 1) / tick_;
+		node.expire = Now() + (ticks ? ticks : 1);
+		Link(i);
+		count_++;
+		return ((uint64_t)node.gen << 32) | (uint32_t)i;
+	}
+
+	bool Cancel(uint64_t id)
+	{
+		size_t i = (uint32_t)id;
+		if (i >= nodes_.size() || nodes_[i].gen != (uint32_t)(id >> 32) || nodes_[i].slot < 0) {
+			return false;
+		}
+		Unlink(i);
+		Free(i);
+		return true;
+	}
+
+	//推进到当前时间，到期的定时器按到期顺序追加到expired，返回下次需要推进的毫秒数，没有定时器返回-1
+	template<class TContainer>
+	int64_t Advance(TContainer& expired)
+	{
+		uint64_t now = Now();
+		while (count_) {
+			uint64_t next = NextTick();
+			if (next > now) {
+				current_ = now;
+				return (int64_t)((next - now) * tick_);
+			}
+			current_ = next;
+			//先从高层往低层重新分层，再执行第0层到期的定时器
+			for (int level = LEVEL_COUNT - 1; level > 0; level--)
+			{
+				if (current_ & (((uint64_t)1 << (level * LEVEL_BITS)) - 1)) {
+					continue;
+				}
+				Cascade(level * LEVEL_SLOTS + ((current_ >> (level * LEVEL_BITS)) & LEVEL_MASK));
+			}
+			int slot = current_ & LEVEL_MASK;
+			while (slots_[slot] >= 0) {
+				int i = slots_[slot];
+				Unlink(i);
+				expired.emplace_back(((uint64_t)nodes_[i].gen << 32) | (uint32_t)i, std::move(nodes_[i].cb));
+				Free(i);
+			}
+		}
+		current_ = now;
+		return -1;
+	}
+
+protected:
+	inline uint64_t Now()
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() / tick_;
+	}
+
+	static inline int Ctz(uint64_t x)
+	{
+#ifdef _MSC_VER
+		unsigned long i = 0;
+		_BitScanForward64(&i, x);
+		return i;
+#else
+		return __builtin_ctzll(x);
+#endif//
+	}
+
+	//下一个需要处理（到期或者重新分层）的刻度
+	inline uint64_t NextTick()
+	{
+		uint64_t next = (uint64_t)-1;
+		for (int level = 0; level < LEVEL_COUNT; level++)
+		{
+			uint64_t bitmap = bitmaps_[level];
+			if (!bitmap) {
+				continue;
+			}
+			uint64_t base = current_ >> (level * LEVEL_BITS);
+			int shift = (base + 1) & LEVEL_MASK;
+			//从base+1对应的槽开始找第一个非空槽
+			uint64_t rotated = shift ? ((bitmap >> shift) | (bitmap << (LEVEL_SLOTS - shift))) : bitmap;
+			uint64_t tick = (base + 1 + Ctz(rotated)) << (level * LEVEL_BITS);
+			if (tick < next) {
+				next = tick;
+			}
+		}
+		return next;
+	}
+
+	inline void Link(int i)
+	{
+		Node& node = nodes_[i];
+		int level = 0;
+		for (; level < LEVEL_COUNT; level++)
+		{
+			if ((node.expire >> (level * LEVEL_BITS)) - (current_ >> (level * LEVEL_BITS)) < LEVEL_SLOTS) {
+				break;
+			}
+		}
+		int slot = 0;
+		if (level < LEVEL_COUNT) {
+			slot = (node.expire >> (level * LEVEL_BITS)) & LEVEL_MASK;
+		} else {
+			//超出范围，放在最高层最后一个槽
+			level = LEVEL_COUNT - 1;
+			slot = ((current_ >> (level * LEVEL_BITS)) + LEVEL_MASK) & LEVEL_MASK;
+		}
+		slot += level * LEVEL_SLOTS;
+		node.slot = slot;
+		node.prev = -1;
+		node.next = slots_[slot];
+		if (node.next >= 0) {
+			nodes_[node.next].prev = i;
+		}
+		slots_[slot] = i;
+		bitmaps_[level] |= (uint64_t)1 << (slot & LEVEL_MASK);
+	}
+
+	inline void Unlink(int i)
+	{
+		Node& node = nodes_[i];
+		if (node.prev >= 0) {
+			nodes_[node.prev].next = node.next;
+		} else {
+			slots_[node.slot] = node.next;
+			if (node.next < 0) {
+				bitmaps_[node.slot / LEVEL_SLOTS] &= ~((uint64_t)1 << (node.slot & LEVEL_MASK));
+			}
+		}
+		if (node.next >= 0) {
+			nodes_[node.next].prev = node.prev;
+		}
+		node.slot = -1;
+		node.prev = -1;
+		node.next = -1;
+	}
+
+	inline void Free(int i)
+	{
+		Node& node = nodes_[i];
+		node.cb = nullptr;
+		node.gen++;
+		node.next = free_head_;
+		free_head_ = i;
+		count_--;
+	}
+
+	inline void Cascade(int slot)
+	{
+		int i = slots_[slot];
+		slots_[slot] = -1;
+		bitmaps_[slot / LEVEL_SLOTS] &= ~((uint64_t)1 << (slot & LEVEL_MASK));
+		while (i >= 0) {
+			int next = nodes_[i].next;
+			Link(i);
+			i = next;
+		}
+	}
+};
+
+/*!
+ *	@brief ServiceStat 定义.
+ *
+ *	服务唤醒延迟统计，用于调优忙轮询
+ */
+struct ServiceStat
+{
+	enum { HIST_COUNT = 16 };
+	uint64_t wakeups; //通知唤醒次数
+	uint64_t total_us; //通知唤醒总延迟（微秒）
+	uint64_t max_us; //最大通知唤醒延迟（微秒）
+	uint64_t hist[HIST_COUNT]; //延迟分布，hist[0]表示小于1微秒，hist[i]表示[2^(i-1),2^i)微秒，最后一个桶包含更大延迟
+	uint64_t spins; //忙轮询等待（超时为0）次数
+	uint64_t blocks; //阻塞等待次数
+	uint64_t busy_us; //服务线程忙（不在等待）的累计时间（微秒）
+	uint64_t run_us; //服务线程运行的累计时间（微秒）
+	uint32_t load; //最近的负载（千分比），按DEFAULT_SERVICE_LOAD_WINDOW窗口平滑
+};
+
+/*!
+ *	@brief Service 定义.
+ *
+ *	封装Service，实现基本服务框架
+ */
+class Service 
+{
+protected:
+    //停止标记，默认停止状态，启动后停止状态为false
+    std::atomic<bool> stop_flag_;
+	std::atomic<bool> notify_flag_; //通知处理标志,false表示没有通知任务，true表示有通知任务，其他线程投递，不能和其他标志共用位域
+	uint32_t idle_flag_:1; //空闲处理标志,0表示不执行空闲任务，1表示执行空闲任务
+	uint32_t wait_timeout_:31; //服务等待时间（毫秒）
+	std::chrono::steady_clock::time_point timer_time_; //最短定时任务时间,0表示没有定时任务，非0表示最短定时任务
+	uint32_t busy_poll_us_; //忙轮询时间（微秒），有事件后这段时间内不阻塞等待，0表示不忙轮询
+	std::chrono::steady_clock::time_point busy_time_; //最近一次处理事件的时间
+	bool stat_flag_; //是否统计唤醒延迟
+	std::atomic<int64_t> notify_time_; //最早未处理通知的投递时间（steady_clock纳秒），0表示没有
+	std::chrono::steady_clock::time_point wait_time_; //本次等待开始时间
+	std::chrono::steady_clock::time_point load_time_; //本负载窗口开始时间
+	uint64_t wait_ns_; //本负载窗口等待时间（纳秒）
+	std::atomic<uint32_t> load_; //最近的负载（千分比）
+	std::atomic<uint64_t> busy_ns_; //累计忙时间（纳秒）
+	std::atomic<uint64_t> run_ns_; //累计运行时间（纳秒）
+	//统计数据，服务线程写，其他线程可以随时读
+	struct {
+		std::atomic<uint64_t> wakeups;
+		std::atomic<uint64_t> total_us;
+		std::atomic<uint64_t> max_us;
+		std::atomic<uint64_t> hist[ServiceStat::HIST_COUNT];
+		std::atomic<uint64_t> spins;
+		std::atomic<uint64_t> blocks;
+	} stat_;
+public:
+	static Service* service();
+
+	Service();
+
+	inline bool StartTest()
+	{
+		bool expected = true;
+		if (!stop_flag_.compare_exchange_strong(expected, false)) {
+			return false; //已经Start过了
+		}
+		return true;
+	}
+	inline void Start() { ASSERT(!IsStopFlag()); }
+	inline bool StopTest()
+	{
+		bool expected = false;
+		if (!stop_flag_.compare_exchange_strong(expected, true)) {
+			return false; //已经Stop过了
+		}
+		return true;
+	}
+	inline void Stop() { ASSERT(IsStopFlag()); }
+	inline bool IsStopFlag() { return stop_flag_; }
+
+	inline void SetWaitTimeOut(size_t millis) { wait_timeout_ = millis; }
+	inline size_t GetWaitTimeOut() { return wait_timeout_; }
+	
+	inline void PostNotify() { 
+		if(stat_flag_) {
+			int64_t expected = 0;
+			notify_time_.compare_exchange_strong(expected, std::chrono::steady_clock::now().time_since_epoch().count());
+		}
+		notify_flag_ = true; idle_flag_ = false; 
+	}
+
+	//设置忙轮询时间（微秒），有事件后usecs微秒内以超时0轮询，之后退回阻塞等待，0表示关闭
+	inline void SetBusyPoll(size_t usecs) { busy_poll_us_ = (uint32_t)usecs; }
+	inline size_t GetBusyPoll() { return busy_poll_us_; }
+	inline bool IsBusyPoll() { return busy_poll_us_ != 0; }
+
+	//开启/关闭唤醒延迟统计
+	inline void EnableStat(bool enable) { stat_flag_ = enable; }
+	inline bool IsEnableStat() { return stat_flag_; }
+	void GetStat(ServiceStat& stat);
+	void ResetStat();
+
+	//服务线程最近的负载（千分比，0~1000），负载均衡时使用，其他线程可以随时读
+	inline uint32_t GetLoad() { return load_.load(std::memory_order_relaxed); }
+
+	//millis毫秒后在服务线程执行cb，返回定时器ID，返回0表示服务不支持定时器（由SocketSet等服务实现）
+	virtual uint64_t AddTimer(size_t, std::function<void()>&&) { return 0; }
+	virtual bool CancelTimer(uint64_t) { return false; }
+
+	inline void PostTimer(size_t millis) { 
+		std::chrono::steady_clock::time_point time = std::chrono::steady_clock::now() + std::chrono::milliseconds(millis);
+		if(!timer_time_.time_since_epoch().count()) {
+			timer_time_ = time;
+		} else if(timer_time_ > time) { 
+			timer_time_ = time; 
+		} 
+	}
+	
+protected:
+	//
+	inline size_t GetWaitingTimeOut()
+	{
+		if(notify_flag_) {
+			return 0;
+		}
+		if(IsBusyPolling()) {
+			if(stat_flag_) {
+				stat_.spins.fetch_add(1, std::memory_order_relaxed);
+			}
+			return 0;
+		}
+		size_t timeout = wait_timeout_;
+		if(timer_time_.time_since_epoch().count()) {
+			std::chrono::milliseconds span = std::chrono::duration_cast<std::chrono::milliseconds>(timer_time_ - std::chrono::steady_clock::now());
+			int64_t span_count = span.count();
+			if(span_count <= 0) {
+				timeout = 0;
+			} else if(span_count < wait_timeout_) {
+				timeout = span_count;
+			}
+		}
+		if(stat_flag_ && timeout) {
+			stat_.blocks.fetch_add(1, std::memory_order_relaxed);
+		}
+		return timeout;
+	}
+
+	//等待事件前后调用，统计服务线程忙/闲时间
+	inline void BeginWait()
+	{
+		wait_time_ = std::chrono::steady_clock::now();
+	}
+	inline void EndWait()
+	{
+		wait_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - wait_time_).count();
+	}
+
+	//每轮循环调用，到了统计窗口就更新负载
+	inline void CheckLoad(const std::chrono::steady_clock::time_point& now)
+	{
+		if(now - load_time_ >= std::chrono::milliseconds(DEFAULT_SERVICE_LOAD_WINDOW)) {
+			UpdateLoad(now);
+		}
+	}
+	void UpdateLoad(const std::chrono::steady_clock::time_point& now);
+
+	//有事件处理，开始/延续忙轮询
+	inline void MarkBusy()
+	{
+		if(busy_poll_us_) {
+			busy_time_ = std::chrono::steady_clock::now();
+		}
+	}
+
+	//是否在忙轮询时间内
+	inline bool IsBusyPolling()
+	{
+		if(!busy_poll_us_) {
+			return false;
+		}
+		return (std::chrono::steady_clock::now() - busy_time_) < std::chrono::microseconds(busy_poll_us_);
+	}
+
+	//统计通知唤醒延迟
+	inline void StatNotify()
+	{
+		int64_t post_time = notify_time_.exchange(0);
+		if(!post_time || !stat_flag_) {
+			return;
+		}
+		int64_t span = std::chrono::steady_clock::now().time_since_epoch().count() - post_time;
+		uint64_t us = span > 0 ? (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::duration(span)).count() : 0;
+		stat_.wakeups.fetch_add(1, std::memory_order_relaxed);
+		stat_.total_us.fetch_add(us, std::memory_order_relaxed);
+		if(us > stat_.max_us.load(std::memory_order_relaxed)) {
+			stat_.max_us.store(us, std::memory_order_relaxed);
+		}
+		int bucket = 0;
+		while(us && bucket < ServiceStat::HIST_COUNT - 1) {
+			us >>= 1;
+			bucket++;
+		}
+		stat_.hist[bucket].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	virtual bool OnInit();
+
+	virtual void OnTerm()
+	{
+
+	}
+
+	virtual void OnNotify()
+	{
+
+	}
+
+	virtual void OnWait()
+	{
+
+	}
+	
+	virtual void OnTimer()
+	{
+
+	}
+
+	virtual void OnIdle()
+	{
+
+	}
+	
+	virtual void OnRun()
+	{
+		if(OnInit()) {
+			while (!IsStopFlag()) {
+				std::chrono::steady_clock::time_point tp = std::chrono::steady_clock::now();
+				CheckLoad(tp);
+				if(notify_flag_.exchange(false)) {
+					idle_flag_ = true;
+					StatNotify();
+					MarkBusy();
+					OnNotify();
+				}
+				if(IsStopFlag()) {
+					break;
+				}
+				OnWait();
+				if(IsStopFlag()) {
+					break;
+				}
+				if(timer_time_.time_since_epoch().count()) {
+					if(timer_time_ <= std::chrono::steady_clock::now()) {
+						timer_time_ = std::chrono::steady_clock::time_point();
+						OnTimer();
+					}
+				}
+				if(idle_flag_) {
+					if(IsStopFlag()) {
+						break;
+					}
+					OnIdle(/*std::chrono::duration_cast<std::chrono::milliseconds>(tp.time_since_epoch()).count()*/);
+					if(IsStopFlag()) {
+						break;
+					}
+					if(!wait_timeout_ && !IsBusyPolling()) {
+						static const std::chrono::microseconds max_span(200);
+						std::chrono::microseconds tp_span = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tp);
+						if(tp_span < max_span) {
+							//std::this_thread::yield();
+							//std::this_thread::sleep_for(std::chrono::nanoseconds(1));
+							BeginWait();
+							std::this_thread::sleep_for(max_span-tp_span);
+							EndWait();
+						}
+					}
+				}
+			}
+		}
+		OnTerm();
+	}
+};
+
+/*!
+ *	@brief TaskID 定义.
+ *
+ *	封装TaskID，实现Task唯一表示，和比较大小
+ */
+struct TaskID
+{
+	TaskID(size_t _delay = 0) : id(IDGenerator<size_t>::Inst().get()), time(std::chrono::steady_clock::now() + std::chrono::milliseconds(_delay)), handle(0) {}
+
+	inline bool operator<(const TaskID &o) const
+	{
+		if (time < o.time) {
+			return true;
+		} else if (time > o.time) {
+			return false;
+		}
+		return id < o.id;
+	}
+
+	const size_t id;
+	const std::chrono::steady_clock::time_point time;
+	mutable uint64_t handle; //投递后在TaskHeap里的句柄，取消时直接定位
+};
+
+#ifndef DEFAULT_TASK_INLINE_SIZE
+#define DEFAULT_TASK_INLINE_SIZE 64 //TaskFunction内联存储大小（字节）
+#endif//
+
+#ifndef DEFAULT_TASK_CACHE_COUNT
+#define DEFAULT_TASK_CACHE_COUNT 256 //TaskCache每个线程最多缓存的空闲块数，满了整批交给共享仓库
+#endif//
+
+#ifndef DEFAULT_TASK_CACHE_DEPOT
+#define DEFAULT_TASK_CACHE_DEPOT 64 //TaskCache共享仓库最多保存的批数
+#endif//
+
+/*!
+ *	@brief TaskCache 模板定义.
+ *
+ *	线程本地的定长空闲块缓存，任务节点、任务状态等频繁分配释放的对象用它代替堆分配，
+ *	在哪个线程释放就缓存在哪个线程；本地缓存满DEFAULT_TASK_CACHE_COUNT后整批放入共享仓库，
+ *	本地缓存空了再从仓库整批取回，这样一个线程分配、另一个线程释放的生产者/消费者模式也能复用
+ */
+template<class T>
+class TaskCache
+{
+	struct Block
+	{
+		Block* next;
+	};
+	struct FreeList
+	{
+		Block* head = nullptr;
+		size_t count = 0;
+		~FreeList()
+		{
+			while (head)
+			{
+				Block* next = head->next;
+				::operator delete(head);
+				head = next;
+			}
+		}
+	};
+	struct Batch
+	{
+		Block* head;
+		size_t count;
+	};
+	struct Depot
+	{
+		std::mutex mutex;
+		std::vector<Batch> batches;
+	};
+	static inline FreeList& Local()
+	{
+		static thread_local FreeList s_list;
+		return s_list;
+	}
+	static inline Depot& Shared()
+	{
+		//不析构，避免退出时其他线程还在归还
+		static Depot* s_depot = new Depot();
+		return *s_depot;
+	}
+	enum { BLOCK_SIZE = sizeof(T) > sizeof(Block) ? sizeof(T) : sizeof(Block) };
+public:
+	static inline void* Alloc(size_t size)
+	{
+		if (size != sizeof(T)) {
+			return ::operator new(size);
+		}
+		FreeList& list = Local();
+		if (list.head) {
+			Block* block = list.head;
+			list.head = block->next;
+			list.count--;
+			return block;
+		}
+		Depot& depot = Shared();
+		{
+			std::unique_lock<std::mutex> lock(depot.mutex);
+			if (!depot.batches.empty()) {
+				Batch batch = depot.batches.back();
+				depot.batches.pop_back();
+				lock.unlock();
+				list.head = batch.head->next;
+				list.count = batch.count - 1;
+				return batch.head;
+			}
+		}
+		return ::operator new(BLOCK_SIZE);
+	}
+	static inline void Free(void* ptr, size_t size)
+	{
+		if (!ptr) {
+			return;
+		}
+		if (size != sizeof(T)) {
+			::operator delete(ptr);
+			return;
+		}
+		FreeList& list = Local();
+		if (list.count >= DEFAULT_TASK_CACHE_COUNT) {
+			Depot& depot = Shared();
+			std::unique_lock<std::mutex> lock(depot.mutex);
+			if (depot.batches.size() >= DEFAULT_TASK_CACHE_DEPOT) {
+				lock.unlock();
+				::operator delete(ptr);
+				return;
+			}
+			depot.batches.push_back({ list.head, list.count });
+			list.head = nullptr;
+			list.count = 0;
+		}
+		Block* block = (Block*)ptr;
+		block->next = list.head;
+		list.head = block;
+		list.count++;
+	}
+};
+
+/*!
+ *	@brief TaskFunction 定义.
  *
- *	封装Service，实现基本服务框架
+ *	只能移动的void()任务，不超过DEFAULT_TASK_INLINE_SIZE字节的可调用对象直接存放在对象里，不分配堆内存，
+ *	可以从lambda、std::bind、std::function等隐式构造
  */
-class Service 
+class TaskFunction
 {
 protected:
-    //停止标记，默认停止状态，启动后停止状态为false
-    std::atomic<bool> stop_flag_;
-	uint32_t idle_flag_:1; //空闲处理标志,0表示不执行空闲任务，1表示执行空闲任务
-	uint32_t notify_flag_:1; //通知处理标志,0表示没有通知任务，1表示有通知任务
-	uint32_t wait_timeout_:30; //服务等待时间（毫秒）
-	std::chrono::steady_clock::time_point timer_time_; //最短定时任务时间,0表示没有定时任务，非0表示最短定时任务
+	struct Ops
+	{
+		void (*call)(void* p);
+		void (*move)(void* dst, void* src);
+		void (*destroy)(void* p);
+	};
+	template<class F>
+	struct InlineOps
+	{
+		static void Call(void* p) { (*(F*)p)(); }
+		static void Move(void* dst, void* src) { new (dst) F(std::move(*(F*)src)); ((F*)src)->~F(); }
+		static void Destroy(void* p) { ((F*)p)->~F(); }
+		static const Ops ops;
+	};
+	template<class F>
+	struct HeapOps
+	{
+		static void Call(void* p) { (**(F**)p)(); }
+		static void Move(void* dst, void* src) { *(F**)dst = *(F**)src; }
+		static void Destroy(void* p) { delete *(F**)p; }
+		static const Ops ops;
+	};
+	template<class F>
+	struct IsInline
+	{
+		enum { value = sizeof(F) <= DEFAULT_TASK_INLINE_SIZE && alignof(F) <= alignof(std::max_align_t)
+			&& std::is_nothrow_move_constructible<F>::value };
+	};
+	typename std::aligned_storage<DEFAULT_TASK_INLINE_SIZE, alignof(std::max_align_t)>::type buf_;
+	const Ops* ops_ = nullptr;
 public:
-	static Service* service();
+	TaskFunction() {}
+	TaskFunction(std::nullptr_t) {}
+	template<class F, class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, TaskFunction>::value>::type>
+	TaskFunction(F&& f)
+	{
+		typedef typename std::decay<F>::type Fn;
+		if (IsNull(f)) {
+			return;
+		}
+		Init<Fn>(std::forward<F>(f), std::integral_constant<bool, IsInline<Fn>::value>());
+	}
+	TaskFunction(TaskFunction&& o) noexcept
+	{
+		if (o.ops_) {
+			o.ops_->move(&buf_, &o.buf_);
+			ops_ = o.ops_;
+			o.ops_ = nullptr;
+		}
+	}
+	TaskFunction(const TaskFunction&) = delete;
+	~TaskFunction()
+	{
+		Reset();
+	}
 
-	Service();
+	TaskFunction& operator=(TaskFunction&& o)
+	{
+		if (this != &o) {
+			Reset();
+			if (o.ops_) {
+				o.ops_->move(&buf_, &o.buf_);
+				ops_ = o.ops_;
+				o.ops_ = nullptr;
+			}
+		}
+		return *this;
+	}
+	TaskFunction& operator=(const TaskFunction&) = delete;
+	TaskFunction& operator=(std::nullptr_t)
+	{
+		Reset();
+		return *this;
+	}
 
-	inline bool StartTest()
+	inline void operator()()
 	{
-		bool expected = true;
-		if (!stop_flag_.compare_exchange_strong(expected, false)) {
-			return false; //已经Start过了
+		if (!ops_) {
+			throw std::bad_function_call();
 		}
-		return true;
+		ops_->call(&buf_);
 	}
-	inline void Start() { ASSERT(!IsStopFlag()); }
-	inline bool StopTest()
+
+	explicit operator bool() const { return ops_ != nullptr; }
+
+	inline void Reset()
 	{
-		bool expected = false;
-		if (!stop_flag_.compare_exchange_strong(expected, true)) {
-			return false; //已经Stop过了
+		if (ops_) {
+			ops_->destroy(&buf_);
+			ops_ = nullptr;
 		}
-		return true;
 	}
-	inline void Stop() { ASSERT(IsStopFlag()); }
-	inline bool IsStopFlag() { return stop_flag_; }
 
-	inline void SetWaitTimeOut(size_t millis) { wait_timeout_ = millis; }
-	inline size_t GetWaitTimeOut() { return wait_timeout_; }
-	
-	inline void PostNotify() { notify_flag_ = true; idle_flag_ = false; }
-	inline void PostTimer(size_t millis) { 
-		std::chrono::steady_clock::time_point time = std::chrono::steady_clock::now() + std::chrono::milliseconds(millis);
-		if(!timer_time_.time_since_epoch().count()) {
-			timer_time_ = time;
-		} else if(timer_time_ > time) { 
-			timer_time_ = time; 
-		} 
+protected:
+	template<class F>
+	static inline bool IsNull(const F&) { return false; }
+	static inline bool IsNull(const std::function<void()>& f) { return !f; }
+	template<class R>
+	static inline bool IsNull(R (*f)()) { return !f; }
+
+	template<class Fn, class F>
+	inline void Init(F&& f, std::true_type)
+	{
+		new (&buf_) Fn(std::forward<F>(f));
+		ops_ = &InlineOps<Fn>::ops;
 	}
-	
+	template<class Fn, class F>
+	inline void Init(F&& f, std::false_type)
+	{
+		*(Fn**)&buf_ = new Fn(std::forward<F>(f));
+		ops_ = &HeapOps<Fn>::ops;
+	}
+};
+
+template<class F>
+const TaskFunction::Ops TaskFunction::InlineOps<F>::ops = { &TaskFunction::InlineOps<F>::Call, &TaskFunction::InlineOps<F>::Move, &TaskFunction::InlineOps<F>::Destroy };
+template<class F>
+const TaskFunction::Ops TaskFunction::HeapOps<F>::ops = { &TaskFunction::HeapOps<F>::Call, &TaskFunction::HeapOps<F>::Move, &TaskFunction::HeapOps<F>::Destroy };
+
+/*!
+ *	@brief TaskValue 模板定义.
+ *
+ *	TaskState的结果存储，结果直接放在状态里
+ */
+template<class R>
+struct TaskValue
+{
+	typename std::aligned_storage<sizeof(R), alignof(R)>::type buf;
+	bool has = false;
+	~TaskValue() { if (has) { ((R*)&buf)->~R(); } }
+	template<class V>
+	inline void Set(V&& v) { new (&buf) R(std::forward<V>(v)); has = true; }
+	inline R Get() { return std::move(*(R*)&buf); }
+};
+template<class R>
+struct TaskValue<R&>
+{
+	R* ptr = nullptr;
+	inline void Set(R& v) { ptr = &v; }
+	inline R& Get() { return *ptr; }
+};
+template<>
+struct TaskValue<void>
+{
+	inline void Set() { }
+	inline void Get() { }
+};
+
+/*!
+ *	@brief TaskState 模板定义.
+ *
+ *	TaskPromise/TaskFuture共享状态，引用计数，从TaskCache分配，
+ *	结果就绪后只有在有线程等待或者转成了std::future时才加锁通知
+ */
+template<class R>
+class TaskState
+{
+public:
+	std::atomic<int> ref;
+	std::atomic<bool> ready;
+	std::atomic<bool> waiting;
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::exception_ptr error;
+	TaskValue<R> value;
+	std::promise<R>* bridge = nullptr; //TaskFuture转成std::future后，结果就绪时转交给它
+
+	TaskState():ref(2),ready(false),waiting(false) {}
+	~TaskState() { delete bridge; }
+
+	static void* operator new(size_t size) { return TaskCache<TaskState>::Alloc(size); }
+	static void operator delete(void* ptr, size_t size) { TaskCache<TaskState>::Free(ptr, size); }
+
+	inline void Release()
+	{
+		if (ref.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			delete this;
+		}
+	}
+
+	inline void Ready()
+	{
+		ready.store(true);
+		if (waiting.load()) {
+			//先加锁一次确保等待方已进入wait，解锁后再唤醒，避免被唤醒方立即阻塞在mutex上
+			std::promise<R>* promise = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				std::swap(promise, bridge);
+			}
+			if (promise) {
+				Forward(*promise);
+				delete promise;
+			}
+			cv.notify_all();
+		}
+	}
+
+	//转成std::future，已经就绪就直接转交结果，否则挂上bridge等Ready转交
+	inline std::future<R> Bridge()
+	{
+		std::promise<R>* promise = new std::promise<R>();
+		std::future<R> res = promise->get_future();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			waiting.store(true);
+			if (!ready.load()) {
+				bridge = promise;
+				promise = nullptr;
+			}
+		}
+		if (promise) {
+			Forward(*promise);
+			delete promise;
+		}
+		return res;
+	}
+
+	inline void Wait()
+	{
+		if (ready.load(std::memory_order_acquire)) {
+			return;
+		}
+		std::unique_lock<std::mutex> lock(mutex);
+		waiting.store(true);
+		while (!ready.load())
+		{
+			cv.wait(lock);
+		}
+	}
+
+	template<class Clock, class Duration>
+	inline std::future_status WaitUntil(const std::chrono::time_point<Clock, Duration>& time)
+	{
+		if (ready.load(std::memory_order_acquire)) {
+			return std::future_status::ready;
+		}
+		std::unique_lock<std::mutex> lock(mutex);
+		waiting.store(true);
+		while (!ready.load())
+		{
+			if (cv.wait_until(lock, time) == std::cv_status::timeout) {
+				return ready.load() ? std::future_status::ready : std::future_status::timeout;
+			}
+		}
+		return std::future_status::ready;
+	}
+
 protected:
-	//
-	inline size_t GetWaitingTimeOut()
+	inline void Forward(std::promise<R>& promise)
 	{
-		if(notify_flag_) {
+		if (error) {
+			promise.set_exception(error);
+		} else {
+			Forward(promise, std::is_void<R>());
+		}
+	}
+	inline void Forward(std::promise<R>& promise, std::true_type) { value.Get(); promise.set_value(); }
+	inline void Forward(std::promise<R>& promise, std::false_type) { promise.set_value(value.Get()); }
+};
+
+/*!
+ *	@brief TaskFuture 模板定义.
+ *
+ *	轻量的future，接口和std::future一致，get后失效；
+ *	可以隐式转成std::future，原来用std::future接收Send/PostF结果的代码不用改，转换多一次分配
+ */
+template<class R>
+class TaskFuture
+{
+	template<class> friend class TaskPromise;
+protected:
+	TaskState<R>* state_ = nullptr;
+	explicit TaskFuture(TaskState<R>* state):state_(state) {}
+public:
+	TaskFuture() {}
+	TaskFuture(TaskFuture&& o) noexcept:state_(o.state_) { o.state_ = nullptr; }
+	TaskFuture(const TaskFuture&) = delete;
+	~TaskFuture() { if (state_) { state_->Release(); } }
+
+	TaskFuture& operator=(TaskFuture&& o)
+	{
+		if (this != &o) {
+			if (state_) {
+				state_->Release();
+			}
+			state_ = o.state_;
+			o.state_ = nullptr;
+		}
+		return *this;
+	}
+	TaskFuture& operator=(const TaskFuture&) = delete;
+
+	inline bool valid() const { return state_ != nullptr; }
+
+	inline void wait() const
+	{
+		if (!state_) {
+			throw std::future_error(std::future_errc::no_state);
+		}
+		state_->Wait();
+	}
+
+	template<class Rep, class Period>
+	inline std::future_status wait_for(const std::chrono::duration<Rep, Period>& span) const
+	{
+		return wait_until(std::chrono::steady_clock::now() + span);
+	}
+
+	template<class Clock, class Duration>
+	inline std::future_status wait_until(const std::chrono::time_point<Clock, Duration>& time) const
+	{
+		if (!state_) {
+			throw std::future_error(std::future_errc::no_state);
+		}
+		return state_->WaitUntil(time);
+	}
+
+	inline R get()
+	{
+		wait();
+		TaskState<R>* state = state_;
+		state_ = nullptr;
+		std::unique_ptr<TaskState<R>, void(*)(TaskState<R>*)> guard(state, [](TaskState<R>* s) { s->Release(); });
+		if (state->error) {
+			std::rethrow_exception(state->error);
+		}
+		return state->value.Get();
+	}
+
+	//转换后失效
+	inline operator std::future<R>()
+	{
+		if (!state_) {
+			throw std::future_error(std::future_errc::no_state);
+		}
+		TaskState<R>* state = state_;
+		state_ = nullptr;
+		std::future<R> res = state->Bridge();
+		state->Release();
+		return res;
+	}
+};
+
+/*!
+ *	@brief TaskPromise 模板定义.
+ *
+ *	轻量的promise，只能设置一次结果，没设置结果就析构时future得到broken_promise异常
+ */
+template<class R>
+class TaskPromise
+{
+protected:
+	TaskState<R>* state_;
+	bool future_ = false;
+public:
+	TaskPromise():state_(new TaskState<R>()) {}
+	TaskPromise(TaskPromise&& o) noexcept:state_(o.state_),future_(o.future_) { o.state_ = nullptr; }
+	TaskPromise(const TaskPromise&) = delete;
+	~TaskPromise()
+	{
+		if (state_) {
+			if (!state_->ready.load(std::memory_order_relaxed)) {
+				state_->error = std::make_exception_ptr(std::future_error(std::future_errc::broken_promise));
+				state_->Ready();
+			}
+			if (!future_) {
+				//没有取future，释放future的引用
+				state_->Release();
+			}
+			state_->Release();
+		}
+	}
+
+	TaskPromise& operator=(TaskPromise&& o)
+	{
+		if (this != &o) {
+			TaskPromise tmp(std::move(*this));
+			state_ = o.state_;
+			future_ = o.future_;
+			o.state_ = nullptr;
+		}
+		return *this;
+	}
+	TaskPromise& operator=(const TaskPromise&) = delete;
+
+	inline TaskFuture<R> get_future()
+	{
+		if (!state_) {
+			throw std::future_error(std::future_errc::no_state);
+		}
+		if (future_) {
+			throw std::future_error(std::future_errc::future_already_retrieved);
+		}
+		future_ = true;
+		return TaskFuture<R>(state_);
+	}
+
+	template<class... V>
+	inline void set_value(V&&... v)
+	{
+		Check();
+		state_->value.Set(std::forward<V>(v)...);
+		state_->Ready();
+	}
+
+	inline void set_exception(std::exception_ptr e)
+	{
+		Check();
+		state_->error = e;
+		state_->Ready();
+	}
+
+	//执行fn并设置结果或者异常
+	template<class Fn>
+	inline void Run(Fn& fn)
+	{
+		try {
+			Invoke(fn, std::is_void<R>());
+		} catch(...) {
+			set_exception(std::current_exception());
+		}
+	}
+
+protected:
+	inline void Check()
+	{
+		if (!state_) {
+			throw std::future_error(std::future_errc::no_state);
+		}
+		if (state_->ready.load(std::memory_order_relaxed)) {
+			throw std::future_error(std::future_errc::promise_already_satisfied);
+		}
+	}
+	template<class Fn>
+	inline void Invoke(Fn& fn, std::true_type) { fn(); set_value(); }
+	template<class Fn>
+	inline void Invoke(Fn& fn, std::false_type) { set_value(fn()); }
+};
+
+/*!
+ *	@brief TaskPackage 模板定义.
+ *
+ *	把可调用对象和TaskPromise打包成TaskFunction任务，代替shared_ptr<packaged_task>
+ */
+template<class R, class Fn>
+struct TaskPackage
+{
+	TaskPromise<R> promise;
+	Fn fn;
+	TaskPackage(TaskPromise<R>&& _promise, Fn&& _fn):promise(std::move(_promise)),fn(std::move(_fn)) {}
+	inline void operator()() { promise.Run(fn); }
+};
+
+//打包f(args...)，res返回结果future
+template<class F, class... Args>
+inline TaskFunction MakeTask(TaskFuture<typename std::result_of<F(Args...)>::type>& res, F&& f, Args&&... args)
+{
+	typedef typename std::result_of<F(Args...)>::type return_type;
+	typedef decltype(std::bind(std::forward<F>(f), std::forward<Args>(args)...)) bind_type;
+	TaskPromise<return_type> promise;
+	res = promise.get_future();
+	return TaskPackage<return_type, bind_type>(std::move(promise), std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+}
+
+/*!
+ *	@brief TaskHeap 模板定义.
+ *
+ *	延迟任务4叉最小堆，按(时间,投递顺序)排序，插入O(log n)，查看最早任务O(1)，
+ *	节点记录自己在堆里的位置，按句柄取消直接从堆中间删除O(log n)，
+ *	投递时可以带一个非0键（任务ID、对象指针），同键任务串成链表，按键取消O(k log n)，
+ *	句柄是高32位代数|低32位节点下标，0表示无效句柄，非线程安全
+ */
+template<class T>
+class TaskHeap
+{
+public:
+	typedef std::chrono::steady_clock::time_point time_point;
+protected:
+	struct Node
+	{
+		T value;
+		uintptr_t key = 0;
+		uint32_t gen = 0;
+		int next = -1; //空闲链表
+		int key_prev = -1; //同键链表
+		int key_next = -1;
+		size_t pos = 0; //在heap_里的位置
+		bool active = false; //false表示空闲
+	};
+	struct Entry
+	{
+		time_point time;
+		uint64_t seq;
+		uint32_t idx;
+		inline bool operator<(const Entry& o) const
+		{
+			if (time < o.time) {
+				return true;
+			} else if (time > o.time) {
+				return false;
+			}
+			return seq < o.seq;
+		}
+	};
+	std::vector<Node> nodes_;
+	std::vector<Entry> heap_;
+	std::unordered_map<uintptr_t, int> keys_; //键对应的同键链表头
+	int free_head_ = -1;
+	uint64_t seq_ = 0;
+public:
+	inline size_t Count() { return heap_.size(); }
+	inline bool IsEmpty() { return heap_.empty(); }
+
+	uint64_t Push(const time_point& time, T&& value, uintptr_t key = 0)
+	{
+		int idx = free_head_;
+		if (idx >= 0) {
+			free_head_ = nodes_[idx].next;
+		} else {
+			idx = nodes_.size();
+			nodes_.emplace_back();
+		}
+		Node& node = nodes_[idx];
+		node.value = std::move(value);
+		node.gen++;
+		if (!node.gen) {
+			node.gen++;
+		}
+		node.next = -1;
+		node.active = true;
+		LinkKey(idx, key);
+		Entry entry = { time, seq_++, (uint32_t)idx };
+		heap_.push_back(entry);
+		SiftUp(heap_.size() - 1);
+		return ((uint64_t)node.gen << 32) | (uint32_t)idx;
+	}
+
+	//句柄对应的任务，已取消或者已执行返回nullptr
+	inline T* Get(uint64_t handle)
+	{
+		uint32_t idx = (uint32_t)handle;
+		if (!handle || idx >= nodes_.size()) {
+			return nullptr;
+		}
+		Node& node = nodes_[idx];
+		if (!node.active || node.gen != (uint32_t)(handle >> 32)) {
+			return nullptr;
+		}
+		return &node.value;
+	}
+
+	inline bool Cancel(uint64_t handle)
+	{
+		if (!Get(handle)) {
+			return false;
+		}
+		Erase((uint32_t)handle);
+		return true;
+	}
+
+	//取消键为key的所有任务，返回取消个数
+	size_t CancelKey(uintptr_t key)
+	{
+		auto it = keys_.find(key);
+		if (it == keys_.end()) {
 			return 0;
 		}
-		if(timer_time_.time_since_epoch().count()) {
-			std::chrono::milliseconds span = std::chrono::duration_cast<std::chrono::milliseconds>(timer_time_ - std::chrono::steady_clock::now());
-			int64_t span_count = span.count();
-			if(span_count <= 0) {
-				return 0;
-			}
-			if(span_count < wait_timeout_) {
-				return span_count;
+		size_t count = 0;
+		int idx = it->second;
+		keys_.erase(it);
+		while (idx >= 0)
+		{
+			int next = nodes_[idx].key_next;
+			nodes_[idx].key = 0;
+			Erase(idx);
+			idx = next;
+			count++;
+		}
+		return count;
+	}
+
+	//取消所有满足条件的任务，返回取消个数，需要遍历所有任务，能用键时用CancelKey
+	template<class Pred>
+	size_t CancelIf(Pred pred)
+	{
+		size_t count = 0;
+		for (size_t i = 0; i < nodes_.size(); i++)
+		{
+			if (nodes_[i].active && pred(nodes_[i].value)) {
+				Erase(i);
+				count++;
 			}
 		}
-		return wait_timeout_;
+		return count;
 	}
 
-	virtual bool OnInit();
-
-	virtual void OnTerm()
+	//查看最早的任务时间，没有任务返回false
+	inline bool Peek(time_point& time)
 	{
-
+		if (heap_.empty()) {
+			return false;
+		}
+		time = heap_.front().time;
+		return true;
 	}
 
-	virtual void OnNotify()
+	//取出最早的任务，没有任务返回false
+	inline bool Pop(T& value)
 	{
-
+		if (heap_.empty()) {
+			return false;
+		}
+		uint32_t idx = heap_.front().idx;
+		value = std::move(nodes_[idx].value);
+		Erase(idx);
+		return true;
 	}
 
-	virtual void OnWait()
+	//取出已经到期的最早任务，delay返回最早任务剩余时间（毫秒），没有任务时delay为-1
+	inline bool PopActive(T& value, ssize_t* delay = nullptr)
 	{
-
+		time_point time;
+		if (!Peek(time)) {
+			if (delay) {
+				*delay = -1;
+			}
+			return false;
+		}
+		ssize_t diff = std::chrono::duration_cast<std::chrono::milliseconds>(time - std::chrono::steady_clock::now()).count();
+		if (delay) {
+			*delay = diff > 0 ? diff : 0;
+		}
+		if (diff > 0) {
+			return false;
+		}
+		return Pop(value);
 	}
-	
-	virtual void OnTimer()
-	{
 
+protected:
+	inline void LinkKey(uint32_t idx, uintptr_t key)
+	{
+		Node& node = nodes_[idx];
+		node.key = key;
+		node.key_prev = -1;
+		node.key_next = -1;
+		if (!key) {
+			return;
+		}
+		auto ret = keys_.emplace(key, (int)idx);
+		if (!ret.second) {
+			node.key_next = ret.first->second;
+			nodes_[node.key_next].key_prev = idx;
+			ret.first->second = idx;
+		}
 	}
 
-	virtual void OnIdle()
+	inline void UnlinkKey(uint32_t idx)
 	{
-
+		Node& node = nodes_[idx];
+		if (!node.key) {
+			return;
+		}
+		if (node.key_next >= 0) {
+			nodes_[node.key_next].key_prev = node.key_prev;
+		}
+		if (node.key_prev >= 0) {
+			nodes_[node.key_prev].key_next = node.key_next;
+		} else if (node.key_next >= 0) {
+			keys_[node.key] = node.key_next;
+		} else {
+			keys_.erase(node.key);
+		}
+		node.key = 0;
 	}
-	
-	virtual void OnRun()
+
+	//从堆中删除并释放节点，最后一项补到空位后向上或向下调整
+	inline void Erase(uint32_t idx)
 	{
-		if(OnInit()) {
-			while (!IsStopFlag()) {
-				std::chrono::steady_clock::time_point tp = std::chrono::steady_clock::now();
-				if(notify_flag_) {
-					notify_flag_ = false;
-					idle_flag_ = true;
-					OnNotify();
-				}
-				if(IsStopFlag()) {
-					break;
-				}
-				OnWait();
-				if(IsStopFlag()) {
-					break;
-				}
-				if(timer_time_.time_since_epoch().count()) {
-					if(timer_time_ <= std::chrono::steady_clock::now()) {
-						timer_time_ = std::chrono::steady_clock::time_point();
-						OnTimer();
-					}
-				}
-				if(idle_flag_) {
-					if(IsStopFlag()) {
-						break;
-					}
-					OnIdle(/*std::chrono::duration_cast<std::chrono::milliseconds>(tp.time_since_epoch()).count()*/);
-					if(IsStopFlag()) {
-						break;
-					}
-					if(!wait_timeout_) {
-						static const std::chrono::microseconds max_span(200);
-						std::chrono::microseconds tp_span = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tp);
-						if(tp_span < max_span) {
-							//std::this_thread::yield();
-							//std::this_thread::sleep_for(std::chrono::nanoseconds(1));
-							std::this_thread::sleep_for(max_span-tp_span);
-						}
-					}
-				}
+		Node& node = nodes_[idx];
+		size_t pos = node.pos;
+		UnlinkKey(idx);
+		node.value = T();
+		node.active = false;
+		node.next = free_head_;
+		free_head_ = idx;
+		size_t last = heap_.size() - 1;
+		if (pos != last) {
+			heap_[pos] = heap_[last];
+			nodes_[heap_[pos].idx].pos = pos;
+			heap_.pop_back();
+			if (pos > 0 && heap_[pos] < heap_[(pos - 1) / 4]) {
+				SiftUp(pos);
+			} else {
+				SiftDown(pos);
 			}
+		} else {
+			heap_.pop_back();
 		}
-		OnTerm();
 	}
-};
-
-/*!
- *	@brief TaskID 定义.
- *
- *	封装TaskID，实现Task唯一表示，和比较大小
- */
-struct TaskID
-{
-	TaskID(size_t _delay = 0) : id(IDGenerator<size_t>::Inst().get()), time(std::chrono::steady_clock::now() + std::chrono::milliseconds(_delay)) {}
 
-	inline bool operator<(const TaskID &o) const
+	inline void SiftUp(size_t i)
 	{
-		if (time < o.time) {
-			return true;
-		} else if (time > o.time) {
-			return false;
+		Entry entry = heap_[i];
+		while (i > 0)
+		{
+			size_t parent = (i - 1) / 4;
+			if (!(entry < heap_[parent])) {
+				break;
+			}
+			heap_[i] = heap_[parent];
+			nodes_[heap_[i].idx].pos = i;
+			i = parent;
 		}
-		return id < o.id;
+		heap_[i] = entry;
+		nodes_[entry.idx].pos = i;
 	}
 
-	const size_t id;
-	const std::chrono::steady_clock::time_point time;
+	inline void SiftDown(size_t i)
+	{
+		size_t size = heap_.size();
+		if (i >= size) {
+			return;
+		}
+		Entry entry = heap_[i];
+		for (;;)
+		{
+			size_t child = i * 4 + 1;
+			if (child >= size) {
+				break;
+			}
+			size_t best = child;
+			size_t end = std::min(child + 4, size);
+			for (size_t c = child + 1; c < end; c++)
+			{
+				if (heap_[c] < heap_[best]) {
+					best = c;
+				}
+			}
+			if (!(heap_[best] < entry)) {
+				break;
+			}
+			heap_[i] = heap_[best];
+			nodes_[heap_[i].idx].pos = i;
+			i = best;
+		}
+		heap_[i] = entry;
+		nodes_[entry.idx].pos = i;
+	}
 };
 
 /*!
@@ -865,23 +3450,26 @@ struct TaskID
  */
 class TaskQue
 {
+protected:
+	struct DelayTask
+	{
+		size_t id = 0;
+		TaskFunction task;
+	};
 public:
-	inline void Push(const TaskID& key, std::function<void()> && task)
+	inline void Push(const TaskID& key, TaskFunction && task)
 	{
 		//std::lock_guard<std::mutex> lock(mutex_);
-		auto it = tasks_.emplace(key,std::move(task));
-		ASSERT(it.second);
+		DelayTask value;
+		value.id = key.id;
+		value.task = std::move(task);
+		key.handle = tasks_.Push(key.time, std::move(value), key.id);
 #ifdef _DEBUG
-		printf("task pool delay queue:");
-		for(auto& pr : tasks_) {
-			ssize_t delay = std::chrono::duration_cast<std::chrono::milliseconds>(pr.first.time-std::chrono::steady_clock::now()).count();
-			printf("%d ", (int)delay);
-		}
-		printf("\n");
+		printf("task pool delay queue: %d\n", (int)tasks_.Count());
 #endif//
 	}
 
-	inline void Push(std::function<void()> && task)
+	inline void Push(TaskFunction && task)
 	{		
 		// TaskID key;
 		// Post(key, std::move(task));
@@ -892,23 +3480,48 @@ public:
 	inline void Remove(const TaskID& t)
 	{
 		//std::unique_lock<std::mutex> lock(mutex_);
-		tasks_.erase(t);
+		DelayTask* value = tasks_.Get(t.handle);
+		if (value && value->id == t.id) {
+			tasks_.Cancel(t.handle);
+			return;
+		}
+		//投递前复制的TaskID没有句柄，按ID取消
+		tasks_.CancelKey(t.id);
 	}
 
-	inline bool Count() { return tasks_que_.size() + tasks_.size(); }
-	inline bool IsEmpty() { return tasks_que_.empty() && tasks_.empty(); }
+	inline size_t Count() { return tasks_que_.size() + tasks_.Count(); }
+	inline bool IsEmpty() { return tasks_que_.empty() && tasks_.IsEmpty(); }
+
+	//查看最早的任务，delay返回剩余延迟时间（毫秒），没有任务返回false
+	inline bool Peek(ssize_t* delay)
+	{
+		if (!tasks_que_.empty()) {
+			if(delay) {
+				*delay = 0;
+			}
+			return true;
+		} else {
+			TaskHeap<DelayTask>::time_point time;
+			if (tasks_.Peek(time)) {
+				if(delay) {
+					*delay = std::chrono::duration_cast<std::chrono::milliseconds>(time-std::chrono::steady_clock::now()).count();
+				}
+				return true;
+			}
+		}
+		return false;
+	}
 
-	inline bool Pop(std::function<void()>& task, ssize_t* dealy)
+	inline bool Pop(TaskFunction& task, ssize_t* dealy)
 	{
 		if (!tasks_que_.empty()) {
 			task = std::move(tasks_que_.front());
 			tasks_que_.pop();
 			return true;
 		} else {
-			auto it = tasks_.begin();
-			if(IsActive(it->first, dealy)) {
-				task = std::move(it->second);
-				tasks_.erase(it);
+			DelayTask value;
+			if(tasks_.PopActive(value, dealy)) {
+				task = std::move(value.task);
 				return true;
 			}
 		}
@@ -925,28 +3538,59 @@ protected:
 	}
 	
 private:
-	std::map<TaskID,std::function<void()>> tasks_;
-	std::queue<std::function<void()>> tasks_que_;
+	TaskHeap<DelayTask> tasks_;
+	std::queue<TaskFunction> tasks_que_;
 };
 
 /*!
  *	@brief ThreadPool 模板定义.
  *
- *	封装ThreadPool，线程池
+ *	封装ThreadPool，工作窃取线程池，每个工作线程一个Chase-Lev队列，
+ *	工作线程投递的任务放自己队列，外部线程投递的任务放进全局注入队列，Start之前投递的任务也在这里等Start，
+ *	空闲线程先取注入队列再从其他线程队列窃取，没有任务时单独等待，
+ *	同一时间最多只有一个刚唤醒还没醒来的线程，醒来拿到任务后还有剩余再唤醒下一个，延迟任务仍然放在TaskQue里
  */
 class ThreadPool : public TaskQue
 {
+protected:
+	//任务节点，工作线程投递时直接放自己队列，注入队列的任务由工作线程成批取出后转成节点
+	struct Task : public MPSCNode
+	{
+		TaskFunction func;
+		Task(TaskFunction&& _func):func(std::move(_func)) {}
+		static void* operator new(size_t size) { return TaskCache<Task>::Alloc(size); }
+		static void operator delete(void* ptr, size_t size) { TaskCache<Task>::Free(ptr, size); }
+	};
+	struct Worker
+	{
+		ThreadPool* pool = nullptr;
+		size_t index = 0;
+		StealDeque<Task*> deque; //本线程任务，本线程后进先出，其他线程先进先出窃取
+		size_t tick = 0; //执行的任务数，定期先看注入队列，避免本线程队列一直不空时外部任务饿死
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::atomic<bool> wake; //已经唤醒还没醒来，避免重复唤醒
+		std::atomic<bool> parked;
+		std::thread thread;
+		Worker():wake(false),parked(false) {}
+	};
 public:
 	static ThreadPool& Inst() {
 		static ThreadPool _inst(std::thread::hardware_concurrency() + 1);
 		return _inst;
 	}
 
-	ThreadPool() : stop_flag_(true)
+	enum
+	{
+		INJECT_BATCH = 64, //一次从注入队列转到自己队列的最多任务数
+		INJECT_TICK = 61, //每执行这么多任务先看一次注入队列
+	};
+
+	ThreadPool() : stop_flag_(true), inject_head_(0), inject_size_(0), post_next_(0), parked_count_(0), waking_count_(0), delay_time_(0)
 	{
 		
 	}
-	ThreadPool(size_t threads) : stop_flag_(true)
+	ThreadPool(size_t threads) : stop_flag_(true), inject_head_(0), inject_size_(0), post_next_(0), parked_count_(0), waking_count_(0), delay_time_(0)
 	{
 		Start(threads);
 	}
@@ -954,6 +3598,7 @@ public:
 	~ThreadPool()
 	{
 		Stop();
+		Clear();
 	}
 
 	inline bool IsStopFlag() {
@@ -966,129 +3611,347 @@ public:
 		if (!stop_flag_.compare_exchange_strong(expected, false)) {
 			return;
 		}
+		Clear();
+		waking_count_.store(0);
+		if (!threads) {
+			threads = 1;
+		}
 		for (size_t i = 0; i < threads; ++i) {
-			workers_.emplace_back(
-				[this] {
-					std::chrono::milliseconds timeout(3000);
-					for (;;)
-					{
-						std::function<void()> task;
-						{
-							std::unique_lock<std::mutex> lock(mutex_);
-							if(!cv_.wait_for(lock, timeout, [this] { return stop_flag_ || !TaskQue::IsEmpty(); })) {
-								continue;
-							}
-							if (stop_flag_)
-								break;
-							
-							ssize_t delay = 0;
-							TaskQue::Pop(task,&delay);
-							if(delay > 0) {
-								timeout = std::chrono::milliseconds(delay);
-							} else {
-								timeout = std::chrono::milliseconds(3000);
-							}
-							// if(!tasks_que_.empty()) {
-							// 	task = std::move(tasks_que_.front());
-							// 	tasks_que_.pop();
-							// } else {
-							// 	auto it = tasks_.begin();
-							// 	std::chrono::steady_clock::time_point tp_now = std::chrono::steady_clock::now();
-							// 	if(it->first.time > tp_now) {
-							// 		timeout = std::chrono::duration_cast<std::chrono::milliseconds>(it->first.time - tp_now);
-							// 		continue;
-							// 	} else {
-							// 		timeout = std::chrono::milliseconds(3000);
-							// 	}
-							// 	task = std::move(it->second);
-							// 	tasks_.erase(it);
-							// }
-						}
-						task();
-					}
-				});
+			std::unique_ptr<Worker> worker(new Worker());
+			worker->pool = this;
+			worker->index = i;
+			workers_.emplace_back(std::move(worker));
+		}
+		//先创建好所有Worker再启动线程，窃取时会访问其他Worker
+		for (size_t i = 0; i < threads; ++i) {
+			Worker* worker = workers_[i].get();
+			worker->thread = std::thread([this, worker] { Run(worker); });
+		}
+		//return true;
+	}
+
+	void Stop()
+	{
+		bool expected = false;
+		if (!stop_flag_.compare_exchange_strong(expected, true)) {
+			return;
+		}
+		for (auto &worker : workers_) {
+			std::lock_guard<std::mutex> lock(worker->mutex);
+			if (!worker->wake.exchange(true)) {
+				waking_count_++;
+			}
+			worker->cv.notify_one();
+		}
+		for (auto &worker : workers_) {
+			worker->thread.join();
+		}
+		//没执行的任务放回注入队列，重新Start后继续执行
+		std::lock_guard<std::mutex> lock(inject_mutex_);
+		for (auto &worker : workers_) {
+			while (Task* task = worker->deque.Take())
+			{
+				InjectPush(std::move(task->func));
+				delete task;
+			}
+		}
+	}
+
+	void Post(const TaskID& key, TaskFunction && task)
+	{
+		{
+		std::lock_guard<std::mutex> lock(delay_mutex_);
+		TaskQue::Push(key, std::move(task));
+		UpdateDelayTime();
+		}
+		//唤醒一个线程重新计算等待时间
+		WakeOne();
+	}
+
+	void Post(TaskFunction && task)
+	{		
+		Worker* worker = Current();
+		if (worker) {
+			//工作线程投递，放到自己队列，有空闲线程就唤醒来窃取
+			worker->deque.Push(new Task(std::move(task)));
+		} else {
+			//外部线程投递，放进注入队列，还没Start时等Start后执行
+			std::lock_guard<std::mutex> lock(inject_mutex_);
+			InjectPush(std::move(task));
+		}
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (parked_count_.load(std::memory_order_relaxed)) {
+			WakeOne();
+		}
+	}
+
+	template<class F, class... Args>
+	auto Send(const TaskID& key, F&& f, Args&&... args) 
+		-> TaskFuture<typename std::result_of<F(Args...)>::type>
+	{
+		TaskFuture<typename std::result_of<F(Args...)>::type> res;
+		Post(key, MakeTask(res, std::forward<F>(f), std::forward<Args>(args)...));
+		return res;
+	}
+
+	template<class F, class... Args>
+	auto Send(F&& f, Args&&... args) 
+		-> TaskFuture<typename std::result_of<F(Args...)>::type>
+	{
+		TaskFuture<typename std::result_of<F(Args...)>::type> res;
+		Post(MakeTask(res, std::forward<F>(f), std::forward<Args>(args)...));
+		return res;
+	}
+
+	void Cancel(const TaskID& t)
+	{
+		std::unique_lock<std::mutex> lock(delay_mutex_);
+		TaskQue::Remove(t);
+		UpdateDelayTime();
+	}
+
+protected:
+	//释放Worker，需要在工作线程都退出后调用，没执行的任务Stop时已经放回注入队列
+	void Clear()
+	{
+		workers_.clear();
+	}
+
+	//当前线程是本线程池的工作线程时返回对应Worker
+	inline Worker* Current()
+	{
+		Worker* worker = CurrentWorker();
+		if (worker && worker->pool == this) {
+			return worker;
+		}
+		return nullptr;
+	}
+	static inline Worker*& CurrentWorker()
+	{
+		static thread_local Worker* s_worker = nullptr;
+		return s_worker;
+	}
+
+	inline void Wake(Worker* worker)
+	{
+		if (worker->parked.load() && !worker->wake.exchange(true)) {
+			waking_count_++;
+			std::lock_guard<std::mutex> lock(worker->mutex);
+			worker->cv.notify_one();
+		}
+	}
+
+	//已经有刚唤醒还没醒来的线程时不再唤醒，它醒来会取任务，拿到任务后还有剩余再唤醒下一个
+	inline void WakeOne()
+	{
+		if (waking_count_.load() || !parked_count_.load()) {
+			return;
+		}
+		size_t count = workers_.size();
+		size_t next = post_next_.fetch_add(1, std::memory_order_relaxed);
+		for (size_t i = 0; i < count; i++)
+		{
+			Worker* worker = workers_[(next + i) % count].get();
+			if (worker->parked.load() && !worker->wake.load()) {
+				Wake(worker);
+				break;
+			}
+		}
+	}
+
+	//需要在delay_mutex_里调用
+	inline void UpdateDelayTime()
+	{
+		if (TaskQue::IsEmpty()) {
+			delay_time_.store(0);
+		} else {
+			ssize_t delay = 0;
+			TaskQue::Peek(&delay);
+			delay_time_.store(NowMillis() + (delay > 0 ? delay : 0));
+		}
+	}
+
+	static inline int64_t NowMillis()
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	//取一个到期的延迟任务
+	inline Task* PopDelay()
+	{
+		int64_t delay_time = delay_time_.load(std::memory_order_relaxed);
+		if (!delay_time || delay_time > NowMillis()) {
+			return nullptr;
+		}
+		TaskFunction func;
+		{
+		std::unique_lock<std::mutex> lock(delay_mutex_, std::try_to_lock);
+		if (!lock.owns_lock() || TaskQue::IsEmpty()) {
+			return nullptr;
+		}
+		ssize_t delay = 0;
+		bool ok = TaskQue::Pop(func, &delay);
+		UpdateDelayTime();
+		if (!ok) {
+			return nullptr;
+		}
+		}
+		return new Task(std::move(func));
+	}
+
+	inline Task* Steal(Worker* worker)
+	{
+		size_t count = workers_.size();
+		for (size_t i = 1; i < count; i++)
+		{
+			Worker* victim = workers_[(worker->index + i) % count].get();
+			if (Task* task = victim->deque.Steal()) {
+				return task;
+			}
+		}
+		return nullptr;
+	}
+
+	//注入队列是2的幂大小的环形缓冲，满了翻倍，稳定后投递不再分配内存，需要在inject_mutex_里调用
+	inline void InjectPush(TaskFunction&& task)
+	{
+		size_t size = inject_size_.load(std::memory_order_relaxed);
+		if (size == inject_.size()) {
+			std::vector<TaskFunction> que(inject_.empty() ? 256 : inject_.size() * 2);
+			for (size_t i = 0; i < size; i++)
+			{
+				que[i] = std::move(inject_[(inject_head_ + i) & (inject_.size() - 1)]);
+			}
+			inject_.swap(que);
+			inject_head_ = 0;
 		}
-		//return true;
+		inject_[(inject_head_ + size) & (inject_.size() - 1)] = std::move(task);
+		inject_size_.store(size + 1, std::memory_order_relaxed);
 	}
 
-	void Stop()
+	inline TaskFunction InjectPop()
 	{
-		bool expected = false;
-		if (!stop_flag_.compare_exchange_strong(expected, true)) {
-			return;
-		}
-		cv_.notify_all();
-		for (auto &worker : workers_) {
-			worker.join();
-		}
-		workers_.clear();
+		TaskFunction task(std::move(inject_[inject_head_]));
+		inject_head_ = (inject_head_ + 1) & (inject_.size() - 1);
+		inject_size_.store(inject_size_.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+		return task;
 	}
 
-	void Post(const TaskID& key, std::function<void()> && task)
+	//从注入队列取一个任务，顺便按线程数平分一批任务转到自己队列供其他线程窃取
+	inline Task* PopInject(Worker* worker)
 	{
-		std::lock_guard<std::mutex> lock(mutex_);
-		TaskQue::Push(key, std::move(task));
-		cv_.notify_one();
+		if (!inject_size_.load(std::memory_order_relaxed)) {
+			return nullptr;
+		}
+		std::unique_lock<std::mutex> lock(inject_mutex_);
+		size_t size = inject_size_.load(std::memory_order_relaxed);
+		if (!size) {
+			return nullptr;
+		}
+		size_t count = std::min<size_t>(std::min<size_t>(size / workers_.size() + 1, size), INJECT_BATCH);
+		Task* first = new Task(InjectPop());
+		for (size_t i = 1; i < count; i++)
+		{
+			worker->deque.Push(new Task(InjectPop()));
+		}
+		lock.unlock();
+		if (count > 1 && parked_count_.load()) {
+			WakeOne();
+		}
+		return first;
 	}
 
-	void Post(std::function<void()> && task)
-	{		
-		// TaskID key;
-		// Post(key, std::move(task));
-		std::lock_guard<std::mutex> lock(mutex_);
-		TaskQue::Push(std::move(task));
-		cv_.notify_one();
+	inline Task* Next(Worker* worker)
+	{
+		if (Task* task = PopDelay()) {
+			return task;
+		}
+		if (++worker->tick % INJECT_TICK == 0) {
+			if (Task* task = PopInject(worker)) {
+				return task;
+			}
+		}
+		if (Task* task = worker->deque.Take()) {
+			return task;
+		}
+		if (Task* task = PopInject(worker)) {
+			return task;
+		}
+		Task* task = Steal(worker);
+		if (task && parked_count_.load()) {
+			//窃取到任务说明还有积压，唤醒下一个线程
+			WakeOne();
+		}
+		return task;
 	}
 
-	template<class F, class... Args>
-	auto Send(const TaskID& key, F&& f, Args&&... args) 
-		-> std::future<typename std::result_of<F(Args...)>::type>
+	inline bool HasWork()
 	{
-		using return_type = typename std::result_of<F(Args...)>::type;
-
-		auto task = std::make_shared< std::packaged_task<return_type()> >(
-				std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-			);
-			
-		std::future<return_type> res = task->get_future();
+		if (inject_size_.load()) {
+			return true;
+		}
+		for (size_t i = 0; i < workers_.size(); i++)
 		{
-			Post(key, [task](){ (*task)(); });
+			if (workers_[i]->deque.Size() > 0) {
+				return true;
+			}
 		}
-		return res;
+		int64_t delay_time = delay_time_.load();
+		return delay_time && delay_time <= NowMillis();
 	}
 
-	template<class F, class... Args>
-	auto Send(F&& f, Args&&... args) 
-		-> std::future<typename std::result_of<F(Args...)>::type>
+	void Park(Worker* worker)
 	{
-		// TaskID key;
-		// return Send(key, std::forward<F>(f), std::forward<Args>(args)...);
-		using return_type = typename std::result_of<F(Args...)>::type;
-
-		auto task = std::make_shared< std::packaged_task<return_type()> >(
-				std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-			);
-			
-		std::future<return_type> res = task->get_future();
-		{
-			Post([task](){ (*task)(); });
+		std::unique_lock<std::mutex> lock(worker->mutex);
+		worker->parked.store(true);
+		parked_count_++;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (!stop_flag_ && !worker->wake && !HasWork()) {
+			std::chrono::milliseconds timeout(3000);
+			int64_t delay_time = delay_time_.load();
+			if (delay_time) {
+				int64_t delay = delay_time - NowMillis();
+				if (delay < timeout.count()) {
+					timeout = std::chrono::milliseconds(delay > 0 ? delay : 0);
+				}
+			}
+			worker->cv.wait_for(lock, timeout, [this, worker] { return stop_flag_ || worker->wake; });
+		}
+		parked_count_--;
+		worker->parked.store(false);
+		if (worker->wake.exchange(false)) {
+			waking_count_--;
 		}
-		return res;
 	}
 
-	void Cancel(const TaskID& t)
+	void Run(Worker* worker)
 	{
-		std::unique_lock<std::mutex> lock(mutex_);
-		TaskQue::Remove(t);
+		CurrentWorker() = worker;
+		while (!stop_flag_)
+		{
+			Task* task = Next(worker);
+			if (task) {
+				task->func();
+				delete task;
+			} else {
+				Park(worker);
+			}
+		}
+		CurrentWorker() = nullptr;
 	}
 
 private:
 	std::atomic<bool> stop_flag_;
-	std::vector<std::thread> workers_;
-	// std::map<TaskID,std::function<void()>> tasks_;
-	// std::queue<std::function<void()>> tasks_que_;
-	std::mutex mutex_;
-	std::condition_variable cv_;
+	std::vector<std::unique_ptr<Worker>> workers_;
+	std::mutex inject_mutex_;
+	std::vector<TaskFunction> inject_; //外部线程投递的任务，环形缓冲，工作线程成批取出
+	size_t inject_head_;
+	std::atomic<size_t> inject_size_; //inject_的任务数，不加锁判断是否为空
+	std::atomic<size_t> post_next_; //唤醒线程的轮转位置
+	std::atomic<size_t> parked_count_; //空闲等待的线程数
+	std::atomic<int> waking_count_; //已经唤醒还没醒来的线程数
+	std::mutex delay_mutex_; //延迟任务锁，延迟任务放在TaskQue里
+	std::atomic<int64_t> delay_time_; //最早延迟任务到期时间（steady_clock毫秒），0表示没有延迟任务
 };
 
 class ThreadGroupPool
@@ -1164,7 +4027,7 @@ class TaskServiceT : public TBase, public TaskQue
 {
 	typedef TBase Base;
 public:
-	inline void Post(const TaskID& key, std::function<void()> && task)
+	inline void Post(const TaskID& key, TaskFunction && task)
 	{
  		std::lock_guard<std::mutex> lock(mutex_);
 // 		auto it = tasks_.emplace(key,std::move(task));
@@ -1187,7 +4050,7 @@ public:
 		}
 	}
 
-	inline void Post(std::function<void()> && task)
+	inline void Post(TaskFunction && task)
 	{
 		// TaskID key;
 		// Post(key, std::move(task));
@@ -1199,37 +4062,19 @@ public:
 
 	template<class F, class... Args>
 	auto Send(const TaskID& key, F&& f, Args&&... args) 
-		-> std::future<typename std::result_of<F(Args...)>::type>
+		-> TaskFuture<typename std::result_of<F(Args...)>::type>
 	{
-		using return_type = typename std::result_of<F(Args...)>::type;
-
-		auto task = std::make_shared< std::packaged_task<return_type()> >(
-				std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-			);
-			
-		std::future<return_type> res = task->get_future();
-		{
-			Post(key, [task](){ (*task)(); });
-		}
+		TaskFuture<typename std::result_of<F(Args...)>::type> res;
+		Post(key, MakeTask(res, std::forward<F>(f), std::forward<Args>(args)...));
 		return res;
 	}
 
 	template<class F, class... Args>
 	inline auto Send(F&& f, Args&&... args) 
-		-> std::future<typename std::result_of<F(Args...)>::type>
+		-> TaskFuture<typename std::result_of<F(Args...)>::type>
 	{
-		// TaskID key;
-		// return Send(key, std::forward<F>(f), std::forward<Args>(args)...);
-		using return_type = typename std::result_of<F(Args...)>::type;
-
-		auto task = std::make_shared< std::packaged_task<return_type()> >(
-				std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-			);
-			
-		std::future<return_type> res = task->get_future();
-		{
-			Post([task](){ (*task)(); });
-		}
+		TaskFuture<typename std::result_of<F(Args...)>::type> res;
+		Post(MakeTask(res, std::forward<F>(f), std::forward<Args>(args)...));
 		return res;
 	}
 
@@ -1292,7 +4137,7 @@ protected:
 		// 	}
 		// }
 		
-		std::function<void()> task;
+		TaskFunction task;
 		size_t i = 0, j = TaskQue::Count();
 		for(; i < j; i++) {
 			ssize_t delay = 0;
@@ -1367,7 +4212,9 @@ protected:
 		size_t timeout = Base::GetWaitingTimeOut();
 		if (timeout) {
 			std::unique_lock<std::mutex> lock(mutex_);
+			Base::BeginWait();
 			cv_.wait_for(lock, std::chrono::milliseconds(timeout));
+			Base::EndWait();
 		}
 	}
 
@@ -1535,6 +4382,16 @@ protected:
 	//
 	inline SocketEx* IsSocketEvent(Event& evt) { return nullptr; }
 	inline bool IsActive(Event& evt) { return true; }
+	//还没激活的延迟事件还要等多少毫秒，0表示不知道，只能重新投递
+	inline uint32_t GetDelay(const Event& evt) { return GetDelay(evt, std::is_base_of<DealyEventBase,Event>()); }
+
+private:
+	inline uint32_t GetDelay(const Event& evt, std::true_type) { 
+		uint32_t millis = 0;
+		evt.IsActive(&millis);
+		return millis;
+	}
+	inline uint32_t GetDelay(const Event& evt, std::false_type) { return 0; }
 };
 
 /*!
@@ -1671,10 +4528,31 @@ protected:
 		if(Base::IsSelect(FD_CONNECT) && connect_timeout_) {
 			if(IsConnectTimeOut()) {
 				OnConnect(ETIMEDOUT);
+			} else {
+				SetConnectTimer();
 			}
 		}
 	}
 
+	virtual void OnAttachService(Service* pSvr)
+	{
+		Base::OnAttachService(pSvr);
+
+		if(Base::IsSelect(FD_CONNECT) && connect_timeout_) {
+			SetConnectTimer(pSvr);
+		}
+	}
+
+	//连接超时定时器，到期触发OnIdle检查超时
+	inline void SetConnectTimer(Service* pSvr = nullptr)
+	{
+		size_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		size_t deadline = connect_time_ + connect_timeout_;
+		if(!Base::SetIdleTimer(deadline > now ? deadline - now : 0, pSvr)) {
+			Base::Select(FD_IDLE);
+		}
+	}
+
 	virtual void OnRole(int nRole)
 	{
 		Base::OnRole(nRole);
@@ -1687,6 +4565,9 @@ protected:
 	{
 		Base::OnConnect(nErrorCode);
 
+		if(connect_timeout_) {
+			Base::KillIdleTimer();
+		}
 		if(!nErrorCode) {
 			connected_ = true;
 			connect_time_ = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() - connect_time_; //记住连接耗时
@@ -1897,39 +4778,79 @@ public:
 protected:
 	u_short sock_count_ = 0;
 	std::vector<std::shared_ptr<Socket>> sock_ptrs_;
+	std::vector<uint32_t> sock_gens_; //槽位代数，槽位每回收一次加1，用于识别过期的槽位句柄
+	std::vector<int> sock_free_next_; //空闲槽位链表，sock_free_next_[i]是槽位i之后的下一个空闲槽位，-1表示链表结束
+	int sock_free_head_ = -1; //空闲槽位链表头，-1表示没有空闲槽位
 	//u_short sock_idle_next_ = 0;
 	std::mutex mutex_;
+	TimerWheel timer_wheel_; //定时器时间轮，空闲超时、连接超时、延迟事件都在这里
+	//回调在timer_mutex_外执行，回调里会加mutex_（Select/RemoveSocket），持有mutex_时也会AddTimer，不能反过来嵌套
+	std::mutex timer_mutex_;
+	std::condition_variable timer_cv_;
+	std::deque<TimerWheel::Expired> timer_expired_; //已经到期还没执行的定时器
+	uint64_t timer_running_ = 0; //正在执行回调的定时器ID
+	std::thread::id timer_thread_; //执行回调的线程
+public:
+	virtual uint64_t AddTimer(size_t millis, std::function<void()>&& cb)
+	{
+		std::unique_lock<std::mutex> lock(timer_mutex_);
+		uint64_t id = timer_wheel_.Add(millis, std::move(cb));
+		lock.unlock();
+		Base::PostTimer(millis);
+		return id;
+	}
+	//取消后回调不会再执行；回调正在其他线程执行时等它执行完再返回，调用者可以放心释放回调里用到的对象
+	//所以不能在持有回调需要的锁时取消别的线程正在执行的定时器
+	virtual bool CancelTimer(uint64_t id)
+	{
+		std::unique_lock<std::mutex> lock(timer_mutex_);
+		if (timer_wheel_.Cancel(id)) {
+			return true;
+		}
+		for (auto it = timer_expired_.begin(); it != timer_expired_.end(); ++it)
+		{
+			if (it->first == id) {
+				timer_expired_.erase(it);
+				return true;
+			}
+		}
+		if (timer_running_ == id && timer_thread_ != std::this_thread::get_id()) {
+			timer_cv_.wait(lock, [this, id]() { return timer_running_ != id; });
+		}
+		return false;
+	}
 public:
 	SocketSetT(){}
-	SocketSetT(int nMaxSocketCount):sock_ptrs_(nMaxSocketCount)
+	SocketSetT(int nMaxSocketCount):sock_ptrs_(nMaxSocketCount),sock_gens_(nMaxSocketCount,1)
 	{
+		ResetFreeSlot();
 	}
 
-	inline void SetMaxSocketCount(int nMaxSocketCount) { sock_ptrs_.resize(nMaxSocketCount); }
+	inline void SetMaxSocketCount(int nMaxSocketCount) { 
+		std::unique_lock<std::mutex> lock(mutex_);
+		sock_ptrs_.resize(nMaxSocketCount); 
+		sock_gens_.resize(nMaxSocketCount,1); 
+		ResetFreeSlot();
+	}
 	inline const size_t GetMaxSocketCount() { return sock_ptrs_.size(); }
 	inline size_t GetSocketCount() { return sock_count_; }
 
 	int AddSocket(std::shared_ptr<Socket> sock_ptr, int evt = 0)
 	{
 		std::unique_lock<std::mutex> lock(mutex_);
-		int i, j;
-		for (i = 0, j = sock_ptrs_.size(); i < j; i++)
-		{
-			if(sock_ptrs_[i]==NULL) {
-				if (sock_ptr) {
-					sock_count_++;
-					sock_ptr->AttachService(this);
-					sock_ptr->Select(evt);
-					sock_ptrs_[i] = sock_ptr;
-					return i;
-				} else {
-					//测试可不可以增加Socket，返回true表示可以增加
-					return i;
-				}
-				break;
-			}
+		if (!sock_ptr) {
+			//测试可不可以增加Socket，返回>=0表示可以增加
+			return sock_free_head_;
 		}
-		return -1;
+		int i = AllocSlot();
+		if (i >= 0) {
+			sock_count_++;
+			sock_ptr->SetHandle(MakeHandle(i), this);
+			sock_ptr->AttachService(this);
+			sock_ptr->Select(evt);
+			sock_ptrs_[i] = sock_ptr;
+		}
+		return i;
 	}
 	template<class Ty = Socket>
 	inline int AddConnect(std::shared_ptr<Ty> sock_ptr, u_short port)
@@ -1944,16 +4865,24 @@ public:
 		return AddSocket(sock_ptr,FD_ACCEPT);
 	}
 
+	//Socket选择的事件变了，epoll/io_uring需要同步到内核的重载，select模型每轮按event_重建不需要
+	inline void SelectSocket(SocketEx* sock_ptr, int evt) { }
+
+	//通过槽位句柄直接定位Socket，槽位已回收（代数不一致）返回空
+	inline std::shared_ptr<Socket> FindSocket(uint64_t handle) {
+		size_t i = (uint32_t)handle;
+		if (i < sock_ptrs_.size() && sock_gens_[i] == (uint32_t)(handle >> 32)) {
+			return sock_ptrs_[i];
+		}
+		return nullptr;
+	}
+
 	int RemoveSocket(std::shared_ptr<Socket> sock_ptr)
 	{
 		ASSERT(sock_ptr);
-		//std::unique_lock<std::mutex> lock(mutex_);
-		int i, j;
-		for (i = 0, j = sock_ptrs_.size(); i < j; i++)
-		{
-			if(sock_ptrs_[i]==sock_ptr) {
-				return RemoveSocketByPos(i);
-			}
+		int i = FindSocketPos(sock_ptr);
+		if (i >= 0) {
+			return RemoveSocketByPos(i);
 		}
 		return -1;
 	}
@@ -1983,6 +4912,60 @@ public:
 	}*/
 protected:
 	//
+	//槽位句柄：高32位是槽位代数（从1开始，不会为0），低32位是槽位
+	inline uint64_t MakeHandle(int i) 
+	{
+		return ((uint64_t)sock_gens_[i] << 32) | (uint32_t)i;
+	}
+
+	//重建空闲槽位链表，按槽位从小到大链接所有空槽位
+	inline void ResetFreeSlot()
+	{
+		sock_free_next_.resize(sock_ptrs_.size());
+		sock_free_head_ = -1;
+		for (int i = (int)sock_ptrs_.size() - 1; i >= 0; i--)
+		{
+			if (!sock_ptrs_[i]) {
+				sock_free_next_[i] = sock_free_head_;
+				sock_free_head_ = i;
+			}
+		}
+	}
+
+	//从空闲槽位链表头取一个槽位，没有空闲槽位返回-1，需要在mutex_保护下调用
+	inline int AllocSlot()
+	{
+		int i = sock_free_head_;
+		if (i >= 0) {
+			sock_free_head_ = sock_free_next_[i];
+			sock_free_next_[i] = -1;
+		}
+		return i;
+	}
+
+	//回收槽位到空闲槽位链表头，代数加1，之前发出的槽位句柄全部失效，需要在mutex_保护下调用
+	inline void FreeSlot(int i) 
+	{
+		if(!++sock_gens_[i]) {
+			sock_gens_[i] = 1;
+		}
+		sock_free_next_[i] = sock_free_head_;
+		sock_free_head_ = i;
+	}
+
+	//Socket记住了自己的槽位句柄，直接定位槽位，不属于本SocketSet返回-1
+	inline int FindSocketPos(const std::shared_ptr<Socket>& sock_ptr)
+	{
+		uint64_t handle = sock_ptr->Handle();
+		if (handle) {
+			size_t i = (uint32_t)handle;
+			if (i < sock_ptrs_.size() && sock_ptrs_[i] == sock_ptr) {
+				return i;
+			}
+		}
+		return -1;
+	}
+
 	inline int RemoveSocketByPos(int i)
 	{
 		if (i>=0 && i<sock_ptrs_.size()) {
@@ -1990,6 +4973,8 @@ protected:
 			std::shared_ptr<Socket> sock_ptr = sock_ptrs_[i];
 			if (sock_ptr) {
 				sock_ptrs_[i].reset();
+				FreeSlot(i);
+				sock_ptr->SetHandle(0);
 				sock_count_--;
 				lock.unlock();
 				sock_ptr->DetachService(this);
@@ -2006,9 +4991,15 @@ protected:
 		int i, j;
 		for (i = 0, j = sock_ptrs_.size(); i < j; i++)
 		{
-			if (sock_ptrs_[i]) {
-				std::shared_ptr<Socket> sock_ptr = sock_ptrs_[i];
+			//AddSocket可能在其他线程同时AllocSlot，回收槽位要加锁，回调在锁外
+			std::unique_lock<std::mutex> lock(mutex_);
+			std::shared_ptr<Socket> sock_ptr = sock_ptrs_[i];
+			if (sock_ptr) {
 				sock_ptrs_[i].reset();
+				FreeSlot(i);
+				sock_ptr->SetHandle(0);
+				sock_count_--;
+				lock.unlock();
 				if (sock_ptr->IsSocket()) {
 					if (bClose) {
 						sock_ptr->Trigger(FD_CLOSE, 0);
@@ -2017,7 +5008,6 @@ protected:
 				sock_ptr->DetachService(this);
 			}
 		}
-		sock_count_ = 0;
 	}
 
 	inline std::shared_ptr<Socket> FindSocket(SocketEx* sock_ptr) {
@@ -2041,6 +5031,31 @@ protected:
 		RemoveAllSocket(true);
 	}
 
+	virtual void OnTimer()
+	{
+		Base::OnTimer();
+		std::unique_lock<std::mutex> lock(timer_mutex_);
+		int64_t next = timer_wheel_.Advance(timer_expired_);
+		timer_thread_ = std::this_thread::get_id();
+		while (!timer_expired_.empty())
+		{
+			timer_running_ = timer_expired_.front().first;
+			{
+				std::function<void()> cb(std::move(timer_expired_.front().second));
+				timer_expired_.pop_front();
+				lock.unlock();
+				cb();
+			}
+			lock.lock();
+			timer_running_ = 0;
+			timer_cv_.notify_all();
+		}
+		lock.unlock();
+		if (next > 0) {
+			Base::PostTimer(next);
+		}
+	}
+
 	virtual void OnIdle()
 	{
 		Base::OnIdle();
@@ -2077,6 +5092,35 @@ protected:
 	}
 };
 
+/*!
+ *	@brief 监听模式定义.
+ *
+ *	SocketManager监听Socket的分布方式
+ */
+enum
+{
+	LISTEN_MODE_SINGLE = 0,		//!< 一个监听Socket，Accept到的连接轮流分配到各SocketSet
+	LISTEN_MODE_REUSEPORT,		//!< 每个SocketSet一个SO_REUSEPORT监听Socket，内核分发连接，各SocketSet自己Accept
+	LISTEN_MODE_EXCLUSIVE,		//!< 所有SocketSet共享一个监听Socket，以EPOLLEXCLUSIVE监听，只支持epoll
+};
+
+/*!
+ *	@brief 分配策略定义.
+ *
+ *	SocketManager把新Socket分配到哪个SocketSet，分配的SocketSet满了再依次尝试后面的SocketSet
+ */
+enum
+{
+	PLACE_POLICY_ROUND_ROBIN = 0,	//!< 轮流分配
+	PLACE_POLICY_LEAST_CONN,		//!< 分配到Socket数最少的SocketSet
+	PLACE_POLICY_LEAST_LOAD,		//!< 分配到最近负载（Service::GetLoad）最低的SocketSet，负载相同时Socket数少的优先
+	PLACE_POLICY_PEER_HASH,			//!< 按对端地址一致性哈希，同一对端总是分配到同一个SocketSet，取不到对端地址时轮流分配
+};
+
+#ifndef DEFAULT_PLACE_HASH_VNODES
+#define DEFAULT_PLACE_HASH_VNODES 64 //一致性哈希每个SocketSet的虚拟节点数
+#endif//
+
 /*!
  *	@brief SocketManagerT 模板定义.
  *
@@ -2091,6 +5135,10 @@ public:
 protected:
 	std::vector<SocketSet*> sockset_ptrs_;
 	size_t sockset_add_next_ = 0;
+	int listen_mode_ = LISTEN_MODE_SINGLE;
+	int place_policy_ = PLACE_POLICY_ROUND_ROBIN;
+	std::function<int(Socket*)> place_func_; //自定义分配，返回SocketSet位置，<0表示使用place_policy_
+	std::vector<std::pair<uint32_t,uint32_t>> place_ring_; //一致性哈希环，哈希值->SocketSet位置
 public:
 	SocketManagerT(){}
 	SocketManagerT(int nMaxSocketCount, int nMaxSockSetCount/* = std::thread::hardware_concurrency() + 1*/)
@@ -2148,7 +5196,14 @@ public:
 			sockset_ptrs_[i] = new SocketSet(nMaxSocketCountPerSet);
 		}
 		sockset_add_next_ = 0; 
+		BuildPlaceRing();
 	}
+
+	//设置分配策略，见PLACE_POLICY_*
+	inline void SetPlacePolicy(int policy) { place_policy_ = policy; }
+	inline int GetPlacePolicy() { return place_policy_; }
+	//设置自定义分配，返回SocketSet位置，返回<0表示使用分配策略
+	inline void SetPlaceFunc(const std::function<int(Socket*)>& func) { place_func_ = func; }
 	inline size_t GetSocketSetCount() { return sockset_ptrs_.size(); }
 	inline size_t GetMaxSocketCount() { 
 		return sockset_ptrs_.size() * SocketSet::GetMaxSocketCount(); 
@@ -2170,8 +5225,7 @@ public:
 
 	inline int AddSocket(std::shared_ptr<Socket> sock_ptr, int evt = 0)
 	{
-		size_t next = sockset_add_next_, next_end = sockset_add_next_ + sockset_ptrs_.size();
-		sockset_add_next_ = (sockset_add_next_ + 1) % sockset_ptrs_.size();
+		size_t next = PlaceSocket(sock_ptr.get()), next_end = next + sockset_ptrs_.size();
 		for (; next < next_end; next++)
 		{
 			int i = next % sockset_ptrs_.size();
@@ -2186,8 +5240,7 @@ public:
 	template<class Ty = Socket>
 	inline int AddConnect(std::shared_ptr<Ty> sock_ptr, u_short port)
 	{
-		size_t next = sockset_add_next_, next_end = sockset_add_next_ + sockset_ptrs_.size();
-		sockset_add_next_ = (sockset_add_next_ + 1) % sockset_ptrs_.size();
+		size_t next = PlaceSocket(sock_ptr.get()), next_end = next + sockset_ptrs_.size();
 		for (; next < next_end; next++)
 		{
 			int i = next % sockset_ptrs_.size();
@@ -2201,8 +5254,7 @@ public:
 	}
 	inline int AddAccept(std::shared_ptr<Socket> sock_ptr)
 	{
-		size_t next = sockset_add_next_, next_end = sockset_add_next_ + sockset_ptrs_.size();
-		sockset_add_next_ = (sockset_add_next_ + 1) % sockset_ptrs_.size();
+		size_t next = PlaceSocket(sock_ptr.get()), next_end = next + sockset_ptrs_.size();
 		for (; next < next_end; next++)
 		{
 			int i = next % sockset_ptrs_.size();
@@ -2215,19 +5267,224 @@ public:
 		return -1;
 	}
 
+	inline int AddAcceptAt(size_t pos, std::shared_ptr<Socket> sock_ptr)
+	{
+		if (pos < sockset_ptrs_.size() && sockset_ptrs_[pos]->AddAccept(sock_ptr) >= 0) {
+			return pos;
+		}
+		return -1;
+	}
+
+	inline int GetListenMode() { return listen_mode_; }
+
+	//监听Socket Accept到的连接，每个SocketSet自己监听时直接加入当前线程的SocketSet，不跨线程分配
+	inline int AddAcceptSocket(std::shared_ptr<Socket> sock_ptr, int evt = 0)
+	{
+		if (listen_mode_ != LISTEN_MODE_SINGLE) {
+			SocketSet* sockset_ptr = dynamic_cast<SocketSet*>(SocketSet::service());
+			for (size_t i = 0; sockset_ptr && i < sockset_ptrs_.size(); i++)
+			{
+				if (sockset_ptrs_[i] == sockset_ptr) {
+					if (sockset_ptr->AddSocket(sock_ptr, evt) >= 0) {
+						return i;
+					}
+					break;
+				}
+			}
+			//当前SocketSet满了，再轮流分配
+		}
+		return AddSocket(sock_ptr, evt);
+	}
+
+#ifdef SO_REUSEPORT
+	//每个SocketSet打开一个SO_REUSEPORT监听Socket，create用于创建监听Socket，需要支持Open(address)和Bind(port)，如ListenSocketExT
+	//返回成功监听的SocketSet数
+	template<class Ty>
+	int ListenReusePort(const std::function<std::shared_ptr<Ty>()>& create, const char* address, u_short port, int backlog = SOMAXCONN)
+	{
+		int count = 0;
+		for (size_t i = 0; i < sockset_ptrs_.size(); i++)
+		{
+			std::shared_ptr<Ty> sock_ptr = create();
+			sock_ptr->Open(address);
+			sock_ptr->SetSockOpt(SOL_SOCKET, SO_REUSEADDR, 1);
+			sock_ptr->SetSockOpt(SOL_SOCKET, SO_REUSEPORT, 1);
+			if (SOCKET_ERROR == sock_ptr->Bind(port) || SOCKET_ERROR == sock_ptr->Listen(backlog)) {
+				PRINTF("reuseport listen err:%d", XSocket::Socket::GetLastError());
+				sock_ptr->Close();
+				continue;
+			}
+			if (AddAcceptAt(i, sock_ptr) >= 0) {
+				count++;
+			}
+		}
+		if (count) {
+			listen_mode_ = LISTEN_MODE_REUSEPORT;
+		}
+		return count;
+	}
+#endif//
+
+#ifndef WIN32
+	//所有SocketSet共享一个监听Socket，每个SocketSet用dup出的句柄以EPOLLEXCLUSIVE监听，避免惊群
+	//不希望内核按四元组固定分发连接时使用，SocketSet需要支持AddExclusiveAccept（EPollSocketSetT）
+	template<class Ty>
+	int ListenExclusive(const std::function<std::shared_ptr<Ty>()>& create, const char* address, u_short port, int backlog = SOMAXCONN)
+	{
+		std::shared_ptr<Ty> listen_ptr = create();
+		listen_ptr->Open(address);
+		listen_ptr->SetSockOpt(SOL_SOCKET, SO_REUSEADDR, 1);
+		if (SOCKET_ERROR == listen_ptr->Bind(port) || SOCKET_ERROR == listen_ptr->Listen(backlog)) {
+			PRINTF("exclusive listen err:%d", XSocket::Socket::GetLastError());
+			listen_ptr->Close();
+			return 0;
+		}
+		int count = 0;
+		for (size_t i = 0; i < sockset_ptrs_.size(); i++)
+		{
+			std::shared_ptr<Ty> sock_ptr = listen_ptr;
+			if (i > 0) {
+				SOCKET fd = dup((SOCKET)*listen_ptr);
+				if (!XSocket::Socket::IsSocket(fd)) {
+					break;
+				}
+				sock_ptr = create();
+				sock_ptr->Attach(fd);
+				sock_ptr->Listen(backlog);
+			}
+			if (sockset_ptrs_[i]->AddExclusiveAccept(sock_ptr) >= 0) {
+				count++;
+			}
+		}
+		if (count) {
+			listen_mode_ = LISTEN_MODE_EXCLUSIVE;
+		}
+		return count;
+	}
+#endif//
+
 	inline int RemoveSocket(std::shared_ptr<Socket> sock_ptr)
 	{
+		if (!sock_ptr->Handle()) {
+			//没有槽位句柄，说明不属于任何SocketSet
+			return -1;
+		}
+		//Socket记住了所属SocketSet，直接交给它按槽位句柄删除，不用逐个SocketSet尝试
+		SocketSet* sockset_ptr = dynamic_cast<SocketSet*>(sock_ptr->Owner());
+		if (!sockset_ptr || sockset_ptr->RemoveSocket(sock_ptr) < 0) {
+			return -1;
+		}
+		//和原来一样返回SocketSet的位置
 		for (size_t i=0,j=sockset_ptrs_.size();i<j;i++)
 		{
-			int result = sockset_ptrs_[i]->RemoveSocket(sock_ptr);
-			if (result >= 0) {
+			if (sockset_ptrs_[i] == sockset_ptr) {
 				return i;
-				break;
 			}
 		}
 		return -1;
 	}
 
+	//按分配策略选择第一个尝试的SocketSet位置
+	inline size_t PlaceSocket(Socket* sock_ptr)
+	{
+		size_t count = sockset_ptrs_.size();
+		if (place_func_) {
+			int pos = place_func_(sock_ptr);
+			if (pos >= 0) {
+				return pos % count;
+			}
+		}
+		switch (place_policy_)
+		{
+		case PLACE_POLICY_LEAST_CONN: {
+			size_t best = 0;
+			for (size_t i = 1; i < count; i++)
+			{
+				if (sockset_ptrs_[i]->GetSocketCount() < sockset_ptrs_[best]->GetSocketCount()) {
+					best = i;
+				}
+			}
+			return best;
+		} break;
+		case PLACE_POLICY_LEAST_LOAD: {
+			size_t best = 0;
+			for (size_t i = 1; i < count; i++)
+			{
+				uint32_t load = sockset_ptrs_[i]->GetLoad(), best_load = sockset_ptrs_[best]->GetLoad();
+				if (load < best_load || (load == best_load 
+					&& sockset_ptrs_[i]->GetSocketCount() < sockset_ptrs_[best]->GetSocketCount())) {
+					best = i;
+				}
+			}
+			return best;
+		} break;
+		case PLACE_POLICY_PEER_HASH: {
+			uint32_t hash = 0;
+			if (sock_ptr && !place_ring_.empty() && PeerHash(sock_ptr, hash)) {
+				auto it = std::lower_bound(place_ring_.begin(), place_ring_.end(), std::make_pair(hash, (uint32_t)0));
+				if (it == place_ring_.end()) {
+					it = place_ring_.begin();
+				}
+				return it->second;
+			}
+		} break;
+		default:
+			break;
+		}
+		size_t next = sockset_add_next_;
+		sockset_add_next_ = (sockset_add_next_ + 1) % count;
+		return next;
+	}
+
+	static inline uint32_t HashBytes(const void* data, size_t len, uint32_t hash = 2166136261u)
+	{
+		//FNV-1a
+		const uint8_t* p = (const uint8_t*)data;
+		for (size_t i = 0; i < len; i++)
+		{
+			hash ^= p[i];
+			hash *= 16777619u;
+		}
+		return hash;
+	}
+
+	//对端地址（不含端口）的哈希
+	static bool PeerHash(Socket* sock_ptr, uint32_t& hash)
+	{
+		SOCKADDR_STORAGE addr = {};
+		int addrlen = sizeof(addr);
+		if (!sock_ptr->IsSocket() || SOCKET_ERROR == sock_ptr->GetPeerName((SOCKADDR*)&addr, &addrlen)) {
+			return false;
+		}
+		switch (addr.ss_family)
+		{
+		case AF_INET:
+			hash = HashBytes(&((SOCKADDR_IN*)&addr)->sin_addr, sizeof(((SOCKADDR_IN*)&addr)->sin_addr));
+			return true;
+		case AF_INET6:
+			hash = HashBytes(&((SOCKADDR_IN6*)&addr)->sin6_addr, sizeof(((SOCKADDR_IN6*)&addr)->sin6_addr));
+			return true;
+		default:
+			break;
+		}
+		return false;
+	}
+
+	void BuildPlaceRing()
+	{
+		place_ring_.clear();
+		place_ring_.reserve(sockset_ptrs_.size() * DEFAULT_PLACE_HASH_VNODES);
+		for (uint32_t i = 0; i < sockset_ptrs_.size(); i++)
+		{
+			for (uint32_t v = 0; v < DEFAULT_PLACE_HASH_VNODES; v++)
+			{
+				uint32_t key[2] = { i, v };
+				place_ring_.emplace_back(HashBytes(key, sizeof(key)), i);
+			}
+		}
+		std::sort(place_ring_.begin(), place_ring_.end());
+	}
+
 	/*int RemoveInvalidSocket(std::shared_ptr<Socket> & sock_ptr)
 	{
 		for (size_t i=0,j=sockset_ptrs_.size();i<j;i++)
@@ -2451,7 +5708,7 @@ protected:
 		struct timeval tv = {0, Base::GetWaitingTimeOut()*1000};
 		std::unique_lock<std::mutex> lock(Base::mutex_);
 		{
-			for (size_t i=0; i<uFD_SETSize; ++i)
+			for (size_t i=0; i<Base::sock_ptrs_.size(); ++i)
 			{
 				if (Base::sock_ptrs_[i] && Base::sock_ptrs_[i]->IsSocket()) {
 					nfds++;
@@ -2472,12 +5729,14 @@ protected:
 			}
 			lock.unlock();
 		}
+		Base::BeginWait();
 		if(nfds > 0)
 			nfds = select(maxfds, &readfds, &writefds, &exceptfds, &tv);
 		else if(tv.tv_usec)
 			std::this_thread::sleep_for(std::chrono::microseconds(tv.tv_usec));
+		Base::EndWait();
 		if (nfds > 0) {
-			for (size_t i = 0; i < uFD_SETSize; ++i)
+			for (size_t i = 0; i < Base::sock_ptrs_.size(); ++i)
 			{
 				if (Base::sock_ptrs_[i]) {
 					lock.lock();
@@ -2658,7 +5917,7 @@ protected:
 					XSocket::Socket::Close(Sock);
 					return;
 				}
-				std::shared_ptr<Socket> sock_ptr = std::make_shared<Socket>();
+				std::shared_ptr<Socket> sock_ptr = SocketFactoryT<Socket>::Inst().New();
 				sock_ptr->Attach(Sock,SOCKET_ROLE_WORK);
 				sock_ptr->SetNonBlock();//设为非阻塞模式
 				int pos = SockManager::AddSocket(sock_ptr, FD_READ|FD_OOB);
@@ -81,6 +81,11 @@ protected:
 	int m_nSendLen;
 	const char* m_pSendBuf;
 	int m_nSendBufLen;
+	size_t m_nSendHighMark; //未发送数据超过高水位触发OnSendBufHigh，0表示不检查
+	size_t m_nSendLowMark; //超过高水位后降到低水位触发OnSendBufDrained
+	bool m_bSendHigh;
+	bool m_bRecvPaused;
+	std::function<void(bool)> m_fnRelayPause; //转发时暂停/恢复对端接收
 public:
 	TcpSocket()
 		:Base()
@@ -90,6 +95,10 @@ public:
 		,m_nSendLen(0)
 		,m_pSendBuf(nullptr)
 		,m_nSendBufLen(0)
+		,m_nSendHighMark(0)
+		,m_nSendLowMark(0)
+		,m_bSendHigh(false)
+		,m_bRecvPaused(false)
 	{
 		
 	}
@@ -101,6 +110,7 @@ public:
 
 	inline int Close()
 	{
+		FlushPendingSend();
 		int ret = Base::Close();
 		m_nRecvLen = 0;
 		m_pRecvBuf = nullptr;
@@ -108,10 +118,134 @@ public:
 		m_nSendLen = 0;
 		m_pSendBuf = nullptr;
 		m_nSendBufLen = 0;
+		//关闭时对端还暂停着要恢复，不然对端永远收不到数据
+		if (m_bSendHigh && m_fnRelayPause) {
+			m_fnRelayPause(false);
+		}
+		m_fnRelayPause = nullptr;
+		m_bSendHigh = false;
+		m_bRecvPaused = false;
 		return ret;
 	}
 
+	//未发送数据大小
+	virtual size_t NotSendBufSize()
+	{
+		return m_pSendBuf ? m_nSendBufLen - m_nSendLen : 0;
+	}
+
+	//设置发送水位，nLowMark默认是nHighMark的一半，nHighMark为0表示不检查
+	inline void SetSendBufMark(size_t nHighMark, size_t nLowMark = (size_t)-1)
+	{
+		m_nSendHighMark = nHighMark;
+		m_nSendLowMark = nLowMark < nHighMark ? nLowMark : nHighMark / 2;
+	}
+
+	inline bool IsSendBufHigh() { return m_bSendHigh; }
+
+	//暂停接收，接收缓存和内核缓存里的数据留着，ResumeRecv后继续处理
+	inline void PauseRecv()
+	{
+		if (!m_bRecvPaused) {
+			m_bRecvPaused = true;
+			if (Base::IsSelect(FD_READ)) {
+				Base::RemoveSelect(FD_READ);
+				//同步到内核，LT模式不去掉EPOLLIN会一直触发
+				typedef typename Base::SocketSet SocketSet;
+				SocketSet* set = dynamic_cast<SocketSet*>(Base::Owner());
+				if (set && Base::IsSocket()) {
+					set->SelectSocket(this, FD_READ);
+				}
+			}
+		}
+	}
+
+	inline void ResumeRecv()
+	{
+		if (m_bRecvPaused) {
+			m_bRecvPaused = false;
+			if (Base::IsSocket()) {
+				//Select会把新选择的FD_READ同步到内核并马上触发一次，处理暂停期间留下的数据
+				Base::Select(FD_READ);
+			}
+		}
+	}
+
+	inline bool IsRecvPaused() { return m_bRecvPaused; }
+
+	//推迟到本轮事件处理完的发送（合并发送、发送预算用完）马上发，关闭前调用，不然同一轮SendBuf后Close的数据就丢了
+	//只发到EWOULDBLOCK为止，发送出错会在Trigger里关闭连接
+	inline void FlushPendingSend()
+	{
+		while (Base::IsSocket() && Base::IsPending(FD_WRITE))
+		{
+			if (Base::TakePending() & FD_READ) {
+				Base::Pending(FD_READ);
+			}
+			if (!Base::IsSelect(FD_WRITE)) {
+				break;
+			}
+			Base::Trigger(FD_WRITE, 0);
+		}
+	}
+
+	//转发时设置对端：本连接发送缓存超过高水位时对端PauseRecv，降到低水位后ResumeRecv
+	//用weak_ptr持有对端，对端先关闭也没关系，两个方向都要转发时两边都设置
+	template<class TPeer>
+	inline void SetRelayPeer(const std::shared_ptr<TPeer>& peer)
+	{
+		std::weak_ptr<TPeer> weak_peer = peer;
+		m_fnRelayPause = [weak_peer](bool pause) {
+			std::shared_ptr<TPeer> peer = weak_peer.lock();
+			if (peer && peer->IsSocket()) {
+				if (pause) {
+					peer->PauseRecv();
+				} else {
+					peer->ResumeRecv();
+				}
+			}
+		};
+		if (m_bSendHigh) {
+			m_fnRelayPause(true);
+		}
+	}
+
 protected:
+	//
+	//加入发送数据后检查高水位
+	inline void CheckSendBufHigh()
+	{
+		if (m_nSendHighMark && !m_bSendHigh && NotSendBufSize() >= m_nSendHighMark) {
+			m_bSendHigh = true;
+			OnSendBufHigh();
+		}
+	}
+
+	//发送数据后检查低水位
+	inline void CheckSendBufLow()
+	{
+		if (m_bSendHigh && NotSendBufSize() <= m_nSendLowMark) {
+			m_bSendHigh = false;
+			OnSendBufDrained();
+		}
+	}
+
+	//未发送数据超过高水位，生产者应该停止继续SendBuf，默认暂停转发对端的接收
+	virtual void OnSendBufHigh()
+	{
+		if (m_fnRelayPause) {
+			m_fnRelayPause(true);
+		}
+	}
+
+	//未发送数据从高水位降到低水位，默认恢复转发对端的接收
+	virtual void OnSendBufDrained()
+	{
+		if (m_fnRelayPause) {
+			m_fnRelayPause(false);
+		}
+	}
+
 	//
 	//解析数据包
 	virtual int ParseBuf(const char* lpBuf, int & nBufLen) { return SOCKET_PACKET_FLAG_COMPLETE; }
@@ -133,6 +267,13 @@ protected:
 		
 	}
 
+	//解析完后还剩从lpBuf开始的nBufLen字节，返回true表示已经自己调整好m_pRecvBuf/m_nRecvLen/m_nRecvBufLen
+	//（比如环形缓存只移动读位置），返回false由TcpSocket把剩余数据memmove到缓存开头
+	virtual bool ConsumeRecvBuf(const char*, int)
+	{
+		return false;
+	}
+
 	//准备发送数据包
 	virtual bool PrepareSendBuf(const char* & lpBuf, int & nBufLen)
 	{
@@ -145,6 +286,18 @@ protected:
 
 	}
 
+	//准备分片发送，填充最多nBufCount个待发送分片，nFlags可以加上MSG_ZEROCOPY等发送标志，返回0表示没有分片，走PrepareSendBuf
+	virtual int PrepareSendBufs(SOCKBUF*, int, int &)
+	{
+		return 0;
+	}
+
+	//分片发送了nBufLen字节，可能跨越多个分片，也可能停在某个分片中间
+	virtual void OnSendBufs(int)
+	{
+
+	}
+
 protected:
 	//
 	virtual void OnReceive(int nErrorCode)
@@ -154,6 +307,7 @@ protected:
 			return;
 		}
 		bool bConitnue = false;
+		int nBudget = Base::RecvBudget();
 		do {
 			bConitnue = false;
 			char* lpBuf = nullptr;
@@ -177,7 +331,17 @@ protected:
 				Base::Trigger(FD_CLOSE, XSocket::Socket::GetLastError());
 			} else {
 				OnReceive(lpBuf, nBufLen, 0);
-				bConitnue = Base::IsSocket();
+				//这次收到的请求合并好的响应先发出去，再接着收
+				Base::FlushCork();
+				bConitnue = Base::IsSocket() && !m_bRecvPaused;
+				if (bConitnue && nBudget) {
+					nBudget -= nBufLen;
+					if (nBudget <= 0) {
+						//接收预算用完，还没读到EWOULDBLOCK，交给SocketSet下一轮继续
+						Base::Pending(FD_READ);
+						break;
+					}
+				}
 			}
 		} while (bConitnue);
 	}
@@ -207,13 +371,17 @@ protected:
 			//异常不处理了，后续会关闭连接
 		} else {
 			if(nParseBufLen <= 0) {
-				m_nRecvLen = 0;
-				//m_pRecvBuf;
-				//m_nRecvBufLen;
+				if(!ConsumeRecvBuf(lpParseBuf, 0)) {
+					m_nRecvLen = 0;
+					//m_pRecvBuf;
+					//m_nRecvBufLen;
+				}
 			} else if(nParseBufLen < m_nRecvBufLen) {
 				//还剩nParseBufLen长度数据没有解析
 				if(nParseBufLen == m_nRecvLen) {
 					//没有解析任何数据，不需要移动数据
+				} else if(ConsumeRecvBuf(lpParseBuf, nParseBufLen)) {
+					//接收缓存自己移动了读位置
 				} else {
 					//需要移动数据
 					m_nRecvLen = nParseBufLen;
@@ -241,24 +409,41 @@ protected:
 		}
 
 		bool bConitnue = false;
+		int nBudget = Base::SendBudget();
 		do {
 			bConitnue = false;
 			const char* lpBuf = nullptr;
 			int nBufLen = 0;
 			if (!m_pSendBuf) {
-				if(!PrepareSendBuf(lpBuf,nBufLen)) {
+				SOCKBUF Bufs[DEFAULT_SEND_IOV_COUNT];
+				int nFlags = MSG_NOSIGNAL;
+				int nBufCount = PrepareSendBufs(Bufs, DEFAULT_SEND_IOV_COUNT, nFlags);
+				if (nBufCount > 0) {
+					//分片发送，一次系统调用发送多个分片，发送进度由OnSendBufs推进
+					lpBuf = SOCKBUF_BUF(Bufs[0]);
+					nBufLen = Base::SendV(Bufs, nBufCount, nFlags);
+#ifndef WIN32
+					if (nBufLen < 0 && (nFlags & MSG_ZEROCOPY) && XSocket::Socket::GetLastError() == ENOBUFS) {
+						//完成通知占满了optmem，等错误队列取走通知后再发
+						XSocket::Socket::SetLastError(EWOULDBLOCK);
+					}
+#endif//
+				} else if(!PrepareSendBuf(lpBuf,nBufLen)) {
 					//说明没有可发送数据
 					Base::RemoveSelect(FD_WRITE);
 					return;
+				} else {
+					m_nSendLen = 0;
+					m_pSendBuf = lpBuf;
+					m_nSendBufLen = nBufLen;
 				}
-				m_nSendLen = 0;
-				m_pSendBuf = lpBuf;
-				m_nSendBufLen = nBufLen;
 			}
-			lpBuf = m_pSendBuf+m_nSendLen;
-			nBufLen = (int)(m_nSendBufLen-m_nSendLen);
-			ASSERT(lpBuf && nBufLen>0);
-			nBufLen = Base::Send(lpBuf,nBufLen);
+			if (m_pSendBuf) {
+				lpBuf = m_pSendBuf+m_nSendLen;
+				nBufLen = (int)(m_nSendBufLen-m_nSendLen);
+				ASSERT(lpBuf && nBufLen>0);
+				nBufLen = Base::Send(lpBuf,nBufLen);
+			}
 			if (nBufLen<0) {
 				Base::OnSend(XSocket::Socket::GetLastError());
 			} else if(nBufLen == 0) {
@@ -266,6 +451,14 @@ protected:
 			} else {
 				OnSend(lpBuf, nBufLen, 0);
 				bConitnue = Base::IsSocket(); //继续发送
+				if (bConitnue && nBudget) {
+					nBudget -= nBufLen;
+					if (nBudget <= 0) {
+						//发送预算用完，交给SocketSet下一轮继续
+						Base::Pending(FD_WRITE);
+						break;
+					}
+				}
 			}
 		} while (bConitnue);
 	}
@@ -273,12 +466,19 @@ protected:
 	virtual void OnSend(const char* lpBuf, int nBufLen, int nFlags)
 	{
 		Base::OnSend(lpBuf, nBufLen, nFlags);
-		m_nSendLen += nBufLen;
-		if (m_nSendLen >= m_nSendBufLen) {
-			OnSendBuf(m_pSendBuf, m_nSendLen);
-			m_nSendLen = 0;
-			m_pSendBuf = nullptr;
-			m_nSendBufLen = 0;
+		if (!m_pSendBuf) {
+			OnSendBufs(nBufLen);
+		} else {
+			m_nSendLen += nBufLen;
+			if (m_nSendLen >= m_nSendBufLen) {
+				OnSendBuf(m_pSendBuf, m_nSendLen);
+				m_nSendLen = 0;
+				m_pSendBuf = nullptr;
+				m_nSendBufLen = 0;
+			}
+		}
+		if (Base::IsSocket()) {
+			CheckSendBufLow();
 		}
 	}
 };
@@ -484,37 +684,63 @@ public:
 			//+ lpAddr fix capacity is sizeof SOCKADDR_STORAGE
 			//+ lpBuf
 		}UDPBUF,*PUDPBUF;
-		std::shared_ptr<UdpBuffer> bufptr_;
-		inline PUDPBUF ptr() { return (PUDPBUF)bufptr_->data(); }
-		inline char *begin() { return (char*)ptr() + sizeof(UDPBUF) + sizeof(SOCKADDR_STORAGE); } 
-		inline char *tail() { return begin() + ptr()->nBufLen; };
+		enum { HEAD_SIZE = sizeof(UDPBUF) + sizeof(SOCKADDR_STORAGE) };
+		//放得下UdpBuffer的走UdpBufferPool，jumbo等大包走SlabPool
+		UdpBufferPool::Ptr bufptr_;
+		char* slabptr_ = nullptr;
+		inline char* head() const { return slabptr_ ? slabptr_ : bufptr_->data(); }
+		inline size_t capacity() const { return slabptr_ ? SlabPool::Capacity(slabptr_) : bufptr_->size(); }
+		inline PUDPBUF ptr() const { return (PUDPBUF)head(); }
+		inline char *begin() const { return head() + HEAD_SIZE; } 
+		inline char *tail() const { return begin() + ptr()->nBufLen; };
 	public:
 		Buffer(){}
-		Buffer(std::shared_ptr<UdpBuffer> bufptr):bufptr_(bufptr) {}
+		Buffer(const UdpBufferPool::Ptr& bufptr):bufptr_(bufptr) {}
 		Buffer(const char* lpBuf, int nBufLen, const SOCKADDR* lpAddr, int nAddrLen, int nFlags = 0) { 
 			reinit(lpBuf,nBufLen,lpAddr,nAddrLen,nFlags);
 		}
-		Buffer(const Buffer& rhs):Buffer(rhs.bufptr_) {}
-		Buffer(Buffer&& rhs):Buffer(rhs.bufptr_) {}
+		Buffer(const Buffer& rhs):bufptr_(rhs.bufptr_),slabptr_(rhs.slabptr_) {
+			if(slabptr_) {
+				SlabPool::AddRef(slabptr_);
+			}
+		}
+		Buffer(Buffer&& rhs):bufptr_(std::move(rhs.bufptr_)),slabptr_(rhs.slabptr_) {
+			rhs.slabptr_ = nullptr;
+		}
 		~Buffer() { reset(); }
 		Buffer& operator=(const Buffer& rhs) {
 			if(this == &rhs) {
 				return *this;
 			}
-			bufptr_ = rhs.bufptr_;
+			Buffer(rhs).swap(*this);
 			return *this;
 		}
 		Buffer& operator=(Buffer&& rhs) {
 			if(this == &rhs) {
 				return *this;
 			}
-			bufptr_ = rhs.bufptr_;
+			reset();
+			swap(rhs);
 			return *this;
 		}
+		inline void swap(Buffer& rhs) {
+			bufptr_.swap(rhs.bufptr_);
+			std::swap(slabptr_, rhs.slabptr_);
+		}
 
-		inline bool valid() const { return bufptr_?true:false; }
+		inline bool valid() const { return bufptr_ || slabptr_; }
+		//申请一个至少能放len字节数据的空缓存
+		inline void init(size_t len) {
+			reset();
+			if(HEAD_SIZE + len <= sizeof(UdpBuffer)) {
+				bufptr_ = UdpBufferPool::Inst().New();
+			} else {
+				slabptr_ = SlabPool::Inst().Alloc(HEAD_SIZE + len);
+			}
+			*ptr() = UDPBUF();
+		}
 		inline bool reinit(const char* lpBuf, int nBufLen, const SOCKADDR* lpAddr, int nAddrLen, int nFlags = 0) {
-			bufptr_ = UdpBufferPool::Inst().New();
+			init(nBufLen);
 #ifdef _DEBUG
 			PUDPBUF p = ptr();
 			char* str = data();
@@ -523,13 +749,32 @@ public:
 			flag(nFlags);
 			addr(lpAddr,nAddrLen);
 			write(lpBuf,nBufLen);
+			return true;
+		}
+		//剩余空间不够len字节时换一个SlabPool的大块，数据和地址一起搬过去
+		inline void reserve(size_t len) {
+			if(!valid()) {
+				init(len);
+			} else if(left() < len) {
+				size_t used = HEAD_SIZE + size();
+				char* slabptr = SlabPool::Inst().Alloc(used + len);
+				memcpy(slabptr, head(), used);
+				reset();
+				slabptr_ = slabptr;
+			}
+		}
+		inline void reset() { 
+			bufptr_.reset();
+			if(slabptr_) {
+				SlabPool::Free(slabptr_);
+				slabptr_ = nullptr;
+			}
 		}
-		inline void reset() { bufptr_.reset(); }
 
 		inline int flag() { return ptr()->nFlags; }
 		inline void flag(int f) { ptr()->nFlags = f; }
 
-		inline SOCKADDR* addr() { return (SOCKADDR*)((char*)ptr() + sizeof(UDPBUF)); } 
+		inline SOCKADDR* addr() { return (SOCKADDR*)(head() + sizeof(UDPBUF)); } 
 		//inline const SOCKADDR* const addr() const { return (SOCKADDR*)((char*)ptr() + sizeof(UDPBUF)); }
 		inline int addrlen() { return ptr()->nAddrLen; }
 		inline void addr(const SOCKADDR* sa, int salen) { 
@@ -542,7 +787,7 @@ public:
 
 		inline char* data() { return begin(); }
 		inline size_t size() const { return ptr()->nBufLen; }
-		inline size_t left() const { return bufptr_->size() - size() - sizeof(SOCKADDR_STORAGE) - sizeof(UDPBUF); }
+		inline size_t left() const { return capacity() - size() - HEAD_SIZE; }
 		inline size_t resize(size_t len) { 
 			ptr()->nBufLen = len; 
 			return ptr()->nBufLen; 
@@ -559,6 +804,7 @@ public:
 protected:
 	Buffer recvbuf_;
 	Buffer sendbuf_;
+	size_t recv_buf_size_ = 0; //接收缓存大小，0表示用UdpBuffer
 public:
 	UdpSocketEx():Base()
 	{
@@ -570,6 +816,11 @@ public:
 
 	}
 
+	//接收jumbo等超过UdpBuffer的大包时设置，接收缓存改从SlabPool申请
+	inline void ReserveRecvBufSize(size_t size) {
+		recv_buf_size_ = size;
+	}
+
 	// inline SOCKET Open(int nSockAf = AF_INET, int nSockType = SOCK_STREAM, int nSockProtocol = 0)
 	// {
 	// 	auto ret = Base::Open(nSockAf, nSockType, nSockProtocol);
@@ -623,7 +874,7 @@ protected:
 		do {
 			bConitnue = false;
 			if(!recvbuf_.valid()) {
-				recvbuf_.reinit(nullptr,0,nullptr,0);
+				recvbuf_.init(recv_buf_size_);
 			}
 			char* lpBuf = recvbuf_.data();
 			int nBufLen = recvbuf_.left();
@@ -857,26 +1108,26 @@ public:
 	typedef typename Base::SocketSet TaskSocketSet;
 public:
 	
-	inline void Post(const TaskID& key, std::function<void()> && task)
+	inline void Post(const TaskID& key, TaskFunction && task)
 	{
 		Base::this_service()->Post(key, std::move(task));
 	}
 
-	inline void Post(std::function<void()> && task)
+	inline void Post(TaskFunction && task)
 	{
 		Base::this_service()->Post(std::move(task));
 	}
 
 	template<class F, class... Args>
 	auto Send(const TaskID& key, F&& f, Args&&... args) 
-		-> std::future<typename std::result_of<F(Args...)>::type>
+		-> TaskFuture<typename std::result_of<F(Args...)>::type>
 	{
 		return Base::this_service()->Send(key, std::forward<F>(f), std::forward<Args>(args)...);
 	}
 	
 	template<class F, class... Args>
 	inline auto Send(F&& f, Args&&... args) 
-		-> std::future<typename std::result_of<F(Args...)>::type>
+		-> TaskFuture<typename std::result_of<F(Args...)>::type>
 	{
 		return Base::this_service()->Send(std::forward<F>(f), std::forward<Args>(args)...);
 	}
@@ -904,27 +1155,17 @@ class TaskSocketServiceT : public TBase
 protected:
 	struct Event
 	{
-		Event(std::function<void()> &&_task, void* _ptr = nullptr, size_t _delay = 0)
-		:task(std::move(_task)), ptr(_ptr), time(std::chrono::steady_clock::now() + std::chrono::milliseconds(_delay)) {
+		Event() {}
+		Event(TaskFunction &&_task, void* _ptr = nullptr, size_t _delay = 0)
+		:ptr(_ptr), task(std::move(_task)), time(std::chrono::steady_clock::now() + std::chrono::milliseconds(_delay)) {
 			//PRINTF("Event");
 		}
-		Event(const Event& o):task(o.task),ptr(o.ptr),time(o.time) {
-			//PRINTF("levent");
-		}
-		Event(Event&& o):task(std::move(o.task)),ptr(o.ptr),time(o.time) {
+		Event(Event&& o):ptr(o.ptr),task(std::move(o.task)),time(o.time) {
 			//PRINTF("revent");
 		}
 		~Event() {
 		}
 
-		Event& operator = (const Event& rhs) {
-			if(this == &rhs) return *this;
-			//DealyEventBase::operator=(rhs);
-			ptr = rhs.ptr;
-			task = rhs.task;
-			time = rhs.time;
-        	return *this;
-    	}
 		Event& operator = (Event&& rhs) {
 			if(this == &rhs) return *this;
 			//DealyEventBase::operator=(std::move(rhs));
@@ -950,11 +1191,21 @@ protected:
 			return false;
 		}
 		void* ptr = nullptr;
-		std::function<void()> task;
+		TaskFunction task;
 		std::chrono::steady_clock::time_point time;
 	};
-	std::vector<Event> queue_;
+	TaskHeap<Event> queue_; //延迟任务
 	std::mutex mutex_;
+	struct TaskNode : public MPSCNode
+	{
+		Event evt;
+		TaskNode(TaskFunction &&_task, void* _ptr):evt(std::move(_task), _ptr) {}
+		static void* operator new(size_t size) { return TaskCache<TaskNode>::Alloc(size); }
+		static void operator delete(void* ptr, size_t size) { TaskCache<TaskNode>::Free(ptr, size); }
+	};
+	MPSCQueue<TaskNode> post_que_; //实时任务，无锁投递，消费时在mutex_里取出
+	TaskNode* ready_head_ = nullptr; //从post_que_取出待执行的实时任务，直接串起节点，不再拷到容器里
+	TaskNode* ready_tail_ = nullptr;
 	//
 	/*template<class... _Valty>	
 	inline void InnerPost(_Valty&&... _Val) {
@@ -965,51 +1216,64 @@ protected:
 public:
 	TaskSocketServiceT()
 	{
-		queue_.reserve(1024);
+	}
+	~TaskSocketServiceT()
+	{
+		DrainPost();
+		while (TaskNode* node = ready_head_)
+		{
+			ready_head_ = (TaskNode*)node->next.load(std::memory_order_relaxed);
+			delete node;
+		}
 	}
 
-	inline void Post(void* ptr, std::function<void()> && task)
+	inline void Post(void* ptr, TaskFunction && task)
 	{
 		PostDelay(0, ptr, std::move(task));
 	}
 
-	inline void PostDelay(size_t delay, void* ptr, std::function<void()> && task)
+	//返回延迟任务句柄，可以用Cancel取消，实时任务返回0
+	inline uint64_t PostDelay(size_t delay, void* ptr, TaskFunction && task)
 	{
 		ASSERT(task);
-		Event evt(std::move(task), ptr, delay);
+		if(!delay) {
+			//实时任务无锁入队，多次投递只通知一次
+			if(post_que_.Push(new TaskNode(std::move(task), ptr))) {
+				Base::PostNotify();
+			}
+			return 0;
+		}
+		uint64_t handle = 0;
 		{
 		std::lock_guard<std::mutex> lock(mutex_);
-		//实时任务排在延迟任务前面，延迟任务按延迟时间排队，延迟短排在前面,消费任务从头开始消费
-		auto it = std::upper_bound(queue_.begin(), queue_.end(), evt);
-		queue_.emplace(it,std::move(evt));
-		//queue_.emplace(it.base(),std::forward<std::function<void()>>(task), ptr, delay, repeat);
-		}
-		if(delay) {
-			Base::PostTimer(delay);
-		} else {
-			Base::PostNotify();	
+		//延迟任务按到期时间进堆，同时到期的按投递顺序执行
+		Event evt(std::move(task), ptr, delay);
+		handle = queue_.Push(evt.time, std::move(evt), (uintptr_t)ptr);
 		}
+		Base::PostTimer(delay);
+		return handle;
+	}
+
+	inline bool Cancel(uint64_t handle)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return queue_.Cancel(handle);
 	}
 
 	template<class F, class... Args>
 	inline auto PostF(void* ptr, F&& f, Args&&... args)
-		-> std::future<typename std::result_of<F(Args...)>::type>
+		-> TaskFuture<typename std::result_of<F(Args...)>::type>
 	{
 		return PostDelayF(0, ptr, std::forward<F>(f), std::forward<Args>(args)...);
 	}
 
 	template<class F, class... Args>
 	auto PostDelayF(size_t delay, void* ptr, F&& f, Args&&... args)
-		-> std::future<typename std::result_of<F(Args...)>::type>
+		-> TaskFuture<typename std::result_of<F(Args...)>::type>
 	{
-		using return_type = typename std::result_of<F(Args...)>::type;
-
-		auto task = std::make_shared< std::packaged_task<return_type()> >(
-				std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-			);
-
-		PostDelay(delay, ptr, [task](){ (*task)(); });
-		return task->get_future();
+		TaskFuture<typename std::result_of<F(Args...)>::type> res;
+		PostDelay(delay, ptr, MakeTask(res, std::forward<F>(f), std::forward<Args>(args)...));
+		return res;
 	}
 
 	template<class F, class... Args>
@@ -1026,15 +1290,33 @@ public:
 		return [task](){ (*task)(); };
 	}
 
+	template<class F, class... Args>
+	static inline TaskFunction Package(TaskFuture<typename std::result_of<F(Args...)>::type>& res, F&& f, Args&&... args)
+	{
+		return MakeTask(res, std::forward<F>(f), std::forward<Args>(args)...);
+	}
+
 	inline void Remove(void* ptr) {
 		std::unique_lock<std::mutex> lock(mutex_);
-		for(int i = queue_.size() - 1; i >= 0; i--)
+		DrainPost();
+		TaskNode* head = ready_head_;
+		ready_head_ = ready_tail_ = nullptr;
+		while (head)
 		{
-			const Event& evt = queue_[i];
-			if (evt.ptr == ptr) {
-				queue_.erase(queue_.begin() + i);
+			TaskNode* node = head;
+			head = (TaskNode*)node->next.load(std::memory_order_relaxed);
+			if (node->evt.ptr == ptr) {
+				delete node;
+			} else {
+				PushReady(node);
 			}
 		}
+		//延迟任务按对象指针串成链表，只取消这个对象的任务
+		if (ptr) {
+			queue_.CancelKey((uintptr_t)ptr);
+		} else {
+			queue_.CancelIf([](const Event& evt) { return !evt.ptr; });
+		}
 	}
 
 protected:
@@ -1043,26 +1325,63 @@ protected:
 		Remove(sock_ptr);
 	}
 
+	inline void PushReady(TaskNode* node)
+	{
+		node->next.store(nullptr, std::memory_order_relaxed);
+		if (ready_tail_) {
+			ready_tail_->next.store(node, std::memory_order_relaxed);
+		} else {
+			ready_head_ = node;
+		}
+		ready_tail_ = node;
+	}
+
+	//把post_que_里的任务取到ready_，需要在mutex_里调用
+	inline void DrainPost()
+	{
+		post_que_.Reset();
+		while (TaskNode* node = post_que_.Pop())
+		{
+			PushReady(node);
+		}
+	}
+
 	void DoTask()
 	{
-		//从头开始消费
 		std::unique_lock<std::mutex> lock(mutex_);
-		size_t i = 0, j = queue_.size();
+		//先执行实时任务，只执行本次取出的任务，执行中投递的任务会重新通知
+		DrainPost();
+		//逐个在锁内摘下，执行中Remove的任务不会再被执行
+		for(TaskNode* tail = ready_tail_; ready_head_; )
+		{
+			TaskNode* node = ready_head_;
+			ready_head_ = (TaskNode*)node->next.load(std::memory_order_relaxed);
+			if (!ready_head_) {
+				ready_tail_ = nullptr;
+			}
+			bool last = (node == tail);
+			lock.unlock();
+			node->evt.task();
+			delete node;
+			lock.lock();
+			if (last) {
+				break;
+			}
+		}
+		//再消费到期的延迟任务
+		size_t i = 0, j = queue_.Count();
 		for(; i < j; i++)
 		{
-			Event& evt = queue_.front();
-			uint32_t millis = 0;
-			if (evt.IsActive(&millis)) {
-				auto task(std::move(evt.task));
-				queue_.erase(queue_.begin());
+			Event evt;
+			ssize_t delay = 0;
+			if (queue_.PopActive(evt, &delay)) {
 				lock.unlock();
-				task();
+				evt.task();
 				lock.lock();
 			} else {
-				Base::PostTimer(millis);
-				break;
-			}
-			if (queue_.empty()) {
+				if (delay > 0) {
+					Base::PostTimer(delay);
+				}
 				break;
 			}
 		}
@@ -1126,6 +1445,8 @@ protected:
 	std::vector<Event> queue_;
 	std::mutex mutex_;
 	//std::condition_variable cv_;
+	std::unordered_map<uint64_t,std::pair<void*,uint64_t>> delays_; //延迟事件序号->(Socket,定时器)
+	uint64_t delay_seq_ = 0;
 public:
 	SimpleEvtServiceT()
 	{
@@ -1151,6 +1472,53 @@ protected:
 				}
 			}
 		}
+		std::vector<uint64_t> timers;
+		for(auto it = delays_.begin(); it != delays_.end(); )
+		{
+			if (it->second.first == sock_ptr) {
+				timers.push_back(it->second.second);
+				it = delays_.erase(it);
+			} else {
+				++it;
+			}
+		}
+		lock.unlock();
+		//定时器回调会加mutex_，不能持有mutex_取消定时器
+		for(uint64_t id : timers)
+		{
+			Base::CancelTimer(id);
+		}
+	}
+
+	//还没激活的延迟事件交给定时器，到期再投递，避免OnNotify反复投递空转
+	inline void PostDelay(const Event& evt) {
+		uint32_t millis = Base::GetDelay(evt);
+		if (millis) {
+			std::unique_lock<std::mutex> lock(mutex_);
+			uint64_t seq = ++delay_seq_;
+			delays_[seq] = std::make_pair((void*)Base::IsSocketEvent(evt), (uint64_t)0);
+			lock.unlock();
+			uint64_t id = Base::AddTimer(millis, [this, seq, evt]() {
+				std::unique_lock<std::mutex> lock(mutex_);
+				if (!delays_.erase(seq)) {
+					return; //已经取消了
+				}
+				lock.unlock();
+				Post(evt);
+			});
+			lock.lock();
+			auto it = delays_.find(seq);
+			if (id) {
+				if (it != delays_.end()) {
+					it->second.second = id;
+				}
+				return;
+			}
+			if (it != delays_.end()) {
+				delays_.erase(it);
+			}
+		}
+		Post(evt);
 	}
 
 	inline bool Pop(Event& evt) {
@@ -1172,7 +1540,7 @@ protected:
 				if (Base::IsActive(evt)) {
 					OnEvent(evt);
 				} else {
-					Post(evt);
+					PostDelay(evt);
 				}
 			}
 		}
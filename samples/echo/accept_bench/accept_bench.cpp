@@ -0,0 +1,192 @@
+#include "../../samples.h"
+#include "../../../XSocket/XSocketImpl.h"
+#include "../../../XSocket/XEPoll.h"
+#include "../../../XSocket/XSimpleImpl.h"
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+using namespace XSocket;
+
+//Accept基准：客户端线程不停地连接后马上RST关闭，对比三种监听方式的每秒Accept连接数
+//single：一个监听Socket，Accept到的连接轮流分配到各SocketSet
+//reuseport：每个SocketSet一个SO_REUSEPORT监听Socket（ListenReusePort），内核分发，各自Accept
+//exclusive：共享一个监听Socket，每个SocketSet以EPOLLEXCLUSIVE监听（ListenExclusive）
+//输出每秒Accept数和各SocketSet处理的连接数
+//用法：accept_bench [连接数] [SocketSet数] [客户端线程数]
+
+class WorkSocket;
+typedef EPollSocketSetT<EPollService,WorkSocket> WorkSocketSet;
+
+class WorkSocket : public EPollSocketT<WorkSocketSet,SocketEx>
+{
+};
+
+class worker : public SocketExImpl<worker,SimpleSocketT<WorkSocket>>
+{
+};
+
+enum
+{
+	MODE_SINGLE = 0,
+	MODE_REUSEPORT,
+	MODE_EXCLUSIVE,
+	MODE_COUNT
+};
+
+static const char* s_mode_names[MODE_COUNT] = { "single", "reuseport", "exclusive" };
+
+class listener;
+static SocketManagerT<WorkSocketSet>* s_mgr = nullptr;
+static std::atomic<size_t> s_accepted(0);
+static std::atomic<size_t> s_refused(0);
+static std::vector<std::atomic<size_t>>* s_per_set = nullptr;
+
+class listener : public SocketExImpl<listener,ListenSocketExT<WorkSocket>>
+{
+protected:
+	virtual void OnAccept(SOCKET Sock, const SOCKADDR* lpSockAddr, int nSockAddrLen)
+	{
+		(void)lpSockAddr;
+		(void)nSockAddrLen;
+		std::shared_ptr<worker> sock_ptr = std::make_shared<worker>();
+		sock_ptr->Attach(Sock, SOCKET_ROLE_WORK);
+		sock_ptr->SetNonBlock();
+		int pos = s_mgr->AddAcceptSocket(sock_ptr, FD_READ);
+		if (pos >= 0) {
+			(*s_per_set)[pos].fetch_add(1, std::memory_order_relaxed);
+		} else {
+			s_refused++;
+			sock_ptr->Close();
+		}
+		s_accepted.fetch_add(1, std::memory_order_release);
+	}
+};
+
+//找一个空闲端口，几种监听方式都要绑定同一个端口
+static u_short FreePort()
+{
+	SOCKET ls = Socket::Create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	SOCKADDR_IN addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = Socket::Ip2N(DEFAULT_IP);
+	addr.sin_port = 0;
+	int addr_len = sizeof(addr);
+	Socket::Bind(ls, (const SOCKADDR*)&addr, sizeof(addr));
+	Socket::GetSockName(ls, (SOCKADDR*)&addr, &addr_len);
+	Socket::Close(ls);
+	return ntohs(addr.sin_port);
+}
+
+static bool Bench(int mode, size_t total, int sets, int clients)
+{
+	SocketManagerT<WorkSocketSet> mgr(4096, sets);
+	mgr.SetWaitTimeOut(DEFAULT_WAIT_TIMEOUT);
+	mgr.Start();
+	std::vector<std::atomic<size_t>> per_set(sets);
+	for (auto& count : per_set)
+	{
+		count = 0;
+	}
+	s_mgr = &mgr;
+	s_per_set = &per_set;
+	s_accepted = 0;
+	s_refused = 0;
+
+	u_short port = FreePort();
+	auto create = []() { return std::make_shared<listener>(); };
+	int listeners = 0;
+	switch (mode)
+	{
+	case MODE_SINGLE:
+	{
+		std::shared_ptr<listener> sock_ptr = create();
+		sock_ptr->Open(DEFAULT_IP);
+		sock_ptr->SetSockOpt(SOL_SOCKET, SO_REUSEADDR, 1);
+		if (SOCKET_ERROR != sock_ptr->Bind(port) && SOCKET_ERROR != sock_ptr->Listen(SOMAXCONN) && mgr.AddAccept(sock_ptr) >= 0) {
+			listeners = 1;
+		}
+	}
+	break;
+	case MODE_REUSEPORT:
+		listeners = mgr.ListenReusePort<listener>(create, DEFAULT_IP, port, SOMAXCONN);
+		break;
+	case MODE_EXCLUSIVE:
+		listeners = mgr.ListenExclusive<listener>(create, DEFAULT_IP, port, SOMAXCONN);
+		break;
+	}
+	if (!listeners) {
+		printf("%-10s listen failed\n", s_mode_names[mode]);
+		mgr.Stop();
+		return false;
+	}
+
+	SOCKADDR_IN addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = Socket::Ip2N(DEFAULT_IP);
+	addr.sin_port = htons(port);
+	std::atomic<size_t> connected(0);
+	std::atomic<size_t> failed(0);
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (int c = 0; c < clients; c++)
+	{
+		threads.emplace_back([&addr, &connected, &failed, total, clients, c]() {
+			size_t count = total / clients + (c < (int)(total % clients) ? 1 : 0);
+			for (size_t i = 0; i < count; i++)
+			{
+				SOCKET cs = Socket::Create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+				if (Socket::Connect(cs, (const SOCKADDR*)&addr, sizeof(addr)) == 0) {
+					connected++;
+				} else {
+					failed++;
+				}
+				//RST关闭，不留TIME_WAIT占用本地端口
+				struct linger lg = { 1, 0 };
+				Socket::SetSockOpt(cs, SOL_SOCKET, SO_LINGER, (const char*)&lg, sizeof(lg));
+				Socket::Close(cs);
+			}
+		});
+	}
+	for (auto& t : threads)
+	{
+		t.join();
+	}
+	//等服务端把已经连上的连接都Accept完
+	auto wait = std::chrono::steady_clock::now();
+	while (s_accepted.load(std::memory_order_acquire) < connected
+		&& std::chrono::steady_clock::now() - wait < std::chrono::seconds(5))
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	size_t accepted = s_accepted;
+	bool ok = accepted == total && !failed && !s_refused;
+	std::string dist;
+	for (auto& count : per_set)
+	{
+		dist += (dist.empty() ? "" : "/") + std::to_string(count.load());
+	}
+	printf("%-10s %d listeners %8.0f accept/s per set %s %s\n", s_mode_names[mode], listeners,
+		accepted / wall, dist.c_str(), ok ? "ok" : "FAILED");
+	mgr.Stop();
+	s_mgr = nullptr;
+	s_per_set = nullptr;
+	return ok;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t total = argc > 1 ? atoi(argv[1]) : 20000;
+	int sets = argc > 2 ? atoi(argv[2]) : 4;
+	int clients = argc > 3 ? atoi(argv[3]) : 4;
+
+	worker::Init();
+	printf("%zu connections, %d socket sets, %d client threads\n", total, sets, clients);
+	bool ok = true;
+	for (int mode = 0; mode < MODE_COUNT; mode++)
+	{
+		ok = Bench(mode, total, sets, clients) && ok;
+	}
+	worker::Term();
+	return ok ? 0 : 1;
+}
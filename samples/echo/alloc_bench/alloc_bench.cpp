@@ -0,0 +1,117 @@
+#include "../../samples.h"
+#include "../../../XSocket/XSocketImpl.h"
+#include "../../../XSocket/XEPoll.h"
+#include "../../../XSocket/XSimpleImpl.h"
+#include <cstdio>
+#include <cstdlib>
+using namespace XSocket;
+
+//连接对象分配基准：模拟accept突发，每轮创建一批连接，做第一次接收/发送，然后全部释放
+//对比std::make_shared和SocketFactoryT，输出每个连接的耗时和堆分配次数
+//两种方式交替跑多遍取最好的一遍，单次结果受机器抖动影响很大
+//用法：alloc_bench [每轮连接数] [轮数] [遍数]
+
+static std::atomic<size_t> g_new_count(0);
+
+void* operator new(size_t size)
+{
+	g_new_count.fetch_add(1, std::memory_order_relaxed);
+	void* ptr = malloc(size ? size : 1);
+	if (!ptr) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+	free(ptr);
+}
+
+class worker;
+
+typedef EPollSocketSetT<EPollService,worker> WorkSocketSet;
+
+class worker : public SocketExImpl<worker,SimpleSocketT<EPollSocketT<WorkSocketSet,SocketEx>,SlabString>>
+{
+public:
+	worker()
+	{
+		ReserveRecvBufSize(DEFAULT_BUFSIZE);
+		ReserveSendBufSize(DEFAULT_BUFSIZE);
+	}
+
+	//第一次接收和发送用到的缓存
+	inline void Touch()
+	{
+		char* lpBuf = nullptr;
+		int nBufLen = 0;
+		PrepareRecvBuf(lpBuf, nBufLen);
+		lpBuf[0] = 1;
+		SendBuf().append("HTTP/1.1 200 OK\r\n\r\n");
+	}
+};
+
+struct Result
+{
+	double ns = 0;
+	double allocs = 0;
+};
+
+template<class F>
+static Result Bench(size_t count, size_t round, F&& create)
+{
+	std::vector<std::shared_ptr<worker>> socks;
+	socks.reserve(count);
+	size_t new_count = g_new_count.load();
+	auto start = std::chrono::steady_clock::now();
+	for (size_t r = 0; r < round; r++)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			socks.emplace_back(create());
+			socks.back()->Touch();
+		}
+		socks.clear();
+	}
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	new_count = g_new_count.load() - new_count;
+	Result result;
+	result.ns = ns / (count * round);
+	result.allocs = (double)new_count / (count * round);
+	return result;
+}
+
+static void Print(const char* name, const Result& result)
+{
+	printf("%-24s %8.1f ns/conn %6.2f allocs/conn\n", name, result.ns, result.allocs);
+}
+
+int main(int argc, char* argv[])
+{
+	size_t count = argc > 1 ? atoi(argv[1]) : 10000;
+	size_t round = argc > 2 ? atoi(argv[2]) : 20;
+	int passes = argc > 3 ? atoi(argv[3]) : 5;
+
+	auto make = []() { return std::make_shared<worker>(); };
+	auto factory = []() { return SocketFactoryT<worker>::Inst().New(); };
+	//先各跑一轮预热，后面的结果不含arena/SlabPool的首次申请
+	Bench(count, 1, make);
+	Bench(count, 1, factory);
+	Result best_make, best_factory;
+	for (int pass = 0; pass < passes; pass++)
+	{
+		Result result = Bench(count, round, make);
+		if (!pass || result.ns < best_make.ns) {
+			best_make = result;
+		}
+		result = Bench(count, round, factory);
+		if (!pass || result.ns < best_factory.ns) {
+			best_factory = result;
+		}
+	}
+	printf("%zu connections x %zu rounds, best of %d, block size %zu\n", count, round, passes, SocketFactoryT<worker>::Inst().GetBlockSize());
+	Print("std::make_shared", best_make);
+	Print("SocketFactoryT::New", best_factory);
+	return 0;
+}
@@ -0,0 +1,210 @@
+#include "../../samples.h"
+#include "../../../XSocket/XSocketImpl.h"
+#include "../../../XSocket/XEPoll.h"
+#include "../../../XSocket/XIoUring.h"
+#include "../../../XSocket/XSimpleImpl.h"
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <thread>
+using namespace XSocket;
+
+//后端对比基准：同一个SimpleSocketT回显连接分别跑在EPollSocketSet和IoUringSocketSet上
+//pingpong：客户端线程对每个连接发64字节再逐个收回，输出每秒往返次数和每次往返的进程CPU时间
+//stream：客户端单向发送，服务端只收不回，输出MB/s和每GB的进程CPU时间
+//io_uring接收先进IOURING_BUF_SIZE大小的共享缓存块再拷贝出来，大流量时可以编译时调大块大小对比
+//用法：backend_bench [pingpong往返轮数] [stream MB数]
+
+class EPollWork;
+typedef EPollSocketSetT<EPollService,EPollWork> EPollWorkSet;
+class EPollWork : public EPollSocketT<EPollWorkSet,SocketEx>
+{
+};
+
+class IoUringWork;
+typedef IoUringSocketSetT<IoUringService,IoUringWork> IoUringWorkSet;
+class IoUringWork : public IoUringSocketT<IoUringWorkSet,SocketEx>
+{
+};
+
+static bool s_discard = false; //只收不回
+static std::atomic<size_t> s_recv(0);
+
+template<class TBase>
+class echo : public SocketExImpl<echo<TBase>,SimpleSocketT<TBase>>
+{
+	typedef SocketExImpl<echo<TBase>,SimpleSocketT<TBase>> Base;
+public:
+	echo()
+	{
+		Base::ReserveRecvBufSize(DEFAULT_BUFSIZE);
+		Base::ReserveSendBufSize(DEFAULT_BUFSIZE);
+	}
+
+protected:
+	virtual void OnRecvBuf(const char* lpBuf, int nBufLen, int nFlags)
+	{
+		Base::OnRecvBuf(lpBuf, nBufLen, nFlags);
+		if (!s_discard) {
+			Base::SendBuf(lpBuf, nBufLen);
+		}
+		s_recv.fetch_add(nBufLen, std::memory_order_release);
+	}
+};
+
+static double ProcessCpuTime()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//连接count个客户端，服务端连接加入mgr，返回客户端Socket
+template<class TSocketSet, class TWork>
+static std::vector<SOCKET> Connect(SocketManagerT<TSocketSet>& mgr, size_t count)
+{
+	std::vector<SOCKET> clients;
+	SOCKET ls = Socket::Create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	SOCKADDR_IN addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = Socket::Ip2N(DEFAULT_IP);
+	addr.sin_port = 0;
+	int addr_len = sizeof(addr);
+	Socket::Bind(ls, (const SOCKADDR*)&addr, sizeof(addr));
+	Socket::Listen(ls, SOMAXCONN);
+	Socket::GetSockName(ls, (SOCKADDR*)&addr, &addr_len);
+	for (size_t i = 0; i < count; i++)
+	{
+		SOCKET cs = Socket::Create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		int nodelay = 1;
+		Socket::SetSockOpt(cs, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+		if (Socket::Connect(cs, (const SOCKADDR*)&addr, sizeof(addr)) != 0) {
+			Socket::Close(cs);
+			break;
+		}
+		clients.push_back(cs);
+		SOCKET sock = Socket::Accept(ls, nullptr, nullptr);
+		Socket::SetSockOpt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+		std::shared_ptr<echo<TWork>> sock_ptr = std::make_shared<echo<TWork>>();
+		sock_ptr->Attach(sock, SOCKET_ROLE_WORK);
+		sock_ptr->SetNonBlock();
+		mgr.AddSocket(sock_ptr, FD_READ);
+	}
+	Socket::Close(ls);
+	return clients;
+}
+
+static size_t ReceiveN(SOCKET cs, char* buf, size_t nLen)
+{
+	size_t len = 0;
+	while (len < nLen)
+	{
+		int ret = Socket::Receive(cs, buf + len, (int)(nLen - len));
+		if (ret <= 0) {
+			break;
+		}
+		len += ret;
+	}
+	return len;
+}
+
+template<class TSocketSet, class TWork>
+static bool PingPong(const char* name, size_t conns, size_t rounds)
+{
+	SocketManagerT<TSocketSet> mgr(1024, 1);
+	mgr.SetWaitTimeOut(DEFAULT_WAIT_TIMEOUT);
+	mgr.Start();
+	s_discard = false;
+	std::vector<SOCKET> clients = Connect<TSocketSet,TWork>(mgr, conns);
+	bool ok = clients.size() == conns;
+	char msg[64], buf[64];
+	memset(msg, 'p', sizeof(msg));
+	double cpu = ProcessCpuTime();
+	auto start = std::chrono::steady_clock::now();
+	for (size_t r = 0; r < rounds && ok; r++)
+	{
+		for (SOCKET cs : clients)
+		{
+			ok = Socket::Send(cs, msg, sizeof(msg)) == (int)sizeof(msg) && ok;
+		}
+		for (SOCKET cs : clients)
+		{
+			ok = ReceiveN(cs, buf, sizeof(buf)) == sizeof(buf) && ok;
+		}
+	}
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	cpu = ProcessCpuTime() - cpu;
+	size_t count = rounds * conns;
+	printf("%-8s pingpong %3zu conns %9.0f rtt/s %8.2f us cpu/rtt %s\n", name, conns,
+		count / wall, cpu * 1e6 / count, ok ? "ok" : "FAILED");
+	for (SOCKET cs : clients)
+	{
+		Socket::Close(cs);
+	}
+	mgr.Stop();
+	return ok;
+}
+
+template<class TSocketSet, class TWork>
+static bool Stream(const char* name, size_t total)
+{
+	SocketManagerT<TSocketSet> mgr(1024, 1);
+	mgr.SetWaitTimeOut(DEFAULT_WAIT_TIMEOUT);
+	mgr.Start();
+	s_discard = true;
+	s_recv = 0;
+	std::vector<SOCKET> clients = Connect<TSocketSet,TWork>(mgr, 1);
+	bool ok = clients.size() == 1;
+	std::vector<char> buf(64*1024, 's');
+	double cpu = ProcessCpuTime();
+	auto start = std::chrono::steady_clock::now();
+	size_t sent = 0;
+	while (ok && sent < total)
+	{
+		int ret = Socket::Send(clients[0], buf.data(), (int)std::min(buf.size(), total - sent));
+		if (ret <= 0) {
+			ok = false;
+			break;
+		}
+		sent += ret;
+	}
+	auto wait = std::chrono::steady_clock::now();
+	while (ok && s_recv.load(std::memory_order_acquire) < total)
+	{
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+		if (std::chrono::steady_clock::now() - wait > std::chrono::seconds(10)) {
+			ok = false;
+		}
+	}
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	cpu = ProcessCpuTime() - cpu;
+	double gb = total / (1024.0*1024*1024);
+	printf("%-8s stream   %3d conns %9.1f MB/s  %8.1f ms cpu/GB %s\n", name, 1,
+		total / (1024.0*1024) / wall, cpu * 1000 / gb, ok ? "ok" : "FAILED");
+	for (SOCKET cs : clients)
+	{
+		Socket::Close(cs);
+	}
+	mgr.Stop();
+	s_discard = false;
+	return ok;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t rounds = argc > 1 ? atoi(argv[1]) : 20000;
+	size_t total = (argc > 2 ? atoi(argv[2]) : 1024) * 1024 * 1024ULL;
+
+	echo<EPollWork>::Init();
+	bool ok = true;
+	size_t conns[] = { 1, 16 };
+	for (size_t count : conns)
+	{
+		ok = PingPong<EPollWorkSet,EPollWork>("epoll", count, rounds / count) && ok;
+		ok = PingPong<IoUringWorkSet,IoUringWork>("io_uring", count, rounds / count) && ok;
+	}
+	ok = Stream<EPollWorkSet,EPollWork>("epoll", total) && ok;
+	ok = Stream<IoUringWorkSet,IoUringWork>("io_uring", total) && ok;
+	echo<EPollWork>::Term();
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,132 @@
+#include "../../samples.h"
+#include "../../../XSocket/XSocketImpl.h"
+#include "../../../XSocket/XEPoll.h"
+#include "../../../XSocket/XCoroutine.h"
+using namespace XSocket;
+
+//协程HTTP客户端，所有请求都在SocketManager的epoll服务线程里执行，不为每个请求分配回调对象
+//用法：co_http_client [host] [port] [path] [并发数] [每个并发的请求数]
+
+class client;
+
+typedef EPollSocketSetT<EPollService,client> ClientSocketSet;
+typedef ConnectSocketExT<EPollSocketT<ClientSocketSet,SocketEx>> ClientSocketBase;
+
+class client : public CoSocketImpl<client,ClientSocketBase>
+{
+};
+
+class manager : public SocketManagerT<ClientSocketSet>
+{
+	typedef SocketManagerT<ClientSocketSet> Base;
+public:
+	manager(int nMaxSocketCount):Base(nMaxSocketCount,DEFAULT_MAX_SOCKSET_COUNT)
+	{
+		SetWaitTimeOut(DEFAULT_WAIT_TIMEOUT);
+	}
+};
+
+struct Stat
+{
+	std::atomic<size_t> ok{0};
+	std::atomic<size_t> fail{0};
+	std::atomic<size_t> bytes{0};
+	std::atomic<size_t> done{0};
+};
+
+//一次请求，返回HTTP状态码，失败返回<0
+CoTask<int> Fetch(manager& m, struct addrinfo* ai, u_short port, const std::string& req, Stat& stat)
+{
+	std::shared_ptr<client> sock = std::make_shared<client>();
+	if (!XSocket::Socket::IsSocket(sock->Open(ai))) {
+		co_return -1;
+	}
+	int ret = co_await sock->AsyncConnect(m, port);
+	if (ret < 0) {
+		sock->Close();
+		co_return ret;
+	}
+	ret = co_await sock->AsyncWrite(req.data(), (int)req.size());
+	if (ret < 0) {
+		sock->Close();
+		co_return ret;
+	}
+	//Connection: close，读到对端关闭就是完整响应
+	char buf[2048];
+	int status = 0;
+	while ((ret = co_await sock->AsyncRead(buf, sizeof(buf))) > 0)
+	{
+		if (!status) {
+			//HTTP/1.1 200 OK
+			if (ret < 12 || strncmp(buf, "HTTP/1.", 7) != 0) {
+				break;
+			}
+			status = atoi(buf + 9);
+		}
+		stat.bytes += ret;
+	}
+	sock->Close();
+	co_return ret < 0 ? ret : status;
+}
+
+CoTask<> Run(manager& m, struct addrinfo* ai, u_short port, const std::string& req, int count, Stat& stat)
+{
+	for (int i = 0; i < count; i++)
+	{
+		int status = co_await Fetch(m, ai, port, req, stat);
+		if (status >= 200 && status < 400) {
+			stat.ok++;
+		} else {
+			stat.fail++;
+		}
+	}
+	stat.done++;
+}
+
+#ifdef WIN32
+int _tmain(int argc, _TCHAR* argv[])
+#else
+int main(int argc, char* argv[])
+#endif//
+{
+	const char* host = argc > 1 ? argv[1] : DEFAULT_IP;
+	u_short port = argc > 2 ? atoi(argv[2]) : 80;
+	const char* path = argc > 3 ? argv[3] : "/";
+	int concurrency = argc > 4 ? atoi(argv[4]) : 1000;
+	int count = argc > 5 ? atoi(argv[5]) : 10;
+
+	client::Init();
+	//只解析一次地址，所有连接共用
+	struct addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo* ai = nullptr;
+	if (XSocket::Socket::GetAddrInfo(host, nullptr, &hints, &ai) || !ai) {
+		PRINTF("GetAddrInfo %s failed", host);
+		client::Term();
+		return -1;
+	}
+	XSocket::Socket::SetAddrPort(ai->ai_addr, port);
+	std::string req = std::string("GET ") + path + " HTTP/1.1\r\nHost: " + host + "\r\nConnection: close\r\n\r\n";
+	//每个SocketSet都能容纳全部并发连接，加上关闭后等待移除的连接
+	manager m(concurrency * 2);
+	m.Start();
+	Stat stat;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 0; i < concurrency; i++)
+	{
+		Run(m, ai, port, req, count, stat).Detach();
+	}
+	while (stat.done < (size_t)concurrency)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	size_t total = stat.ok + stat.fail;
+	PRINTF("requests=%zu ok=%zu fail=%zu bytes=%zu time=%.3fs rate=%.0f req/s",
+		total, (size_t)stat.ok, (size_t)stat.fail, (size_t)stat.bytes, secs, total / secs);
+	m.Stop();
+	freeaddrinfo(ai);
+	client::Term();
+	return 0;
+}
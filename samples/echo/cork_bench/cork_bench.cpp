@@ -0,0 +1,182 @@
+#include "../../samples.h"
+#include "../../../XSocket/XSocketImpl.h"
+#include "../../../XSocket/XEPoll.h"
+#include "../../../XSocket/XSimpleImpl.h"
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+using namespace XSocket;
+
+//合并发送基准：服务端每个请求分三次SendBuf（头、内容、尾）回一个响应，对比SocketSet开关合并发送
+//keepalive：一个连接连续请求，输出请求吞吐和平均每个响应的SendV次数
+//close：每个连接一个请求，服务端回完响应马上Close，客户端要收全响应再收到关闭
+//用法：cork_bench [每种模式请求数]
+
+static bool s_cork = false;
+
+class responder;
+
+class WorkSocketSet : public EPollSocketSetT<EPollService,responder>
+{
+	typedef EPollSocketSetT<EPollService,responder> Base;
+public:
+	WorkSocketSet(int nMaxSocketCount):Base(nMaxSocketCount)
+	{
+		Base::SetCork(s_cork);
+	}
+};
+
+static const size_t HEAD_SIZE = 64;
+static const size_t BODY_SIZE = 1024;
+static const size_t TAIL_SIZE = 16;
+static const size_t RESP_SIZE = HEAD_SIZE + BODY_SIZE + TAIL_SIZE;
+
+static std::atomic<size_t> s_sendv(0);
+
+class responder : public SocketExImpl<responder,SimpleSocketT<EPollSocketT<WorkSocketSet,SocketEx>>>
+{
+	typedef SocketExImpl<responder,SimpleSocketT<EPollSocketT<WorkSocketSet,SocketEx>>> Base;
+protected:
+	//请求是一个字节，'r'回响应，'c'回响应后关闭
+	virtual void OnRecvBuf(const char* lpBuf, int nBufLen, int nFlags)
+	{
+		static const std::string head(HEAD_SIZE, 'h'), body(BODY_SIZE, 'b'), tail(TAIL_SIZE, 't');
+		for (int i = 0; i < nBufLen && Base::IsSocket(); i++)
+		{
+			Base::SendBuf(head.data(), (int)head.size());
+			Base::SendBuf(body.data(), (int)body.size());
+			Base::SendBuf(tail.data(), (int)tail.size());
+			if (lpBuf[i] == 'c') {
+				Base::Close();
+			}
+		}
+		Base::OnRecvBuf(lpBuf, nBufLen, nFlags);
+	}
+
+	virtual void OnSendBufs(int nBufLen)
+	{
+		s_sendv.fetch_add(1, std::memory_order_relaxed);
+		Base::OnSendBufs(nBufLen);
+	}
+};
+
+static SOCKET Listen(SOCKADDR_IN& addr)
+{
+	SOCKET ls = Socket::Create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = Socket::Ip2N(DEFAULT_IP);
+	addr.sin_port = 0;
+	int addr_len = sizeof(addr);
+	Socket::Bind(ls, (const SOCKADDR*)&addr, sizeof(addr));
+	Socket::Listen(ls, 128);
+	Socket::GetSockName(ls, (SOCKADDR*)&addr, &addr_len);
+	return ls;
+}
+
+//两端都关Nagle，对比的是系统调用次数和TCP分段数，不是Nagle的延迟
+static void SetNoDelay(SOCKET sock)
+{
+	int nodelay = 1;
+	Socket::SetSockOpt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+}
+
+static SOCKET Connect(const SOCKADDR_IN& addr)
+{
+	SOCKET cs = Socket::Create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	SetNoDelay(cs);
+	Socket::Connect(cs, (const SOCKADDR*)&addr, sizeof(addr));
+	return cs;
+}
+
+//收nLen字节，返回实际收到的字节数
+static size_t ReceiveN(SOCKET cs, char* buf, size_t nLen)
+{
+	size_t len = 0;
+	while (len < nLen)
+	{
+		int ret = Socket::Receive(cs, buf + len, (int)(nLen - len));
+		if (ret <= 0) {
+			break;
+		}
+		len += ret;
+	}
+	return len;
+}
+
+static void AddSocket(SocketManagerT<WorkSocketSet>& mgr, SOCKET sock)
+{
+	SetNoDelay(sock);
+	std::shared_ptr<responder> sock_ptr = std::make_shared<responder>();
+	sock_ptr->Attach(sock, SOCKET_ROLE_WORK);
+	sock_ptr->SetNonBlock();
+	mgr.AddSocket(sock_ptr, FD_READ);
+}
+
+static bool KeepAlive(SocketManagerT<WorkSocketSet>& mgr, size_t count)
+{
+	SOCKADDR_IN addr;
+	SOCKET ls = Listen(addr);
+	SOCKET cs = Connect(addr);
+	AddSocket(mgr, Socket::Accept(ls, nullptr, nullptr));
+	Socket::Close(ls);
+	s_sendv = 0;
+	bool ok = true;
+	std::vector<char> buf(RESP_SIZE);
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < count && ok; i++)
+	{
+		Socket::Send(cs, "r", 1);
+		ok = ReceiveN(cs, buf.data(), RESP_SIZE) == RESP_SIZE;
+	}
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%-7s keepalive %8.0f req/s %6.2f SendV/resp %s\n", s_cork ? "cork" : "nocork",
+		count / wall, (double)s_sendv / count, ok ? "ok" : "FAILED");
+	Socket::Close(cs);
+	return ok;
+}
+
+static bool CloseAfterSend(SocketManagerT<WorkSocketSet>& mgr, size_t count)
+{
+	SOCKADDR_IN addr;
+	SOCKET ls = Listen(addr);
+	s_sendv = 0;
+	size_t lost = 0;
+	std::vector<char> buf(RESP_SIZE + 1);
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < count; i++)
+	{
+		SOCKET cs = Connect(addr);
+		AddSocket(mgr, Socket::Accept(ls, nullptr, nullptr));
+		Socket::Send(cs, "c", 1);
+		//收全响应后应该收到关闭
+		if (ReceiveN(cs, buf.data(), buf.size()) != RESP_SIZE) {
+			lost++;
+		}
+		Socket::Close(cs);
+	}
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	Socket::Close(ls);
+	printf("%-7s close     %8.0f req/s %6.2f SendV/resp %zu lost %s\n", s_cork ? "cork" : "nocork",
+		count / wall, (double)s_sendv / count, lost, lost ? "FAILED" : "ok");
+	return !lost;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t count = argc > 1 ? atoi(argv[1]) : 20000;
+
+	responder::Init();
+	bool ok = true;
+	for (int cork = 0; cork < 2; cork++)
+	{
+		s_cork = cork != 0;
+		SocketManagerT<WorkSocketSet> mgr(1024, 1);
+		mgr.Start();
+		ok = KeepAlive(mgr, count) && ok;
+		ok = CloseAfterSend(mgr, count / 10) && ok;
+		mgr.Stop();
+	}
+	responder::Term();
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,168 @@
+#include "../../samples.h"
+#include "../../../XSocket/XSocketImpl.h"
+#include "../../../XSocket/XEPoll.h"
+#include "../../../XSocket/XFrameImpl.h"
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+using namespace XSocket;
+
+//帧协议基准：客户端写线程连续发帧，服务端FramedSocketT在OnFrame里原样回帧，客户端读线程解析校验
+//小帧用SendFrame拷贝发送，大帧用BeginFrame/EndFrame直接在发送缓存里组帧
+//定长帧头（4字节大端长度+2字节类型）和varint帧头，64B和4KB帧各跑一遍，输出帧吞吐
+//用法：frame_bench [64B帧数]，4KB帧数是它的1/16
+
+typedef FixedFrameHeader<uint32_t, true, uint16_t> FixedHeader;
+typedef VarintFrameHeader<true, uint16_t> VarintHeader;
+
+template<class THeader> class echo;
+
+template<class THeader>
+struct EchoSocketSet
+{
+	typedef EPollSocketSetT<EPollService,echo<THeader>> Type;
+};
+
+template<class THeader>
+class echo : public SocketExImpl<echo<THeader>,FramedSocketT<SimpleSocketT<EPollSocketT<typename EchoSocketSet<THeader>::Type,SocketEx>>,THeader>>
+{
+	typedef SocketExImpl<echo<THeader>,FramedSocketT<SimpleSocketT<EPollSocketT<typename EchoSocketSet<THeader>::Type,SocketEx>>,THeader>> Base;
+public:
+	typedef typename Base::FrameType FrameType;
+protected:
+	virtual void OnFrame(const char* lpBuf, int nBufLen, FrameType type)
+	{
+		if (nBufLen < DEFAULT_SEND_COPY_SIZE) {
+			Base::SendFrame(lpBuf, nBufLen, type);
+		} else {
+			Base::BeginFrame().append(lpBuf, lpBuf + nBufLen);
+			Base::EndFrame(type);
+		}
+	}
+};
+
+static SOCKET Listen(SOCKADDR_IN& addr)
+{
+	SOCKET ls = Socket::Create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = Socket::Ip2N(DEFAULT_IP);
+	addr.sin_port = 0;
+	int addr_len = sizeof(addr);
+	Socket::Bind(ls, (const SOCKADDR*)&addr, sizeof(addr));
+	Socket::Listen(ls, 1);
+	Socket::GetSockName(ls, (SOCKADDR*)&addr, &addr_len);
+	return ls;
+}
+
+template<class THeader>
+static bool Bench(const char* name, size_t frame_size, size_t count)
+{
+	typedef typename EchoSocketSet<THeader>::Type WorkSocketSet;
+	SocketManagerT<WorkSocketSet> mgr(16, 1);
+	mgr.Start();
+
+	SOCKADDR_IN addr;
+	SOCKET ls = Listen(addr);
+	SOCKET cs = Socket::Create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	Socket::Connect(cs, (const SOCKADDR*)&addr, sizeof(addr));
+	SOCKET ss = Socket::Accept(ls, nullptr, nullptr);
+	Socket::Close(ls);
+	std::shared_ptr<echo<THeader>> sock_ptr = std::make_shared<echo<THeader>>();
+	sock_ptr->Attach(ss, SOCKET_ROLE_WORK);
+	sock_ptr->SetNonBlock();
+	mgr.AddSocket(sock_ptr, FD_READ);
+
+	//预先组好一批帧，帧i的类型是i，内容每个字节是i
+	const size_t batch = 64;
+	std::string frames;
+	std::vector<char> head(THeader::MAX_SIZE);
+	for (size_t i = 0; i < batch; i++)
+	{
+		THeader::Build(head.data(), frame_size, (uint16_t)i);
+		frames.append(head.data(), THeader::Size(frame_size));
+		frames.append(frame_size, (char)i);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	std::thread writer([cs, &frames, batch, count]() {
+		for (size_t i = 0; i < count; i += batch)
+		{
+			size_t len = 0;
+			while (len < frames.size())
+			{
+				int ret = Socket::Send(cs, frames.data() + len, (int)(frames.size() - len));
+				if (ret <= 0) {
+					return;
+				}
+				len += ret;
+			}
+		}
+	});
+
+	//读回的帧按顺序校验长度、类型和内容
+	bool ok = true;
+	size_t total = (count + batch - 1) / batch * batch;
+	std::vector<char> buf(1024*1024);
+	size_t len = 0, recv_count = 0;
+	while (ok && recv_count < total)
+	{
+		int ret = Socket::Receive(cs, buf.data() + len, (int)(buf.size() - len));
+		if (ret <= 0) {
+			ok = false;
+			break;
+		}
+		len += ret;
+		size_t pos = 0;
+		for (;;)
+		{
+			size_t frame_len = 0;
+			uint16_t type = 0;
+			int head_len = THeader::Parse(buf.data() + pos, (int)(len - pos), frame_len, type);
+			if (head_len < 0) {
+				ok = false;
+				break;
+			}
+			if (head_len == 0 || len - pos - head_len < frame_len) {
+				break;
+			}
+			char c = (char)(recv_count % batch);
+			const char* frame = buf.data() + pos + head_len;
+			if (frame_len != frame_size || type != (uint16_t)(recv_count % batch) || frame[0] != c || frame[frame_len - 1] != c) {
+				ok = false;
+				break;
+			}
+			pos += head_len + frame_len;
+			recv_count++;
+		}
+		memmove(buf.data(), buf.data() + pos, len - pos);
+		len -= pos;
+	}
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	writer.join();
+	Socket::Close(cs);
+	printf("%-6s %5zuB %8.2f M frame/s %8.1f MB/s %s\n", name, frame_size,
+		recv_count / wall / 1e6, recv_count * frame_size / wall / (1024*1024), ok ? "ok" : "FAILED");
+	//客户端关闭后由服务线程收到对端关闭自己Close
+	while (sock_ptr->IsSocket())
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	mgr.RemoveSocket(sock_ptr);
+	mgr.Stop();
+	return ok;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t count = argc > 1 ? atoi(argv[1]) : 1000000;
+
+	echo<FixedHeader>::Init();
+	bool ok = true;
+	ok = Bench<FixedHeader>("fixed", 64, count) && ok;
+	ok = Bench<VarintHeader>("varint", 64, count) && ok;
+	ok = Bench<FixedHeader>("fixed", 4096, count / 16) && ok;
+	ok = Bench<VarintHeader>("varint", 4096, count / 16) && ok;
+	echo<FixedHeader>::Term();
+	return ok ? 0 : 1;
+}
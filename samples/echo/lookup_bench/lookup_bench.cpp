@@ -0,0 +1,151 @@
+#include "../../samples.h"
+#include "../../../XSocket/XSocketImpl.h"
+#include "../../../XSocket/XEPoll.h"
+#include "../../../XSocket/XSimpleImpl.h"
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <sys/resource.h>
+using namespace XSocket;
+
+//epoll事件查找基准：一个SocketSet里放N个本地socketpair连接，每轮给每个连接发1字节，服务线程收完再下一轮
+//handle：OnEPollEvent用epoll_event.data.u64里的槽位句柄直接定位Socket（现在的做法）
+//scan：每个事件再加锁按指针遍历sock_ptrs_（FindSocket(SocketEx*)，槽位句柄之前的做法），模拟原来的O(N)查找
+//每轮一次唤醒就有很多事件，每轮的固定开销（比如OnIdle扫描）分摊掉，输出每秒处理的epoll事件数
+//用法：lookup_bench [每种配置的事件数]
+
+static bool s_scan = false;
+
+class conn;
+
+class WorkSocketSet : public EPollSocketSetT<EPollService,conn>
+{
+	typedef EPollSocketSetT<EPollService,conn> Base;
+public:
+	std::atomic<size_t> events_;
+
+	WorkSocketSet(int nMaxSocketCount):Base(nMaxSocketCount),events_(0)
+	{
+	}
+
+protected:
+	virtual void OnEPollEvent(const epoll_event& event);
+};
+
+static std::atomic<size_t> s_recv(0);
+
+class conn : public SocketExImpl<conn,SimpleSocketT<EPollSocketT<WorkSocketSet,SocketEx>>>
+{
+	typedef SocketExImpl<conn,SimpleSocketT<EPollSocketT<WorkSocketSet,SocketEx>>> Base;
+public:
+	conn()
+	{
+		Base::ReserveRecvBufSize(DEFAULT_BUFSIZE);
+		Base::ReserveSendBufSize(DEFAULT_BUFSIZE);
+	}
+
+protected:
+	virtual void OnRecvBuf(const char* lpBuf, int nBufLen, int nFlags)
+	{
+		Base::OnRecvBuf(lpBuf, nBufLen, nFlags);
+		s_recv.fetch_add(nBufLen, std::memory_order_release);
+	}
+};
+
+void WorkSocketSet::OnEPollEvent(const epoll_event& event)
+{
+	events_.fetch_add(1, std::memory_order_relaxed);
+	if (s_scan) {
+		std::unique_lock<std::mutex> lock(Base::mutex_);
+		std::shared_ptr<Socket> sock_ptr = Base::FindSocket(event.data.u64);
+		if (sock_ptr && Base::FindSocket(sock_ptr.get()) != sock_ptr) {
+			return;
+		}
+	}
+	Base::OnEPollEvent(event);
+}
+
+static bool Bench(size_t count, size_t total)
+{
+	SocketManagerT<WorkSocketSet> mgr((int)count, 1);
+	mgr.Start();
+	std::vector<SOCKET> peers(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		int fds[2] = { -1, -1 };
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+			printf("%6zu conns socketpair failed: %s\n", count, strerror(errno));
+			for (size_t j = 0; j < i; j++)
+			{
+				Socket::Close(peers[j]);
+			}
+			mgr.Stop();
+			return false;
+		}
+		peers[i] = fds[1];
+		std::shared_ptr<conn> sock_ptr = std::make_shared<conn>();
+		sock_ptr->Attach(fds[0], SOCKET_ROLE_WORK);
+		sock_ptr->SetNonBlock();
+		mgr.AddSocket(sock_ptr, FD_READ);
+	}
+	WorkSocketSet* set = mgr.GetSocketSet(0);
+	size_t rounds = std::max(total / count, (size_t)1);
+	s_recv = 0;
+	set->events_ = 0;
+	size_t sent = 0;
+	bool ok = true;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t r = 0; r < rounds && ok; r++)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			ok = Socket::Send(peers[i], "e", 1) == 1 && ok;
+			sent++;
+		}
+		//等服务线程收完这一轮
+		auto wait = std::chrono::steady_clock::now();
+		while (ok && s_recv.load(std::memory_order_acquire) < sent)
+		{
+			std::this_thread::yield();
+			if (std::chrono::steady_clock::now() - wait > std::chrono::seconds(5)) {
+				ok = false;
+			}
+		}
+	}
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	size_t events = set->events_;
+	printf("%6zu conns %-6s %10.0f events/s %8.2f us/event %s\n", count, s_scan ? "scan" : "handle",
+		events / wall, wall * 1e6 / (events ? events : 1), ok ? "ok" : "FAILED");
+	mgr.Stop();
+	for (size_t i = 0; i < count; i++)
+	{
+		Socket::Close(peers[i]);
+	}
+	return ok;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t total = argc > 1 ? atoi(argv[1]) : 200000;
+
+	//每个连接两个fd
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	conn::Init();
+	bool ok = true;
+	size_t counts[] = { 64, 512, 2048, 8192 };
+	for (size_t count : counts)
+	{
+		for (int scan = 0; scan < 2; scan++)
+		{
+			s_scan = scan != 0;
+			ok = Bench(count, total) && ok;
+		}
+	}
+	conn::Term();
+	return ok ? 0 : 1;
+}
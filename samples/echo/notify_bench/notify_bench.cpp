@@ -0,0 +1,134 @@
+#include "../../samples.h"
+#include "../../../XSocket/XSocketImpl.h"
+#include "../../../XSocket/XEPoll.h"
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+using namespace XSocket;
+
+//跨线程通知基准：多个生产者线程向一个EPollService线程PostNotify(void*)
+//burst：生产者连续投递，输出服务线程处理的消息吞吐和evfd_唤醒次数
+//pingpong：每次投递后等服务线程处理完再投下一条，每条都要唤醒一次，唤醒丢失会超时报错
+//用法：notify_bench [生产者线程数] [每个生产者的消息数]
+
+class notify_service : public EPollService
+{
+	typedef EPollService Base;
+public:
+	std::atomic<size_t> count_;
+	std::atomic<size_t> wakeup_;
+
+	notify_service():count_(0),wakeup_(0)
+	{
+	}
+
+protected:
+	virtual void OnNotify(void*)
+	{
+		count_.fetch_add(1, std::memory_order_release);
+	}
+
+	virtual void OnEPollEvent(const epoll_event&)
+	{
+	}
+
+	virtual void OnWait()
+	{
+		size_t count = count_.load(std::memory_order_relaxed);
+		Base::OnWait();
+		if (count != count_.load(std::memory_order_relaxed)) {
+			wakeup_++;
+		}
+	}
+};
+
+static void Burst(notify_service& svr, int producers, size_t count)
+{
+	svr.count_ = 0;
+	svr.wakeup_ = 0;
+	size_t total = producers * count;
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (int i = 0; i < producers; i++)
+	{
+		threads.emplace_back([&svr, count]() {
+			for (size_t j = 0; j < count; j++)
+			{
+				svr.PostNotify((void*)(j + 1));
+			}
+		});
+	}
+	for (auto& t : threads)
+	{
+		t.join();
+	}
+	while (svr.count_.load(std::memory_order_acquire) < total)
+	{
+		std::this_thread::yield();
+	}
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("burst    %2d producers %8.2f M msg/s %8zu wakeups %6.1f msg/wakeup\n", producers,
+		total / wall / 1e6, (size_t)svr.wakeup_, (double)total / std::max<size_t>(svr.wakeup_, 1));
+}
+
+static bool PingPong(notify_service& svr, int producers, size_t count)
+{
+	svr.count_ = 0;
+	svr.wakeup_ = 0;
+	size_t total = producers * count;
+	std::atomic<bool> lost(false);
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (int i = 0; i < producers; i++)
+	{
+		threads.emplace_back([&svr, &lost, count]() {
+			for (size_t j = 0; j < count && !lost; j++)
+			{
+				size_t expect = svr.count_.load(std::memory_order_acquire) + 1;
+				svr.PostNotify((void*)(j + 1));
+				//多个生产者时只要有进展就行，1秒没有任何进展说明唤醒丢了
+				auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+				while (svr.count_.load(std::memory_order_acquire) < expect)
+				{
+					if (std::chrono::steady_clock::now() > deadline) {
+						lost = true;
+						break;
+					}
+					std::this_thread::yield();
+				}
+			}
+		});
+	}
+	for (auto& t : threads)
+	{
+		t.join();
+	}
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (lost) {
+		printf("pingpong %2d producers LOST WAKEUP after %zu of %zu msgs\n", producers, (size_t)svr.count_, total);
+		return false;
+	}
+	printf("pingpong %2d producers %8.2f K msg/s %8zu wakeups %6.1f us/msg\n", producers,
+		total / wall / 1e3, (size_t)svr.wakeup_, wall * 1e6 / total);
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	int producers = argc > 1 ? atoi(argv[1]) : 4;
+	size_t count = argc > 2 ? atoi(argv[2]) : 1000000;
+
+	notify_service svr;
+	svr.Start();
+	bool ok = true;
+	for (int n = 1; n <= producers; n *= 2)
+	{
+		Burst(svr, n, count);
+	}
+	for (int n = 1; n <= producers; n *= 2)
+	{
+		ok = PingPong(svr, n, count / 20) && ok;
+	}
+	svr.Stop();
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+#include "../../samples.h"
+#include "../../../XSocket/XSocketImpl.h"
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+using namespace XSocket;
+
+//对象池基准：UdpBufferPool分配释放吞吐，对比std::make_shared
+//single：分配后立即释放，batch：每次分配一批再全部释放，cross：一个线程分配、另一个线程释放
+//用法：pool_bench [每个线程操作次数]
+
+typedef std::shared_ptr<UdpBuffer> SharedBuffer;
+
+template<class F>
+static void Run(const char* name, int threads, size_t count, F&& f)
+{
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> workers;
+	for (int i = 0; i < threads; i++)
+	{
+		workers.emplace_back([&f, count]() { f(count); });
+	}
+	for (auto& t : workers)
+	{
+		t.join();
+	}
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%-28s %d threads %8.2f M op/s\n", name, threads, threads * count / wall / 1e6);
+}
+
+template<class New>
+static void Single(size_t count, New&& alloc)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		auto ptr = alloc();
+		(*ptr)[0] = (char)i;
+	}
+}
+
+template<class New>
+static void Batch(size_t count, New&& alloc)
+{
+	std::vector<decltype(alloc())> ptrs;
+	ptrs.reserve(256);
+	for (size_t i = 0; i < count; i += 256)
+	{
+		for (size_t j = 0; j < 256; j++)
+		{
+			ptrs.emplace_back(alloc());
+		}
+		ptrs.clear();
+	}
+}
+
+//分配线程把整批交给释放线程
+template<class New>
+static void Cross(const char* name, size_t count, New&& alloc)
+{
+	typedef decltype(alloc()) Ptr;
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::vector<std::vector<Ptr>> batches;
+	bool done = false;
+	auto start = std::chrono::steady_clock::now();
+	std::thread consumer([&]() {
+		for (;;)
+		{
+			std::vector<std::vector<Ptr>> todo;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [&]() { return done || !batches.empty(); });
+				if (batches.empty()) {
+					break;
+				}
+				todo.swap(batches);
+			}
+		}
+	});
+	for (size_t i = 0; i < count; i += 256)
+	{
+		std::vector<Ptr> ptrs;
+		ptrs.reserve(256);
+		for (size_t j = 0; j < 256; j++)
+		{
+			ptrs.emplace_back(alloc());
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		batches.emplace_back(std::move(ptrs));
+		cv.notify_one();
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		done = true;
+		cv.notify_one();
+	}
+	consumer.join();
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%-28s cross    %8.2f M op/s\n", name, count / wall / 1e6);
+}
+
+int main(int argc, char* argv[])
+{
+	size_t count = argc > 1 ? atoi(argv[1]) : 2000000;
+
+	auto pool_new = []() { return UdpBufferPool::Inst().New(); };
+	auto shared_new = []() { return std::make_shared<UdpBuffer>(); };
+	for (int threads = 1; threads <= 4; threads *= 4)
+	{
+		Run("UdpBufferPool single", threads, count, [&](size_t n) { Single(n, pool_new); });
+		Run("make_shared single", threads, count, [&](size_t n) { Single(n, shared_new); });
+		Run("UdpBufferPool batch 256", threads, count, [&](size_t n) { Batch(n, pool_new); });
+		Run("make_shared batch 256", threads, count, [&](size_t n) { Batch(n, shared_new); });
+	}
+	Cross("UdpBufferPool batch 256", count, pool_new);
+	Cross("make_shared batch 256", count, shared_new);
+	return 0;
+}
@@ -0,0 +1,152 @@
+#include "../../samples.h"
+#include "../../../XSocket/XSocketImpl.h"
+#include "../../../XSocket/XEPoll.h"
+#include "../../../XSocket/XSimpleImpl.h"
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+using namespace XSocket;
+
+//跨线程发送基准：多个生产者线程对同一个连接PostSendBuf，服务线程取信箱合并SendV，接收线程校验
+//每条消息16字节（生产者序号、消息序号），接收端检查每个生产者的消息不丢不乱序
+//输出消息吞吐和平均每次SendV合并的消息数
+//用法：postsend_bench [生产者线程数] [每个生产者的消息数]
+
+class sender;
+
+typedef EPollSocketSetT<EPollService,sender> WorkSocketSet;
+
+struct Message
+{
+	uint32_t producer;
+	uint32_t seq;
+	uint64_t pad;
+};
+
+class sender : public SocketExImpl<sender,SimpleSocketT<EPollSocketT<WorkSocketSet,SocketEx>>>
+{
+	typedef SocketExImpl<sender,SimpleSocketT<EPollSocketT<WorkSocketSet,SocketEx>>> Base;
+public:
+	std::atomic<size_t> sendv_count_;
+
+	sender():sendv_count_(0)
+	{
+	}
+
+protected:
+	virtual void OnSendBufs(int nBufLen)
+	{
+		sendv_count_.fetch_add(1, std::memory_order_relaxed);
+		Base::OnSendBufs(nBufLen);
+	}
+};
+
+static SOCKET Listen(SOCKADDR_IN& addr)
+{
+	SOCKET ls = Socket::Create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = Socket::Ip2N(DEFAULT_IP);
+	addr.sin_port = 0;
+	int addr_len = sizeof(addr);
+	Socket::Bind(ls, (const SOCKADDR*)&addr, sizeof(addr));
+	Socket::Listen(ls, 1);
+	Socket::GetSockName(ls, (SOCKADDR*)&addr, &addr_len);
+	return ls;
+}
+
+static bool Bench(SocketManagerT<WorkSocketSet>& mgr, int producers, size_t count)
+{
+	SOCKADDR_IN addr;
+	SOCKET ls = Listen(addr);
+	size_t total = producers * count;
+
+	//接收线程：收total条消息，检查每个生产者的序号连续
+	bool ok = true;
+	std::thread sink([ls, producers, total, &ok]() {
+		SOCKET ss = Socket::Accept(ls, nullptr, nullptr);
+		Socket::Close(ls);
+		std::vector<uint32_t> next(producers, 0);
+		std::vector<char> buf(1024*1024);
+		size_t len = 0, recv_count = 0;
+		while (recv_count < total)
+		{
+			int ret = Socket::Receive(ss, buf.data() + len, (int)(buf.size() - len));
+			if (ret <= 0) {
+				ok = false;
+				break;
+			}
+			len += ret;
+			size_t pos = 0;
+			for (; pos + sizeof(Message) <= len; pos += sizeof(Message), recv_count++)
+			{
+				Message msg;
+				memcpy(&msg, buf.data() + pos, sizeof(msg));
+				if (msg.producer >= next.size() || msg.seq != next[msg.producer]) {
+					ok = false;
+					recv_count = total;
+					break;
+				}
+				next[msg.producer]++;
+			}
+			memmove(buf.data(), buf.data() + pos, len - pos);
+			len -= pos;
+		}
+		Socket::Close(ss);
+	});
+
+	SOCKET cs = Socket::Create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	Socket::Connect(cs, (const SOCKADDR*)&addr, sizeof(addr));
+	std::shared_ptr<sender> sock_ptr = std::make_shared<sender>();
+	sock_ptr->Attach(cs, SOCKET_ROLE_WORK);
+	sock_ptr->SetNonBlock();
+	mgr.AddSocket(sock_ptr, FD_READ);
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (int i = 0; i < producers; i++)
+	{
+		threads.emplace_back([&sock_ptr, i, count]() {
+			Message msg = { (uint32_t)i, 0, 0 };
+			for (size_t j = 0; j < count; j++)
+			{
+				msg.seq = (uint32_t)j;
+				sock_ptr->PostSendBuf((const char*)&msg, sizeof(msg));
+			}
+		});
+	}
+	for (auto& t : threads)
+	{
+		t.join();
+	}
+	sink.join();
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	size_t sendv = sock_ptr->sendv_count_;
+	printf("%2d producers %8.2f M msg/s %8zu SendV %8.1f msg/SendV %s\n", producers, total / wall / 1e6,
+		sendv, (double)total / std::max<size_t>(sendv, 1), ok ? "ok" : "FAILED");
+	//接收线程关闭后由服务线程收到对端关闭自己Close，Close会清信箱，不能在这个线程和服务线程同时取
+	while (sock_ptr->IsSocket())
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	mgr.RemoveSocket(sock_ptr);
+	return ok;
+}
+
+int main(int argc, char* argv[])
+{
+	int producers = argc > 1 ? atoi(argv[1]) : 4;
+	size_t count = argc > 2 ? atoi(argv[2]) : 500000;
+
+	sender::Init();
+	SocketManagerT<WorkSocketSet> mgr(16, 1);
+	mgr.Start();
+	bool ok = true;
+	for (int n = 1; n <= producers; n *= 2)
+	{
+		ok = Bench(mgr, n, count) && ok;
+	}
+	mgr.Stop();
+	sender::Term();
+	return ok ? 0 : 1;
+}
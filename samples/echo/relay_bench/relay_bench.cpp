@@ -0,0 +1,287 @@
+#include "../../samples.h"
+#include "../../../XSocket/XSocketImpl.h"
+#include "../../../XSocket/XEPoll.h"
+#include "../../../XSocket/XSimpleImpl.h"
+#include "../../../XSocket/XProxyImpl.h"
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <thread>
+using namespace XSocket;
+
+//隧道转发基准：客户端线程 -> 转发服务线程(两个RelaySocketT) -> 接收线程，本机TCP连接
+//对比StartRelay缓存拷贝和splice，输出隧道吞吐和转发线程每GB的CPU时间
+//socks5模式：两个服务线程，客户端先SOCKS5握手，ProxydSocketT在OnProxy里连目标并AddRelayPeer加到自己的SocketSet，
+//目标连接OnConnect后StartTunnel回复握手成功开始转发，检查两边在同一个SocketSet
+//用法：relay_bench [每种模式转发的MB数]
+
+class relay;
+
+typedef EPollSocketSetT<EPollService,relay> WorkSocketSet;
+typedef RelaySocketT<SimpleSocketT<EPollSocketT<WorkSocketSet,SocketEx>>> RelayBase;
+
+static double ThreadCpuTime()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool s_splice = false;
+
+//直接转发时两边都不握手；socks5模式下接入的连接handshake_为true，目标连接由它在OnProxy里创建
+class relay : public SocketExImpl<relay,ProxydSocketT<SimpleSocketT<EPollSocketT<WorkSocketSet,SocketEx>>>>
+{
+	typedef SocketExImpl<relay,ProxydSocketT<SimpleSocketT<EPollSocketT<WorkSocketSet,SocketEx>>>> Base;
+public:
+	double cpu_begin_ = 0;
+	double cpu_end_ = 0;
+	bool handshake_ = false;
+	std::weak_ptr<relay> self_;
+	std::weak_ptr<relay> down_; //目标连接记住接入的连接，连上后由它StartTunnel
+	std::shared_ptr<relay> up_; //接入的连接在目标连接加入SocketSet前持有它
+	std::shared_ptr<relay> tunnel_; //接入的连接创建的目标连接，测完读CPU时间
+	bool tunnel_ok_ = false; //开始转发时两边在同一个SocketSet，splice模式两边都用上了管道
+
+protected:
+	virtual int ParseBuf(const char* lpBuf, int & nBufLen)
+	{
+		if (!handshake_) {
+			return RelayBase::ParseBuf(lpBuf, nBufLen);
+		}
+		return Base::ParseBuf(lpBuf, nBufLen);
+	}
+
+	virtual void OnProxy(const SOCKADDR_IN& addr)
+	{
+		up_ = std::make_shared<relay>();
+		up_->self_ = up_;
+		up_->down_ = self_;
+		tunnel_ = up_;
+		up_->Open(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		up_->Connect((const SOCKADDR*)&addr, sizeof(addr));
+		if (Base::AddRelayPeer(up_, FD_READ) < 0) {
+			up_.reset();
+			Base::Trigger(FD_CLOSE, ECONNABORTED);
+		}
+	}
+
+	virtual void OnConnect(int nErrorCode)
+	{
+		Base::OnConnect(nErrorCode);
+		std::shared_ptr<relay> down = down_.lock();
+		if (!down) {
+			return;
+		}
+		std::shared_ptr<relay> up = down->up_;
+		down->up_.reset();
+		if (nErrorCode || !down->StartTunnel(up, s_splice)) {
+			//两边都关，客户端和接收线程收到关闭结束
+			down->Trigger(FD_CLOSE, nErrorCode ? nErrorCode : ECONNABORTED);
+			Base::Trigger(FD_CLOSE, nErrorCode ? nErrorCode : ECONNABORTED);
+			return;
+		}
+		down->tunnel_ok_ = up->Owner() == down->Owner() && (!s_splice || (up->IsSplice() && down->IsSplice()));
+	}
+
+	//转发线程的CPU时间从第一次可读算到最后一次可读/可写
+	inline void Mark()
+	{
+		cpu_end_ = ThreadCpuTime();
+		if (!cpu_begin_) {
+			cpu_begin_ = cpu_end_;
+		}
+	}
+
+	virtual void OnReceive(int nErrorCode)
+	{
+		Mark();
+		Base::OnReceive(nErrorCode);
+	}
+
+	virtual void OnSend(int nErrorCode)
+	{
+		Mark();
+		Base::OnSend(nErrorCode);
+	}
+};
+
+static SOCKET Listen(SOCKADDR_IN& addr)
+{
+	SOCKET ls = Socket::Create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = Socket::Ip2N(DEFAULT_IP);
+	addr.sin_port = 0;
+	int addr_len = sizeof(addr);
+	Socket::Bind(ls, (const SOCKADDR*)&addr, sizeof(addr));
+	Socket::Listen(ls, 1);
+	Socket::GetSockName(ls, (SOCKADDR*)&addr, &addr_len);
+	return ls;
+}
+
+//收nLen字节，返回实际收到的字节数
+static size_t ReceiveN(SOCKET cs, char* buf, size_t nLen)
+{
+	size_t len = 0;
+	while (len < nLen)
+	{
+		int ret = Socket::Receive(cs, buf + len, (int)(nLen - len));
+		if (ret <= 0) {
+			break;
+		}
+		len += ret;
+	}
+	return len;
+}
+
+//SOCKS5握手：不认证，CONNECT目标IPv4地址
+static bool Socks5Handshake(SOCKET cs, const SOCKADDR_IN& addr)
+{
+	char buf[10] = { 0x05, 0x01, 0x00 };
+	if (Socket::Send(cs, buf, 3) != 3 || ReceiveN(cs, buf, 2) != 2 || buf[1] != 0x00) {
+		return false;
+	}
+	buf[0] = 0x05;
+	buf[1] = 0x01;
+	buf[2] = 0x00;
+	buf[3] = 0x01;
+	memcpy(buf + 4, &addr.sin_addr.s_addr, 4);
+	memcpy(buf + 8, &addr.sin_port, 2);
+	return Socket::Send(cs, buf, 10) == 10 && ReceiveN(cs, buf, 10) == 10 && buf[1] == 0x00;
+}
+
+static bool Bench(SocketManagerT<WorkSocketSet>& mgr, size_t total, bool splice, bool socks)
+{
+	SOCKADDR_IN relay_addr, sink_addr;
+	SOCKET relay_ls = Listen(relay_addr);
+	SOCKET sink_ls = Listen(sink_addr);
+	s_splice = splice;
+
+	//接收线程：收完total字节
+	std::atomic<bool> done(false);
+	size_t recv_len = 0;
+	std::chrono::steady_clock::time_point end;
+	std::thread sink([sink_ls, total, &done, &recv_len, &end]() {
+		SOCKET ss = Socket::Accept(sink_ls, nullptr, nullptr);
+		std::vector<char> buf(1024*1024);
+		while (recv_len < total)
+		{
+			int ret = Socket::Receive(ss, buf.data(), (int)buf.size());
+			if (ret <= 0) {
+				break;
+			}
+			recv_len += ret;
+		}
+		end = std::chrono::steady_clock::now();
+		done = true;
+		Socket::Close(ss);
+	});
+
+	//客户端线程：连上转发端口（socks5模式先握手）发total字节，接收线程收完再关，转发两边都由服务线程收到关闭自己Close
+	std::thread client([&relay_addr, &sink_addr, total, socks, &done]() {
+		SOCKET cs = Socket::Create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (Socket::Connect(cs, (const SOCKADDR*)&relay_addr, sizeof(relay_addr)) != 0
+			|| (socks && !Socks5Handshake(cs, sink_addr))) {
+			Socket::Close(cs);
+			//握手失败时自己连上接收端口关闭，让接收线程结束
+			cs = Socket::Create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+			Socket::Connect(cs, (const SOCKADDR*)&sink_addr, sizeof(sink_addr));
+			Socket::Close(cs);
+			return;
+		}
+		std::vector<char> buf(256*1024, 'r');
+		size_t send_len = 0;
+		while (send_len < total)
+		{
+			int ret = Socket::Send(cs, buf.data(), (int)std::min<size_t>(buf.size(), total - send_len));
+			if (ret <= 0) {
+				break;
+			}
+			send_len += ret;
+		}
+		while (!done)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		Socket::Close(cs);
+	});
+
+	SOCKET down = Socket::Accept(relay_ls, nullptr, nullptr);
+	Socket::Close(relay_ls);
+	std::shared_ptr<relay> down_ptr = std::make_shared<relay>();
+	std::shared_ptr<relay> up_ptr;
+	down_ptr->Attach(down, SOCKET_ROLE_WORK);
+	down_ptr->SetNonBlock();
+	bool ok = true;
+	auto start = std::chrono::steady_clock::now();
+	if (socks) {
+		//目标连接由接入的连接在服务线程里创建
+		down_ptr->handshake_ = true;
+		down_ptr->self_ = down_ptr;
+		mgr.AddSocket(down_ptr, FD_READ);
+	} else {
+		SOCKET up = Socket::Create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		Socket::Connect(up, (const SOCKADDR*)&sink_addr, sizeof(sink_addr));
+		up_ptr = std::make_shared<relay>();
+		up_ptr->Attach(up, SOCKET_ROLE_WORK);
+		up_ptr->SetNonBlock();
+		ok = down_ptr->StartRelay(up_ptr, splice) == splice;
+		up_ptr->StartRelay(down_ptr, splice);
+		mgr.AddSocket(up_ptr, FD_READ);
+		mgr.AddSocket(down_ptr, FD_READ);
+	}
+	sink.join();
+	client.join();
+	Socket::Close(sink_ls);
+	if (socks) {
+		up_ptr = down_ptr->tunnel_;
+		ok = down_ptr->tunnel_ok_;
+	}
+	ok = ok && recv_len == total;
+	double gb = total / (1024.0*1024*1024);
+	double wall = std::chrono::duration<double>(end - start).count();
+	double cpu = up_ptr ? std::max(down_ptr->cpu_end_, up_ptr->cpu_end_) - std::min(down_ptr->cpu_begin_, up_ptr->cpu_begin_) : 0;
+	printf("%-6s %-8s %8.1f MB/s %8.1f ms/GB relay cpu %s\n", socks ? "socks5" : "direct", splice ? "splice" : "copy",
+		total / (1024.0*1024) / wall, cpu * 1000 / gb, ok ? "ok" : "FAILED");
+	//客户端和接收线程都关了，等服务线程收到关闭自己Close，不能在这个线程关
+	while (down_ptr->IsSocket() || (up_ptr && up_ptr->IsSocket()))
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	mgr.RemoveSocket(down_ptr);
+	if (up_ptr) {
+		mgr.RemoveSocket(up_ptr);
+	}
+	return ok;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t total = (argc > 1 ? atoi(argv[1]) : 1024) * 1024 * 1024ULL;
+
+	relay::Init();
+	bool ok = true;
+	{
+		SocketManagerT<WorkSocketSet> mgr(16, 1);
+		mgr.Start();
+		printf("relay %zu MB per mode, one relay thread\n", total/(1024*1024));
+		for (int i = 0; i < 2; i++)
+		{
+			ok = Bench(mgr, total, false, false) && ok;
+			ok = Bench(mgr, total, true, false) && ok;
+		}
+		mgr.Stop();
+	}
+	{
+		//两个服务线程，目标连接要跟着接入的连接放进同一个SocketSet
+		SocketManagerT<WorkSocketSet> mgr(16, 2);
+		mgr.Start();
+		printf("relay %zu MB per mode, socks5 tunnel, two relay threads\n", total/(1024*1024));
+		ok = Bench(mgr, total, false, true) && ok;
+		ok = Bench(mgr, total, true, true) && ok;
+		mgr.Stop();
+	}
+	relay::Term();
+	return ok ? 0 : 1;
+}
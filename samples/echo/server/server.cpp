@@ -3,7 +3,9 @@
 
 #include "../../samples.h"
 #include "../../../XSocket/XSocketImpl.h"
-#if USE_EPOLL
+#if USE_IOURING
+#include "../../../XSocket/XIoUring.h"
+#elif USE_EPOLL
 #include "../../../XSocket/XEPoll.h"
 #elif USE_IOCP
 #include "../../../XSocket/XCompletionPort.h"
@@ -111,7 +113,9 @@ public:
 	// inline int get_flags() { return flags; }
 };
 class WorkEventService : public
-#if USE_EPOLL
+#if USE_IOURING
+EventServiceT<WorkEvent,IoUringService>
+#elif USE_EPOLL
 EventServiceT<WorkEvent,EPollService>
 #elif USE_IOCP
 EventServiceT<WorkEvent,CompletionPortService>
@@ -135,7 +139,9 @@ typedef SimpleSocketEvtServiceT<WorkEventService> WorkService;
 class WorkSocket;
 //class WorkSocketSet;
 
-#if USE_EPOLL
+#if USE_IOURING
+typedef IoUringSocketSetT<WorkService,WorkSocket> WorkSocketSet;
+#elif USE_EPOLL
 typedef EPollSocketSetT<WorkService,WorkSocket> WorkSocketSet;
 #elif USE_IOCP
 typedef CompletionPortSocketSetT<WorkService,WorkSocket> WorkSocketSet;
@@ -144,7 +150,9 @@ typedef SelectSocketSetT<WorkService,WorkSocket> WorkSocketSet;
 #endif//
 
 class WorkSocket : public
-#if USE_EPOLL
+#if USE_IOURING
+IoUringSocketT<WorkSocketSet,SocketEx>
+#elif USE_EPOLL
 EPollSocketT<WorkSocketSet,SocketEx>
 #elif USE_IOCP
 CompletionPortSocketT<WorkSocketSet,SocketEx>
@@ -257,10 +265,10 @@ protected:
 					XSocket::Socket::Close(Sock);
 					return;
 				}
-				std::shared_ptr<worker> sock_ptr = std::make_shared<worker>();
+				std::shared_ptr<worker> sock_ptr = SocketFactoryT<worker>::Inst().New();
 				sock_ptr->Attach(Sock,SOCKET_ROLE_WORK);
 				sock_ptr->SetNonBlock();//设为非阻塞模式
-				int pos = srv_->AddSocket(sock_ptr, FD_READ|FD_OOB);
+				int pos = srv_->AddAcceptSocket(sock_ptr, FD_READ|FD_OOB);
 				if(pos >= 0) {
 					//
 				} else {
@@ -288,6 +296,12 @@ public:
 			return false;
 		}
 
+#ifdef SO_REUSEPORT
+		//每个SocketSet一个监听Socket，各自Accept，失败再用单个监听Socket
+		if(ListenReusePort<listener>([this]() { return std::make_shared<listener>(this); }, address, port, 1024) > 0) {
+			return true;
+		}
+#endif//
 		std::shared_ptr<listener> sock_ptr = std::make_shared<listener>(this);
 		sock_ptr->Open(address);
 		sock_ptr->SetSockOpt(SOL_SOCKET, SO_REUSEADDR, 1);
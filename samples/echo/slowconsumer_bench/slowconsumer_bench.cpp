@@ -0,0 +1,199 @@
+#include "../../samples.h"
+#include "../../../XSocket/XSocketImpl.h"
+#include "../../../XSocket/XEPoll.h"
+#include "../../../XSocket/XSimpleImpl.h"
+#include "../../../XSocket/XProxyImpl.h"
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <thread>
+using namespace XSocket;
+
+//慢消费者转发测试：客户端线程全速发送 -> 转发服务线程(两个RelaySocketT缓存拷贝) -> 接收线程慢慢读
+//转发端对端发送缓存要限制在高水位附近，暂停接收期间转发线程不能空转（LT模式没同步EPOLLIN会一直触发）
+//ET、LT各跑一遍，输出对端发送缓存峰值、暂停期间收到的epoll事件数和进程CPU占用，超出限制返回失败
+//用法：slowconsumer_bench [转发的MB数] [接收线程每64KB休眠的毫秒数]
+
+static bool s_et = true;
+static std::atomic<size_t> s_paused_events(0); //暂停接收的Socket还收到的epoll事件数，没同步到内核时LT模式会一直来
+
+class relay;
+static bool IsRecvPaused(relay* sock_ptr);
+
+class WorkSocketSet : public EPollSocketSetT<EPollService,relay>
+{
+	typedef EPollSocketSetT<EPollService,relay> Base;
+public:
+	WorkSocketSet(int nMaxSocketCount):Base(nMaxSocketCount)
+	{
+		Base::SetEdgeTrigger(s_et);
+	}
+
+protected:
+	virtual void OnEPollEvent(const epoll_event& event)
+	{
+		std::unique_lock<std::mutex> lock(Base::mutex_);
+		std::shared_ptr<relay> sock_ptr = Base::FindSocket(event.data.u64);
+		lock.unlock();
+		if (IsRecvPaused(sock_ptr.get())) {
+			s_paused_events++;
+		}
+		Base::OnEPollEvent(event);
+	}
+};
+
+class relay : public SocketExImpl<relay,RelaySocketT<SimpleSocketT<EPollSocketT<WorkSocketSet,SocketEx>>>>
+{
+	typedef SocketExImpl<relay,RelaySocketT<SimpleSocketT<EPollSocketT<WorkSocketSet,SocketEx>>>> Base;
+public:
+	size_t peak_ = 0; //对端发送缓存峰值
+	int recv_buf_len_ = 0; //接收缓存大小，一次OnReceive最多转发这么多
+
+protected:
+	virtual void OnReceive(int nErrorCode)
+	{
+		Base::OnReceive(nErrorCode);
+		recv_buf_len_ = std::max(recv_buf_len_, Base::m_nRecvBufLen);
+		auto peer = Base::relay_peer_.lock();
+		if (peer) {
+			peak_ = std::max(peak_, peer->NotSendBufSize());
+		}
+	}
+};
+
+static bool IsRecvPaused(relay* sock_ptr)
+{
+	return sock_ptr && sock_ptr->IsRecvPaused();
+}
+
+static double ProcessCpuTime()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static SOCKET Listen(SOCKADDR_IN& addr, int rcvbuf = 0)
+{
+	SOCKET ls = Socket::Create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (rcvbuf) {
+		//继承给accept的连接，让接收端内核缓存小一些，背压尽快传到转发端
+		Socket::SetSockOpt(ls, SOL_SOCKET, SO_RCVBUF, (const char*)&rcvbuf, sizeof(rcvbuf));
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = Socket::Ip2N(DEFAULT_IP);
+	addr.sin_port = 0;
+	int addr_len = sizeof(addr);
+	Socket::Bind(ls, (const SOCKADDR*)&addr, sizeof(addr));
+	Socket::Listen(ls, 1);
+	Socket::GetSockName(ls, (SOCKADDR*)&addr, &addr_len);
+	return ls;
+}
+
+static bool Bench(bool et, size_t total, int sleep_ms)
+{
+	s_et = et;
+	s_paused_events = 0;
+	SocketManagerT<WorkSocketSet> mgr(16, 1);
+	mgr.Start();
+
+	SOCKADDR_IN relay_addr, sink_addr;
+	SOCKET relay_ls = Listen(relay_addr);
+	SOCKET sink_ls = Listen(sink_addr, 64*1024);
+
+	//接收线程：每次最多读64KB，读完休眠
+	std::atomic<bool> done(false);
+	std::thread sink([sink_ls, total, sleep_ms, &done]() {
+		SOCKET ss = Socket::Accept(sink_ls, nullptr, nullptr);
+		std::vector<char> buf(64*1024);
+		size_t recv_len = 0;
+		while (recv_len < total)
+		{
+			int ret = Socket::Receive(ss, buf.data(), (int)buf.size());
+			if (ret <= 0) {
+				break;
+			}
+			recv_len += ret;
+			std::this_thread::sleep_for(std::chrono::milliseconds(sleep_ms));
+		}
+		done = true;
+		Socket::Close(ss);
+	});
+
+	//客户端线程：全速发total字节
+	std::thread client([&relay_addr, total]() {
+		SOCKET cs = Socket::Create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (Socket::Connect(cs, (const SOCKADDR*)&relay_addr, sizeof(relay_addr)) != 0) {
+			Socket::Close(cs);
+			return;
+		}
+		std::vector<char> buf(256*1024, 's');
+		size_t send_len = 0;
+		while (send_len < total)
+		{
+			int ret = Socket::Send(cs, buf.data(), (int)std::min<size_t>(buf.size(), total - send_len));
+			if (ret <= 0) {
+				break;
+			}
+			send_len += ret;
+		}
+		//等对端收完再关，避免RST
+		char c;
+		Socket::Receive(cs, &c, 1);
+		Socket::Close(cs);
+	});
+
+	SOCKET down = Socket::Accept(relay_ls, nullptr, nullptr);
+	SOCKET up = Socket::Create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	Socket::Connect(up, (const SOCKADDR*)&sink_addr, sizeof(sink_addr));
+	Socket::Close(relay_ls);
+	Socket::Close(sink_ls);
+
+	std::shared_ptr<relay> down_ptr = std::make_shared<relay>();
+	std::shared_ptr<relay> up_ptr = std::make_shared<relay>();
+	down_ptr->Attach(down, SOCKET_ROLE_WORK);
+	down_ptr->SetNonBlock();
+	up_ptr->Attach(up, SOCKET_ROLE_WORK);
+	up_ptr->SetNonBlock();
+	down_ptr->StartRelay(up_ptr, false);
+	up_ptr->StartRelay(down_ptr, false);
+	auto start = std::chrono::steady_clock::now();
+	double cpu_start = ProcessCpuTime();
+	mgr.AddSocket(up_ptr, FD_READ);
+	mgr.AddSocket(down_ptr, FD_READ);
+	while (!done)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double cpu = ProcessCpuTime() - cpu_start;
+	sink.join();
+	up_ptr->Trigger(FD_CLOSE, 0);
+	down_ptr->Trigger(FD_CLOSE, 0);
+	client.join();
+	mgr.RemoveSocket(up_ptr);
+	mgr.RemoveSocket(down_ptr);
+	mgr.Stop();
+
+	//高水位之后最多再转发一次接收缓存的数据就会暂停
+	size_t limit = DEFAULT_RELAY_SEND_MARK + down_ptr->recv_buf_len_;
+	//暂停期间只该收到对端关闭之类的少量事件
+	bool ok = down_ptr->peak_ <= limit && s_paused_events < wall * 100 && cpu < wall / 2;
+	printf("%s %8.1f MB/s peak send buf %8zu (limit %zu) %8zu paused events cpu %5.1f%% %s\n", et ? "ET" : "LT",
+		total / (1024.0*1024) / wall, down_ptr->peak_, limit, (size_t)s_paused_events, cpu * 100 / wall, ok ? "ok" : "FAILED");
+	return ok;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t total = (argc > 1 ? atoi(argv[1]) : 16) * 1024 * 1024ULL;
+	int sleep_ms = argc > 2 ? atoi(argv[2]) : 5;
+
+	relay::Init();
+	printf("slow consumer %zu MB, sink sleeps %d ms per 64KB\n", total/(1024*1024), sleep_ms);
+	bool ok = Bench(true, total, sleep_ms);
+	ok = Bench(false, total, sleep_ms) && ok;
+	relay::Term();
+	return ok ? 0 : 1;
+}
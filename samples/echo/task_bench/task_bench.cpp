@@ -0,0 +1,99 @@
+#include "../../samples.h"
+#include "../../../XSocket/XSocketImpl.h"
+#include "../../../XSocket/XEPoll.h"
+#include <cstdio>
+#include <cstdlib>
+using namespace XSocket;
+
+//任务投递分配基准：统计稳定状态下每次投递的堆分配次数和吞吐
+//round trip：投递一个有返回值的任务并等结果（Send/PostF），burst：连续投递一批再等全部执行
+//用法：task_bench [每项次数]
+
+static std::atomic<size_t> g_new_count(0);
+
+void* operator new(size_t size)
+{
+	g_new_count.fetch_add(1, std::memory_order_relaxed);
+	void* ptr = malloc(size ? size : 1);
+	if (!ptr) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+	free(ptr);
+}
+
+typedef TaskSocketServiceT<EPollService> TaskService;
+
+static std::atomic<size_t> s_count(0);
+
+//先跑一遍预热缓存，再统计第二遍
+template<class F>
+static void Bench(const char* name, size_t count, F&& f)
+{
+	f(count);
+	size_t new_count = g_new_count.load();
+	auto start = std::chrono::steady_clock::now();
+	f(count);
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%-32s %8.2f alloc/op %10.0f op/s\n", name, (double)(g_new_count.load() - new_count) / count, count / wall);
+}
+
+static void WaitCount(size_t total)
+{
+	while (s_count.load(std::memory_order_acquire) < total)
+	{
+		std::this_thread::yield();
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	size_t count = argc > 1 ? atoi(argv[1]) : 200000;
+
+	ThreadPool pool(1);
+	TaskService svr;
+	svr.Start();
+
+	Bench("ThreadPool::Send round trip", count, [&pool](size_t n) {
+		for (size_t i = 0; i < n; i++)
+		{
+			pool.Send([](size_t x) { return x + 1; }, i).get();
+		}
+	});
+	Bench("ThreadPool::Post burst", count, [&pool](size_t n) {
+		s_count = 0;
+		for (size_t i = 0; i < n; i++)
+		{
+			pool.Post([]() { s_count.fetch_add(1, std::memory_order_release); });
+		}
+		WaitCount(n);
+	});
+	Bench("TaskSocketService::PostF round", count, [&svr](size_t n) {
+		for (size_t i = 0; i < n; i++)
+		{
+			svr.PostF(nullptr, [](size_t x) { return x + 1; }, i).get();
+		}
+	});
+	Bench("TaskSocketService::Post burst", count, [&svr](size_t n) {
+		s_count = 0;
+		for (size_t i = 0; i < n; i++)
+		{
+			svr.Post(nullptr, []() { s_count.fetch_add(1, std::memory_order_release); });
+		}
+		WaitCount(n);
+	});
+	Bench("TaskSocketService::PostDelay", count, [&svr](size_t n) {
+		for (size_t i = 0; i < n; i++)
+		{
+			svr.Cancel(svr.PostDelay(60000, nullptr, []() {}));
+		}
+	});
+
+	svr.Stop();
+	pool.Stop();
+	return 0;
+}
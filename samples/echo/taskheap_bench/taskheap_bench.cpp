@@ -0,0 +1,150 @@
+#include "../../samples.h"
+#include "../../../XSocket/XSocketImpl.h"
+#include "../../../XSocket/XEPoll.h"
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+using namespace XSocket;
+
+//延迟任务堆基准：随机到期时间投递延迟任务，再按句柄、按ID、按对象指针取消
+//verify：随机投递/取消/取出和std::multimap对照，检查执行顺序和取消结果
+//用法：taskheap_bench [任务数]
+
+typedef TaskSocketServiceT<EPollService> TaskService;
+
+static double Seconds(const std::chrono::steady_clock::time_point& start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void BenchTaskQue(size_t count)
+{
+	std::mt19937 rng(1);
+	TaskQue que;
+	std::vector<std::unique_ptr<TaskID>> ids;
+	ids.reserve(count);
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < count; i++)
+	{
+		ids.emplace_back(new TaskID(1000 + rng() % 100000));
+		que.Push(*ids.back(), []() {});
+	}
+	printf("TaskQue Push(TaskID)          %8.2f M/s\n", count / Seconds(start) / 1e6);
+	//一半用投递时的TaskID（有句柄），一半用句柄清掉的副本（按ID取消）
+	std::shuffle(ids.begin(), ids.end(), rng);
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < count / 2; i++)
+	{
+		que.Remove(*ids[i]);
+	}
+	printf("TaskQue Remove(handle)        %8.2f M/s\n", count / 2 / Seconds(start) / 1e6);
+	for (size_t i = count / 2; i < count; i++)
+	{
+		ids[i]->handle = 0;
+	}
+	start = std::chrono::steady_clock::now();
+	for (size_t i = count / 2; i < count; i++)
+	{
+		que.Remove(*ids[i]);
+	}
+	printf("TaskQue Remove(id)            %8.2f M/s, %zu left\n", (count - count / 2) / Seconds(start) / 1e6, que.Count());
+}
+
+static void BenchTaskService(size_t count)
+{
+	std::mt19937 rng(2);
+	TaskService svr;
+	const size_t objs = 1024;
+	std::vector<uint64_t> handles;
+	handles.reserve(count);
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < count; i++)
+	{
+		handles.push_back(svr.PostDelay(1000 + rng() % 100000, (void*)(i % objs + 1), []() {}));
+	}
+	printf("TaskService PostDelay         %8.2f M/s\n", count / Seconds(start) / 1e6);
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < 64; i++)
+	{
+		svr.Remove((void*)(i + 1));
+	}
+	printf("TaskService Remove(ptr)       %8.2f us/call (%zu tasks per ptr)\n", Seconds(start) * 1e6 / 64, count / objs);
+	std::shuffle(handles.begin(), handles.end(), rng);
+	size_t cancel = 0;
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < handles.size(); i++)
+	{
+		cancel += svr.Cancel(handles[i]);
+	}
+	printf("TaskService Cancel(handle)    %8.2f M/s (%zu live)\n", handles.size() / Seconds(start) / 1e6, cancel);
+}
+
+//随机操作和std::multimap对照
+static bool Verify(size_t count)
+{
+	typedef std::chrono::steady_clock::time_point time_point;
+	std::mt19937 rng(3);
+	TaskHeap<size_t> heap;
+	std::multimap<std::pair<time_point, size_t>, uint64_t> ref; //(时间,投递顺序)->句柄
+	std::map<uint64_t, std::pair<time_point, size_t>> live;
+	time_point base = std::chrono::steady_clock::now();
+	size_t seq = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		size_t op = rng() % 10;
+		if (op < 5 || live.empty()) {
+			time_point time = base + std::chrono::milliseconds(rng() % 1000);
+			uint64_t handle = heap.Push(time, size_t(seq), rng() % 64);
+			ref.emplace(std::make_pair(time, seq), handle);
+			live[handle] = std::make_pair(time, seq);
+			seq++;
+		} else if (op < 8) {
+			auto it = live.begin();
+			std::advance(it, rng() % live.size());
+			if (!heap.Cancel(it->first)) {
+				return false;
+			}
+			ref.erase(ref.find(it->second));
+			live.erase(it);
+		} else {
+			size_t value = 0;
+			if (!heap.Pop(value) || ref.begin()->first.second != value) {
+				return false;
+			}
+			live.erase(ref.begin()->second);
+			ref.erase(ref.begin());
+		}
+		if (heap.Count() != ref.size()) {
+			return false;
+		}
+	}
+	//按键取消后剩下的仍然有序
+	heap.CancelKey(7);
+	size_t last = 0;
+	time_point last_time = base;
+	while (!heap.IsEmpty())
+	{
+		time_point time;
+		size_t value = 0;
+		heap.Peek(time);
+		heap.Pop(value);
+		if (time < last_time || (time == last_time && value < last)) {
+			return false;
+		}
+		last_time = time;
+		last = value;
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t count = argc > 1 ? atoi(argv[1]) : 200000;
+
+	BenchTaskQue(count);
+	BenchTaskService(count);
+	bool ok = Verify(count);
+	printf("verify %s\n", ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
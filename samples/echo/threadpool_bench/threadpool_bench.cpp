@@ -0,0 +1,105 @@
+#include "../../samples.h"
+#include "../../../XSocket/XSocketImpl.h"
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+using namespace XSocket;
+
+//ThreadPool基准
+//external：多个外部线程Post，工作线程执行计数任务
+//fanout：外部线程投递根任务，根任务在工作线程里再投递子任务
+//prestart：Start之前Post的任务在Start后都要执行
+//用法：threadpool_bench [工作线程数] [任务数]
+
+static std::atomic<size_t> s_count(0);
+
+static void WaitCount(size_t total)
+{
+	while (s_count.load(std::memory_order_acquire) < total)
+	{
+		std::this_thread::yield();
+	}
+}
+
+static void External(ThreadPool& pool, int producers, size_t total)
+{
+	s_count = 0;
+	size_t count = total / producers;
+	total = count * producers;
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (int i = 0; i < producers; i++)
+	{
+		threads.emplace_back([&pool, count]() {
+			for (size_t j = 0; j < count; j++)
+			{
+				pool.Post([]() { s_count.fetch_add(1, std::memory_order_release); });
+			}
+		});
+	}
+	for (auto& t : threads)
+	{
+		t.join();
+	}
+	WaitCount(total);
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("external %2d producers %8.2f M task/s\n", producers, total / wall / 1e6);
+}
+
+static void FanOut(ThreadPool& pool, size_t roots, size_t children)
+{
+	s_count = 0;
+	size_t total = roots * children;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < roots; i++)
+	{
+		pool.Post([&pool, children]() {
+			for (size_t j = 0; j < children; j++)
+			{
+				pool.Post([]() { s_count.fetch_add(1, std::memory_order_release); });
+			}
+		});
+	}
+	WaitCount(total);
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("fanout   %4zu roots    %8.2f M task/s\n", roots, total / wall / 1e6);
+}
+
+static bool PreStart(size_t threads, size_t total)
+{
+	s_count = 0;
+	ThreadPool pool;
+	for (size_t i = 0; i < total; i++)
+	{
+		pool.Post([]() { s_count.fetch_add(1, std::memory_order_release); });
+	}
+	pool.Start(threads);
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (s_count.load(std::memory_order_acquire) < total && std::chrono::steady_clock::now() < deadline)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	size_t done = s_count;
+	printf("prestart %zu of %zu tasks run after Start\n", done, total);
+	return done == total;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t threads = argc > 1 ? atoi(argv[1]) : 8;
+	size_t total = argc > 2 ? atoi(argv[2]) : 2000000;
+
+	bool ok = PreStart(threads, 10000);
+	ThreadPool pool(threads);
+	for (int round = 0; round < 3; round++)
+	{
+		for (int producers = 1; producers <= 4; producers *= 2)
+		{
+			External(pool, producers, total);
+		}
+		FanOut(pool, 4, total / 4);
+		FanOut(pool, 1024, total / 1024);
+	}
+	pool.Stop();
+	return ok ? 0 : 1;
+}
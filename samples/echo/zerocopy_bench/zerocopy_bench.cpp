@@ -0,0 +1,277 @@
+#include "../../samples.h"
+#include "../../../XSocket/XSocketImpl.h"
+#include "../../../XSocket/XEPoll.h"
+#include "../../../XSocket/XSimpleImpl.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <thread>
+using namespace XSocket;
+
+//MSG_ZEROCOPY基准：本机TCP连接，服务线程用SimpleSocketT反复共享发送同一块分片，客户端线程接收后丢弃
+//对比普通拷贝和EnableZeroCopy，输出发送线程每GB的CPU时间，找出MSG_ZEROCOPY开始划算的分片大小
+//注意回环连接内核总是退化成拷贝（copied>0），这时测的是MSG_ZEROCOPY的额外开销，真实收益要走网卡
+//最后再跑一次OnSendBuf里关闭：每次发新分片，最后一个分片发完马上Close，检查没有分片在关闭后立刻被释放，
+//内核可能还没用完的分片要么在Close里确认完成后释放，要么停放到ZeroCopyLinger，由定时器到期回收
+//用法：zerocopy_bench [每种分片大小发送的MB数]
+
+class worker;
+
+typedef EPollSocketSetT<EPollService,worker> WorkSocketSet;
+
+//分片释放前填成'x'，内核如果还在读已释放的分片，对端就会收到'x'
+static void FreeChunk(const std::string* p)
+{
+	std::fill(const_cast<char*>(p->data()), const_cast<char*>(p->data()) + p->size(), 'x');
+	delete p;
+}
+
+static double ThreadCpuTime()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+class worker : public SocketExImpl<worker,SimpleSocketT<EPollSocketT<WorkSocketSet,SocketEx>>>
+{
+	typedef SocketExImpl<worker,SimpleSocketT<EPollSocketT<WorkSocketSet,SocketEx>>> Base;
+protected:
+	std::shared_ptr<const std::string> chunk_;
+	size_t total_ = 0;
+	size_t sent_ = 0;
+	double cpu_ = 0;
+	std::chrono::steady_clock::time_point start_;
+public:
+	std::atomic<bool> done_;
+	double cpu_time_ = 0;
+	double wall_time_ = 0;
+	bool close_on_sent_ = false; //每次发新分片，最后一个分片发完在OnSendBuf里Close
+	size_t parked_ = 0; //Close停放的分片数
+
+	worker(std::shared_ptr<const std::string> chunk, size_t total):chunk_(chunk),total_(total),done_(false)
+	{
+	}
+
+protected:
+	//发送队列保持几MB，发完一个分片补一个
+	inline void Fill()
+	{
+		while (sent_ < total_ && NotSendBufSize() < 4*1024*1024)
+		{
+			//SendBuf可能同步回调OnSendBuf再进Fill，先记账
+			sent_ += chunk_->size();
+			if (close_on_sent_) {
+				SendBuf(std::shared_ptr<const std::string>(new std::string(chunk_->size(), 'z'), &FreeChunk));
+			} else {
+				SendBuf(chunk_);
+			}
+		}
+	}
+
+	inline void Check(bool closing = false)
+	{
+		if (!done_ && sent_ >= total_ && !NotSendBufSize() && (closing || !GetZeroCopyPending())) {
+			cpu_time_ = ThreadCpuTime() - cpu_;
+			wall_time_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+			done_ = true;
+		}
+	}
+
+	//客户端发一个字节开始
+	virtual void OnRecvBuf(const char* lpBuf, int nBufLen, int nFlags)
+	{
+		Base::OnRecvBuf(lpBuf, nBufLen, nFlags);
+		if (!sent_) {
+			cpu_ = ThreadCpuTime();
+			start_ = std::chrono::steady_clock::now();
+			Fill();
+		}
+	}
+
+	virtual void OnSendBuf(const char* lpBuf, int nBufLen)
+	{
+		Base::OnSendBuf(lpBuf, nBufLen);
+		if (close_on_sent_ && sent_ >= total_ && !NotSendBufSize()) {
+			size_t count = ZeroCopyLinger::Inst().Count();
+			Close();
+			parked_ = ZeroCopyLinger::Inst().Count() - count;
+			done_ = true;
+			return;
+		}
+		Fill();
+		//MSG_ZEROCOPY要等完成通知，在OnErrQueue里判断
+		if (!IsZeroCopy()) {
+			Check();
+		}
+	}
+
+	virtual void OnErrQueue(int nErrorCode)
+	{
+		Base::OnErrQueue(nErrorCode);
+		Check();
+	}
+
+	//客户端收完才关闭，最后的完成通知可能要到Close里才取，不会再有OnErrQueue
+	virtual void OnClose(int nErrorCode)
+	{
+		Check(true);
+		Base::OnClose(nErrorCode);
+	}
+};
+
+static bool Bench(SocketManagerT<WorkSocketSet>& mgr, size_t chunk_size, size_t total, bool zc)
+{
+	SOCKET ls = Socket::Create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	SOCKADDR_IN addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = Socket::Ip2N(DEFAULT_IP);
+	addr.sin_port = 0;
+	int addr_len = sizeof(addr);
+	Socket::Bind(ls, (const SOCKADDR*)&addr, sizeof(addr));
+	Socket::Listen(ls, 1);
+	Socket::GetSockName(ls, (SOCKADDR*)&addr, &addr_len);
+
+	//客户端线程：连接，发一个字节开始，然后收完total字节
+	std::thread client([&addr, total]() {
+		SOCKET cs = Socket::Create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (Socket::Connect(cs, (const SOCKADDR*)&addr, sizeof(addr)) != 0) {
+			Socket::Close(cs);
+			return;
+		}
+		Socket::Send(cs, "s", 1);
+		std::vector<char> buf(1024*1024);
+		size_t recv_len = 0;
+		while (recv_len < total)
+		{
+			int ret = Socket::Receive(cs, buf.data(), (int)buf.size());
+			if (ret <= 0) {
+				break;
+			}
+			recv_len += ret;
+		}
+		Socket::Close(cs);
+	});
+
+	SOCKET sock = Socket::Accept(ls, nullptr, nullptr);
+	Socket::Close(ls);
+	std::shared_ptr<worker> sock_ptr = std::make_shared<worker>(std::make_shared<const std::string>(chunk_size, 'z'), total);
+	sock_ptr->Attach(sock, SOCKET_ROLE_WORK);
+	sock_ptr->SetNonBlock();
+	bool ok = !zc || sock_ptr->EnableZeroCopy(chunk_size);
+	if (ok) {
+		mgr.AddSocket(sock_ptr, FD_READ);
+		while (!sock_ptr->done_)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		double gb = total / (1024.0*1024*1024);
+		printf("%8zuK %-10s %8.1f ms/GB cpu %8.1f ms/GB wall copied=%zu\n", chunk_size/1024, zc ? "zerocopy" : "copy",
+			sock_ptr->cpu_time_ * 1000 / gb, sock_ptr->wall_time_ * 1000 / gb, sock_ptr->GetZeroCopyCopied());
+	} else {
+		printf("%8zuK %-10s SO_ZEROCOPY not supported\n", chunk_size/1024, "zerocopy");
+	}
+	if (!ok) {
+		//没加入SocketSet，直接关闭让客户端线程结束
+		sock_ptr->Close();
+	}
+	client.join();
+	if (ok) {
+		//客户端关闭后由服务线程收到对端关闭自己Close
+		while (sock_ptr->IsSocket())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		mgr.RemoveSocket(sock_ptr);
+	}
+	return ok;
+}
+
+//最后一个MSG_ZEROCOPY分片发完就在OnSendBuf里Close，客户端收完后收到关闭
+static bool CloseOnSent(SocketManagerT<WorkSocketSet>& mgr, size_t chunk_size, size_t total)
+{
+	SOCKET ls = Socket::Create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	SOCKADDR_IN addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = Socket::Ip2N(DEFAULT_IP);
+	addr.sin_port = 0;
+	int addr_len = sizeof(addr);
+	Socket::Bind(ls, (const SOCKADDR*)&addr, sizeof(addr));
+	Socket::Listen(ls, 1);
+	Socket::GetSockName(ls, (SOCKADDR*)&addr, &addr_len);
+
+	size_t recv_len = 0, bad_len = 0;
+	std::thread client([&addr, &recv_len, &bad_len]() {
+		SOCKET cs = Socket::Create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (Socket::Connect(cs, (const SOCKADDR*)&addr, sizeof(addr)) != 0) {
+			Socket::Close(cs);
+			return;
+		}
+		Socket::Send(cs, "s", 1);
+		//先不收，让最后的分片Close时还留在内核发送队列里
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		std::vector<char> buf(1024*1024);
+		for (;;)
+		{
+			int ret = Socket::Receive(cs, buf.data(), (int)buf.size());
+			if (ret <= 0) {
+				break;
+			}
+			recv_len += ret;
+			bad_len += ret - std::count(buf.begin(), buf.begin() + ret, 'z');
+		}
+		Socket::Close(cs);
+	});
+
+	SOCKET sock = Socket::Accept(ls, nullptr, nullptr);
+	Socket::Close(ls);
+	std::shared_ptr<worker> sock_ptr = std::make_shared<worker>(std::make_shared<const std::string>(chunk_size, 'z'), total);
+	sock_ptr->Attach(sock, SOCKET_ROLE_WORK);
+	sock_ptr->SetNonBlock();
+	sock_ptr->close_on_sent_ = true;
+	if (!sock_ptr->EnableZeroCopy(chunk_size)) {
+		sock_ptr->Close();
+		client.join();
+		printf("%8zuK %-10s SO_ZEROCOPY not supported\n", chunk_size/1024, "close");
+		return true;
+	}
+	mgr.AddSocket(sock_ptr, FD_READ);
+	client.join();
+	while (!sock_ptr->done_ || sock_ptr->IsSocket())
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	mgr.RemoveSocket(sock_ptr);
+	//停放的分片不等下次停放，由定时器到期回收
+	auto start = std::chrono::steady_clock::now();
+	while (ZeroCopyLinger::Inst().Count() && std::chrono::steady_clock::now() - start < std::chrono::milliseconds(DEFAULT_ZEROCOPY_LINGER + 1000))
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	size_t lingering = ZeroCopyLinger::Inst().Count();
+	bool ok = recv_len == total && !bad_len && !lingering;
+	printf("%8zuK %-10s parked=%zu bad=%zu lingering=%zu recv=%zu/%zu %s\n", chunk_size/1024, "close",
+		sock_ptr->parked_, bad_len, lingering, recv_len, total, ok ? "ok" : "FAILED");
+	return ok;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t total = (argc > 1 ? atoi(argv[1]) : 1024) * 1024 * 1024ULL;
+
+	worker::Init();
+	SocketManagerT<WorkSocketSet> mgr(16, 1);
+	mgr.Start();
+	printf("send %zu MB per size, sender thread cpu time per GB\n", total/(1024*1024));
+	size_t sizes[] = { 4*1024, 16*1024, 64*1024, 256*1024, 1024*1024 };
+	for (size_t chunk_size : sizes)
+	{
+		Bench(mgr, chunk_size, total, false);
+		Bench(mgr, chunk_size, total, true);
+	}
+	bool ok = CloseOnSent(mgr, 256*1024, 64*256*1024);
+	mgr.Stop();
+	worker::Term();
+	return ok ? 0 : 1;
+}
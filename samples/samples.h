@@ -14,6 +14,7 @@
 #define USE_IOCP 1
 #endif
 #else
+#define USE_IOURING 0 //io_uring模型，优先于epoll，目前echo server支持
 #define USE_EPOLL 1
 #if USE_EPOLL
 #define USE_EPOLLET